@@ -0,0 +1 @@
+write_hw_platform -fixed -include_bit -force -file Projects/vivado/TDC_64ch_NBANK/TDC_64ch_NBANK.xsa
@@ -117,6 +117,34 @@ begin
         irq_o      => irq,        -- PL -> PS interrupt request
         which_bram => which_bram, -- tell PS which BRAM is being written to currently
         ---------------------------------------------
+        -- Statistics block (not read in this testbench)
+        ---------------------------------------------
+        s_axi_stats_aclk    => clk_sys,
+        s_axi_stats_aresetn => '0',
+        s_axi_stats_awaddr  => (others => '0'),
+        s_axi_stats_awvalid => '0',
+        s_axi_stats_wdata   => (others => '0'),
+        s_axi_stats_wstrb   => (others => '0'),
+        s_axi_stats_wvalid  => '0',
+        s_axi_stats_bready  => '0',
+        s_axi_stats_araddr  => (others => '0'),
+        s_axi_stats_arvalid => '0',
+        s_axi_stats_rready  => '0',
+        ---------------------------------------------
+        -- Control block (reset settings: every channel enabled, no prescale or rate limit)
+        ---------------------------------------------
+        s_axi_ctrl_aclk    => clk_sys,
+        s_axi_ctrl_aresetn => '0',
+        s_axi_ctrl_awaddr  => (others => '0'),
+        s_axi_ctrl_awvalid => '0',
+        s_axi_ctrl_wdata   => (others => '0'),
+        s_axi_ctrl_wstrb   => (others => '0'),
+        s_axi_ctrl_wvalid  => '0',
+        s_axi_ctrl_bready  => '0',
+        s_axi_ctrl_araddr  => (others => '0'),
+        s_axi_ctrl_arvalid => '0',
+        s_axi_ctrl_rready  => '0',
+        ---------------------------------------------
         -- Output to BRAM 1
         ---------------------------------------------
         BRAM_1_addr_b   => BRAM_1_addr_b,
@@ -0,0 +1,333 @@
+---------------------------------------------------------------------------------------------------------
+--! \file tb_2BRAM_throughput.vhd
+--! \brief Self-checking throughput testbench of the 2 BRAM TDC (`TDC_64ch` in TDC_64ch_2BRAM.vhd)
+--!
+--! \details Drives saturated bursts on all 64 channels at once: every burst is `c_pulses` pulses on every channel,
+--! so the arbiter tree receives 64 hits per pulse and has to deliver them to the BRAMs on consecutive clk0 cycles.
+--! After each burst the tree is left to drain and a trigger hands the BRAM off; a PS process answers every interrupt
+--! with the read busy handshake and adds up the fill counts latched in `bram_status`.
+--! At the end the testbench reports the hits generated, the hits written to the BRAMs (in total, per channel and as
+--! duplicates), the longest run of writes on consecutive cycles, the throughput of the arbiter tree in words per clk0
+--! cycle (the writes of every burst over the cycles from its first to its last write) and the fill counts seen by the
+--! PS, and fails if any hit was lost or written twice.
+--! `g_arb_tree` selects the arbiter tree of the UUT: run the testbench once with the default hand-wired tree of
+--! `rr_arbiter_41`s and once with `g_arb_tree => true` to compare the two (e.g. `-generic_top g_arb_tree=true` in xsim).
+---------------------------------------------------------------------------------------------------------
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+
+entity test_2BRAM_throughput is
+    generic (
+        g_arb_tree : boolean := false   --! Build the UUT with the arbiter tree instead of the hand-wired `rr_arbiter_41` tree
+    );
+--  Port ( );
+end test_2BRAM_throughput;
+
+architecture Behavioral of test_2BRAM_throughput is
+
+    -- clock generation
+    procedure clk_gen(signal clk : out std_logic; constant FREQ : real; PHASE : time := 1 ns) is
+        constant PERIOD    : time := 1 sec / FREQ;        -- Full period
+        constant HIGH_TIME : time := PERIOD / 2;          -- High time
+        constant LOW_TIME  : time := PERIOD - HIGH_TIME;  -- Low time; always >= HIGH_TIME
+    begin
+        report "clk started";
+        -- Check the arguments
+        assert (HIGH_TIME /= 0 fs) report "clk_plain: High time is zero; time resolution to large for frequency" severity FAILURE;
+        -- initial phase shift
+        wait for PHASE;
+        -- Generate a clock cycle
+        loop
+            clk <= '1';
+            wait for HIGH_TIME;
+            clk <= '0';
+            wait for LOW_TIME;
+        end loop;
+    end procedure;
+
+    component clk_wiz_0 is
+        port (
+            clk_in1  : in std_logic;
+            reset    : in std_logic;
+            clk_out1 : out std_logic;
+            clk_out2 : out std_logic;
+            clk_out3 : out std_logic;
+            clk_out4 : out std_logic;
+            locked   : out std_logic
+        );
+        end component;
+
+        -- clocking
+        signal clk_sys : std_logic;
+        signal clk0    : std_logic;
+        signal clk45   : std_logic;
+        signal clk90   : std_logic;
+        signal clk135  : std_logic;
+        -- control
+        signal reset  : std_logic := '1';
+        signal locked : std_logic;
+        -- UUT
+        signal hits : std_logic_vector(0 to 63) := (others => '0');
+        signal trig : std_logic := '0';
+        signal busy : std_logic := '0';
+        signal irq  : std_logic;
+        signal which_bram   : std_logic_vector(1 downto 0);
+        signal bram_status  : std_logic_vector(31 downto 0);
+        signal missed_trigs : std_logic_vector(31 downto 0);
+        signal BRAM_1_addr_b   : std_logic_vector(31 downto 0);
+        signal BRAM_1_clk_b    : std_logic;
+        signal BRAM_1_rddata_b : std_logic_vector(63 downto 0) := (others => '0');
+        signal BRAM_1_wrdata_b : std_logic_vector(63 downto 0);
+        signal BRAM_1_en_b     : std_logic;
+        signal BRAM_1_rst_b    : std_logic;
+        signal BRAM_1_we_b     : std_logic_vector(7 downto 0);
+        signal BRAM_2_addr_b   : std_logic_vector(31 downto 0);
+        signal BRAM_2_clk_b    : std_logic;
+        signal BRAM_2_rddata_b : std_logic_vector(63 downto 0) := (others => '0');
+        signal BRAM_2_wrdata_b : std_logic_vector(63 downto 0);
+        signal BRAM_2_en_b     : std_logic;
+        signal BRAM_2_rst_b    : std_logic;
+        signal BRAM_2_we_b     : std_logic_vector(7 downto 0);
+
+        -- clock periods
+        constant tdc_pd : time := 1 sec / 212.400E6;
+        constant sys_pd : time := 1 sec / 53.100E6;
+
+        -- stimulus: c_bursts bursts of c_pulses pulses on all 64 channels
+        constant c_bursts   : natural := 4;
+        constant c_pulses   : natural := 8;
+        constant c_expected : natural := 64 * c_bursts * c_pulses;
+
+        signal stim_done : std_logic := '0';    -- all bursts sent, drained and handed off
+        signal ps_words  : natural := 0;        -- sum of the fill counts read by the PS
+        signal ps_reads  : natural := 0;        -- interrupts answered by the PS
+
+        type count_array is array (0 to 63) of natural;
+        type coarse_array is array (0 to 63) of std_logic_vector(27 downto 0);
+
+begin
+
+    clk_gen(clk_sys, 53.100E6, 0 ns);
+
+    mmcm : clk_wiz_0
+    port map (
+        reset    => reset,
+        locked   => locked,
+        clk_in1  => clk_sys,
+        clk_out1 => clk0,
+        clk_out2 => clk45,
+        clk_out3 => clk90,
+        clk_out4 => clk135
+    );
+
+    uut : entity work.TDC_64ch
+    generic map (
+        g_chID_start   => 0,      -- Channel ID of the lowest channel in the group of 16
+        g_coarse_bits  => 28,     -- Number of coarse bits to use
+        g_sat_duration => 3,      -- Number of 0deg clock cycles signal must be high to be valid
+        g_pipe_depth   => 16,     -- Number of hits stored in the intermediate buffers
+        g_arb_tree     => g_arb_tree
+    )
+    port map (
+        -- TDC and system clocks sent to all 4 channels
+        clk0    => clk0,
+        clk45   => clk45,
+        clk90   => clk90,
+        clk135  => clk135,
+        clk_sys => clk_sys,
+        -- Control
+        reset   => reset,   -- active high
+        enable  => locked,  -- active high, only enable when MMCM locks
+        -- Data input from detector
+        hits     => hits,
+        trigger => trig,
+        -- PL <--> PS communication
+        rd_busy      => busy,         -- PS -> PL indicating read in progress
+        irq_o        => irq,          -- PL -> PS interrupt request
+        which_bram   => which_bram,   -- tell PS which BRAM is being written to currently
+        bram_status  => bram_status,  -- fill count of the BRAM handed off
+        missed_trigs => missed_trigs,
+        ---------------------------------------------
+        -- Statistics block (not read in this testbench)
+        ---------------------------------------------
+        s_axi_stats_aclk    => clk_sys,
+        s_axi_stats_aresetn => '0',
+        s_axi_stats_awaddr  => (others => '0'),
+        s_axi_stats_awvalid => '0',
+        s_axi_stats_wdata   => (others => '0'),
+        s_axi_stats_wstrb   => (others => '0'),
+        s_axi_stats_wvalid  => '0',
+        s_axi_stats_bready  => '0',
+        s_axi_stats_araddr  => (others => '0'),
+        s_axi_stats_arvalid => '0',
+        s_axi_stats_rready  => '0',
+        ---------------------------------------------
+        -- Control block (reset settings: every channel enabled, no prescale or rate limit)
+        ---------------------------------------------
+        s_axi_ctrl_aclk    => clk_sys,
+        s_axi_ctrl_aresetn => '0',
+        s_axi_ctrl_awaddr  => (others => '0'),
+        s_axi_ctrl_awvalid => '0',
+        s_axi_ctrl_wdata   => (others => '0'),
+        s_axi_ctrl_wstrb   => (others => '0'),
+        s_axi_ctrl_wvalid  => '0',
+        s_axi_ctrl_bready  => '0',
+        s_axi_ctrl_araddr  => (others => '0'),
+        s_axi_ctrl_arvalid => '0',
+        s_axi_ctrl_rready  => '0',
+        DEBUG_data   => open,
+        DEBUG_valid  => open,
+        DEBUG_grant  => open,
+        ---------------------------------------------
+        -- Output to BRAM 1
+        ---------------------------------------------
+        BRAM_1_addr_b   => BRAM_1_addr_b,
+        BRAM_1_clk_b    => BRAM_1_clk_b,
+        BRAM_1_rddata_b => BRAM_1_rddata_b,
+        BRAM_1_wrdata_b => BRAM_1_wrdata_b,
+        BRAM_1_en_b     => BRAM_1_en_b,
+        BRAM_1_rst_b    => BRAM_1_rst_b,
+        BRAM_1_we_b     => BRAM_1_we_b,
+        ---------------------------------------------
+        -- Output to BRAM 2
+        ---------------------------------------------
+        BRAM_2_addr_b   => BRAM_2_addr_b,
+        BRAM_2_clk_b    => BRAM_2_clk_b,
+        BRAM_2_rddata_b => BRAM_2_rddata_b,
+        BRAM_2_wrdata_b => BRAM_2_wrdata_b,
+        BRAM_2_en_b     => BRAM_2_en_b,
+        BRAM_2_rst_b    => BRAM_2_rst_b,
+        BRAM_2_we_b     => BRAM_2_we_b
+    );
+
+    -- Saturated bursts on all channels, each followed by a trigger once the arbiter tree has drained
+    psim : process
+    begin
+        wait for 200 ns;
+        reset <= '0';
+
+        wait for 2000 ns;
+
+        for b in 1 to c_bursts loop
+            -- all 64 channels fire together, c_pulses times (asynchronous to clk0)
+            for p in 1 to c_pulses loop
+                hits <= (others => '1');
+                wait for 6.3 * tdc_pd;
+                hits <= (others => '0');
+                wait for 5.7 * tdc_pd;
+            end loop;
+            -- 64 * c_pulses hits leave the tree at one per clk0 period at best, leave it plenty of time
+            wait for 4 * 64 * c_pulses * tdc_pd;
+            -- simulate a trigger arrival (async)
+            trig <= '1';
+            wait for 3.358 * tdc_pd;
+            trig <= '0';
+            -- let the PS finish the readout
+            wait for 200 * tdc_pd;
+        end loop;
+
+        stim_done <= '1';
+        wait;
+    end process psim;
+
+    -- PS side of the readout handshake: answer every interrupt, read the fill count of the BRAM handed off
+    pssim : process
+        variable v_words : natural := 0;
+        variable v_reads : natural := 0;
+    begin
+        wait until irq = '1';
+        wait for 10.3 * tdc_pd;
+        busy <= '1';
+        v_words := v_words + to_integer(unsigned(bram_status(15 downto 0)));
+        v_reads := v_reads + 1;
+        ps_words <= v_words;
+        ps_reads <= v_reads;
+        wait for 40.7 * tdc_pd;
+        busy <= '0';
+    end process pssim;
+
+    -- Record every BRAM write and check the totals once the stimulus is done
+    monitor : process(clk0)
+        variable v_word     : std_logic_vector(63 downto 0);
+        variable v_we       : boolean;
+        variable v_ch       : natural;
+        variable v_written  : natural := 0;
+        variable v_dups     : natural := 0;
+        variable v_run      : natural := 0;
+        variable v_max_run  : natural := 0;
+        variable v_cycle    : natural := 0;     -- clk0 cycles since the start
+        variable v_first    : natural := 0;     -- cycle of the first write of the current burst
+        variable v_last_wr  : natural := 0;     -- cycle of the last write
+        variable v_span     : natural := 0;     -- cycles from the first to the last write of the bursts done so far
+        variable v_in_burst : boolean := false;
+        variable v_count    : count_array := (others => 0);
+        variable v_last     : coarse_array := (others => (others => '0'));
+        variable v_reported : boolean := false;
+        variable v_errors   : natural := 0;
+    begin
+        if rising_edge(clk0) then
+            v_cycle := v_cycle + 1;
+            v_we := false;
+            if BRAM_1_we_b(0) = '1' then
+                v_word := BRAM_1_wrdata_b;
+                v_we := true;
+            elsif BRAM_2_we_b(0) = '1' then
+                v_word := BRAM_2_wrdata_b;
+                v_we := true;
+            end if;
+            if v_we then
+                v_ch := to_integer(unsigned(v_word(5 downto 0)));
+                -- the same channel cannot produce two hits in the same coarse period with these pulses
+                if v_count(v_ch) > 0 and v_word(38 downto 11) = v_last(v_ch) then
+                    v_dups := v_dups + 1;
+                end if;
+                v_last(v_ch)  := v_word(38 downto 11);
+                v_count(v_ch) := v_count(v_ch) + 1;
+                v_written := v_written + 1;
+                -- a write after a long gap starts the next burst
+                if not v_in_burst or v_cycle - v_last_wr > 64 then
+                    if v_in_burst then
+                        v_span := v_span + v_last_wr - v_first + 1;
+                    end if;
+                    v_first := v_cycle;
+                    v_in_burst := true;
+                end if;
+                v_last_wr := v_cycle;
+                v_run := v_run + 1;
+                if v_run > v_max_run then
+                    v_max_run := v_run;
+                end if;
+            else
+                v_run := 0;
+            end if;
+
+            if stim_done = '1' and not v_reported then
+                v_reported := true;
+                if v_in_burst then
+                    v_span := v_span + v_last_wr - v_first + 1;
+                end if;
+                if v_span > 0 then
+                    report "Arbiter tree (g_arb_tree = " & boolean'image(g_arb_tree) & ") throughput: " & integer'image(v_written) & " words in " & integer'image(v_span) &
+                           " clk0 cycles, " & real'image(real(v_written) / real(v_span)) & " words/clock";
+                end if;
+                report "Hits generated: " & integer'image(c_expected) & ", written to BRAM: " & integer'image(v_written) &
+                       ", duplicates: " & integer'image(v_dups) & ", longest run of consecutive writes: " & integer'image(v_max_run) &
+                       ", words handed to the PS: " & integer'image(ps_words) & " in " & integer'image(ps_reads) & " readouts";
+                for ch in 0 to 63 loop
+                    if v_count(ch) /= c_bursts * c_pulses then
+                        report "Channel " & integer'image(ch) & ": " & integer'image(v_count(ch)) & " hits written, expected " &
+                               integer'image(c_bursts * c_pulses) severity error;
+                        v_errors := v_errors + 1;
+                    end if;
+                end loop;
+                if v_written /= c_expected or v_dups /= 0 or ps_words /= v_written or ps_reads /= c_bursts then
+                    v_errors := v_errors + 1;
+                end if;
+                assert v_errors = 0 report "THROUGHPUT TEST FAILED" severity failure;
+                report "THROUGHPUT TEST PASSED";
+            end if;
+        end if;
+    end process monitor;
+
+end Behavioral;
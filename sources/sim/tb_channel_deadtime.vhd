@@ -0,0 +1,285 @@
+---------------------------------------------------------------------------------------------------------
+--! \file tb_channel_deadtime.vhd
+--! \brief Dead time testbench of a TDC channel: the original encoder FSM against the fast re-arm (`g_fast_rearm`)
+--!
+--! \details Two `TDC_4ch` groups receive the same hits on channel 0, one built with the original encoder FSM (sends the hit
+--! out after its trailing edge) and one with fast re-arm (sends it out once it qualifies, re-arms after one low clk0 period).
+--! Two scans are run:
+--! <br> * Double pulse resolution: pairs of 3.3 clk0 period wide pulses separated by a gap of 0.5 to 12 ns, each gap at 8
+--!   phases w.r.t. clk0. For every gap the testbench reports at how many phases each encoder recorded both pulses, and at the
+--!   end the smallest gap from which both pulses are always recorded.
+--! <br> * Sustained rate: trains of `c_train` 3.1 clk0 period wide pulses with a shrinking gap. For every rate the testbench
+--!   reports the hits out of the encoder, the hits dropped by the full ring buffer and the hits out of the arbiter, and at
+--!   the end the highest rate at which every hit of the train made it out of the arbiter.
+--! The testbench fails if the fast re-arm ever records fewer hits than the original FSM, records more hits than pulses, or
+--! misses a pulse that follows a gap of at least one clk0 period.
+---------------------------------------------------------------------------------------------------------
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+
+entity test_channel_deadtime is
+--  Port ( );
+end test_channel_deadtime;
+
+architecture Behavioral of test_channel_deadtime is
+
+    -- clock generation
+    procedure clk_gen(signal clk : out std_logic; constant FREQ : real; PHASE : time := 1 ns) is
+        constant PERIOD    : time := 1 sec / FREQ;        -- Full period
+        constant HIGH_TIME : time := PERIOD / 2;          -- High time
+        constant LOW_TIME  : time := PERIOD - HIGH_TIME;  -- Low time; always >= HIGH_TIME
+    begin
+        report "clk started";
+        -- Check the arguments
+        assert (HIGH_TIME /= 0 fs) report "clk_plain: High time is zero; time resolution to large for frequency" severity FAILURE;
+        -- initial phase shift
+        wait for PHASE;
+        -- Generate a clock cycle
+        loop
+            clk <= '1';
+            wait for HIGH_TIME;
+            clk <= '0';
+            wait for LOW_TIME;
+        end loop;
+    end procedure;
+
+    component clk_wiz_0 is
+        port (
+            clk_in1  : in std_logic;
+            reset    : in std_logic;
+            clk_out1 : out std_logic;
+            clk_out2 : out std_logic;
+            clk_out3 : out std_logic;
+            clk_out4 : out std_logic;
+            locked   : out std_logic
+        );
+        end component;
+
+        -- clocking
+        signal clk_sys : std_logic;
+        signal clk0    : std_logic;
+        signal clk45   : std_logic;
+        signal clk90   : std_logic;
+        signal clk135  : std_logic;
+        -- control
+        signal reset  : std_logic := '1';
+        signal locked : std_logic;
+        -- UUTs: same hits, original FSM (leg) and fast re-arm (fast)
+        signal hits     : std_logic_vector(0 to 3) := (others => '0');
+        signal leg_hit  : std_logic_vector(0 to 3);
+        signal leg_drop : std_logic_vector(0 to 3);
+        signal leg_out  : std_logic;
+        signal fast_hit  : std_logic_vector(0 to 3);
+        signal fast_drop : std_logic_vector(0 to 3);
+        signal fast_out  : std_logic;
+
+        -- clock periods
+        constant tdc_pd : time := 1 sec / 212.400E6;
+
+        -- stimulus
+        constant c_gaps   : natural := 24;      -- double pulse gaps: 0.5 ns steps
+        constant c_phases : natural := 8;       -- phases per gap, tdc_pd / 8 apart
+        constant c_train  : natural := 64;      -- pulses per train of the rate scan
+        constant c_rates  : natural := 16;      -- rate scan gaps: c_rates down to 1 quarter clk0 periods
+
+        -- running counts of the encoder outputs, ring buffer drops and arbiter outputs of channel 0
+        signal leg_hits,  leg_drops,  leg_outs  : natural := 0;
+        signal fast_hits, fast_drops, fast_outs : natural := 0;
+
+begin
+
+    clk_gen(clk_sys, 53.100E6, 0 ns);
+
+    mmcm : clk_wiz_0
+    port map (
+        reset    => reset,
+        locked   => locked,
+        clk_in1  => clk_sys,
+        clk_out1 => clk0,
+        clk_out2 => clk45,
+        clk_out3 => clk90,
+        clk_out4 => clk135
+    );
+
+    uut_legacy : entity work.TDC_4ch
+    generic map (
+        g_chID_start   => 0,
+        g_coarse_bits  => 28,
+        g_sat_duration => 3,
+        g_pipe_depth   => 16,
+        g_fast_rearm   => false
+    )
+    port map (
+        clk0    => clk0,
+        clk45   => clk45,
+        clk90   => clk90,
+        clk135  => clk135,
+        clk_sys => clk_sys,
+        reset   => reset,
+        enable  => locked,
+        hit     => hits,
+        valid_o => leg_out,
+        data_o  => open,
+        hit_o   => leg_hit,
+        drop_o  => leg_drop
+    );
+
+    uut_fast : entity work.TDC_4ch
+    generic map (
+        g_chID_start   => 0,
+        g_coarse_bits  => 28,
+        g_sat_duration => 3,
+        g_pipe_depth   => 16,
+        g_fast_rearm   => true
+    )
+    port map (
+        clk0    => clk0,
+        clk45   => clk45,
+        clk90   => clk90,
+        clk135  => clk135,
+        clk_sys => clk_sys,
+        reset   => reset,
+        enable  => locked,
+        hit     => hits,
+        valid_o => fast_out,
+        data_o  => open,
+        hit_o   => fast_hit,
+        drop_o  => fast_drop
+    );
+
+    -- Count the hits of channel 0 at every stage
+    count : process(clk0)
+    begin
+        if rising_edge(clk0) then
+            if leg_hit(0) = '1' then leg_hits <= leg_hits + 1; end if;
+            if leg_drop(0) = '1' then leg_drops <= leg_drops + 1; end if;
+            if leg_out = '1' then leg_outs <= leg_outs + 1; end if;
+            if fast_hit(0) = '1' then fast_hits <= fast_hits + 1; end if;
+            if fast_drop(0) = '1' then fast_drops <= fast_drops + 1; end if;
+            if fast_out = '1' then fast_outs <= fast_outs + 1; end if;
+        end if;
+    end process count;
+
+    -- Double pulse scan, then rate scan
+    psim : process
+        variable v_leg, v_fast         : natural;
+        variable v_leg_ok, v_fast_ok   : natural;
+        variable v_leg_res, v_fast_res : natural := 0;     -- smallest gap (0.5 ns units) from which all pairs resolve
+        variable v_gap                 : time;
+        variable v_leg0, v_fast0       : natural;
+        variable v_dl, v_df, v_ol, v_of : natural;
+        variable v_leg_rate, v_fast_rate : real := 0.0;    -- highest lossless rate (MHz)
+        variable v_rate                : real;
+        variable v_errors              : natural := 0;
+    begin
+        wait for 200 ns;
+        reset <= '0';
+        wait until locked = '1';
+        wait for 2000 ns;
+
+        -------------------------------------------------
+        -- Double pulse resolution
+        -------------------------------------------------
+        for g in 1 to c_gaps loop
+            v_gap := g * 0.5 ns;
+            v_leg_ok  := 0;
+            v_fast_ok := 0;
+            for p in 0 to c_phases-1 loop
+                wait until rising_edge(clk0);
+                wait for 0.3 ns + p * tdc_pd / c_phases;
+                v_leg0  := leg_hits;
+                v_fast0 := fast_hits;
+                hits(0) <= '1';
+                wait for 3.3 * tdc_pd;
+                hits(0) <= '0';
+                wait for v_gap;
+                hits(0) <= '1';
+                wait for 3.3 * tdc_pd;
+                hits(0) <= '0';
+                wait for 40 * tdc_pd;
+                v_leg  := leg_hits - v_leg0;
+                v_fast := fast_hits - v_fast0;
+                if v_leg = 2 then
+                    v_leg_ok := v_leg_ok + 1;
+                end if;
+                if v_fast = 2 then
+                    v_fast_ok := v_fast_ok + 1;
+                end if;
+                if v_fast < v_leg or v_fast > 2 or (v_fast /= 2 and v_gap >= tdc_pd) then
+                    report "Gap " & time'image(v_gap) & ", phase " & integer'image(p) & ": original FSM recorded " &
+                           integer'image(v_leg) & " hits, fast re-arm " & integer'image(v_fast) severity error;
+                    v_errors := v_errors + 1;
+                end if;
+            end loop;
+            report "Gap " & time'image(v_gap) & ": both pulses recorded at " & integer'image(v_leg_ok) & "/" &
+                   integer'image(c_phases) & " phases by the original FSM, " & integer'image(v_fast_ok) & "/" &
+                   integer'image(c_phases) & " by fast re-arm";
+            -- resolution: smallest gap such that it and every larger gap always resolve
+            if v_leg_ok /= c_phases then
+                v_leg_res := 0;
+            elsif v_leg_res = 0 then
+                v_leg_res := g;
+            end if;
+            if v_fast_ok /= c_phases then
+                v_fast_res := 0;
+            elsif v_fast_res = 0 then
+                v_fast_res := g;
+            end if;
+        end loop;
+
+        -------------------------------------------------
+        -- Sustained per-channel rate
+        -------------------------------------------------
+        for r in c_rates downto 1 loop
+            v_gap  := r * tdc_pd / 4;
+            v_rate := 1.0E6 / real((3.1 * tdc_pd + v_gap) / 1 ps);
+            v_leg0  := leg_hits;
+            v_fast0 := fast_hits;
+            v_dl := leg_drops;
+            v_df := fast_drops;
+            v_ol := leg_outs;
+            v_of := fast_outs;
+            wait until rising_edge(clk0);
+            wait for 1.1 ns;
+            for p in 1 to c_train loop
+                hits(0) <= '1';
+                wait for 3.1 * tdc_pd;
+                hits(0) <= '0';
+                wait for v_gap;
+            end loop;
+            -- let the ring buffers drain
+            wait for 4 * c_train * tdc_pd;
+            v_leg  := leg_hits - v_leg0;
+            v_fast := fast_hits - v_fast0;
+            v_dl := leg_drops - v_dl;
+            v_df := fast_drops - v_df;
+            v_ol := leg_outs - v_ol;
+            v_of := fast_outs - v_of;
+            report "Rate " & integer'image(integer(v_rate)) & " MHz (gap " & time'image(v_gap) & "): original FSM " &
+                   integer'image(v_leg) & " hits, " & integer'image(v_dl) & " dropped, " & integer'image(v_ol) & " out; " &
+                   "fast re-arm " & integer'image(v_fast) & " hits, " & integer'image(v_df) & " dropped, " &
+                   integer'image(v_of) & " out (of " & integer'image(c_train) & ")";
+            if v_ol = c_train and v_rate > v_leg_rate then
+                v_leg_rate := v_rate;
+            end if;
+            if v_of = c_train and v_rate > v_fast_rate then
+                v_fast_rate := v_rate;
+            end if;
+            if v_fast < v_leg or v_fast > c_train or (v_fast /= c_train and v_gap >= tdc_pd) then
+                report "Rate " & integer'image(integer(v_rate)) & " MHz: fast re-arm recorded " & integer'image(v_fast) &
+                       " hits, original FSM " & integer'image(v_leg) severity error;
+                v_errors := v_errors + 1;
+            end if;
+        end loop;
+
+        report "Double pulse resolution: original FSM " & real'image(real(v_leg_res) * 0.5) & " ns, fast re-arm " &
+               real'image(real(v_fast_res) * 0.5) & " ns (0.0: not resolved up to " & real'image(real(c_gaps) * 0.5) & " ns)";
+        report "Highest lossless rate: original FSM " & integer'image(integer(v_leg_rate)) & " MHz, fast re-arm " &
+               integer'image(integer(v_fast_rate)) & " MHz";
+        assert v_errors = 0 report "DEAD TIME TEST FAILED" severity failure;
+        report "DEAD TIME TEST PASSED";
+        wait;
+    end process psim;
+
+end Behavioral;
@@ -4,7 +4,8 @@
 --!
 --! \details This module contains four single \ref TDC_channel "`TDC_channel`" modules whose outputs are connected to intermediate 
 --! ring buffers to store a record of valid hits. The ring buffers are read out by the \ref rr_arbiter_41.vhd "4:1 arbiter" in round
---! robin priority for further processing. A block diagram of the model can be found below.
+--! robin priority for further processing, or with `g_arb_tree` by the 4-input \ref rr_arbiter.vhd "`rr_arbiter`" the
+--! \ref arbiter_tree.vhd "arbiter tree" is built from. A block diagram of the model can be found below.
 --! 
 --! \verbatim
 --! ```
@@ -15,6 +16,15 @@
 --! ```
 --! \endverbatim
 --! 
+--! The hits of every channel go through a \ref hit_filter.vhd "`hit_filter`" (channel mask, prescale and rate limit) before
+--! its ring buffer. The filter settings and the minimum hit width come from the \ref tdc_ctrl.vhd "control block", and their
+--! defaults keep every hit, so the ports may be left open.
+--! 
+--! The ring buffer of every channel is its timestamp FIFO: it holds up to `g_pipe_depth` hits of that channel while the
+--! arbiter serves the other three, so a burst on one channel does not block its neighbours. A hit arriving while its
+--! channel's buffer is full is dropped and flagged on `drop_o`, which the \ref tdc_stats.vhd "statistics block" counts per
+--! channel (`CH_DROPS`).
+--! 
 --! \author Amitav Mitra, amitra3@jhu.edu
 -------------------------------------------------------------------------------------------------------------------------------------
 
@@ -29,7 +39,8 @@ use work.common_types.all;
 --!
 --! \details This module contains four single \ref TDC_channel "`TDC_channel`" modules whose outputs are connected to intermediate 
 --! ring buffers to store a record of valid hits. The ring buffers are read out by the \ref rr_arbiter_41.vhd "4:1 arbiter" in round
---! robin priority for further processing. A block diagram of the model can be found below.
+--! robin priority for further processing, or with `g_arb_tree` by the 4-input \ref rr_arbiter.vhd "`rr_arbiter`" the
+--! \ref arbiter_tree.vhd "arbiter tree" is built from. A block diagram of the model can be found below.
 --! 
 --! \verbatim
 --! TDC channel -> ring buffer -|
@@ -37,12 +48,23 @@ use work.common_types.all;
 --! TDC channel -> ring buffer -|
 --! TDC Channel -> ring buffer -|
 --! \endverbatim
+--! 
+--! The hits of every channel go through a \ref hit_filter.vhd "`hit_filter`" (channel mask, prescale and rate limit) before
+--! its ring buffer. The filter settings and the minimum hit width come from the \ref tdc_ctrl.vhd "control block", and their
+--! defaults keep every hit, so the ports may be left open.
+--! 
+--! The ring buffer of every channel is its timestamp FIFO: it holds up to `g_pipe_depth` hits of that channel while the
+--! arbiter serves the other three, so a burst on one channel does not block its neighbours. A hit arriving while its
+--! channel's buffer is full is dropped and flagged on `drop_o`, which the \ref tdc_stats.vhd "statistics block" counts per
+--! channel (`CH_DROPS`).
 entity TDC_4ch is
     generic (
         g_chID_start   : natural := 0;  --! Channel ID of the first TDC channel. A for loop assigns the next three channels' IDs starting from `g_chID_start`
         g_coarse_bits  : natural := 28; --! Number of bits in the \ref CoarseCounter.vhd "coarse counter"
         g_sat_duration : natural := 3;  --! Minimum duration (in clk0 periods) that hit must remain high to be considered valid
-        g_pipe_depth   : natural := 5   --! Max number of hits stored in intermediate ring buffer pipeline
+        g_pipe_depth   : natural := 5;  --! Max number of hits stored in intermediate ring buffer pipeline
+        g_fast_rearm   : boolean := false; --! Encoders send hits out once they qualify and re-arm after one low clk0 period (not simulated yet, off by default)
+        g_arb_tree     : boolean := false  --! Read the ring buffers out with the `rr_arbiter` of the arbiter tree instead of `rr_arbiter_41` (not simulated yet, off by default)
     );
     port (
         -- TDC and system clocks sent to all 4 channels
@@ -56,9 +78,18 @@ entity TDC_4ch is
         enable  : in std_logic; --! Active high enable
         -- Data input from detector
         hit     : in std_logic_vector(0 to 3);  --! Front-end discriminator hits
+        -- Runtime hit qualification from the control block (may be left open)
+        ch_enable   : in std_logic_vector(0 to 3) := (others => '1');       --! Channel enables
+        ch_sat      : in IntArray(0 to 3) := (others => g_sat_duration);    --! Minimum hit width of every channel (clk0 periods, 1 to 7)
+        ch_prescale : in IntArray(0 to 3) := (others => 0);                 --! Prescale of every channel (0 => none)
+        ch_limit    : in IntArray(0 to 3) := (others => 0);                 --! Rate limit of every channel (0 => none)
+        limit_tick  : in std_logic := '0';                                  --! Start of a rate limit period
         -- Data outputs (timestamp + valid) from arbiter
         valid_o : out std_logic;                                    --! Write enable pulse sent from arbiter downstream
-        data_o  : out std_logic_vector(g_coarse_bits+10 downto 0)   --! Timestamp data from FIFOs
+        data_o  : out std_logic_vector(g_coarse_bits+10 downto 0);  --! Timestamp data from FIFOs
+        -- Per channel statistics (may be left open)
+        hit_o   : out std_logic_vector(0 to 3);                     --! Valid pulse of every channel (one per hit, before the filter)
+        drop_o  : out std_logic_vector(0 to 3)                      --! Filtered hit dropped because the channel's ring buffer was full
     );
 end TDC_4ch;
 
@@ -74,15 +105,16 @@ architecture Behavioral of TDC_4ch is
 
     -- Signals from TDC channel -> ring buffers
     signal tdc_buf_data_s  : SlvArray(0 to 3)(g_coarse_bits+10 downto 0);       --! [TDC channel -> ring buffer] SLV array with each channels' digitized hit data
-    signal tdc_buf_valid_s : std_logic_vector(0 to 3);                          --! [TDC channel -> ring buffer] SLV with each channels' data valid flag to be sent to ring buffer write enable
+    signal tdc_buf_valid_s : std_logic_vector(0 to 3);                          --! [TDC channel -> hit filter] SLV with each channels' data valid flag
+    signal flt_buf_valid_s : std_logic_vector(0 to 3);                          --! [hit filter -> ring buffer] SLV with each channels' filtered valid flag to be sent to ring buffer write enable
 
     -- Signals between ring buffers and arbiter.
     signal arb_buf_ren_s       : std_logic_vector(0 to 3);                      --! [arbiter -> ring buffer] SLV to issue ring buffers readout grants from the arbiter
     signal buf_arb_rvalid_s    : std_logic_vector(0 to 3);                      --! [ring buffer -> arbiter] SLV to issue readout valid flags from the buffer to arbiter
     signal buf_arb_data_s      : SlvArray(0 to 3)(g_coarse_bits+10 downto 0);   --! [ring buffer -> arbiter] SLV array with each buffers' exposed digitized hit data
     signal buf_arb_empty_s     : std_logic_vector(0 to 3);                      --! [ring buffer -> arbiter] SLV containing empty status of all TDC channels' hit buffers
-    signal buf_arb_emptyNext_s : std_logic_vector(0 to 3);                      --! UNUSED
-    signal buf_arb_full_s      : std_logic_vector(0 to 3);                      --! UNUSED
+    signal buf_arb_emptyNext_s : std_logic_vector(0 to 3);                      --! [ring buffer -> arbiter] SLV containing the empty next status of all TDC channels' hit buffers (`g_arb_tree` only)
+    signal buf_arb_full_s      : std_logic_vector(0 to 3);                      --! [ring buffer -> statistics] SLV containing full status of all TDC channels' hit buffers
     signal buf_arb_fullNext_s  : std_logic_vector(0 to 3);                      --! UNUSED
     signal buf_arb_fillCount_s : IntArray(0 to 3);                              --! UNUSED
 
@@ -97,6 +129,10 @@ begin
         end if;
     end process p_RegRst;
 
+    -- Export the hits of every channel, and the ones its ring buffer had to drop, for the statistics
+    hit_o  <= tdc_buf_valid_s;
+    drop_o <= flt_buf_valid_s and buf_arb_full_s;
+
     
     tdc_channels : for ch in 0 to 3 generate
     begin
@@ -105,7 +141,8 @@ begin
             generic map (
                 g_channel_id   => g_chID_start + ch,
                 g_sat_duration => g_sat_duration,
-                g_coarse_bits  => g_coarse_bits
+                g_coarse_bits  => g_coarse_bits,
+                g_fast_rearm   => g_fast_rearm
             )
             port map (
                 clk0      => clk0,
@@ -116,9 +153,22 @@ begin
                 reset     => reset_s,
                 enable    => enable, 
                 hit       => hit(ch),
+                sat_duration => ch_sat(ch),
                 valid     => tdc_buf_valid_s(ch),
                 timestamp => tdc_buf_data_s(ch)
             );
+        --! Mask, prescale and rate limit the hits of the channel
+        TDC_ch_flt_inst : entity work.hit_filter
+            port map (
+                clk0       => clk0,
+                reset      => reset_s,
+                enable     => ch_enable(ch),
+                prescale   => ch_prescale(ch),
+                limit      => ch_limit(ch),
+                limit_tick => limit_tick,
+                valid_i    => tdc_buf_valid_s(ch),
+                valid_o    => flt_buf_valid_s(ch)
+            );
         --! Instantiate the intermediate hit buffer FIFOs reading from the TDC channels and writing to the arbiter
         TDC_ch_buf_inst : entity work.ring_buffer
             generic map (
@@ -128,14 +178,14 @@ begin
             port map (
                 clk             => clk0,
                 rst             => reset_s, 
-                wr_en           => tdc_buf_valid_s(ch), -- Valid signals from TDC channels
+                wr_en           => flt_buf_valid_s(ch), -- Filtered valid signals from TDC channels
                 wr_data         => tdc_buf_data_s(ch),  -- Data word from TDC channels 
                 rd_en           => arb_buf_ren_s(ch),   -- Read enable from arbiter to buffer
                 rd_valid        => buf_arb_rvalid_s(ch),-- Read valid from buffer to arbiter
                 rd_data         => buf_arb_data_s(ch),  -- Data from buffer to arbiter
                 empty           => buf_arb_empty_s(ch), -- Empty signal from buffer to arbiter
+                empty_next      => buf_arb_emptyNext_s(ch), -- Last word signal from buffer to arbiter
                 -- FOLLOWING ARE UNUSED FOR NOW
-                empty_next      => buf_arb_emptyNext_s(ch),
                 full            => buf_arb_full_s(ch),
                 full_next       => buf_arb_fullNext_s(ch),
                 fill_count      => buf_arb_fillCount_s(ch)
@@ -143,17 +193,36 @@ begin
     end generate tdc_channels;
 
     --! Connect the 4 TDC channel ring buffers to the arbiter
-    arbiter_4ch : entity work.rr_arbiter_41
-        generic map ( DWIDTH => g_coarse_bits + 11 )
-        port map (
-            empty_in    => buf_arb_empty_s,
-            valid_in    => buf_arb_rvalid_s,
-            data_in     => buf_arb_data_s,
-            enable_out  => arb_buf_ren_s,
-            clk         => clk0,
-            rst         => reset_s,
-            data_out    => data_o,
-            valid_out   => valid_o
-        );
+    g_arb : if g_arb_tree generate
+        arbiter_4ch : entity work.rr_arbiter
+            generic map (
+                DWIDTH   => g_coarse_bits + 11,
+                g_inputs => 4
+            )
+            port map (
+                empty_in    => buf_arb_empty_s,
+                valid_in    => buf_arb_rvalid_s,
+                data_in     => buf_arb_data_s,
+                empty_next_in => buf_arb_emptyNext_s,
+                enable_out  => arb_buf_ren_s,
+                clk         => clk0,
+                rst         => reset_s,
+                data_out    => data_o,
+                valid_out   => valid_o
+            );
+    else generate
+        arbiter_4ch : entity work.rr_arbiter_41
+            generic map ( DWIDTH => g_coarse_bits + 11 )
+            port map (
+                empty_in    => buf_arb_empty_s,
+                valid_in    => buf_arb_rvalid_s,
+                data_in     => buf_arb_data_s,
+                enable_out  => arb_buf_ren_s,
+                clk         => clk0,
+                rst         => reset_s,
+                data_out    => data_o,
+                valid_out   => valid_o
+            );
+    end generate g_arb;
 
 end Behavioral;
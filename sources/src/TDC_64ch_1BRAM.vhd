@@ -80,7 +80,13 @@ entity TDC_64ch_1BRAM is
         g_chID_start   : natural := 0;  --! Channel ID of the first TDC channel in the group of 64. Should normally always be 0, so this generic is kind of pointless.
         g_coarse_bits  : natural := 28; --! Number of bits in the \ref CoarseCounter.vhd "coarse counter"
         g_sat_duration : natural := 3;  --! Minimum duration (in clk0 periods) that hit must remain high to be considered valid
-        g_pipe_depth   : natural := 5   --! Max number of hits stored in pipeline
+        g_pipe_depth   : natural := 5;  --! Max number of hits stored in pipeline
+        g_fast_rearm   : boolean := false;          --! Encoders send hits out once they qualify and re-arm after one low clk0 period (see \ref encoder.vhd "encoder"; off until tb_channel_deadtime has been run)
+        g_arb_tree     : boolean := false;          --! Serialize the hits with the \ref arbiter_tree.vhd "arbiter tree" of `rr_arbiter`s instead of the hand-wired tree of `rr_arbiter_41`s (not simulated yet, off by default)
+        g_arb_fanin    : IntArray := (4, 4);        --! Fan-in of every layer of the arbiter tree reading out the 16 `TDC_4ch` buffers (`g_arb_tree` only)
+        g_arb_depth    : IntArray := (0 => 128);    --! Depth of the hit buffers written by every layer of the arbiter tree but the top one (`g_arb_tree` only)
+        g_arb_req_stages : natural := 0;            --! Register stages on the request vector of every arbiter in the tree (`g_arb_tree` only)
+        g_arb_out_stages : natural := 0             --! Register stages on the output of every arbiter in the tree
     );
     port (
         -- TDC and system clocks sent to all channels
@@ -137,28 +143,19 @@ architecture RTL of TDC_64ch_1BRAM is
     signal layer1_buf_arb_rvalid_s    : std_logic_vector(0 to 15);                      --! L1 buffer readout valid signal to L1 arbiter 
     signal layer1_buf_arb_data_s      : SlvArray(0 to 15)(g_coarse_bits+10 downto 0);   --! L1 buffer readout data to L1 arbiter 
     signal layer1_buf_arb_empty_s     : std_logic_vector(0 to 15);                      --! L1 buffer empty signal to L1 arbiter
-    signal layer1_buf_arb_emptyNext_s : std_logic_vector(0 to 15);                      --! UNUSED
+    signal layer1_buf_arb_emptyNext_s : std_logic_vector(0 to 15);                      --! L1 buffer empty next signal to the arbiter tree (`g_arb_tree` only)
     signal layer1_buf_arb_full_s      : std_logic_vector(0 to 15);                      --! UNUSED
     signal layer1_buf_arb_fullNext_s  : std_logic_vector(0 to 15);                      --! UNUSED
     signal layer1_buf_arb_fillCount_s : IntArray(0 to 15);                              --! UNUSED
-    -- Layer 2
-    signal layer2_buf_arb_data_s  : SlvArray(0 to 3)(g_coarse_bits+10 downto 0);        --! L1 buffer readout data to L2 arbiter 
-    signal layer2_buf_arb_valid_s : std_logic_vector(0 to 3);                           --! L1 buffer readout valid signal to L2 arbiter
-    -- Layer 3
-    signal layer3_arb_buf_rd_en  : std_logic_vector(0 to 3);                            --! L3 arbiter read enable to L2 ring buffers
-    signal layer3_arb_buf_rvalid : std_logic_vector(0 to 3);                            --! L2 buffer readout valid signal to L3 arbiter
-    signal layer3_buf_arb_data_s : SlvArray(0 to 3)(g_coarse_bits+10 downto 0);         --! L2 buffer readout data signal to L3 arbiter
-    signal layer3_buf_arb_empty_s     : std_logic_vector(0 to 3);                       --! L2 buffer empty signal to L3 arbiter
-    signal layer3_buf_arb_emptyNext_s : std_logic_vector(0 to 3);                       --! UNUSED
-    signal layer3_buf_arb_full_s      : std_logic_vector(0 to 3);                       --! UNUSED
-    signal layer3_buf_arb_fullNext_s  : std_logic_vector(0 to 3);                       --! UNUSED
-    signal layer3_buf_arb_fillCount_s : IntArray(0 to 3);                               --! UNUSED
+    -- Layers 2 and 3 (hand-wired or arbiter tree)
+    signal arb_top_grant_s : std_logic_vector(0 to sel(g_arb_tree, arbTreeTopInputs(16, g_arb_fanin, 0), 4)-1); --! Top level arbiter read enable to the buffers below it
 
     ------------------------------------------------------------------------
     -- Top-level data signals
     ------------------------------------------------------------------------
     signal tdc64ch_valid_s : std_logic;                                                           --! Top level arbiter valid data signal
-    signal tdc64ch_valid_s_last : std_logic;                                                      --! Registered data valid signal
+    signal tdc64ch_valid_s_last : std_logic;                                                        --! Registered data valid signal
+    signal tdc64ch_wr_s    : std_logic;                                                             --! One pulse per hit out of the top level arbiter
     signal tdc64ch_data_s  : std_logic_vector(g_coarse_bits+10 downto 0);                         --! Top level arbiter data to BRAM
     signal tdc64ch_data_s_last : std_logic_vector(g_coarse_bits+10 downto 0);                     --! Registered arbiter data
     signal tdc_data_dummy : std_logic_vector(62-(g_coarse_bits+10) downto 0) := (others => '1');  --! Dummy bits to append to `tdc64ch_data_s` to reach 64 bits (to comply with AXI standard)
@@ -187,7 +184,7 @@ begin
     -- Expose top level arbiter outputs for ILA debug 
     DEBUG_data  <= tdc64ch_data_s;
     DEBUG_valid <= tdc64ch_valid_s;
-    DEBUG_grant <= layer3_arb_buf_rd_en;
+    DEBUG_grant <= std_logic_vector(resize(unsigned(arb_top_grant_s), DEBUG_grant'length));
 
     -- The channel IDs obey the following algorithm:
     -- ---------------------------------------------------------------
@@ -226,7 +223,9 @@ begin
             g_chID_start   => g_chID_start + (4 * ch),
             g_coarse_bits  => g_coarse_bits,
             g_sat_duration => g_sat_duration,
-            g_pipe_depth   => 16  -- (4ch) * (4hits / channel) = 16 hits max. Adjustable
+            g_pipe_depth   => 16, -- (4ch) * (4hits / channel) = 16 hits max. Adjustable
+            g_fast_rearm   => g_fast_rearm,
+            g_arb_tree     => g_arb_tree
         )
         port map (
             clk0      => clk0,
@@ -256,79 +255,125 @@ begin
             rd_data         => layer1_buf_arb_data_s(ch),  -- Data from buffer to arbiter
             -- FOLLOWING ARE UNUSED FOR NOW
             empty           => layer1_buf_arb_empty_s(ch),
-            empty_next      => layer1_buf_arb_emptyNext_s(ch),
+            empty_next      => layer1_buf_arb_emptyNext_s(ch), -- Last word signal to the arbiter tree
             full            => layer1_buf_arb_full_s(ch),
             full_next       => layer1_buf_arb_fullNext_s(ch),
             fill_count      => layer1_buf_arb_fillCount_s(ch)
         );
     end generate layer1;
 
-    -- Now connect the 16 ring buffers to four 4:1 arbiters and buffers
-    layer2 : for idx in 0 to 3 generate
-    -- Algorithm:
-    --      idx      |    connections
-    --  ----------------------------------
-    --      0        |    [4 * idx : (4 * idx) + 3] = [0:3]
-    --      1        |    [4 * idx : (4 * idx) + 3] = [4:7]
-    --      2        |    [4 * idx : (4 * idx) + 3] = [8:11]
-    --      3        |    [4 * idx : (4 * idx) + 3] = [12:15]
-    begin
-        --! Connect layer 1 buffers to layer 2 arbiters
-        L2_arb_inst : entity work.rr_arbiter_41
+    --! \brief Serialize the 16 layer 1 buffers into the top level output
+    --! \details Four 4:1 layer 2 arbiters write to 128 hit buffers, read out by the top level (layer 3) 4:1 arbiter, as in the
+    --! diagram above: by default wired by hand from \ref rr_arbiter_41.vhd "`rr_arbiter_41`"s, with `g_arb_tree` generated by the
+    --! \ref arbiter_tree.vhd "arbiter tree", whose shape is then set by `g_arb_fanin` and `g_arb_depth`. The arbiter tree has
+    --! not been simulated yet (see tb_2BRAM_throughput), so it stays off by default.
+    g_tree : if g_arb_tree generate
+        arb_tree : entity work.arbiter_tree
         generic map (
-            DWIDTH => g_coarse_bits + 11
+            DWIDTH       => g_coarse_bits + 11,
+            g_inputs     => 16,
+            g_fanin      => g_arb_fanin,
+            g_depth      => g_arb_depth,
+            g_req_stages => g_arb_req_stages,
+            g_out_stages => g_arb_out_stages
         )
         port map (
             clk         => clk0,
             rst         => reset,
             -- Connect to the layer 1 buffers
-            empty_in    => layer1_buf_arb_empty_s( (4*idx) to (4*idx+3) ),
-            valid_in    => layer1_buf_arb_rvalid_s( (4*idx) to (4*idx+3) ),
-            data_in     => layer1_buf_arb_data_s((4*idx) to (4*idx+3) ),
-            enable_out  => layer1_arb_buf_ren_s( (4*idx) to (4*idx+3) ),
-            -- Connect to the layer 2 buffers
-            data_out    => layer2_buf_arb_data_s(idx),
-            valid_out   => layer2_buf_arb_valid_s(idx)
+            empty_in    => layer1_buf_arb_empty_s,
+            valid_in    => layer1_buf_arb_rvalid_s,
+            data_in     => layer1_buf_arb_data_s,
+            empty_next_in => layer1_buf_arb_emptyNext_s,
+            enable_out  => layer1_arb_buf_ren_s,
+            data_out    => tdc64ch_data_s,  -- final top level output
+            valid_out   => tdc64ch_valid_s, -- final top level output
+            top_grant   => arb_top_grant_s
         );
-        --! Connect layer 2 arbiters to layer 2 buffers
-        L2_buf_inst : entity work.ring_buffer
-        generic map (
-            RAM_WIDTH => g_coarse_bits + 11,
-            RAM_DEPTH => 128
-        )
+    else generate
+        signal layer2_arb_buf_data_s  : SlvArray(0 to 3)(g_coarse_bits+10 downto 0);    --! L2 arbiter data to L2 buffers
+        signal layer2_arb_buf_valid_s : std_logic_vector(0 to 3);                       --! L2 arbiter valid signal to L2 buffers
+        signal layer3_buf_arb_rvalid_s : std_logic_vector(0 to 3);                      --! L2 buffer readout valid signal to L3 arbiter
+        signal layer3_buf_arb_data_s  : SlvArray(0 to 3)(g_coarse_bits+10 downto 0);    --! L2 buffer readout data to L3 arbiter
+        signal layer3_buf_arb_empty_s : std_logic_vector(0 to 3);                       --! L2 buffer empty signal to L3 arbiter
+        signal layer3_buf_arb_emptyNext_s : std_logic_vector(0 to 3);                   --! UNUSED
+        signal layer3_buf_arb_fullNext_s  : std_logic_vector(0 to 3);                   --! UNUSED
+        signal layer2_buf_full_s : std_logic_vector(0 to 3);                            --! UNUSED
+        signal layer2_buf_fill_s : IntArray(0 to 3);                                    --! UNUSED
+    begin
+        -- Connect the 16 ring buffers to four 4:1 arbiters and buffers
+        layer2 : for idx in 0 to 3 generate
+        -- Algorithm:
+        --      idx      |    connections
+        --  ----------------------------------
+        --      0        |    [4 * idx : (4 * idx) + 3] = [0:3]
+        --      1        |    [4 * idx : (4 * idx) + 3] = [4:7]
+        --      2        |    [4 * idx : (4 * idx) + 3] = [8:11]
+        --      3        |    [4 * idx : (4 * idx) + 3] = [12:15]
+        begin
+            --! Connect layer 1 buffers to layer 2 arbiters
+            L2_arb_inst : entity work.rr_arbiter_41
+            generic map (
+                DWIDTH => g_coarse_bits + 11
+            )
+            port map (
+                clk         => clk0,
+                rst         => reset,
+                -- Connect to the layer 1 buffers
+                empty_in    => layer1_buf_arb_empty_s( (4*idx) to (4*idx+3) ),
+                valid_in    => layer1_buf_arb_rvalid_s( (4*idx) to (4*idx+3) ),
+                data_in     => layer1_buf_arb_data_s((4*idx) to (4*idx+3) ),
+                enable_out  => layer1_arb_buf_ren_s( (4*idx) to (4*idx+3) ),
+                -- Connect to the layer 2 buffers
+                data_out    => layer2_arb_buf_data_s(idx),
+                valid_out   => layer2_arb_buf_valid_s(idx)
+            );
+            --! Connect layer 2 arbiters to layer 2 buffers
+            L2_buf_inst : entity work.ring_buffer
+            generic map (
+                RAM_WIDTH => g_coarse_bits + 11,
+                RAM_DEPTH => 128
+            )
+            port map (
+                clk             => clk0,
+                rst             => reset,
+                wr_en           => layer2_arb_buf_valid_s(idx),
+                wr_data         => layer2_arb_buf_data_s(idx),
+                rd_en           => arb_top_grant_s(idx),
+                rd_valid        => layer3_buf_arb_rvalid_s(idx),
+                rd_data         => layer3_buf_arb_data_s(idx),
+                empty           => layer3_buf_arb_empty_s(idx),
+                full            => layer2_buf_full_s(idx),       -- unused
+                fill_count      => layer2_buf_fill_s(idx),       -- unused
+                -- FOLLOWING ARE UNUSED FOR NOW
+                empty_next      => layer3_buf_arb_emptyNext_s(idx),
+                full_next       => layer3_buf_arb_fullNext_s(idx)
+            );
+        end generate layer2;
+
+        --! Connect the layer 2 buffers to the final (layer 3) arbiter
+        layer3_arbiter : entity work.rr_arbiter_41
+        generic map ( DWIDTH => g_coarse_bits + 11 )
         port map (
-            clk             => clk0,
-            rst             => reset,
-            wr_en           => layer2_buf_arb_valid_s(idx),
-            wr_data         => layer2_buf_arb_data_s(idx),
-            rd_en           => layer3_arb_buf_rd_en(idx),
-            rd_valid        => layer3_arb_buf_rvalid(idx),
-            rd_data         => layer3_buf_arb_data_s(idx),
-            empty           => layer3_buf_arb_empty_s(idx),
-            -- FOLLOWING ARE UNUSED FOR NOW
-            empty_next      => layer3_buf_arb_emptyNext_s(idx),  -- unused
-            full            => layer3_buf_arb_full_s(idx),       -- unused
-            full_next       => layer3_buf_arb_fullNext_s(idx),   -- unused
-            fill_count      => layer3_buf_arb_fillCount_s(idx)   -- unused
+            clk         => clk0,
+            rst         => reset,
+            empty_in    => layer3_buf_arb_empty_s,
+            valid_in    => layer3_buf_arb_rvalid_s,
+            data_in     => layer3_buf_arb_data_s,
+            enable_out  => arb_top_grant_s,
+            data_out    => tdc64ch_data_s,  -- final top level output
+            valid_out   => tdc64ch_valid_s  -- final top level output
         );
-    end generate layer2;
+    end generate g_tree;
 
-    --! Connect the layer 2 buffers to the final (layer 3) arbiter
-    layer3_arbiter : entity work.rr_arbiter_41
-    generic map ( DWIDTH => g_coarse_bits + 11 )
-    port map (
-        clk         => clk0,
-        rst         => reset,
-        empty_in    => layer3_buf_arb_empty_s,
-        valid_in    => layer3_arb_buf_rvalid,
-        data_in     => layer3_buf_arb_data_s,
-        enable_out  => layer3_arb_buf_rd_en,
-        data_out    => tdc64ch_data_s,  -- final top level output
-        valid_out   => tdc64ch_valid_s  -- final top level output
-    );
+    --! \brief One write strobe per hit out of the top level arbiter
+    --! \details The \ref rr_arbiter_41.vhd "`rr_arbiter_41`" of the hand-wired tree holds its valid flag high for two or more
+    --! cycles per hit, so a hit is written on the rising edge of the flag. The arbiter tree raises the flag for exactly one
+    --! cycle per hit, and can do so on consecutive cycles, so with `g_arb_tree` every valid cycle is a hit.
+    tdc64ch_wr_s <= tdc64ch_valid_s when g_arb_tree else tdc64ch_valid_s and not tdc64ch_valid_s_last;
 
     --! \brief Register signals to enable level detection
-    --! \details Register the reset, PS read busy, trigger, and top level arbiter valid and data signals.
+    --! \details Register the reset, PS read busy, trigger, and top level arbiter data signals.
     --! By registering them, we can track changes in the state which are then used to control the FSM that handles BRAM writes
     p_register : process(all)
     begin
@@ -363,9 +408,12 @@ begin
                 -- BRAM_1_wrdata_b <= tdc_data_dummy & tdc64ch_data_s;
                 -- if (tdc64ch_data_s_last = (tdc64ch_data_s_last'range => '0')) and (tdc64ch_data_s_last )
 
-                if (tdc64ch_valid_s_last = '0') and (tdc64ch_valid_s = '1') then
+                if (tdc64ch_wr_s = '1') then
                     BRAM_1_we_b <= (others => '1');
                     BRAM_1_wrdata_b <= tdc_data_dummy & tdc64ch_data_s;
+                    BRAM_1_addr_b <= std_logic_vector(shift_left(addr1,3));
+                    -- When data arrives, increment address at all times (at most one hit per clock cycle)
+                    addr1 <= addr1 + 1;
                 else 
                     BRAM_1_we_b <= (others => '0');
                     BRAM_1_wrdata_b <= (others => '0');
@@ -373,11 +421,6 @@ begin
 
                 BRAM_1_en_b <= '1';
 
-                -- When data arrives, increment address at all times
-                if (tdc64ch_valid_s_last = '1') and (tdc64ch_valid_s = '0') then 
-                    addr1 <= addr1 + 1;
-                end if;
-
                 -- FSM to handle trigger accept logic
                 case state is 
                     when s_idle =>  -- system collecting data, waiting for trigger
@@ -414,8 +457,6 @@ begin
         end if;
     end process p_handle_BRAM_rw;
 
-    -- Handle byte -> word addressing for both BRAMs
-    BRAM_1_addr_b <= std_logic_vector(shift_left(addr1,3));
     -- Send BRAM clocks straight through
     BRAM_1_clk_b <= clk0;
 
@@ -1,40 +1,38 @@
 ----------------------------------------------------------------------------------
 --! \file TDC_64ch_2BRAM.vhd
---! \brief 64-channel TDC block that writes to a one of two DPBRAM blocks depending on the arrival of an external trigger.
---! \details A 64-channel TDC module that connects four groups of \ref TDC_4ch.vhd "`TDC_4ch`" modules to 4:1 arbiters,
---! whose outputs are then connected to intermediate hit storage buffers before being read out by a top level arbiter.
---! The top level arbiter writes directly to one of two DPBRAM blocks in the PL fabric at the clk0 frequency (212.4 MHz for
---! nominal SpinQuest operation). Upon arrival of an external trigger, the module switches writing from the original BRAM to
---! the second BRAM and sends an interrupt to the PS. The PS then sends a read busy signal and fully reads out the non-active
---! BRAM. An internal counter keeps track of the number of missed triggers (trigger arrived during BRAM readout, currently 
---! unused). Having two BRAM blocks ensures zero readout deadtime. A block diagram of the setup is given below:
+--! \brief 64-channel TDC block that writes to one of two DPBRAM blocks, switching to the other one on every accepted trigger.
+--! \details The hits of the 64 channels are timestamped by 16 \ref TDC_4ch.vhd "`TDC_4ch`" modules, each writing into a
+--! ring buffer of its own, and serialized by a tree of \ref rr_arbiter_41.vhd "4:1 arbiters" (with `g_arb_tree`, by the
+--! \ref arbiter_tree.vhd "arbiter tree" whose shape is set by `g_arb_fanin` and `g_arb_depth`). The output of the tree is
+--! written to the active one of two DPBRAM blocks at the clk0 frequency (212.4 MHz for nominal SpinQuest operation), one
+--! word per hit, wrapping around (and flagging an overflow) when full. The data path is:
 --!
 --! \verbatim
---!           layer 1                 layer 2            layer 3 (top)
---!  |----------------------||-----------------------||-----------------|
---!
---!   4x TDC_4ch -> buffer -|
---!   4x TDC_4ch -> buffer -|\___arbiter --> buffer___
---!   4x TDC_4ch -> buffer -|/                        \
---!   4x TDC_4ch -> buffer -|                          |
---!                                                    |
---!   4x TDC_4ch -> buffer -|                          |
---!   4x TDC_4ch -> buffer -|\___arbiter --> buffer____|
---!   4x TDC_4ch -> buffer -|/                         | 
---!   4x TDC_4ch -> buffer -|                          |
---!                                                    |--> arbiter --> output to BRAM
---!   4x TDC_4ch -> buffer -|                          |
---!   4x TDC_4ch -> buffer -|\___arbiter --> buffer____|
---!   4x TDC_4ch -> buffer -|/                         |
---!   4x TDC_4ch -> buffer -|                          |
---!                                                    |
---!   4x TDC_4ch -> buffer -|                          |
---!   4x TDC_4ch -> buffer -|\___arbiter --> buffer____/
---!   4x TDC_4ch -> buffer -|/                           
---!   4x TDC_4ch -> buffer -|           
+--!   16x TDC_4ch -> buffer -> 4x 4:1 arbiter -> buffer(128) -> 4:1 arbiter -> [trigger_match] -> active BRAM
 --! \endverbatim
---! 
---! Since this module makes use of VHDL 2008 (unconstrained SLV arrays), it must be wrapped by 
+--!
+--! An external trigger is accepted when the PS is not reading a BRAM out (`rd_busy` low, FSM in `s_idle`): the writer
+--! switches to the other BRAM, latches the fill count and overflow flag of the BRAM handed off into `bram_status` and the
+--! missed trigger count into `missed_trigs`, and raises the interrupt. The PS raises `rd_busy`, reads the filled part of
+--! the BRAM and lowers `rd_busy`, which clears that BRAM for the next switch. Hits keep being written to the active BRAM
+--! throughout, so no hit is lost to the readout, but a trigger arriving between its acceptance and the end of the PS readout
+--! has no free BRAM to switch to: it is missed, and counted. The difference between the `missed_trigs` values read at two
+--! consecutive interrupts is the number of triggers missed in between.
+--!
+--! With `g_match_enable`, the module runs in trigger matching mode instead: the hits out of the arbiter tree go to the
+--! circular history of a \ref trigger_match.vhd "`trigger_match`" block rather than to the BRAMs, and on an accepted trigger
+--! only the hits whose coarse time lies in the window `[t_trig - lookback, t_trig - lookback + width)` are written to the
+--! active BRAM before the BRAMs are switched and the interrupt is raised. The PS handshake is unchanged.
+--!
+--! The \ref tdc_ctrl.vhd "control block" (`s_axi_ctrl`) sets at runtime the channel mask, the minimum hit width and the
+--! prescale and rate limit of every channel, applied by every `TDC_4ch` in front of its channel buffers, and the trigger
+--! window, starting from `g_match_lookback` and `g_match_width` after a reset. The \ref tdc_stats.vhd "statistics block"
+--! (`s_axi_stats`) counts the hits of every channel before the filter (CH_HITS) and the ones written after it, the
+--! occupancy of the buffers at every stage, and timestamps every trigger handshake with the PS (trigger accepted, interrupt
+--! raised, `rd_busy` raised and lowered) on a free-running clk0 cycle counter, so that the PS can measure its interrupt and
+--! readout latency.
+--!
+--! Since this module makes use of VHDL 2008 (unconstrained SLV arrays), it must be wrapped by
 --! a VHDL 1993 module, in this case the \ref top_2BRAM.vhd "`top_64ch_2BRAM`" module.
 --! \author Amitav Mitra, amitra3@jhu.edu
 -- ###########################################################################
@@ -46,48 +44,25 @@ use IEEE.STD_LOGIC_1164.ALL;
 use IEEE.NUMERIC_STD.ALL;
 use work.common_types.all;
 
---! \brief 64-channel TDC block that writes to a one of two DPBRAM blocks depending on the arrival of an external trigger.
---! \details A 64-channel TDC module that connects four groups of \ref TDC_4ch.vhd "`TDC_4ch`" modules to 4:1 arbiters,
---! whose outputs are then connected to intermediate hit storage buffers before being read out by a top level arbiter.
---! The top level arbiter writes directly to one of two DPBRAM blocks in the PL fabric at the clk0 frequency (212.4 MHz for
---! nominal SpinQuest operation). Upon arrival of an external trigger, the module switches writing from the original BRAM to
---! the second BRAM and sends an interrupt to the PS. The PS then sends a read busy signal and fully reads out the non-active
---! BRAM. An internal counter keeps track of the number of missed triggers (trigger arrived during BRAM readout, currently 
---! unused). A block diagram of the setup is given below:
---!
---! \verbatim
---!           layer 1                 layer 2            layer 3 (top)
---!  |----------------------||-----------------------||-----------------|
---!
---!   4x TDC_4ch -> buffer -|
---!   4x TDC_4ch -> buffer -|\___arbiter --> buffer___
---!   4x TDC_4ch -> buffer -|/                        \
---!   4x TDC_4ch -> buffer -|                          |
---!                                                    |
---!   4x TDC_4ch -> buffer -|                          |
---!   4x TDC_4ch -> buffer -|\___arbiter --> buffer____|
---!   4x TDC_4ch -> buffer -|/                         | 
---!   4x TDC_4ch -> buffer -|                          |
---!                                                    |--> arbiter --> output to BRAM
---!   4x TDC_4ch -> buffer -|                          |
---!   4x TDC_4ch -> buffer -|\___arbiter --> buffer____|
---!   4x TDC_4ch -> buffer -|/                         |
---!   4x TDC_4ch -> buffer -|                          |
---!                                                    |
---!   4x TDC_4ch -> buffer -|                          |
---!   4x TDC_4ch -> buffer -|\___arbiter --> buffer____/
---!   4x TDC_4ch -> buffer -|/                           
---!   4x TDC_4ch -> buffer -|           
---! \endverbatim
---! 
---! Since this module makes use of VHDL 2008 (unconstrained SLV arrays), it must be wrapped by 
---! a VHDL 1993 module, in this case the \ref top_2BRAM.vhd "`top_64ch_2BRAM`" module.
+--! \brief 64-channel TDC block that writes to one of two DPBRAM blocks, switching to the other one on every accepted trigger.
+--! \details See the file documentation for the data path, the trigger handshake with the PS and the runtime settings.
 entity TDC_64ch is 
     generic (
         g_chID_start   : natural := 0;  --! Channel ID of the first TDC channel in the group of 64. Should normally always be 0, so this generic is kind of pointless.
         g_coarse_bits  : natural := 28; --! Number of bits in the \ref CoarseCounter.vhd "coarse counter"
         g_sat_duration : natural := 3;  --! Minimum duration (in clk0 periods) that hit must remain high to be considered valid
-        g_pipe_depth   : natural := 5   --! Max number of hits stored in pipeline
+        g_pipe_depth   : natural := 5;  --! Max number of hits stored in pipeline
+        g_fast_rearm   : boolean := false;          --! Encoders send hits out once they qualify and re-arm after one low clk0 period (see \ref encoder.vhd "encoder"; off until tb_channel_deadtime has been run)
+        g_arb_tree     : boolean := false;          --! Serialize the hits with the \ref arbiter_tree.vhd "arbiter tree" of `rr_arbiter`s instead of the hand-wired tree of `rr_arbiter_41`s (not simulated yet, off by default)
+        g_arb_fanin    : IntArray := (4, 4);        --! Fan-in of every layer of the arbiter tree reading out the 16 `TDC_4ch` buffers (`g_arb_tree` only)
+        g_arb_depth    : IntArray := (0 => 128);    --! Depth of the hit buffers written by every layer of the arbiter tree but the top one (`g_arb_tree` only)
+        g_arb_req_stages : natural := 0;            --! Register stages on the request vector of every arbiter in the tree (`g_arb_tree` only)
+        g_arb_out_stages : natural := 0;            --! Register stages on the output of every arbiter in the tree
+        g_match_enable   : boolean := false;        --! Trigger matching mode: only write the hits in the trigger window to BRAM
+        g_match_depth    : natural := 2048;         --! Number of hits kept in the trigger matching history (power of two)
+        g_match_lookback : natural := 0;            --! Start of the trigger window before the trigger after a reset (coarse periods), then set through the control block
+        g_match_width    : natural := 0;            --! Length of the trigger window after a reset (coarse periods), then set through the control block
+        g_match_latency  : natural := 64            --! Coarse periods to wait after the window for its hits to get through the arbiter tree
     );
     port (
         -- TDC and system clocks sent to all channels
@@ -106,6 +81,52 @@ entity TDC_64ch is
         rd_busy : in std_logic;                         --! [PS -> PL] PS BRAM read in progress
         irq_o   : out std_logic;                        --! [PL -> PS] Processor interrupt request
         which_bram : out std_logic_vector(1 downto 0);  --! [PL -> PS] Tell PS which BRAM is currently being written to
+        bram_status : out std_logic_vector(31 downto 0); --! [PL -> PS] Status of the BRAM handed off to the PS, latched at trigger time: [15:0] fill count (words), [31] overflow (BRAM wrapped)
+        missed_trigs : out std_logic_vector(31 downto 0); --! [PL -> PS] Number of triggers missed since reset, latched at trigger time (before the interrupt is raised)
+        ---------------------------------------------
+        -- Statistics block AXI4-Lite slave (see tdc_stats.vhd)
+        ---------------------------------------------
+        s_axi_stats_aclk    : in std_logic;                       --! AXI clock of the statistics block
+        s_axi_stats_aresetn : in std_logic;                       --! AXI reset of the statistics block, active low
+        s_axi_stats_awaddr  : in std_logic_vector(11 downto 0);   --! Write address
+        s_axi_stats_awvalid : in std_logic;                       --! Write address valid
+        s_axi_stats_awready : out std_logic;                      --! Write address ready
+        s_axi_stats_wdata   : in std_logic_vector(31 downto 0);   --! Write data
+        s_axi_stats_wstrb   : in std_logic_vector(3 downto 0);    --! Write byte strobes
+        s_axi_stats_wvalid  : in std_logic;                       --! Write data valid
+        s_axi_stats_wready  : out std_logic;                      --! Write data ready
+        s_axi_stats_bresp   : out std_logic_vector(1 downto 0);   --! Write response
+        s_axi_stats_bvalid  : out std_logic;                      --! Write response valid
+        s_axi_stats_bready  : in std_logic;                       --! Write response ready
+        s_axi_stats_araddr  : in std_logic_vector(11 downto 0);   --! Read address
+        s_axi_stats_arvalid : in std_logic;                       --! Read address valid
+        s_axi_stats_arready : out std_logic;                      --! Read address ready
+        s_axi_stats_rdata   : out std_logic_vector(31 downto 0);  --! Read data
+        s_axi_stats_rresp   : out std_logic_vector(1 downto 0);   --! Read response
+        s_axi_stats_rvalid  : out std_logic;                      --! Read data valid
+        s_axi_stats_rready  : in std_logic;                       --! Read data ready
+        ---------------------------------------------
+        -- Control block AXI4-Lite slave (see tdc_ctrl.vhd)
+        ---------------------------------------------
+        s_axi_ctrl_aclk    : in std_logic;                       --! AXI clock of the control block
+        s_axi_ctrl_aresetn : in std_logic;                       --! AXI reset of the control block, active low
+        s_axi_ctrl_awaddr  : in std_logic_vector(11 downto 0);   --! Write address
+        s_axi_ctrl_awvalid : in std_logic;                       --! Write address valid
+        s_axi_ctrl_awready : out std_logic;                      --! Write address ready
+        s_axi_ctrl_wdata   : in std_logic_vector(31 downto 0);   --! Write data
+        s_axi_ctrl_wstrb   : in std_logic_vector(3 downto 0);    --! Write byte strobes
+        s_axi_ctrl_wvalid  : in std_logic;                       --! Write data valid
+        s_axi_ctrl_wready  : out std_logic;                      --! Write data ready
+        s_axi_ctrl_bresp   : out std_logic_vector(1 downto 0);   --! Write response
+        s_axi_ctrl_bvalid  : out std_logic;                      --! Write response valid
+        s_axi_ctrl_bready  : in std_logic;                       --! Write response ready
+        s_axi_ctrl_araddr  : in std_logic_vector(11 downto 0);   --! Read address
+        s_axi_ctrl_arvalid : in std_logic;                       --! Read address valid
+        s_axi_ctrl_arready : out std_logic;                      --! Read address ready
+        s_axi_ctrl_rdata   : out std_logic_vector(31 downto 0);  --! Read data
+        s_axi_ctrl_rresp   : out std_logic_vector(1 downto 0);   --! Read response
+        s_axi_ctrl_rvalid  : out std_logic;                      --! Read data valid
+        s_axi_ctrl_rready  : in std_logic;                       --! Read data ready
         ---------------------------------------------
         -- DEBUG ILA
         ---------------------------------------------
@@ -155,28 +176,32 @@ architecture RTL of TDC_64ch is
     signal layer1_buf_arb_rvalid_s    : std_logic_vector(0 to 15);                      --! L1 buffer readout valid signal to L1 arbiter
     signal layer1_buf_arb_data_s      : SlvArray(0 to 15)(g_coarse_bits+10 downto 0);   --! L1 buffer readout data to L1 arbiter 
     signal layer1_buf_arb_empty_s     : std_logic_vector(0 to 15);                      --! L1 buffer empty signal to L1 arbiter
-    signal layer1_buf_arb_emptyNext_s : std_logic_vector(0 to 15);                      --! UNUSED
-    signal layer1_buf_arb_full_s      : std_logic_vector(0 to 15);                      --! UNUSED
+    signal layer1_buf_arb_emptyNext_s : std_logic_vector(0 to 15);                      --! L1 buffer empty next signal to the arbiter tree (`g_arb_tree` only)
+    signal layer1_buf_arb_full_s      : std_logic_vector(0 to 15);                      --! L1 buffer full flag, to the statistics block
     signal layer1_buf_arb_fullNext_s  : std_logic_vector(0 to 15);                      --! UNUSED
-    signal layer1_buf_arb_fillCount_s : IntArray(0 to 15);                              --! UNUSED
-    -- Layer 2
-    signal layer2_buf_arb_data_s  : SlvArray(0 to 3)(g_coarse_bits+10 downto 0);        --! L1 buffer readout data to L2 arbiter 
-    signal layer2_buf_arb_valid_s : std_logic_vector(0 to 3);                           --! L1 buffer readout valid signal to L2 arbiter
-    -- Layer 3
-    signal layer3_arb_buf_rd_en  : std_logic_vector(0 to 3);                            --! L3 arbiter read enable to L2 ring buffers
-    signal layer3_arb_buf_rvalid : std_logic_vector(0 to 3);                            --! L2 buffer readout valid signal to L3 arbiter
-    signal layer3_buf_arb_data_s : SlvArray(0 to 3)(g_coarse_bits+10 downto 0);         --! L2 buffer readout data signal to L3 arbiter
-    signal layer3_buf_arb_empty_s     : std_logic_vector(0 to 3);                       --! L2 buffer empty signal to L3 arbiter
-    signal layer3_buf_arb_emptyNext_s : std_logic_vector(0 to 3);                       --! UNUSED
-    signal layer3_buf_arb_full_s      : std_logic_vector(0 to 3);                       --! UNUSED
-    signal layer3_buf_arb_fullNext_s  : std_logic_vector(0 to 3);                       --! UNUSED
-    signal layer3_buf_arb_fillCount_s : IntArray(0 to 3);                               --! UNUSED
+    signal layer1_buf_arb_fillCount_s : IntArray(0 to 15);                              --! L1 buffer fill count, to the statistics block
+    signal layer1_ch_hit_s            : std_logic_vector(0 to 63);                      --! Hit out of the encoder of every channel, to the statistics block
+    signal layer1_ch_drop_s           : std_logic_vector(0 to 63);                      --! Hit dropped by the full channel buffer, to the statistics block
+    signal ctrl_ch_enable_s           : std_logic_vector(0 to 63);                      --! Channel enables from the control block
+    signal ctrl_ch_sat_s              : IntArray(0 to 63);                              --! Minimum hit width of every channel from the control block
+    signal ctrl_ch_prescale_s         : IntArray(0 to 63);                              --! Prescale of every channel from the control block
+    signal ctrl_ch_limit_s            : IntArray(0 to 63);                              --! Rate limit of every channel from the control block
+    signal ctrl_limit_tick_s          : std_logic;                                      --! Start of a rate limit period
+    signal ctrl_match_lookback_s      : std_logic_vector(15 downto 0);                  --! Start of the trigger window before the trigger, from the control block
+    signal ctrl_match_width_s         : std_logic_vector(15 downto 0);                  --! Length of the trigger window, from the control block
+    -- Layers 2 and 3 (hand-wired or arbiter tree)
+    constant c_arb_buffers : natural := sel(g_arb_tree, arbTreeBuffers(16, g_arb_fanin, 0), 4); --! Number of layer 2 buffers
+    signal arb_top_grant_s : std_logic_vector(0 to sel(g_arb_tree, arbTreeTopInputs(16, g_arb_fanin, 0), 4)-1); --! Top level arbiter read enable to the buffers below it
+    signal layer2_buf_wr_s   : std_logic_vector(0 to c_arb_buffers-1);                           --! L2 buffer write enable, to the statistics block
+    signal layer2_buf_full_s : std_logic_vector(0 to c_arb_buffers-1);                           --! L2 buffer full flag, to the statistics block
+    signal layer2_buf_fill_s : IntArray(0 to c_arb_buffers-1);                                   --! L2 buffer fill count, to the statistics block
 
     ------------------------------------------------------------------------
     -- Top-level data signals
     ------------------------------------------------------------------------
     signal tdc64ch_valid_s : std_logic;                                                             --! Top level arbiter valid data signal
     signal tdc64ch_valid_s_last : std_logic;                                                        --! Registered data valid signal
+    signal tdc64ch_wr_s    : std_logic;                                                             --! One pulse per hit out of the top level arbiter
     signal tdc64ch_data_s  : std_logic_vector(g_coarse_bits+10 downto 0);                           --! Top level arbiter data to BRAM
     signal tdc_data_dummy : std_logic_vector(62-(g_coarse_bits+10) downto 0) := (others => '1');    --! Dummy bits to append to `tdc64ch_data_s` to reach 64 bits (to comply with AXI standard)
 
@@ -190,24 +215,46 @@ architecture RTL of TDC_64ch is
     
     signal trig_last  : std_logic;                                  --! Register the trigger signal 
     signal busy_last  : std_logic;                                  --! Register the busy signal from the PS
-    signal missed_trigs : unsigned(5 downto 0) := (others => '0');  --! Signal to count missed triggers (trigger arrived during PS readout)
+    signal missed_count : unsigned(31 downto 0) := (others => '0'); --! Count of missed triggers (trigger arrived while the previous one was still being handled)
+    signal missed_trigs_s : std_logic_vector(31 downto 0) := (others => '0');   --! `missed_count` latched when a trigger is accepted, stable while the PS reads it
     type t_state is (
         s_idle,  -- Waiting for trigger accept, writing data to one of the BRAMs
+        s_match, -- trigger received in trigger matching mode, writing the hits of its window to the active BRAM
         s_trigd, -- trigger received, send out interrupt request and wait for busy flag from PS 
         s_busy   -- PS is busy reading from one of the BRAMs, await busy low from PS
     );
     signal state : t_state := s_idle;
     signal addr  : unsigned(31 downto 0) := (others => '0');    --! UNUSED
-    signal addr1 : unsigned(31 downto 0) := (others => '0');    --! BRAM 1 address
-    signal addr2 : unsigned(31 downto 0) := (others => '0');    --! BRAM 2 address
+    signal addr1 : unsigned(31 downto 0) := (others => '0');    --! BRAM 1 address (next word to be written == number of words written)
+    signal addr2 : unsigned(31 downto 0) := (others => '0');    --! BRAM 2 address (next word to be written == number of words written)
+    signal ovf1  : std_logic := '0';                            --! BRAM 1 address wrapped around since it was last read out
+    signal ovf2  : std_logic := '0';                            --! BRAM 2 address wrapped around since it was last read out
     signal which_bram_s : unsigned(1 downto 0) := "01";
+    signal bram_status_s : std_logic_vector(31 downto 0) := (others => '0');  --! Fill count and overflow flag of the BRAM handed off to the PS
+
+    -- Trigger matching
+    signal coarse_s        : std_logic_vector(g_coarse_bits-1 downto 0);    --! Coarse time, to latch the trigger time
+    signal match_start_s   : std_logic := '0';                              --! Trigger accepted, extract its window
+    signal match_done_s    : std_logic;                                     --! All hits of the window have been written to BRAM
+    signal match_valid_s   : std_logic;                                     --! Hit of the trigger window valid
+    signal match_data_s    : std_logic_vector(g_coarse_bits+10 downto 0);   --! Hit of the trigger window
+    signal wr_valid_s      : std_logic;                                     --! Hit to write to BRAM valid (arbiter tree or trigger window)
+    signal wr_data_s       : std_logic_vector(g_coarse_bits+10 downto 0);   --! Hit to write to BRAM
+
+    constant c_bram_words : natural := 1024;    --! Depth of each BRAM in 64-bit words (8 KB, see the block design)
+    signal stats_overwrite_s : std_logic;       --! The BRAM being written has wrapped around, so every write overwrites a hit
+    signal stats_fill_s      : natural;         --! Fill count (words) of the BRAM being written
+    signal hs_trig_s     : std_logic := '0';    --! Trigger accepted (handshake timing in the statistics block)
+    signal hs_irq_s      : std_logic := '0';    --! Interrupt raised
+    signal hs_busy_set_s : std_logic := '0';    --! `rd_busy` raised by the PS
+    signal hs_busy_clr_s : std_logic := '0';    --! `rd_busy` lowered by the PS, handshake done
 
 begin
 
     -- Expose top level arbiter outputs for ILA debug  
     DEBUG_data  <= tdc64ch_data_s;
     DEBUG_valid <= tdc64ch_valid_s;
-    DEBUG_grant <= layer3_arb_buf_rd_en;
+    DEBUG_grant <= std_logic_vector(resize(unsigned(arb_top_grant_s), DEBUG_grant'length));
 
     -- The channel IDs obey the following algorithm:
     -- ---------------------------------------------------------------
@@ -246,7 +293,9 @@ begin
             g_chID_start   => g_chID_start + (4 * ch),
             g_coarse_bits  => g_coarse_bits,
             g_sat_duration => g_sat_duration,
-            g_pipe_depth   => 16  -- (4ch) * (4hits / channel) = 16 hits max. Adjustable
+            g_pipe_depth   => 16, -- (4ch) * (4hits / channel) = 16 hits max. Adjustable
+            g_fast_rearm   => g_fast_rearm,
+            g_arb_tree     => g_arb_tree
         )
         port map (
             clk0      => clk0,
@@ -257,8 +306,15 @@ begin
             reset     => reset,
             enable    => enable, 
             hit       => hits( (4*ch) to (4*ch+3) ),
+            ch_enable   => ctrl_ch_enable_s( (4*ch) to (4*ch+3) ),
+            ch_sat      => ctrl_ch_sat_s( (4*ch) to (4*ch+3) ),
+            ch_prescale => ctrl_ch_prescale_s( (4*ch) to (4*ch+3) ),
+            ch_limit    => ctrl_ch_limit_s( (4*ch) to (4*ch+3) ),
+            limit_tick  => ctrl_limit_tick_s,
             valid_o   => layer1_tdc_buf_valid_s(ch),
-            data_o    => layer1_tdc_buf_data_s(ch)
+            data_o    => layer1_tdc_buf_data_s(ch),
+            hit_o     => layer1_ch_hit_s( (4*ch) to (4*ch+3) ),
+            drop_o    => layer1_ch_drop_s( (4*ch) to (4*ch+3) )
         );
         --! Connect the 16 `TDC_4ch` modules to their hit buffers
         TDC4ch_buf_inst : entity work.ring_buffer
@@ -274,81 +330,267 @@ begin
             rd_en           => layer1_arb_buf_ren_s(ch),   -- Read enable from arbiter to buffer
             rd_valid        => layer1_buf_arb_rvalid_s(ch),-- Read valid from buffer to arbiter
             rd_data         => layer1_buf_arb_data_s(ch),  -- Data from buffer to arbiter
-            -- FOLLOWING ARE UNUSED FOR NOW
             empty           => layer1_buf_arb_empty_s(ch),
-            empty_next      => layer1_buf_arb_emptyNext_s(ch),
-            full            => layer1_buf_arb_full_s(ch),
-            full_next       => layer1_buf_arb_fullNext_s(ch),
-            fill_count      => layer1_buf_arb_fillCount_s(ch)
+            full            => layer1_buf_arb_full_s(ch),      -- To the statistics block
+            fill_count      => layer1_buf_arb_fillCount_s(ch), -- To the statistics block
+            empty_next      => layer1_buf_arb_emptyNext_s(ch), -- Last word signal to the arbiter tree
+            -- FOLLOWING ARE UNUSED FOR NOW
+            full_next       => layer1_buf_arb_fullNext_s(ch)
         );
     end generate layer1;
 
-    -- Now connect the 16 ring buffers to four 4:1 arbiters and buffers
-    layer2 : for idx in 0 to 3 generate
-    -- Algorithm:
-    --      idx      |    connections
-    --  ----------------------------------
-    --      0        |    [4 * idx : (4 * idx) + 3] = [0:3]
-    --      1        |    [4 * idx : (4 * idx) + 3] = [4:7]
-    --      2        |    [4 * idx : (4 * idx) + 3] = [8:11]
-    --      3        |    [4 * idx : (4 * idx) + 3] = [12:15]
-    begin
-        --! Connect layer 1 buffers to layer 2 arbiters
-        L2_arb_inst : entity work.rr_arbiter_41
+    --! \brief Serialize the 16 layer 1 buffers into the top level output
+    --! \details Four 4:1 layer 2 arbiters write to 128 hit buffers, read out by the top level (layer 3) 4:1 arbiter, as in the
+    --! diagram above: by default wired by hand from \ref rr_arbiter_41.vhd "`rr_arbiter_41`"s, with `g_arb_tree` generated by the
+    --! \ref arbiter_tree.vhd "arbiter tree", whose shape is then set by `g_arb_fanin` and `g_arb_depth`. The arbiter tree has
+    --! not been simulated yet (see tb_2BRAM_throughput), so it stays off by default.
+    g_tree : if g_arb_tree generate
+        arb_tree : entity work.arbiter_tree
         generic map (
-            DWIDTH => g_coarse_bits + 11
+            DWIDTH       => g_coarse_bits + 11,
+            g_inputs     => 16,
+            g_fanin      => g_arb_fanin,
+            g_depth      => g_arb_depth,
+            g_req_stages => g_arb_req_stages,
+            g_out_stages => g_arb_out_stages
         )
         port map (
             clk         => clk0,
             rst         => reset,
             -- Connect to the layer 1 buffers
-            empty_in    => layer1_buf_arb_empty_s( (4*idx) to (4*idx+3) ),
-            valid_in    => layer1_buf_arb_rvalid_s( (4*idx) to (4*idx+3) ),
-            data_in     => layer1_buf_arb_data_s((4*idx) to (4*idx+3) ),
-            enable_out  => layer1_arb_buf_ren_s( (4*idx) to (4*idx+3) ),
-            -- Connect to the layer 2 buffers
-            data_out    => layer2_buf_arb_data_s(idx),
-            valid_out   => layer2_buf_arb_valid_s(idx)
+            empty_in    => layer1_buf_arb_empty_s,
+            valid_in    => layer1_buf_arb_rvalid_s,
+            data_in     => layer1_buf_arb_data_s,
+            empty_next_in => layer1_buf_arb_emptyNext_s,
+            enable_out  => layer1_arb_buf_ren_s,
+            data_out    => tdc64ch_data_s,  -- final top level output
+            valid_out   => tdc64ch_valid_s, -- final top level output
+            top_grant   => arb_top_grant_s,
+            buf_wr      => layer2_buf_wr_s,
+            buf_full    => layer2_buf_full_s,
+            buf_fill    => layer2_buf_fill_s
+        );
+    else generate
+        signal layer2_arb_buf_data_s  : SlvArray(0 to 3)(g_coarse_bits+10 downto 0);    --! L2 arbiter data to L2 buffers
+        signal layer2_arb_buf_valid_s : std_logic_vector(0 to 3);                       --! L2 arbiter valid signal to L2 buffers
+        signal layer3_buf_arb_rvalid_s : std_logic_vector(0 to 3);                      --! L2 buffer readout valid signal to L3 arbiter
+        signal layer3_buf_arb_data_s  : SlvArray(0 to 3)(g_coarse_bits+10 downto 0);    --! L2 buffer readout data to L3 arbiter
+        signal layer3_buf_arb_empty_s : std_logic_vector(0 to 3);                       --! L2 buffer empty signal to L3 arbiter
+        signal layer3_buf_arb_emptyNext_s : std_logic_vector(0 to 3);                   --! UNUSED
+        signal layer3_buf_arb_fullNext_s  : std_logic_vector(0 to 3);                   --! UNUSED
+    begin
+        -- Connect the 16 ring buffers to four 4:1 arbiters and buffers
+        layer2 : for idx in 0 to 3 generate
+        -- Algorithm:
+        --      idx      |    connections
+        --  ----------------------------------
+        --      0        |    [4 * idx : (4 * idx) + 3] = [0:3]
+        --      1        |    [4 * idx : (4 * idx) + 3] = [4:7]
+        --      2        |    [4 * idx : (4 * idx) + 3] = [8:11]
+        --      3        |    [4 * idx : (4 * idx) + 3] = [12:15]
+        begin
+            --! Connect layer 1 buffers to layer 2 arbiters
+            L2_arb_inst : entity work.rr_arbiter_41
+            generic map (
+                DWIDTH => g_coarse_bits + 11
+            )
+            port map (
+                clk         => clk0,
+                rst         => reset,
+                -- Connect to the layer 1 buffers
+                empty_in    => layer1_buf_arb_empty_s( (4*idx) to (4*idx+3) ),
+                valid_in    => layer1_buf_arb_rvalid_s( (4*idx) to (4*idx+3) ),
+                data_in     => layer1_buf_arb_data_s((4*idx) to (4*idx+3) ),
+                enable_out  => layer1_arb_buf_ren_s( (4*idx) to (4*idx+3) ),
+                -- Connect to the layer 2 buffers
+                data_out    => layer2_arb_buf_data_s(idx),
+                valid_out   => layer2_arb_buf_valid_s(idx)
+            );
+            --! Connect layer 2 arbiters to layer 2 buffers
+            L2_buf_inst : entity work.ring_buffer
+            generic map (
+                RAM_WIDTH => g_coarse_bits + 11,
+                RAM_DEPTH => 128
+            )
+            port map (
+                clk             => clk0,
+                rst             => reset,
+                wr_en           => layer2_arb_buf_valid_s(idx),
+                wr_data         => layer2_arb_buf_data_s(idx),
+                rd_en           => arb_top_grant_s(idx),
+                rd_valid        => layer3_buf_arb_rvalid_s(idx),
+                rd_data         => layer3_buf_arb_data_s(idx),
+                empty           => layer3_buf_arb_empty_s(idx),
+                full            => layer2_buf_full_s(idx),       -- To the statistics block
+                fill_count      => layer2_buf_fill_s(idx),       -- To the statistics block
+                -- FOLLOWING ARE UNUSED FOR NOW
+                empty_next      => layer3_buf_arb_emptyNext_s(idx),
+                full_next       => layer3_buf_arb_fullNext_s(idx)
+            );
+            layer2_buf_wr_s(idx) <= layer2_arb_buf_valid_s(idx);
+        end generate layer2;
+
+        --! Connect the layer 2 buffers to the final (layer 3) arbiter
+        layer3_arbiter : entity work.rr_arbiter_41
+        generic map ( DWIDTH => g_coarse_bits + 11 )
+        port map (
+            clk         => clk0,
+            rst         => reset,
+            empty_in    => layer3_buf_arb_empty_s,
+            valid_in    => layer3_buf_arb_rvalid_s,
+            data_in     => layer3_buf_arb_data_s,
+            enable_out  => arb_top_grant_s,
+            data_out    => tdc64ch_data_s,  -- final top level output
+            valid_out   => tdc64ch_valid_s  -- final top level output
         );
-        --! Connect layer 2 arbiters to layer 2 buffers
-        L2_buf_inst : entity work.ring_buffer
+    end generate g_tree;
+
+    --! \brief One write strobe per hit out of the top level arbiter
+    --! \details The \ref rr_arbiter_41.vhd "`rr_arbiter_41`" of the hand-wired tree holds its valid flag high for two or more
+    --! cycles per hit, so a hit is written on the rising edge of the flag. The arbiter tree raises the flag for exactly one
+    --! cycle per hit, and can do so on consecutive cycles, so with `g_arb_tree` every valid cycle is a hit.
+    tdc64ch_wr_s <= tdc64ch_valid_s when g_arb_tree else tdc64ch_valid_s and not tdc64ch_valid_s_last;
+
+    --! \brief Trigger matching mode: keep the hits in a history and only write those of the trigger window to BRAM
+    --! \details The coarse time of the trigger comes from a \ref CoarseCounter.vhd "`CoarseCounter`" of its own, reset
+    --! together with the ones of the channels so that it counts in step with them.
+    g_match : if g_match_enable generate
+        match_coarse_inst : entity work.CoarseCounter
         generic map (
-            RAM_WIDTH => g_coarse_bits + 11,
-            RAM_DEPTH => 128
+            g_coarse_bits => g_coarse_bits
         )
         port map (
-            clk             => clk0,
-            rst             => reset,
-            wr_en           => layer2_buf_arb_valid_s(idx),
-            wr_data         => layer2_buf_arb_data_s(idx),
-            rd_en           => layer3_arb_buf_rd_en(idx),
-            rd_valid        => layer3_arb_buf_rvalid(idx),
-            rd_data         => layer3_buf_arb_data_s(idx),
-            empty           => layer3_buf_arb_empty_s(idx),
-            -- FOLLOWING ARE UNUSED FOR NOW
-            empty_next      => layer3_buf_arb_emptyNext_s(idx),  -- unused
-            full            => layer3_buf_arb_full_s(idx),       -- unused
-            full_next       => layer3_buf_arb_fullNext_s(idx),   -- unused
-            fill_count      => layer3_buf_arb_fillCount_s(idx)   -- unused
+            clk_RF      => clk_sys,
+            reset_i     => reset,
+            heartbeat_o => open,
+            coarse_o    => coarse_s
+        );
+
+        match_inst : entity work.trigger_match
+        generic map (
+            g_coarse_bits => g_coarse_bits,
+            g_depth       => g_match_depth,
+            g_win_bits    => 16,
+            g_latency     => g_match_latency
+        )
+        port map (
+            clk0      => clk0,
+            reset     => reset_s,
+            coarse_i  => coarse_s,
+            lookback  => ctrl_match_lookback_s,
+            width     => ctrl_match_width_s,
+            in_valid  => tdc64ch_wr_s,
+            in_data   => tdc64ch_data_s,
+            start     => match_start_s,
+            out_valid => match_valid_s,
+            out_data  => match_data_s,
+            busy_o    => open,
+            done_o    => match_done_s
         );
-    end generate layer2;
 
-    --! Connect the layer 2 buffers to the final (layer 3) arbiter
-    layer3_arbiter : entity work.rr_arbiter_41
-    generic map ( DWIDTH => g_coarse_bits + 11 )
+        wr_valid_s <= match_valid_s;
+        wr_data_s  <= match_data_s;
+    else generate
+        -- Every hit goes to the active BRAM
+        match_done_s <= '0';
+        wr_valid_s   <= tdc64ch_wr_s;
+        wr_data_s    <= tdc64ch_data_s;
+    end generate g_match;
+
+    --! \brief Count hits, drops and buffer occupancy at every stage for the PS
+    --! \details Buffers 0 to 15 of the \ref tdc_stats.vhd "statistics block" are the layer 1 buffers and the following ones
+    --! the layer 2 buffers of the arbiter tree. At the BRAM writer, a word overwrites an older hit when the active BRAM has
+    --! wrapped around, and the fill level is the word count reported in `bram_status` for that BRAM.
+    stats_inst : entity work.tdc_stats
+    generic map (
+        g_channels => 64,
+        g_buffers  => 16 + c_arb_buffers
+    )
     port map (
-        clk         => clk0,
-        rst         => reset,
-        empty_in    => layer3_buf_arb_empty_s,
-        valid_in    => layer3_arb_buf_rvalid,
-        data_in     => layer3_buf_arb_data_s,
-        enable_out  => layer3_arb_buf_rd_en,
-        data_out    => tdc64ch_data_s,  -- final top level output
-        valid_out   => tdc64ch_valid_s  -- final top level output
+        clk0          => clk0,
+        reset         => reset,
+        ch_hit        => layer1_ch_hit_s,
+        ch_drop       => layer1_ch_drop_s,
+        buf_wr        => layer1_tdc_buf_valid_s & layer2_buf_wr_s,
+        buf_full      => layer1_buf_arb_full_s & layer2_buf_full_s,
+        buf_fill      => layer1_buf_arb_fillCount_s & layer2_buf_fill_s,
+        out_valid     => wr_valid_s,
+        out_channel   => wr_data_s(5 downto 0),
+        out_overwrite => stats_overwrite_s,
+        out_fill      => stats_fill_s,
+        hs_trig       => hs_trig_s,
+        hs_irq        => hs_irq_s,
+        hs_busy_set   => hs_busy_set_s,
+        hs_busy_clr   => hs_busy_clr_s,
+        s_axi_aclk    => s_axi_stats_aclk,
+        s_axi_aresetn => s_axi_stats_aresetn,
+        s_axi_awaddr  => s_axi_stats_awaddr,
+        s_axi_awvalid => s_axi_stats_awvalid,
+        s_axi_awready => s_axi_stats_awready,
+        s_axi_wdata   => s_axi_stats_wdata,
+        s_axi_wstrb   => s_axi_stats_wstrb,
+        s_axi_wvalid  => s_axi_stats_wvalid,
+        s_axi_wready  => s_axi_stats_wready,
+        s_axi_bresp   => s_axi_stats_bresp,
+        s_axi_bvalid  => s_axi_stats_bvalid,
+        s_axi_bready  => s_axi_stats_bready,
+        s_axi_araddr  => s_axi_stats_araddr,
+        s_axi_arvalid => s_axi_stats_arvalid,
+        s_axi_arready => s_axi_stats_arready,
+        s_axi_rdata   => s_axi_stats_rdata,
+        s_axi_rresp   => s_axi_stats_rresp,
+        s_axi_rvalid  => s_axi_stats_rvalid,
+        s_axi_rready  => s_axi_stats_rready
     );
 
+    --! Runtime channel mask and hit qualification of the 64 channels, and trigger window
+    ctrl_inst : entity work.tdc_ctrl
+    generic map (
+        g_channels       => 64,
+        g_sat_duration   => g_sat_duration,
+        g_win_bits       => 16,
+        g_match_lookback => g_match_lookback,
+        g_match_width    => g_match_width
+    )
+    port map (
+        clk0          => clk0,
+        reset         => reset,
+        ch_enable     => ctrl_ch_enable_s,
+        ch_sat        => ctrl_ch_sat_s,
+        ch_prescale   => ctrl_ch_prescale_s,
+        ch_limit      => ctrl_ch_limit_s,
+        limit_tick    => ctrl_limit_tick_s,
+        match_lookback => ctrl_match_lookback_s,
+        match_width   => ctrl_match_width_s,
+        s_axi_aclk    => s_axi_ctrl_aclk,
+        s_axi_aresetn => s_axi_ctrl_aresetn,
+        s_axi_awaddr  => s_axi_ctrl_awaddr,
+        s_axi_awvalid => s_axi_ctrl_awvalid,
+        s_axi_awready => s_axi_ctrl_awready,
+        s_axi_wdata   => s_axi_ctrl_wdata,
+        s_axi_wstrb   => s_axi_ctrl_wstrb,
+        s_axi_wvalid  => s_axi_ctrl_wvalid,
+        s_axi_wready  => s_axi_ctrl_wready,
+        s_axi_bresp   => s_axi_ctrl_bresp,
+        s_axi_bvalid  => s_axi_ctrl_bvalid,
+        s_axi_bready  => s_axi_ctrl_bready,
+        s_axi_araddr  => s_axi_ctrl_araddr,
+        s_axi_arvalid => s_axi_ctrl_arvalid,
+        s_axi_arready => s_axi_ctrl_arready,
+        s_axi_rdata   => s_axi_ctrl_rdata,
+        s_axi_rresp   => s_axi_ctrl_rresp,
+        s_axi_rvalid  => s_axi_ctrl_rvalid,
+        s_axi_rready  => s_axi_ctrl_rready
+    );
+
+    -- Overwrite flag and fill level of the BRAM being written, for the statistics block
+    stats_overwrite_s <= ovf1 when which_bram_s = "01" else ovf2;
+    stats_fill_s      <= c_bram_words when stats_overwrite_s = '1' else
+                         to_integer(addr1(15 downto 0)) when which_bram_s = "01" else
+                         to_integer(addr2(15 downto 0));
+
     --! \brief Register signals to enable level detection
-    --! \details Register the reset, PS read busy, trigger, and top level arbiter valid and data signals.
+    --! \details Register the reset, PS read busy and trigger signals.
     --! By registering them, we can track changes in the state which are then used to control the FSM that handles BRAM writes
     p_register : process(all)
     begin
@@ -360,16 +602,26 @@ begin
         end if;
     end process p_register;
 
-    -- Wire the selected BRAM ID to output 
-    which_bram <= std_logic_vector(which_bram_s);
+    -- Wire the selected BRAM ID and the status of the BRAM handed off to the PS to output 
+    which_bram  <= std_logic_vector(which_bram_s);
+    bram_status <= bram_status_s;
+    missed_trigs <= missed_trigs_s;
 
     --! \brief Handle BRAM writing and trigger interface
     --! \details The module continually reads out hits from the 64 TDC channels and writes them to one of two DPBRAM blocks.
     --! Upon trigger arrival, the current BRAM is disabled and the second BRAM is enabled and the module begins writing hits to it.
     --! Simultaneously, the module sends an interrupt to the PS as well as the ID of the BRAM being written to currently. The PS
     --! then asserts a busy flag and fully reads out the original BRAM, deasserting the busy flag when finished. If another trigger
-    --! arrives during the PS readout, this module increments an internal counter to keep track of missed triggers. Because there are 
-    --! two BRAMs available for writing, there is zero readout deadtime. 
+    --! arrives before the PS readout of the previous one has finished (i.e. outside of `s_idle`), this module increments a counter 
+    --! of missed triggers. Hits are written to the other BRAM meanwhile, so none are lost, but triggers are until the readout ends.
+    --! The number of words written to the BRAM being handed off (and whether its address wrapped around) is latched into 
+    --! `bram_status` once the BRAMs have switched, before the interrupt is raised, so that the PS only reads out the filled part of the BRAM.
+    --! The missed trigger count is latched into `missed_trigs` at the same time: the counter runs in the clk0 domain while the PS samples
+    --! it through an AXI GPIO, so it is only exported while it is guaranteed not to change. The difference between the values read for two
+    --! consecutive interrupts is the number of triggers missed in between.
+    --! In trigger matching mode, the BRAM being written only receives the hits of the trigger window, during `s_match`, and the
+    --! BRAMs are switched once the \ref trigger_match.vhd "`trigger_match`" block is done with them.
+    --! Every step of the handshake is pulsed to the statistics block (`hs_*_s`), which timestamps it.
     p_handle_BRAM_rw : process(all)
     begin
         if rising_edge(clk0) then 
@@ -383,20 +635,38 @@ begin
                 BRAM_2_we_b  <= (others => '0');
                 BRAM_1_en_b  <= '0';
                 BRAM_2_en_b  <= '0';
+                BRAM_1_addr_b <= (others => '0');
+                BRAM_2_addr_b <= (others => '0');
                 --addr <= (others => '0');
                 addr1 <= (others => '0');
                 addr2 <= (others => '0');
+                ovf1  <= '0';
+                ovf2  <= '0';
+                bram_status_s <= (others => '0');
+                missed_count  <= (others => '0');
+                missed_trigs_s <= (others => '0');
                 -- Clear PL -> PS interrupt flag
                 irq_o <= '0';
+                match_start_s <= '0';
+                hs_trig_s     <= '0';
+                hs_irq_s      <= '0';
+                hs_busy_set_s <= '0';
+                hs_busy_clr_s <= '0';
             else
+                match_start_s <= '0';
+                hs_trig_s     <= '0';
+                hs_irq_s      <= '0';
+                hs_busy_set_s <= '0';
+                hs_busy_clr_s <= '0';
                 if which_bram_s = "01" then 
                     -- Tie TDC data to the selected BRAM at all times
-                    BRAM_1_wrdata_b <= tdc_data_dummy & tdc64ch_data_s;
+                    BRAM_1_wrdata_b <= tdc_data_dummy & wr_data_s;
                     BRAM_2_wrdata_b <= (others => '0');
                     -- Writing to BRAM 1 whenever valid data rxd
-                    --BRAM_1_we_b <= (others => tdc64ch_valid_s);
-                    if (tdc64ch_valid_s_last = '0') and (tdc64ch_valid_s = '1') then
-                        BRAM_1_we_b <= (others => '1');
+                    --BRAM_1_we_b <= (others => wr_valid_s);
+                    if (wr_valid_s = '1') then
+                        BRAM_1_we_b   <= (others => '1');
+                        BRAM_1_addr_b <= std_logic_vector(shift_left(addr1,3));
                     else 
                         BRAM_1_we_b <= (others => '0');
                     end if;
@@ -405,30 +675,33 @@ begin
                     BRAM_2_en_b <= '0';
                 elsif which_bram_s = "10" then 
                     BRAM_1_wrdata_b <= (others => '0');
-                    BRAM_2_wrdata_b <= tdc_data_dummy & tdc64ch_data_s;
+                    BRAM_2_wrdata_b <= tdc_data_dummy & wr_data_s;
                     BRAM_1_we_b <= (others => '0');
-                    if (tdc64ch_valid_s_last = '0') and (tdc64ch_valid_s = '1') then
-                        BRAM_2_we_b <= (others => '1');
+                    if (wr_valid_s = '1') then
+                        BRAM_2_we_b   <= (others => '1');
+                        BRAM_2_addr_b <= std_logic_vector(shift_left(addr2,3));
                     else 
                         BRAM_2_we_b <= (others => '0');
                     end if;
-                    --BRAM_2_we_b <= (others => tdc64ch_valid_s);
+                    --BRAM_2_we_b <= (others => wr_valid_s);
                     BRAM_1_en_b <= '0';
                     BRAM_2_en_b <= '1';
                 end if;
-                -- When data arrives, increment address at all times
-                if (tdc64ch_valid_s_last = '0') and (tdc64ch_valid_s = '1') then 
+                -- When data arrives, increment address at all times (at most one hit per clock cycle)
+                if (wr_valid_s = '1') then 
                     --addr <= addr + 1;
                     case which_bram_s is
                         when "01" =>
-                            if addr1 = "00000000000000000001111101000000" then  -- 8000, just hard code it for now...
+                            if addr1 = c_bram_words-1 then  -- BRAM full, wrap around and overwrite the oldest hits
                                 addr1 <= (others => '0');
+                                ovf1  <= '1';
                             else
                                 addr1 <= addr1 + 1;
                             end if;
                         when "10" =>
-                            if addr2 = "00000000000000000001111101000000" then
+                            if addr2 = c_bram_words-1 then
                                 addr2 <= (others => '0');
+                                ovf2  <= '1';
                             else
                                 addr2 <= addr2 + 1;
                             end if;
@@ -445,7 +718,12 @@ begin
                         BRAM_2_rst_b <= '0';
                         --  If the trigger has been fired and the BRAM is *not* busy being read by PS, switch the BRAM that's being written to
                         if (trigger = '1') and (trig_last = '0') then 
-                            if (rd_busy = '0') then 
+                            hs_trig_s <= not rd_busy;   -- Accepted below
+                            if (rd_busy = '0') and g_match_enable then
+                                -- In trigger matching mode, first write the hits of the trigger window to the active BRAM
+                                match_start_s <= '1';
+                                state <= s_match;
+                            elsif (rd_busy = '0') then 
                                 -- If PS is not busy reading, then we can switch BRAMs and initiate read transaction
                                 case which_bram_s is 
                                     when "01" =>    -- BRAM 1 is currently being written to - move write ptr to BRAM 2, and let PS know
@@ -460,28 +738,78 @@ begin
                                 state <= s_trigd; -- Send out interrupt request to PS
                             else 
                                 -- Otherwise, if PS is busy reading, report that we missed one trigger
-                                missed_trigs <= missed_trigs + 1;
+                                missed_count <= missed_count + 1;
                             end if;
                         end if;
+                    when s_match =>                 -- Trigger received, writing the hits of its window to the active BRAM
+                        if (trigger = '1') and (trig_last = '0') then
+                            missed_count <= missed_count + 1;
+                        end if;
+                        if (match_done_s = '1') then    -- Window complete: hand the BRAM off to the PS as in the normal mode
+                            case which_bram_s is 
+                                when "01" =>
+                                    which_bram_s <= "10";
+                                    BRAM_2_en_b  <= '1';
+                                when "10" =>
+                                    which_bram_s <= "01";
+                                    BRAM_1_en_b  <= '1';
+                                when others => 
+                                    NULL;
+                            end case;
+                            state <= s_trigd;
+                        end if;
                     when s_trigd =>                 -- Trigger received, BRAMs have switched, let PS know and await busy flag.
                         irq_o <= '1';               -- Send out interrupt to PS
+                        if (trigger = '1') and (trig_last = '0') then  -- No BRAM to switch to until the PS has read out the last one
+                            missed_count <= missed_count + 1;
+                        end if;
+                        -- The BRAM handed off to the PS is no longer written to, so its address is frozen. Latch its fill count 
+                        -- (all words if it wrapped around) and overflow flag for the PS.
+                        case which_bram_s is 
+                            when "01" =>    -- BRAM 2 was handed off
+                                bram_status_s <= (others => '0');
+                                bram_status_s(31) <= ovf2;
+                                if ovf2 = '1' then 
+                                    bram_status_s(15 downto 0) <= std_logic_vector(to_unsigned(c_bram_words, 16));
+                                else
+                                    bram_status_s(15 downto 0) <= std_logic_vector(addr2(15 downto 0));
+                                end if;
+                            when "10" =>    -- BRAM 1 was handed off
+                                bram_status_s <= (others => '0');
+                                bram_status_s(31) <= ovf1;
+                                if ovf1 = '1' then 
+                                    bram_status_s(15 downto 0) <= std_logic_vector(to_unsigned(c_bram_words, 16));
+                                else
+                                    bram_status_s(15 downto 0) <= std_logic_vector(addr1(15 downto 0));
+                                end if;
+                            when others => 
+                                NULL;
+                        end case;
+                        if (irq_o = '0') then       -- First cycle in s_trigd: latch the triggers missed up to this one
+                            missed_trigs_s <= std_logic_vector(missed_count);
+                            hs_irq_s <= '1';
+                        end if;
                         if (busy_last = '1') then   -- Wait for async PS ready busy signal to arrive before moving to next state
                             irq_o <= '0';           -- Drop interrupt flag (since it will be edge-triggered)
+                            hs_busy_set_s <= '1';
                             state <= s_busy;
                         end if;
                     when s_busy =>  
-                        if (trigger = '1') then
-                            missed_trigs <= missed_trigs + 1;
+                        if (trigger = '1') and (trig_last = '0') then   -- Count trigger edges, not clock cycles with the trigger high
+                            missed_count <= missed_count + 1;
                         end if;
                         if (busy_last = '0') then       -- Wait for async PS read busy to go low
+                            hs_busy_clr_s <= '1';
                             --addr <= (others => '0');    -- Reset address
                             case which_bram_s is 
                                 when "01" =>    -- BRAM 1 is being written to, so clear BRAM 2 (it was just read out)
                                     BRAM_2_rst_b <= '1';
                                     addr2 <= (others => '0');
+                                    ovf2  <= '0';
                                 when "10" =>    -- BRAM 2 is being written to, so clear BRAM 1 (it was just read out)
                                     BRAM_1_rst_b <= '1';
                                     addr1 <= (others => '0');
+                                    ovf1  <= '0';
                                 when others => 
                                     NULL;
                             end case;
@@ -494,9 +822,8 @@ begin
         end if;
     end process p_handle_BRAM_rw;
 
-    -- Handle byte -> word addressing for both BRAMs
-    BRAM_1_addr_b <= std_logic_vector(shift_left(addr1,3));
-    BRAM_2_addr_b <= std_logic_vector(shift_left(addr2,3));
+    -- Byte -> word addressing for both BRAMs is handled in p_handle_BRAM_rw, where the address is registered 
+    -- together with the write enable so that the first hit after a readout lands in word 0.
     -- Send BRAM clocks straight through
     BRAM_1_clk_b <= clk0;
     BRAM_2_clk_b <= clk0;
@@ -0,0 +1,420 @@
+----------------------------------------------------------------------------------
+--! \file TDC_64ch_DMA.vhd
+--! \brief 64-channel TDC block that streams its hits to the PS DDR over AXI-Stream.
+--! \details A 64-channel TDC module that connects four groups of \ref TDC_4ch.vhd "`TDC_4ch`" modules to 4:1 arbiters,
+--! whose outputs are then connected to intermediate hit storage buffers before being read out by a top level arbiter.
+--! This is the same hit path as \ref TDC_64ch_2BRAM.vhd "`TDC_64ch`", but instead of writing to one of two BRAMs the
+--! top level arbiter output is sent out on an AXI-Stream master, which is moved into a ring of DDR buffers by an AXI DMA 
+--! in the block design. Each trigger closes the current event by appending a trailer word and asserting TLAST, so every
+--! DMA packet holds the hits collected since the previous trigger. There is no per-trigger PS handshake and no limit 
+--! on the number of hits per trigger other than the size of the DMA buffers. A block diagram of the setup is given below:
+--!
+--! \verbatim
+--!           layer 1                 layer 2            layer 3 (top)
+--!  |----------------------||-----------------------||-----------------|
+--!
+--!   4x TDC_4ch -> buffer -|
+--!   4x TDC_4ch -> buffer -|\___arbiter --> buffer___
+--!   4x TDC_4ch -> buffer -|/                        \
+--!   4x TDC_4ch -> buffer -|                          |
+--!                                                    |
+--!   4x TDC_4ch -> buffer -|                          |
+--!   4x TDC_4ch -> buffer -|\___arbiter --> buffer____|
+--!   4x TDC_4ch -> buffer -|/                         | 
+--!   4x TDC_4ch -> buffer -|                          |
+--!                                                    |--> arbiter --> AXI-Stream
+--!   4x TDC_4ch -> buffer -|                          |
+--!   4x TDC_4ch -> buffer -|\___arbiter --> buffer____|
+--!   4x TDC_4ch -> buffer -|/                         |
+--!   4x TDC_4ch -> buffer -|                          |
+--!                                                    |
+--!   4x TDC_4ch -> buffer -|                          |
+--!   4x TDC_4ch -> buffer -|\___arbiter --> buffer____/
+--!   4x TDC_4ch -> buffer -|/                           
+--!   4x TDC_4ch -> buffer -|           
+--! \endverbatim
+--!
+--! The trailer word closing every event has the following layout:
+--!
+--! \verbatim
+--!   [63:56]  0x5A marker (hit words always have these bits set to 1, see `tdc_data_dummy`)
+--!   [55:32]  number of hits dropped in this event because the stream was back-pressured (saturates)
+--!   [31:0]   trigger number (first trigger is 1)
+--! \endverbatim
+--! 
+--! Since this module makes use of VHDL 2008 (unconstrained SLV arrays), it must be wrapped by 
+--! a VHDL 1993 module, in this case the \ref top_DMA.vhd "`top_64ch_DMA`" module.
+--! \author Amitav Mitra, amitra3@jhu.edu
+-- ###########################################################################
+-- Top-level TDC design for the 64-channel AXI-Stream/DMA implementation
+--
+----------------------------------------------------------------------------------
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+use work.common_types.all;
+
+--! \brief 64-channel TDC block that streams its hits to the PS DDR over AXI-Stream.
+--! \details Hits from the top level arbiter are sent out on `m_axis` as 64-bit words (same format as the BRAM words of
+--! the 2 BRAM design). On every trigger a trailer word with TLAST set is inserted into the stream to close the event.
+--! The stream cannot stall the TDC channels, so a hit arriving while the previous beat is still waiting for TREADY is 
+--! dropped and counted in the trailer of the current event.
+entity TDC_64ch_DMA is 
+    generic (
+        g_chID_start   : natural := 0;  --! Channel ID of the first TDC channel in the group of 64. Should normally always be 0, so this generic is kind of pointless.
+        g_coarse_bits  : natural := 28; --! Number of bits in the \ref CoarseCounter.vhd "coarse counter"
+        g_sat_duration : natural := 3;  --! Minimum duration (in clk0 periods) that hit must remain high to be considered valid
+        g_pipe_depth   : natural := 5;  --! Max number of hits stored in pipeline
+        g_fast_rearm   : boolean := false;          --! Encoders send hits out once they qualify and re-arm after one low clk0 period (see \ref encoder.vhd "encoder"; off until tb_channel_deadtime has been run)
+        g_arb_tree     : boolean := false;          --! Serialize the hits with the \ref arbiter_tree.vhd "arbiter tree" of `rr_arbiter`s instead of the hand-wired tree of `rr_arbiter_41`s (not simulated yet, off by default)
+        g_arb_fanin    : IntArray := (4, 4);        --! Fan-in of every layer of the arbiter tree reading out the 16 `TDC_4ch` buffers (`g_arb_tree` only)
+        g_arb_depth    : IntArray := (0 => 128);    --! Depth of the hit buffers written by every layer of the arbiter tree but the top one (`g_arb_tree` only)
+        g_arb_req_stages : natural := 0;            --! Register stages on the request vector of every arbiter in the tree (`g_arb_tree` only)
+        g_arb_out_stages : natural := 0             --! Register stages on the output of every arbiter in the tree
+    );
+    port (
+        -- TDC and system clocks sent to all channels
+        clk0    : in std_logic; --! 0 degree (212.4 MHz, 4x RF) clock, also clocks the AXI-Stream output
+        clk45   : in std_logic; --! 45 degree clock
+        clk90   : in std_logic; --! 90 degree clock
+        clk135  : in std_logic; --! 135 degree clock
+        clk_sys : in std_logic; --! RF clock (53.1 MHz)
+        -- Control
+        reset   : in std_logic; --! Active high reset
+        enable  : in std_logic; --! Active high enable
+        -- Data input from detector
+        hits    : in std_logic_vector(0 to 63); --! 64 discriminator front-end hits
+        trigger : in std_logic;                 --! External trigger signal
+        ---------------------------------------------
+        -- DEBUG ILA
+        ---------------------------------------------
+        DEBUG_data  : out std_logic_vector(g_coarse_bits+10 downto 0);  --! Exposing the top level arbiter data for ILA debug
+        DEBUG_valid : out std_logic;                                    --! Exposing the top level arbiter valid signal for ILA debug
+        DEBUG_grant : out std_logic_vector(3 downto 0);                 --! Exposing the top level read enable signal from arbiter to ring buffers for ILA debug
+        ---------------------------------------------
+        -- AXI-Stream output to the DMA (clk0 domain)
+        ---------------------------------------------
+        m_axis_tdata  : out std_logic_vector(63 downto 0);  --! Hit word, or trailer word when `m_axis_tlast` is set
+        m_axis_tvalid : out std_logic;                      --! Beat valid
+        m_axis_tready : in std_logic;                       --! Downstream (clock crossing FIFO) ready
+        m_axis_tlast  : out std_logic                       --! Last beat of an event (trailer word)
+    );
+end TDC_64ch_DMA;
+
+architecture RTL of TDC_64ch_DMA is 
+
+    -- Preserve architecture
+    attribute keep_hierarchy : string;
+    attribute keep_hierarchy of RTL : architecture is "true";
+    attribute keep : string;
+    attribute dont_touch : string;
+    
+    -------------------------------------------------
+    -- Low-level TDC channel signals.
+    -- Naming conventions:
+    --      layer_from_to_purpose_s
+    -------------------------------------------------
+    -- Layer 1: 16x TDC_4ch modules -> ring buffers -> arbiter
+    signal layer1_tdc_buf_data_s      : SlvArray(0 to 15)(g_coarse_bits+10 downto 0);   --! TDC_4ch data to L1 ring buffers
+    signal layer1_tdc_buf_valid_s     : std_logic_vector(0 to 15);                      --! TDC_4ch data valid to L1 ring buffers
+    signal layer1_arb_buf_ren_s       : std_logic_vector(0 to 15);                      --! L1 arbiter read enable to L1 buffers
+    signal layer1_buf_arb_rvalid_s    : std_logic_vector(0 to 15);                      --! L1 buffer readout valid signal to L1 arbiter
+    signal layer1_buf_arb_data_s      : SlvArray(0 to 15)(g_coarse_bits+10 downto 0);   --! L1 buffer readout data to L1 arbiter 
+    signal layer1_buf_arb_empty_s     : std_logic_vector(0 to 15);                      --! L1 buffer empty signal to L1 arbiter
+    signal layer1_buf_arb_emptyNext_s : std_logic_vector(0 to 15);                      --! L1 buffer empty next signal to the arbiter tree (`g_arb_tree` only)
+    signal layer1_buf_arb_full_s      : std_logic_vector(0 to 15);                      --! UNUSED
+    signal layer1_buf_arb_fullNext_s  : std_logic_vector(0 to 15);                      --! UNUSED
+    signal layer1_buf_arb_fillCount_s : IntArray(0 to 15);                              --! UNUSED
+    -- Layers 2 and 3 (hand-wired or arbiter tree)
+    signal arb_top_grant_s : std_logic_vector(0 to sel(g_arb_tree, arbTreeTopInputs(16, g_arb_fanin, 0), 4)-1); --! Top level arbiter read enable to the buffers below it
+
+    ------------------------------------------------------------------------
+    -- Top-level data signals
+    ------------------------------------------------------------------------
+    signal tdc64ch_valid_s : std_logic;                                                             --! Top level arbiter valid data signal
+    signal tdc64ch_valid_s_last : std_logic;                                                        --! Registered data valid signal
+    signal tdc64ch_wr_s    : std_logic;                                                             --! One pulse per hit out of the top level arbiter
+    signal tdc64ch_data_s  : std_logic_vector(g_coarse_bits+10 downto 0);                           --! Top level arbiter data to the stream
+    signal tdc_data_dummy : std_logic_vector(62-(g_coarse_bits+10) downto 0) := (others => '1');    --! Dummy bits to append to `tdc64ch_data_s` to reach 64 bits (to comply with AXI standard)
+
+    attribute keep of tdc_data_dummy : signal is "true";
+    attribute dont_touch of tdc_data_dummy : signal is "true";
+    
+    -- reduce fanout
+    signal reset_s : std_logic;                         --! Register the reset signal 
+    attribute max_fanout : integer;                     --! Limit the fanout for a given signal or net
+    attribute max_fanout of reset_s  : signal is 55;    --! Limit the fanout of the registered reset signal to meet timing
+    
+    signal trig_last  : std_logic;                                      --! Register the trigger signal 
+    signal trig_count : unsigned(31 downto 0) := (others => '0');       --! Number of triggers received since reset
+    signal trailer_pending : std_logic := '0';                          --! A trigger arrived and its trailer word has not been sent yet
+    signal dropped : unsigned(23 downto 0) := (others => '0');          --! Hits dropped in the current event (stream back-pressured)
+
+    -- AXI-Stream output register
+    signal axis_tdata_s  : std_logic_vector(63 downto 0) := (others => '0');
+    signal axis_tvalid_s : std_logic := '0';
+    signal axis_tlast_s  : std_logic := '0';
+
+    constant c_trailer_marker : std_logic_vector(7 downto 0) := x"5A";  --! Upper byte of the trailer word
+
+begin
+
+    -- Expose top level arbiter outputs for ILA debug  
+    DEBUG_data  <= tdc64ch_data_s;
+    DEBUG_valid <= tdc64ch_valid_s;
+    DEBUG_grant <= std_logic_vector(resize(unsigned(arb_top_grant_s), DEBUG_grant'length));
+
+    -- The channel IDs obey the following algorithm:
+    -- ---------------------------------------------------------------
+    -- channels    | ch  | calculation          | TDC_4c g_chID_start
+    -- ---------------------------------------------------------------
+    -- 0  1  2  3  |  0  | g_chID_start + (4*0) = 0    \
+    -- 4  5  6  7  |  1  | g_chID_start + (4*1) = 4     \___________ 16 channels starting with g_chID_start => 0
+    -- 8  9  10 11 |  2  | g_chID_start + (4*2) = 8     /
+    -- 12 13 14 15 |  3  | g_chID_start + (4*3) = 12   /
+    --
+    -- 16 17 18 19 |  4  | g_chID_start + (4*4) = 16  \
+    -- 20 21 22 23 |  5  | g_chID_start + (4*5) = 20   \___________ 16 channels starting with g_chID_start => 16
+    -- 24 25 26 27 |  6  | g_chID_start + (4*6) = 24   /
+    -- 28 29 30 31 |  7  | g_chID_start + (4*7) = 28  /
+    --
+    -- 32 33 34 35 |  8  | g_chID_start + (4*8) = 32  \
+    -- 36 37 38 39 |  9  | g_chID_start + (4*9) = 36   \___________ 16 channels starting with g_chID_start => 0
+    -- 40 41 42 43 | 10  | g_chID_start + (4*10) = 40  /
+    -- 44 45 46 47 | 11  | g_chID_start + (4*11) = 44 /
+    --
+    -- 48 49 50 51 | 12  | g_chID_start + (4*12) = 48 \
+    -- 52 53 54 55 | 13  | g_chID_start + (4*13) = 52  \___________ 16 channels starting with g_chID_start => 16
+    -- 56 57 58 59 | 14  | g_chID_start + (4*14) = 56  /
+    -- 60 61 62 63 | 15  | g_chID_start + (4*15) = 60  /
+    --
+    -- The below loop generates the first value in each row. The TDC_4ch modules 
+    -- have their own generate loop that loops again: ch->ch+3 
+    -------------------------------------------------------------------------------------------------------------
+
+    -- Connect the 16 TDC_4ch modules to ring buffers
+    layer1 : for ch in 0 to 15 generate
+    begin 
+        --! First generate 16 `TDC_4ch` modules
+        TDC4ch_inst : entity work.TDC_4ch
+        generic map (
+            g_chID_start   => g_chID_start + (4 * ch),
+            g_coarse_bits  => g_coarse_bits,
+            g_sat_duration => g_sat_duration,
+            g_pipe_depth   => 16, -- (4ch) * (4hits / channel) = 16 hits max. Adjustable
+            g_fast_rearm   => g_fast_rearm,
+            g_arb_tree     => g_arb_tree
+        )
+        port map (
+            clk0      => clk0,
+            clk45     => clk45,
+            clk90     => clk90,
+            clk135    => clk135,
+            clk_sys   => clk_sys,
+            reset     => reset,
+            enable    => enable, 
+            hit       => hits( (4*ch) to (4*ch+3) ),
+            valid_o   => layer1_tdc_buf_valid_s(ch),
+            data_o    => layer1_tdc_buf_data_s(ch)
+        );
+        --! Connect the 16 `TDC_4ch` modules to their hit buffers
+        TDC4ch_buf_inst : entity work.ring_buffer
+        generic map (
+            RAM_WIDTH => g_coarse_bits + 11, -- (N coarse bits) + (6 bit chID) + (5 bit fine)
+            RAM_DEPTH => 16
+        )
+        port map (
+            clk             => clk0,
+            rst             => reset, 
+            wr_en           => layer1_tdc_buf_valid_s(ch), -- Valid signals from TDC channels
+            wr_data         => layer1_tdc_buf_data_s(ch),  -- Data word from TDC channels 
+            rd_en           => layer1_arb_buf_ren_s(ch),   -- Read enable from arbiter to buffer
+            rd_valid        => layer1_buf_arb_rvalid_s(ch),-- Read valid from buffer to arbiter
+            rd_data         => layer1_buf_arb_data_s(ch),  -- Data from buffer to arbiter
+            -- FOLLOWING ARE UNUSED FOR NOW
+            empty           => layer1_buf_arb_empty_s(ch),
+            empty_next      => layer1_buf_arb_emptyNext_s(ch), -- Last word signal to the arbiter tree
+            full            => layer1_buf_arb_full_s(ch),
+            full_next       => layer1_buf_arb_fullNext_s(ch),
+            fill_count      => layer1_buf_arb_fillCount_s(ch)
+        );
+    end generate layer1;
+
+    --! \brief Serialize the 16 layer 1 buffers into the top level output
+    --! \details Four 4:1 layer 2 arbiters write to 128 hit buffers, read out by the top level (layer 3) 4:1 arbiter, as in the
+    --! diagram above: by default wired by hand from \ref rr_arbiter_41.vhd "`rr_arbiter_41`"s, with `g_arb_tree` generated by the
+    --! \ref arbiter_tree.vhd "arbiter tree", whose shape is then set by `g_arb_fanin` and `g_arb_depth`. The arbiter tree has
+    --! not been simulated yet (see tb_2BRAM_throughput), so it stays off by default.
+    g_tree : if g_arb_tree generate
+        arb_tree : entity work.arbiter_tree
+        generic map (
+            DWIDTH       => g_coarse_bits + 11,
+            g_inputs     => 16,
+            g_fanin      => g_arb_fanin,
+            g_depth      => g_arb_depth,
+            g_req_stages => g_arb_req_stages,
+            g_out_stages => g_arb_out_stages
+        )
+        port map (
+            clk         => clk0,
+            rst         => reset,
+            -- Connect to the layer 1 buffers
+            empty_in    => layer1_buf_arb_empty_s,
+            valid_in    => layer1_buf_arb_rvalid_s,
+            data_in     => layer1_buf_arb_data_s,
+            empty_next_in => layer1_buf_arb_emptyNext_s,
+            enable_out  => layer1_arb_buf_ren_s,
+            data_out    => tdc64ch_data_s,  -- final top level output
+            valid_out   => tdc64ch_valid_s, -- final top level output
+            top_grant   => arb_top_grant_s
+        );
+    else generate
+        signal layer2_arb_buf_data_s  : SlvArray(0 to 3)(g_coarse_bits+10 downto 0);    --! L2 arbiter data to L2 buffers
+        signal layer2_arb_buf_valid_s : std_logic_vector(0 to 3);                       --! L2 arbiter valid signal to L2 buffers
+        signal layer3_buf_arb_rvalid_s : std_logic_vector(0 to 3);                      --! L2 buffer readout valid signal to L3 arbiter
+        signal layer3_buf_arb_data_s  : SlvArray(0 to 3)(g_coarse_bits+10 downto 0);    --! L2 buffer readout data to L3 arbiter
+        signal layer3_buf_arb_empty_s : std_logic_vector(0 to 3);                       --! L2 buffer empty signal to L3 arbiter
+        signal layer3_buf_arb_emptyNext_s : std_logic_vector(0 to 3);                   --! UNUSED
+        signal layer3_buf_arb_fullNext_s  : std_logic_vector(0 to 3);                   --! UNUSED
+        signal layer2_buf_full_s : std_logic_vector(0 to 3);                            --! UNUSED
+        signal layer2_buf_fill_s : IntArray(0 to 3);                                    --! UNUSED
+    begin
+        -- Connect the 16 ring buffers to four 4:1 arbiters and buffers
+        layer2 : for idx in 0 to 3 generate
+        -- Algorithm:
+        --      idx      |    connections
+        --  ----------------------------------
+        --      0        |    [4 * idx : (4 * idx) + 3] = [0:3]
+        --      1        |    [4 * idx : (4 * idx) + 3] = [4:7]
+        --      2        |    [4 * idx : (4 * idx) + 3] = [8:11]
+        --      3        |    [4 * idx : (4 * idx) + 3] = [12:15]
+        begin
+            --! Connect layer 1 buffers to layer 2 arbiters
+            L2_arb_inst : entity work.rr_arbiter_41
+            generic map (
+                DWIDTH => g_coarse_bits + 11
+            )
+            port map (
+                clk         => clk0,
+                rst         => reset,
+                -- Connect to the layer 1 buffers
+                empty_in    => layer1_buf_arb_empty_s( (4*idx) to (4*idx+3) ),
+                valid_in    => layer1_buf_arb_rvalid_s( (4*idx) to (4*idx+3) ),
+                data_in     => layer1_buf_arb_data_s((4*idx) to (4*idx+3) ),
+                enable_out  => layer1_arb_buf_ren_s( (4*idx) to (4*idx+3) ),
+                -- Connect to the layer 2 buffers
+                data_out    => layer2_arb_buf_data_s(idx),
+                valid_out   => layer2_arb_buf_valid_s(idx)
+            );
+            --! Connect layer 2 arbiters to layer 2 buffers
+            L2_buf_inst : entity work.ring_buffer
+            generic map (
+                RAM_WIDTH => g_coarse_bits + 11,
+                RAM_DEPTH => 128
+            )
+            port map (
+                clk             => clk0,
+                rst             => reset,
+                wr_en           => layer2_arb_buf_valid_s(idx),
+                wr_data         => layer2_arb_buf_data_s(idx),
+                rd_en           => arb_top_grant_s(idx),
+                rd_valid        => layer3_buf_arb_rvalid_s(idx),
+                rd_data         => layer3_buf_arb_data_s(idx),
+                empty           => layer3_buf_arb_empty_s(idx),
+                full            => layer2_buf_full_s(idx),       -- unused
+                fill_count      => layer2_buf_fill_s(idx),       -- unused
+                -- FOLLOWING ARE UNUSED FOR NOW
+                empty_next      => layer3_buf_arb_emptyNext_s(idx),
+                full_next       => layer3_buf_arb_fullNext_s(idx)
+            );
+        end generate layer2;
+
+        --! Connect the layer 2 buffers to the final (layer 3) arbiter
+        layer3_arbiter : entity work.rr_arbiter_41
+        generic map ( DWIDTH => g_coarse_bits + 11 )
+        port map (
+            clk         => clk0,
+            rst         => reset,
+            empty_in    => layer3_buf_arb_empty_s,
+            valid_in    => layer3_buf_arb_rvalid_s,
+            data_in     => layer3_buf_arb_data_s,
+            enable_out  => arb_top_grant_s,
+            data_out    => tdc64ch_data_s,  -- final top level output
+            valid_out   => tdc64ch_valid_s  -- final top level output
+        );
+    end generate g_tree;
+
+    --! \brief One write strobe per hit out of the top level arbiter
+    --! \details The \ref rr_arbiter_41.vhd "`rr_arbiter_41`" of the hand-wired tree holds its valid flag high for two or more
+    --! cycles per hit, so a hit is written on the rising edge of the flag. The arbiter tree raises the flag for exactly one
+    --! cycle per hit, and can do so on consecutive cycles, so with `g_arb_tree` every valid cycle is a hit.
+    tdc64ch_wr_s <= tdc64ch_valid_s when g_arb_tree else tdc64ch_valid_s and not tdc64ch_valid_s_last;
+
+    --! \brief Register signals to enable level detection
+    --! \details Register the reset and trigger signals. By registering them, we can 
+    --! track changes in the state which are then used to control the stream output
+    p_register : process(all)
+    begin
+        if rising_edge(clk0) then
+            reset_s   <= reset;
+            trig_last <= trigger;
+            tdc64ch_valid_s_last <= tdc64ch_valid_s;
+        end if;
+    end process p_register;
+
+    m_axis_tdata  <= axis_tdata_s;
+    m_axis_tvalid <= axis_tvalid_s;
+    m_axis_tlast  <= axis_tlast_s;
+
+    --! \brief Send hits and event trailers out on the AXI-Stream master
+    --! \details Every new hit from the top level arbiter is placed in the output register. On a trigger, a trailer word
+    --! carrying the trigger number and the number of dropped hits is sent with TLAST set as soon as the output register 
+    --! is free and no hit is being sent in the same cycle. With `g_arb_tree` the arbiter can send a hit on every clock cycle, so
+    --! during a burst the trailer waits for the first cycle without a hit and the event also takes the hits still queued in the
+    --! arbiter tree; the hand-wired tree leaves at least one free cycle between hits.
+    --! A hit arriving while the output register still holds a beat that has not been accepted is dropped and counted.
+    p_stream : process(all)
+        variable slot_free : boolean;
+    begin
+        if rising_edge(clk0) then 
+            if (reset_s = '1') then 
+                axis_tvalid_s   <= '0';
+                axis_tlast_s    <= '0';
+                trailer_pending <= '0';
+                trig_count      <= (others => '0');
+                dropped         <= (others => '0');
+            else
+                -- Output register can be loaded if it is empty or its beat is accepted this cycle
+                slot_free := (axis_tvalid_s = '0') or (m_axis_tready = '1');
+                if (axis_tvalid_s = '1') and (m_axis_tready = '1') then 
+                    axis_tvalid_s <= '0';
+                    axis_tlast_s  <= '0';
+                end if;
+
+                if (tdc64ch_wr_s = '1') then 
+                    if slot_free then 
+                        axis_tdata_s  <= tdc_data_dummy & tdc64ch_data_s;
+                        axis_tvalid_s <= '1';
+                        axis_tlast_s  <= '0';
+                    elsif dropped /= to_unsigned(2**dropped'length - 1, dropped'length) then 
+                        dropped <= dropped + 1;
+                    end if;
+                elsif (trailer_pending = '1') and slot_free then 
+                    axis_tdata_s  <= c_trailer_marker & std_logic_vector(dropped) & std_logic_vector(trig_count);
+                    axis_tvalid_s <= '1';
+                    axis_tlast_s  <= '1';
+                    dropped <= (others => '0');
+                    trailer_pending <= '0';
+                end if;
+
+                -- Triggers arriving before the previous trailer was sent are merged into a single event, the gap in 
+                -- the trigger numbers tells the PS how many were missed
+                if (trigger = '1') and (trig_last = '0') then 
+                    trig_count <= trig_count + 1;
+                    trailer_pending <= '1';
+                end if;
+            end if;
+        end if;
+    end process p_stream;
+
+end RTL;
@@ -0,0 +1,523 @@
+----------------------------------------------------------------------------------
+--! \file TDC_64ch_NBANK.vhd
+--! \brief 64-channel TDC block that writes to one of N BRAM banks, rotating to the next free bank on every trigger.
+--! \details A 64-channel TDC module that connects four groups of \ref TDC_4ch.vhd "`TDC_4ch`" modules to 4:1 arbiters,
+--! whose outputs are then connected to intermediate hit storage buffers before being read out by a top level arbiter.
+--! This is the same hit path as \ref TDC_64ch_2BRAM.vhd "`TDC_64ch`", but instead of alternating between two BRAMs the
+--! top level arbiter writes to one of `g_banks` banks of 1024 words (8 KB) in a single DPBRAM. Upon arrival of an external
+--! trigger the bank being written is queued for readout and writing moves on to the next bank. The PS is interrupted once
+--! for every queued bank, oldest first, and reads it out with the same read busy handshake as the 2 BRAM design. A trigger
+--! is only missed when all the other banks are still queued, so bursts of up to `g_banks`-1 triggers arriving faster than
+--! the PS readout are absorbed without dead time. A block diagram of the setup is given below:
+--!
+--! \verbatim
+--!           layer 1                 layer 2            layer 3 (top)
+--!  |----------------------||-----------------------||-----------------|
+--!
+--!   4x TDC_4ch -> buffer -|
+--!   4x TDC_4ch -> buffer -|\___arbiter --> buffer___
+--!   4x TDC_4ch -> buffer -|/                        \
+--!   4x TDC_4ch -> buffer -|                          |
+--!                                                    |
+--!   4x TDC_4ch -> buffer -|                          |
+--!   4x TDC_4ch -> buffer -|\___arbiter --> buffer____|
+--!   4x TDC_4ch -> buffer -|/                         |
+--!   4x TDC_4ch -> buffer -|                          |
+--!                                                    |--> arbiter --> BRAM bank 0 .. g_banks-1
+--!   4x TDC_4ch -> buffer -|                          |
+--!   4x TDC_4ch -> buffer -|\___arbiter --> buffer____|
+--!   4x TDC_4ch -> buffer -|/                         |
+--!   4x TDC_4ch -> buffer -|                          |
+--!                                                    |
+--!   4x TDC_4ch -> buffer -|                          |
+--!   4x TDC_4ch -> buffer -|\___arbiter --> buffer____/
+--!   4x TDC_4ch -> buffer -|/
+--!   4x TDC_4ch -> buffer -|
+--! \endverbatim
+--!
+--! Bank k occupies words k*1024 to k*1024+1023 of the BRAM, which the PS sees as one contiguous AXI BRAM controller range
+--! of `g_banks` * 8 KB. The status of the bank to be read out is exported on `bank_sel` and `bank_status`:
+--!
+--! \verbatim
+--!   bank_sel    [3:0]   bank to read out
+--!               [7:4]   banks queued for readout when the interrupt was raised, including this one
+--!   bank_status [15:0]  fill count of the bank (words)
+--!               [31]    overflow (the bank wrapped around, all 1024 words are valid)
+--! \endverbatim
+--!
+--! Since this module makes use of VHDL 2008 (unconstrained SLV arrays), it must be wrapped by
+--! a VHDL 1993 module, in this case the \ref top_NBANK.vhd "`top_64ch_NBANK`" module.
+--! \author Amitav Mitra, amitra3@jhu.edu
+-- ###########################################################################
+-- Top-level TDC design for the 64-channel N bank implementation
+--
+----------------------------------------------------------------------------------
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+use work.common_types.all;
+
+--! \brief 64-channel TDC block that writes to one of N BRAM banks, rotating to the next free bank on every trigger.
+--! \details Hits from the top level arbiter are written to the current bank of a single DPBRAM split into `g_banks` banks.
+--! Every trigger hands the current bank off to a queue of banks waiting for readout, provided that the next bank is free,
+--! and the PS reads the queued banks out one interrupt at a time in the order they were filled. The fill count, overflow
+--! flag and missed trigger count of each bank are latched when it is handed off and exported while the PS reads it.
+entity TDC_64ch_NBANK is
+    generic (
+        g_chID_start   : natural := 0;  --! Channel ID of the first TDC channel in the group of 64. Should normally always be 0, so this generic is kind of pointless.
+        g_coarse_bits  : natural := 28; --! Number of bits in the \ref CoarseCounter.vhd "coarse counter"
+        g_sat_duration : natural := 3;  --! Minimum duration (in clk0 periods) that hit must remain high to be considered valid
+        g_pipe_depth   : natural := 5;  --! Max number of hits stored in pipeline
+        g_fast_rearm   : boolean := false;          --! Encoders send hits out once they qualify and re-arm after one low clk0 period (see \ref encoder.vhd "encoder"; off until tb_channel_deadtime has been run)
+        g_arb_tree     : boolean := false;          --! Serialize the hits with the \ref arbiter_tree.vhd "arbiter tree" of `rr_arbiter`s instead of the hand-wired tree of `rr_arbiter_41`s (not simulated yet, off by default)
+        g_arb_fanin    : IntArray := (4, 4);        --! Fan-in of every layer of the arbiter tree reading out the 16 `TDC_4ch` buffers (`g_arb_tree` only)
+        g_arb_depth    : IntArray := (0 => 128);    --! Depth of the hit buffers written by every layer of the arbiter tree but the top one (`g_arb_tree` only)
+        g_arb_req_stages : natural := 0;            --! Register stages on the request vector of every arbiter in the tree (`g_arb_tree` only)
+        g_arb_out_stages : natural := 0;            --! Register stages on the output of every arbiter in the tree
+        g_banks        : natural := 4   --! Number of 1024-word banks in the BRAM (2 to 16). Must match the BRAM size in the block design.
+    );
+    port (
+        -- TDC and system clocks sent to all channels
+        clk0    : in std_logic; --! 0 degree (212.4 MHz, 4x RF) clock
+        clk45   : in std_logic; --! 45 degree clock
+        clk90   : in std_logic; --! 90 degree clock
+        clk135  : in std_logic; --! 135 degree clock
+        clk_sys : in std_logic; --! RF clock (53.1 MHz)
+        -- Control
+        reset   : in std_logic; --! Active high reset
+        enable  : in std_logic; --! Active high enable
+        -- Data input from detector
+        hits    : in std_logic_vector(0 to 63); --! 64 discriminator front-end hits
+        trigger : in std_logic;                 --! External trigger signal
+        -- PL <--> PS communication
+        rd_busy : in std_logic;                             --! [PS -> PL] PS bank read in progress
+        irq_o   : out std_logic;                            --! [PL -> PS] Processor interrupt request, one per queued bank
+        bank_sel : out std_logic_vector(7 downto 0);        --! [PL -> PS] Bank to read out [3:0] and number of queued banks [7:4]
+        bank_status : out std_logic_vector(31 downto 0);    --! [PL -> PS] Status of the bank to read out, latched when it was handed off: [15:0] fill count (words), [31] overflow (bank wrapped)
+        missed_trigs : out std_logic_vector(31 downto 0);   --! [PL -> PS] Number of triggers missed since reset, latched when the bank to read out was handed off
+        ---------------------------------------------
+        -- DEBUG ILA
+        ---------------------------------------------
+        DEBUG_data  : out std_logic_vector(g_coarse_bits+10 downto 0);  --! Exposing the top level arbiter data for ILA debug
+        DEBUG_valid : out std_logic;                                    --! Exposing the top level arbiter valid signal for ILA debug
+        DEBUG_grant : out std_logic_vector(3 downto 0);                 --! Exposing the top level read enable signal from arbiter to ring buffers for ILA debug
+        ---------------------------------------------
+        -- Output to the banked BRAM
+        ---------------------------------------------
+        BRAM_addr_b : out std_logic_vector(31 downto 0);    --! BRAM port B address (byte addressing)
+        BRAM_clk_b  : out std_logic;                        --! BRAM port B clock (driven by clk0)
+        BRAM_rddata_b : in std_logic_vector(63 downto 0);   --! BRAM port B read data (unused)
+        BRAM_wrdata_b : out std_logic_vector(63 downto 0);  --! BRAM port B write data
+        BRAM_en_b   : out std_logic;                        --! BRAM port B enable
+        BRAM_rst_b  : out std_logic;                        --! BRAM port B reset
+        BRAM_we_b   : out std_logic_vector(7 downto 0)      --! BRAM port B write enable
+    );
+end TDC_64ch_NBANK;
+
+architecture RTL of TDC_64ch_NBANK is
+
+    -- Preserve architecture
+    attribute keep_hierarchy : string;
+    attribute keep_hierarchy of RTL : architecture is "true";
+    attribute keep : string;
+    attribute dont_touch : string;
+    
+    -------------------------------------------------
+    -- Low-level TDC channel signals.
+    -- Naming conventions:
+    --      layer_from_to_purpose_s
+    -------------------------------------------------
+    -- Layer 1: 16x TDC_4ch modules -> ring buffers -> arbiter
+    signal layer1_tdc_buf_data_s      : SlvArray(0 to 15)(g_coarse_bits+10 downto 0);   --! TDC_4ch data to L1 ring buffers
+    signal layer1_tdc_buf_valid_s     : std_logic_vector(0 to 15);                      --! TDC_4ch data valid to L1 ring buffers
+    signal layer1_arb_buf_ren_s       : std_logic_vector(0 to 15);                      --! L1 arbiter read enable to L1 buffers
+    signal layer1_buf_arb_rvalid_s    : std_logic_vector(0 to 15);                      --! L1 buffer readout valid signal to L1 arbiter
+    signal layer1_buf_arb_data_s      : SlvArray(0 to 15)(g_coarse_bits+10 downto 0);   --! L1 buffer readout data to L1 arbiter 
+    signal layer1_buf_arb_empty_s     : std_logic_vector(0 to 15);                      --! L1 buffer empty signal to L1 arbiter
+    signal layer1_buf_arb_emptyNext_s : std_logic_vector(0 to 15);                      --! L1 buffer empty next signal to the arbiter tree (`g_arb_tree` only)
+    signal layer1_buf_arb_full_s      : std_logic_vector(0 to 15);                      --! UNUSED
+    signal layer1_buf_arb_fullNext_s  : std_logic_vector(0 to 15);                      --! UNUSED
+    signal layer1_buf_arb_fillCount_s : IntArray(0 to 15);                              --! UNUSED
+    -- Layers 2 and 3 (hand-wired or arbiter tree)
+    signal arb_top_grant_s : std_logic_vector(0 to sel(g_arb_tree, arbTreeTopInputs(16, g_arb_fanin, 0), 4)-1); --! Top level arbiter read enable to the buffers below it
+
+    ------------------------------------------------------------------------
+    -- Top-level data signals
+    ------------------------------------------------------------------------
+    signal tdc64ch_valid_s : std_logic;                                                             --! Top level arbiter valid data signal
+    signal tdc64ch_valid_s_last : std_logic;                                                        --! Registered data valid signal
+    signal tdc64ch_wr_s    : std_logic;                                                             --! One pulse per hit out of the top level arbiter
+    signal tdc64ch_data_s  : std_logic_vector(g_coarse_bits+10 downto 0);                           --! Top level arbiter data to BRAM
+    signal tdc_data_dummy : std_logic_vector(62-(g_coarse_bits+10) downto 0) := (others => '1');    --! Dummy bits to append to `tdc64ch_data_s` to reach 64 bits (to comply with AXI standard)
+
+    attribute keep of tdc_data_dummy : signal is "true";
+    attribute dont_touch of tdc_data_dummy : signal is "true";
+    
+    -- reduce fanout
+    signal reset_s : std_logic;                         --! Register the reset signal 
+    attribute max_fanout : integer;                     --! Limit the fanout for a given signal or net
+    attribute max_fanout of reset_s  : signal is 55;    --! Limit the fanout of the registered reset signal to meet timing
+
+    signal trig_last  : std_logic;                                  --! Register the trigger signal
+    signal busy_last  : std_logic;                                  --! Register the busy signal from the PS
+    signal missed_count : unsigned(31 downto 0) := (others => '0'); --! Count of missed triggers (trigger arrived while every other bank was still queued for readout)
+
+    constant c_bram_words : natural := 1024;    --! Depth of each bank in 64-bit words (8 KB)
+
+    -- Bank queue. The banks are handed off and read out in the same order, so the queue is fully described by the bank being
+    -- written, the oldest queued bank and the number of queued banks.
+    signal wr_bank   : natural range 0 to g_banks-1 := 0;   --! Bank being written
+    signal rd_bank   : natural range 0 to g_banks-1 := 0;   --! Oldest queued bank (next to be read out by the PS)
+    signal n_queued  : natural range 0 to g_banks-1 := 0;   --! Banks handed off and not yet read out
+    signal wr_addr   : unsigned(31 downto 0) := (others => '0');  --! Address in the bank being written (next word to be written == number of words written)
+    signal wr_ovf    : std_logic := '0';                          --! Bank being written wrapped around
+    signal bank_fill_arr   : SlvArray(0 to g_banks-1)(31 downto 0);  --! Fill count and overflow flag of every bank, latched when it is handed off
+    signal bank_missed_arr : SlvArray(0 to g_banks-1)(31 downto 0);  --! `missed_count` latched when each bank is handed off
+
+    -- Readout handshake with the PS, one pass per queued bank
+    type t_state is (
+        s_idle,  -- Waiting for a bank to be queued
+        s_trigd, -- Oldest queued bank exported, send out interrupt request and wait for busy flag from PS
+        s_busy   -- PS is busy reading the bank, await busy low from PS
+    );
+    signal state : t_state := s_idle;
+    signal bank_sel_s     : std_logic_vector(7 downto 0) := (others => '0');    --! Bank to read out and queue depth, stable while the PS reads it
+    signal bank_status_s  : std_logic_vector(31 downto 0) := (others => '0');   --! Fill count and overflow flag of the bank to read out
+    signal missed_trigs_s : std_logic_vector(31 downto 0) := (others => '0');   --! Missed trigger count of the bank to read out
+
+    --! Next bank in the rotation
+    function next_bank(bank : natural) return natural is
+    begin
+        if bank = g_banks-1 then
+            return 0;
+        end if;
+        return bank + 1;
+    end function;
+
+begin
+
+    -- Expose top level arbiter outputs for ILA debug  
+    DEBUG_data  <= tdc64ch_data_s;
+    DEBUG_valid <= tdc64ch_valid_s;
+    DEBUG_grant <= std_logic_vector(resize(unsigned(arb_top_grant_s), DEBUG_grant'length));
+
+    -- The channel IDs obey the following algorithm:
+    -- ---------------------------------------------------------------
+    -- channels    | ch  | calculation          | TDC_4c g_chID_start
+    -- ---------------------------------------------------------------
+    -- 0  1  2  3  |  0  | g_chID_start + (4*0) = 0    \
+    -- 4  5  6  7  |  1  | g_chID_start + (4*1) = 4     \___________ 16 channels starting with g_chID_start => 0
+    -- 8  9  10 11 |  2  | g_chID_start + (4*2) = 8     /
+    -- 12 13 14 15 |  3  | g_chID_start + (4*3) = 12   /
+    --
+    -- 16 17 18 19 |  4  | g_chID_start + (4*4) = 16  \
+    -- 20 21 22 23 |  5  | g_chID_start + (4*5) = 20   \___________ 16 channels starting with g_chID_start => 16
+    -- 24 25 26 27 |  6  | g_chID_start + (4*6) = 24   /
+    -- 28 29 30 31 |  7  | g_chID_start + (4*7) = 28  /
+    --
+    -- 32 33 34 35 |  8  | g_chID_start + (4*8) = 32  \
+    -- 36 37 38 39 |  9  | g_chID_start + (4*9) = 36   \___________ 16 channels starting with g_chID_start => 0
+    -- 40 41 42 43 | 10  | g_chID_start + (4*10) = 40  /
+    -- 44 45 46 47 | 11  | g_chID_start + (4*11) = 44 /
+    --
+    -- 48 49 50 51 | 12  | g_chID_start + (4*12) = 48 \
+    -- 52 53 54 55 | 13  | g_chID_start + (4*13) = 52  \___________ 16 channels starting with g_chID_start => 16
+    -- 56 57 58 59 | 14  | g_chID_start + (4*14) = 56  /
+    -- 60 61 62 63 | 15  | g_chID_start + (4*15) = 60  /
+    --
+    -- The below loop generates the first value in each row. The TDC_4ch modules 
+    -- have their own generate loop that loops again: ch->ch+3 
+    -------------------------------------------------------------------------------------------------------------
+
+    -- Connect the 16 TDC_4ch modules to ring buffers
+    layer1 : for ch in 0 to 15 generate
+    begin 
+        --! First generate 16 `TDC_4ch` modules
+        TDC4ch_inst : entity work.TDC_4ch
+        generic map (
+            g_chID_start   => g_chID_start + (4 * ch),
+            g_coarse_bits  => g_coarse_bits,
+            g_sat_duration => g_sat_duration,
+            g_pipe_depth   => 16, -- (4ch) * (4hits / channel) = 16 hits max. Adjustable
+            g_fast_rearm   => g_fast_rearm,
+            g_arb_tree     => g_arb_tree
+        )
+        port map (
+            clk0      => clk0,
+            clk45     => clk45,
+            clk90     => clk90,
+            clk135    => clk135,
+            clk_sys   => clk_sys,
+            reset     => reset,
+            enable    => enable, 
+            hit       => hits( (4*ch) to (4*ch+3) ),
+            valid_o   => layer1_tdc_buf_valid_s(ch),
+            data_o    => layer1_tdc_buf_data_s(ch)
+        );
+        --! Connect the 16 `TDC_4ch` modules to their hit buffers
+        TDC4ch_buf_inst : entity work.ring_buffer
+        generic map (
+            RAM_WIDTH => g_coarse_bits + 11, -- (N coarse bits) + (6 bit chID) + (5 bit fine)
+            RAM_DEPTH => 16
+        )
+        port map (
+            clk             => clk0,
+            rst             => reset, 
+            wr_en           => layer1_tdc_buf_valid_s(ch), -- Valid signals from TDC channels
+            wr_data         => layer1_tdc_buf_data_s(ch),  -- Data word from TDC channels 
+            rd_en           => layer1_arb_buf_ren_s(ch),   -- Read enable from arbiter to buffer
+            rd_valid        => layer1_buf_arb_rvalid_s(ch),-- Read valid from buffer to arbiter
+            rd_data         => layer1_buf_arb_data_s(ch),  -- Data from buffer to arbiter
+            -- FOLLOWING ARE UNUSED FOR NOW
+            empty           => layer1_buf_arb_empty_s(ch),
+            empty_next      => layer1_buf_arb_emptyNext_s(ch), -- Last word signal to the arbiter tree
+            full            => layer1_buf_arb_full_s(ch),
+            full_next       => layer1_buf_arb_fullNext_s(ch),
+            fill_count      => layer1_buf_arb_fillCount_s(ch)
+        );
+    end generate layer1;
+
+    --! \brief Serialize the 16 layer 1 buffers into the top level output
+    --! \details Four 4:1 layer 2 arbiters write to 128 hit buffers, read out by the top level (layer 3) 4:1 arbiter, as in the
+    --! diagram above: by default wired by hand from \ref rr_arbiter_41.vhd "`rr_arbiter_41`"s, with `g_arb_tree` generated by the
+    --! \ref arbiter_tree.vhd "arbiter tree", whose shape is then set by `g_arb_fanin` and `g_arb_depth`. The arbiter tree has
+    --! not been simulated yet (see tb_2BRAM_throughput), so it stays off by default.
+    g_tree : if g_arb_tree generate
+        arb_tree : entity work.arbiter_tree
+        generic map (
+            DWIDTH       => g_coarse_bits + 11,
+            g_inputs     => 16,
+            g_fanin      => g_arb_fanin,
+            g_depth      => g_arb_depth,
+            g_req_stages => g_arb_req_stages,
+            g_out_stages => g_arb_out_stages
+        )
+        port map (
+            clk         => clk0,
+            rst         => reset,
+            -- Connect to the layer 1 buffers
+            empty_in    => layer1_buf_arb_empty_s,
+            valid_in    => layer1_buf_arb_rvalid_s,
+            data_in     => layer1_buf_arb_data_s,
+            empty_next_in => layer1_buf_arb_emptyNext_s,
+            enable_out  => layer1_arb_buf_ren_s,
+            data_out    => tdc64ch_data_s,  -- final top level output
+            valid_out   => tdc64ch_valid_s, -- final top level output
+            top_grant   => arb_top_grant_s
+        );
+    else generate
+        signal layer2_arb_buf_data_s  : SlvArray(0 to 3)(g_coarse_bits+10 downto 0);    --! L2 arbiter data to L2 buffers
+        signal layer2_arb_buf_valid_s : std_logic_vector(0 to 3);                       --! L2 arbiter valid signal to L2 buffers
+        signal layer3_buf_arb_rvalid_s : std_logic_vector(0 to 3);                      --! L2 buffer readout valid signal to L3 arbiter
+        signal layer3_buf_arb_data_s  : SlvArray(0 to 3)(g_coarse_bits+10 downto 0);    --! L2 buffer readout data to L3 arbiter
+        signal layer3_buf_arb_empty_s : std_logic_vector(0 to 3);                       --! L2 buffer empty signal to L3 arbiter
+        signal layer3_buf_arb_emptyNext_s : std_logic_vector(0 to 3);                   --! UNUSED
+        signal layer3_buf_arb_fullNext_s  : std_logic_vector(0 to 3);                   --! UNUSED
+        signal layer2_buf_full_s : std_logic_vector(0 to 3);                            --! UNUSED
+        signal layer2_buf_fill_s : IntArray(0 to 3);                                    --! UNUSED
+    begin
+        -- Connect the 16 ring buffers to four 4:1 arbiters and buffers
+        layer2 : for idx in 0 to 3 generate
+        -- Algorithm:
+        --      idx      |    connections
+        --  ----------------------------------
+        --      0        |    [4 * idx : (4 * idx) + 3] = [0:3]
+        --      1        |    [4 * idx : (4 * idx) + 3] = [4:7]
+        --      2        |    [4 * idx : (4 * idx) + 3] = [8:11]
+        --      3        |    [4 * idx : (4 * idx) + 3] = [12:15]
+        begin
+            --! Connect layer 1 buffers to layer 2 arbiters
+            L2_arb_inst : entity work.rr_arbiter_41
+            generic map (
+                DWIDTH => g_coarse_bits + 11
+            )
+            port map (
+                clk         => clk0,
+                rst         => reset,
+                -- Connect to the layer 1 buffers
+                empty_in    => layer1_buf_arb_empty_s( (4*idx) to (4*idx+3) ),
+                valid_in    => layer1_buf_arb_rvalid_s( (4*idx) to (4*idx+3) ),
+                data_in     => layer1_buf_arb_data_s((4*idx) to (4*idx+3) ),
+                enable_out  => layer1_arb_buf_ren_s( (4*idx) to (4*idx+3) ),
+                -- Connect to the layer 2 buffers
+                data_out    => layer2_arb_buf_data_s(idx),
+                valid_out   => layer2_arb_buf_valid_s(idx)
+            );
+            --! Connect layer 2 arbiters to layer 2 buffers
+            L2_buf_inst : entity work.ring_buffer
+            generic map (
+                RAM_WIDTH => g_coarse_bits + 11,
+                RAM_DEPTH => 128
+            )
+            port map (
+                clk             => clk0,
+                rst             => reset,
+                wr_en           => layer2_arb_buf_valid_s(idx),
+                wr_data         => layer2_arb_buf_data_s(idx),
+                rd_en           => arb_top_grant_s(idx),
+                rd_valid        => layer3_buf_arb_rvalid_s(idx),
+                rd_data         => layer3_buf_arb_data_s(idx),
+                empty           => layer3_buf_arb_empty_s(idx),
+                full            => layer2_buf_full_s(idx),       -- unused
+                fill_count      => layer2_buf_fill_s(idx),       -- unused
+                -- FOLLOWING ARE UNUSED FOR NOW
+                empty_next      => layer3_buf_arb_emptyNext_s(idx),
+                full_next       => layer3_buf_arb_fullNext_s(idx)
+            );
+        end generate layer2;
+
+        --! Connect the layer 2 buffers to the final (layer 3) arbiter
+        layer3_arbiter : entity work.rr_arbiter_41
+        generic map ( DWIDTH => g_coarse_bits + 11 )
+        port map (
+            clk         => clk0,
+            rst         => reset,
+            empty_in    => layer3_buf_arb_empty_s,
+            valid_in    => layer3_buf_arb_rvalid_s,
+            data_in     => layer3_buf_arb_data_s,
+            enable_out  => arb_top_grant_s,
+            data_out    => tdc64ch_data_s,  -- final top level output
+            valid_out   => tdc64ch_valid_s  -- final top level output
+        );
+    end generate g_tree;
+
+    --! \brief One write strobe per hit out of the top level arbiter
+    --! \details The \ref rr_arbiter_41.vhd "`rr_arbiter_41`" of the hand-wired tree holds its valid flag high for two or more
+    --! cycles per hit, so a hit is written on the rising edge of the flag. The arbiter tree raises the flag for exactly one
+    --! cycle per hit, and can do so on consecutive cycles, so with `g_arb_tree` every valid cycle is a hit.
+    tdc64ch_wr_s <= tdc64ch_valid_s when g_arb_tree else tdc64ch_valid_s and not tdc64ch_valid_s_last;
+
+    --! \brief Register signals to enable level detection
+    --! \details Register the reset, PS read busy and trigger signals.
+    --! By registering them, we can track changes in the state which are then used to control the FSM that handles BRAM writes
+    p_register : process(all)
+    begin
+        if rising_edge(clk0) then
+            reset_s   <= reset;
+            busy_last <= rd_busy;
+            trig_last <= trigger;
+            tdc64ch_valid_s_last <= tdc64ch_valid_s;
+        end if;
+    end process p_register;
+
+    assert g_banks >= 2 and g_banks <= 16
+        report "TDC_64ch_NBANK: g_banks must be between 2 and 16" severity failure;
+
+    -- Wire the bank to read out and its status to output
+    bank_sel     <= bank_sel_s;
+    bank_status  <= bank_status_s;
+    missed_trigs <= missed_trigs_s;
+
+    --! \brief Handle BRAM writing, the bank queue and the trigger interface
+    --! \details The module continually reads out hits from the 64 TDC channels and writes them to the current bank.
+    --! Upon trigger arrival the current bank is handed off: its fill count, overflow flag and the number of triggers missed
+    --! so far are latched, it joins the queue of banks waiting for readout and writing continues at the start of the next bank.
+    --! A hit written in the same clock cycle as the hand-off still belongs to the bank handed off. If the next bank is itself
+    --! still queued (all other banks are waiting for readout), the trigger is missed and counted instead.
+    --! Independently of the trigger side, whenever a bank is queued the status of the oldest one is exported and an interrupt
+    --! is sent to the PS. The PS asserts a busy flag, reads out the bank and deasserts the busy flag, which removes the bank
+    --! from the queue and frees it for writing. The exported values only change between two readouts, so the PS can sample
+    --! them through an AXI GPIO from another clock domain.
+    p_handle_BRAM_rw : process(all)
+        variable v_addr   : unsigned(31 downto 0);
+        variable v_ovf    : std_logic;
+        variable v_queued : natural range 0 to g_banks-1;
+    begin
+        if rising_edge(clk0) then
+            if (reset_s = '1') then
+                -- Back to bank 0 with an empty queue, disable writing
+                BRAM_rst_b <= '1';
+                BRAM_we_b  <= (others => '0');
+                BRAM_en_b  <= '0';
+                BRAM_addr_b <= (others => '0');
+                wr_bank  <= 0;
+                rd_bank  <= 0;
+                n_queued <= 0;
+                wr_addr  <= (others => '0');
+                wr_ovf   <= '0';
+                bank_sel_s     <= (others => '0');
+                bank_status_s  <= (others => '0');
+                missed_trigs_s <= (others => '0');
+                missed_count   <= (others => '0');
+                -- Clear PL -> PS interrupt flag
+                irq_o <= '0';
+                state <= s_idle;
+            else
+                BRAM_rst_b <= '0';
+                BRAM_en_b  <= '1';
+                -- Tie TDC data to the BRAM at all times
+                BRAM_wrdata_b <= tdc_data_dummy & tdc64ch_data_s;
+                v_addr   := wr_addr;
+                v_ovf    := wr_ovf;
+                v_queued := n_queued;
+                -- Write every new hit to the current bank
+                if (tdc64ch_wr_s = '1') then
+                    BRAM_we_b   <= (others => '1');
+                    BRAM_addr_b <= std_logic_vector(shift_left(to_unsigned(wr_bank * c_bram_words, 32) + wr_addr, 3));
+                    if wr_addr = c_bram_words-1 then    -- Bank full, wrap around and overwrite the oldest hits
+                        v_addr := (others => '0');
+                        v_ovf  := '1';
+                    else
+                        v_addr := wr_addr + 1;
+                    end if;
+                else
+                    BRAM_we_b <= (others => '0');
+                end if;
+
+                -- Trigger accept: hand the current bank off if the next one is free
+                if (trigger = '1') and (trig_last = '0') then
+                    if n_queued < g_banks-1 then
+                        bank_fill_arr(wr_bank) <= (others => '0');
+                        bank_fill_arr(wr_bank)(31) <= v_ovf;
+                        if v_ovf = '1' then
+                            bank_fill_arr(wr_bank)(15 downto 0) <= std_logic_vector(to_unsigned(c_bram_words, 16));
+                        else
+                            bank_fill_arr(wr_bank)(15 downto 0) <= std_logic_vector(v_addr(15 downto 0));
+                        end if;
+                        bank_missed_arr(wr_bank) <= std_logic_vector(missed_count);
+                        wr_bank  <= next_bank(wr_bank);
+                        v_addr   := (others => '0');
+                        v_ovf    := '0';
+                        v_queued := v_queued + 1;
+                    else
+                        -- Every other bank is waiting for the PS, report that we missed one trigger
+                        missed_count <= missed_count + 1;
+                    end if;
+                end if;
+                wr_addr <= v_addr;
+                wr_ovf  <= v_ovf;
+
+                -- FSM to hand the queued banks to the PS, oldest first
+                case state is
+                    when s_idle =>
+                        irq_o <= '0';
+                        if n_queued > 0 then
+                            bank_sel_s     <= std_logic_vector(to_unsigned(n_queued, 4)) & std_logic_vector(to_unsigned(rd_bank, 4));
+                            bank_status_s  <= bank_fill_arr(rd_bank);
+                            missed_trigs_s <= bank_missed_arr(rd_bank);
+                            state <= s_trigd;
+                        end if;
+                    when s_trigd =>                 -- Bank status exported, let PS know and await busy flag
+                        irq_o <= '1';
+                        if (busy_last = '1') then   -- Wait for async PS ready busy signal to arrive before moving to next state
+                            irq_o <= '0';           -- Drop interrupt flag (since it will be edge-triggered)
+                            state <= s_busy;
+                        end if;
+                    when s_busy =>
+                        if (busy_last = '0') then   -- Wait for async PS read busy to go low, the bank is free again
+                            rd_bank  <= next_bank(rd_bank);
+                            v_queued := v_queued - 1;
+                            state <= s_idle;
+                        end if;
+                    when others =>
+                        NULL;
+                end case;
+                n_queued <= v_queued;
+            end if;
+        end if;
+    end process p_handle_BRAM_rw;
+
+    -- Send BRAM clock straight through
+    BRAM_clk_b <= clk0;
+
+end RTL;
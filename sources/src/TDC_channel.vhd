@@ -20,7 +20,8 @@ entity TDC_channel is
     generic (
         g_channel_id : natural := 0;    --! Channel ID
         g_sat_duration : natural := 3;  --! Minumum number of `clk0` periods the hit must remain high to be considered valid and digitized
-        g_coarse_bits : natural := 28   --! The number of bits in the \ref CoarseCounter.vhd "coarse time counter".
+        g_coarse_bits : natural := 28;  --! The number of bits in the \ref CoarseCounter.vhd "coarse time counter".
+        g_fast_rearm  : boolean := false --! Send hits out once they qualify and re-arm after one low `clk0` period (see \ref encoder.vhd "encoder")
     );
     port (
         -- TDC and system clocks 
@@ -35,6 +36,7 @@ entity TDC_channel is
         -- Data input
         --coarse_i : in std_logic_vector(g_coarse_bits-1 downto 0);
         hit : in std_logic;     --! Front-end discriminator hit
+        sat_duration : in natural range 1 to 7 := g_sat_duration;   --! Runtime minimum hit width (`clk0` periods), overrides `g_sat_duration`
         -- Data output (timestamp + valid)
         valid      : out std_logic;                                     --! Data valid flag from \ref encoder.vhd "encoder"
         timestamp  : out std_logic_vector(g_coarse_bits+10 downto 0)    --! 
@@ -88,13 +90,15 @@ begin
     generic map (
         g_coarse_bits  => g_coarse_bits,
         g_sat_duration => g_sat_duration,
-        g_channel_id   => g_channel_id
+        g_channel_id   => g_channel_id,
+        g_fast_rearm   => g_fast_rearm
     )
     port map (
         clk_0       => clk0,
         fine_i      => sampler_o_s,
         reset_i     => reset,
         coarse_i    => coarse_s,
+        sat_duration_i => sat_duration,
         timestamp_o => timestamp,
         valid_o     => valid
     );
@@ -0,0 +1,208 @@
+---------------------------------------------------------------------------------------------------------
+--! \file arbiter_tree.vhd
+--! \brief A tree of round-robin arbiters and hit buffers that serializes any number of requester FIFOs into one output stream.
+--!
+--! \details This module generates the arbiter tree between the hit buffers of the TDC channel groups and the hit storage.
+--! Every layer of the tree splits its inputs into groups of its fan-in (the last group takes the remainder), reads each group
+--! out with a \ref rr_arbiter.vhd "round robin arbiter" and writes the words into a \ref ring_buffer.vhd "ring buffer" of
+--! the depth given for that layer. These buffers are the inputs of the next layer. The last layer, or the first layer with no
+--! more inputs than its fan-in, is a single arbiter whose output is the output of the tree. For example, the 64 channel
+--! designs built with `g_arb_tree` (off by default until the tree is simulated) read out their 16 `TDC_4ch` buffers with
+--! `g_fanin => (4, 4)` and `g_depth => (0 => 128)`:
+--!
+--! \verbatim
+--!      layer 0                          layer 1 (top)
+--!   16 inputs -> 4x 4:1 arbiter -> buffer(128) -> 4:1 arbiter -> output
+--! \endverbatim
+--!
+--! The layers are generated by recursively instantiating this entity with `g_level` incremented, so the fan-in of every layer
+--! can be retuned for timing closure, and the number of inputs can grow, without editing the tree by hand. `g_req_stages`
+--! and `g_out_stages` are passed to every arbiter (see \ref rr_arbiter.vhd "`rr_arbiter`"), and the `empty_next` flags of the
+--! buffers go to the arbiters reading them, so a buffer is not granted again while its last word is read out. Each layer
+--! moves up to one word per clock cycle per arbiter, so a tree delivers up to one word per clock cycle at its output.
+--! The write enable, full flag and fill count of the buffers of the first layer are exported for the
+--! \ref tdc_stats.vhd "statistics block" (the buffers of the deeper layers are not).
+--!
+--! \author Amitav Mitra, amitra3@jhu.edu
+---------------------------------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+
+--! Use SlvArray and IntArray for the requester signals and the tree topology
+use work.common_types.all;
+
+--! \brief A tree of round-robin arbiters and hit buffers that serializes any number of requester FIFOs into one output stream.
+--!
+--! \details Every layer groups its inputs by its fan-in (`g_fanin`), reads each group out with a round robin arbiter into a
+--! ring buffer of the layer's depth (`g_depth`), and the buffers are the inputs of the next layer. The top level arbiter drives
+--! the outputs. The tree has the same requester interface as a single \ref rr_arbiter.vhd "arbiter".
+entity arbiter_tree is
+    generic (
+        DWIDTH       : natural  := 39;          --! Data word width from requester FIFOs
+        g_inputs     : positive := 16;          --! Number of requester FIFOs
+        g_fanin      : IntArray := (4, 4);      --! Fan-in of every layer, starting with the layer reading the requesters. The last layer arbitrates all its inputs.
+        g_depth      : IntArray := (0 => 128);  --! Depth of the ring buffers written by every layer but the top one
+        g_req_stages : natural  := 0;           --! Register stages on the request vector of every arbiter
+        g_out_stages : natural  := 0;           --! Register stages on the output of every arbiter
+        g_level      : natural  := 0            --! Layer of this (sub)tree, only set by the recursion
+    );
+    port (
+        -- Control inputs
+        clk : in std_logic;     --! 4x RF clock
+        rst : in std_logic;     --! Synchronous, active high reset
+        -- Input from requesters
+        empty_in : in std_logic_vector(0 to g_inputs-1);            --! Empty signals from requester FIFOs
+        valid_in : in std_logic_vector(0 to g_inputs-1);            --! Read valid signals from requester FIFOs
+        data_in  : in SlvArray(0 to g_inputs-1)(DWIDTH-1 downto 0); --! Array of data to be read from requester FIFOs
+        empty_next_in : in std_logic_vector(0 to g_inputs-1) := (others => '0'); --! Empty next signals from requester FIFOs (see \ref rr_arbiter.vhd "`rr_arbiter`")
+        -- Outputs
+        enable_out : out std_logic_vector(0 to g_inputs-1);         --! Read enable signals sent to requester FIFOs
+        data_out   : out std_logic_vector(DWIDTH-1 downto 0);       --! Data from the top level arbiter
+        valid_out  : out std_logic;                                 --! Write enable pulse from the top level arbiter
+        top_grant  : out std_logic_vector(0 to arbTreeTopInputs(g_inputs, g_fanin, g_level)-1); --! Read enables of the top level arbiter, for ILA debug
+        -- Status of the hit buffers written by the first layer of this (sub)tree (null ranges if it is the top level arbiter)
+        buf_wr   : out std_logic_vector(0 to arbTreeBuffers(g_inputs, g_fanin, g_level)-1);   --! Write enables of the buffers
+        buf_full : out std_logic_vector(0 to arbTreeBuffers(g_inputs, g_fanin, g_level)-1);   --! Full flags of the buffers (a write while full is dropped)
+        buf_fill : out IntArray(0 to arbTreeBuffers(g_inputs, g_fanin, g_level)-1)            --! Fill counts of the buffers
+    );
+end arbiter_tree;
+
+architecture RTL of arbiter_tree is
+
+    constant c_fanin  : positive := g_fanin(g_fanin'low + g_level);                             --! Fan-in of this layer
+    constant c_top    : boolean  := (g_level = g_fanin'length - 1) or (g_inputs <= c_fanin);    --! This layer is the top level arbiter
+    constant c_groups : positive := ceilDiv(g_inputs, c_fanin);                                 --! Number of arbiters in this layer
+
+    --! Number of inputs of group `g` of this layer
+    function group_size(g : natural) return positive is
+    begin
+        if (g + 1) * c_fanin <= g_inputs then
+            return c_fanin;
+        end if;
+        return g_inputs - g * c_fanin;
+    end function;
+
+begin
+
+    assert g_level < g_fanin'length
+        report "arbiter_tree: no fan-in given for layer " & integer'image(g_level) severity failure;
+
+    --! Top level: a single arbiter drives the outputs of the tree
+    g_top : if c_top generate
+        signal top_grant_s : std_logic_vector(0 to g_inputs-1);
+    begin
+        top_arb_inst : entity work.rr_arbiter
+        generic map (
+            DWIDTH       => DWIDTH,
+            g_inputs     => g_inputs,
+            g_req_stages => g_req_stages,
+            g_out_stages => g_out_stages
+        )
+        port map (
+            clk         => clk,
+            rst         => rst,
+            empty_in    => empty_in,
+            valid_in    => valid_in,
+            data_in     => data_in,
+            empty_next_in => empty_next_in,
+            enable_out  => top_grant_s,
+            data_out    => data_out,
+            valid_out   => valid_out
+        );
+        enable_out <= top_grant_s;
+        top_grant  <= top_grant_s;
+    end generate g_top;
+
+    --! Lower layers: groups of arbiters writing to ring buffers, read out by the rest of the tree
+    g_layer : if not c_top generate
+        signal arb_buf_data_s  : SlvArray(0 to c_groups-1)(DWIDTH-1 downto 0);  --! Layer arbiter data to layer buffers
+        signal arb_buf_valid_s : std_logic_vector(0 to c_groups-1);             --! Layer arbiter valid to layer buffers
+        signal up_buf_ren_s    : std_logic_vector(0 to c_groups-1);             --! Upper layer read enable to layer buffers
+        signal buf_up_rvalid_s : std_logic_vector(0 to c_groups-1);             --! Layer buffer readout valid to upper layer
+        signal buf_up_data_s   : SlvArray(0 to c_groups-1)(DWIDTH-1 downto 0);  --! Layer buffer readout data to upper layer
+        signal buf_up_empty_s  : std_logic_vector(0 to c_groups-1);             --! Layer buffer empty signal to upper layer
+        signal buf_up_enext_s  : std_logic_vector(0 to c_groups-1);             --! Layer buffer empty next signal to upper layer
+    begin
+
+        -- Export the status of this layer's buffers
+        buf_wr <= arb_buf_valid_s;
+
+        groups : for g in 0 to c_groups-1 generate
+            constant c_lo : natural := g * c_fanin;                 --! First input of this group
+            constant c_hi : natural := c_lo + group_size(g) - 1;    --! Last input of this group
+            signal buf_fullNext_s  : std_logic;                     --! UNUSED
+        begin
+            --! Read out the inputs of this group
+            arb_inst : entity work.rr_arbiter
+            generic map (
+                DWIDTH       => DWIDTH,
+                g_inputs     => group_size(g),
+                g_req_stages => g_req_stages,
+                g_out_stages => g_out_stages
+            )
+            port map (
+                clk         => clk,
+                rst         => rst,
+                empty_in    => empty_in(c_lo to c_hi),
+                valid_in    => valid_in(c_lo to c_hi),
+                data_in     => data_in(c_lo to c_hi),
+                empty_next_in => empty_next_in(c_lo to c_hi),
+                enable_out  => enable_out(c_lo to c_hi),
+                data_out    => arb_buf_data_s(g),
+                valid_out   => arb_buf_valid_s(g)
+            );
+            --! Buffer the serialized words of this group for the next layer
+            buf_inst : entity work.ring_buffer
+            generic map (
+                RAM_WIDTH => DWIDTH,
+                RAM_DEPTH => g_depth(g_depth'low + g_level)
+            )
+            port map (
+                clk             => clk,
+                rst             => rst,
+                wr_en           => arb_buf_valid_s(g),
+                wr_data         => arb_buf_data_s(g),
+                rd_en           => up_buf_ren_s(g),
+                rd_valid        => buf_up_rvalid_s(g),
+                rd_data         => buf_up_data_s(g),
+                empty           => buf_up_empty_s(g),
+                empty_next      => buf_up_enext_s(g),
+                full            => buf_full(g),
+                fill_count      => buf_fill(g),
+                -- FOLLOWING ARE UNUSED FOR NOW
+                full_next       => buf_fullNext_s
+            );
+        end generate groups;
+
+        --! The rest of the tree reads out the buffers of this layer
+        upper_inst : entity work.arbiter_tree
+        generic map (
+            DWIDTH       => DWIDTH,
+            g_inputs     => c_groups,
+            g_fanin      => g_fanin,
+            g_depth      => g_depth,
+            g_req_stages => g_req_stages,
+            g_out_stages => g_out_stages,
+            g_level      => g_level + 1
+        )
+        port map (
+            clk         => clk,
+            rst         => rst,
+            empty_in    => buf_up_empty_s,
+            valid_in    => buf_up_rvalid_s,
+            data_in     => buf_up_data_s,
+            empty_next_in => buf_up_enext_s,
+            enable_out  => up_buf_ren_s,
+            data_out    => data_out,
+            valid_out   => valid_out,
+            top_grant   => top_grant,
+            buf_wr      => open,
+            buf_full    => open,
+            buf_fill    => open
+        );
+
+    end generate g_layer;
+
+end RTL;
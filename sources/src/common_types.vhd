@@ -28,6 +28,10 @@ package common_types is
    function bitSize (constant number : natural) return positive;  --! Returns number of bits needed to represent a natural
    function toSlv(ARG : integer; SIZE : integer) return slv;
    function isodd (n: positive) return natural;
+   function ceilDiv (a : natural; b : positive) return natural;                          --! Returns a / b rounded up
+   function arbTreeTopInputs (n : positive; fanin : IntArray; level : natural) return positive; --! Returns the number of inputs of the top level arbiter of an \ref arbiter_tree.vhd "arbiter tree"
+   function arbTreeBuffers (n : positive; fanin : IntArray; level : natural) return natural;    --! Returns the number of hit buffers written by the first layer of an \ref arbiter_tree.vhd "arbiter tree"
+   function sel (cond : boolean; a, b : integer) return integer;                          --! Returns `a` if `cond`, `b` otherwise (constants that depend on a boolean generic)
 
 end package;
 
@@ -95,5 +99,54 @@ package body common_types is
          return 0;
       end if;
    end function;
+
+   --! \brief Integer division rounded up
+   --! \param a   Dividend
+   --! \param b   Divisor
+   function ceilDiv (a : natural; b : positive) return natural is
+   begin
+      return (a + b - 1) / b;
+   end function;
+
+   --! \brief Number of inputs of the top level arbiter of an \ref arbiter_tree.vhd "arbiter tree"
+   --!
+   --! \details Follows the layers of the tree starting at `level`: every layer groups its inputs by its fan-in, until the
+   --! last layer or a layer with no more inputs than its fan-in is reached, which is the top level arbiter.
+   --! \param n       Number of inputs of the tree at `level`
+   --! \param fanin   Fan-in of every layer, starting with the requesters
+   --! \param level   Layer to start from
+   function arbTreeTopInputs (n : positive; fanin : IntArray; level : natural) return positive is
+      variable v_n : positive := n;
+   begin
+      for l in level to fanin'length - 2 loop
+         exit when v_n <= fanin(fanin'low + l);
+         v_n := ceilDiv(v_n, fanin(fanin'low + l));
+      end loop;
+      return v_n;
+   end function;
+
+   --! \brief Number of hit buffers written by layer `level` of an \ref arbiter_tree.vhd "arbiter tree"
+   --!
+   --! \details 0 if that layer is the top level arbiter, otherwise one buffer per group of `fanin(level)` inputs.
+   --! \param n       Number of inputs of the tree at `level`
+   --! \param fanin   Fan-in of every layer, starting with the requesters
+   --! \param level   Layer of the tree
+   function arbTreeBuffers (n : positive; fanin : IntArray; level : natural) return natural is
+   begin
+      if (level >= fanin'length - 1) or (n <= fanin(fanin'low + level)) then
+         return 0;
+      end if;
+      return ceilDiv(n, fanin(fanin'low + level));
+   end function;
+
+   --! \brief Select one of two integers
+   --! \param cond    Selects `a` if true, `b` if false
+   function sel (cond : boolean; a, b : integer) return integer is
+   begin
+      if cond then
+         return a;
+      end if;
+      return b;
+   end function;
    
 end package body common_types;
@@ -7,6 +7,15 @@
 --! The additional factor of 11 comes from the 11-bit concatenation of (5-bit fine time) & (6-bit channel ID).
 --! The fine time is encoded by a 5-bit value representing one of the 32 0.58ns time intervals making up the RF clock period.
 --! 
+--! With `g_fast_rearm`, the timestamp of the leading edge is latched once, when the sampler first saturates,
+--! and sent out as soon as the hit has been saturated for long enough, without waiting for it to go low. The encoder is
+--! re-armed by the first clk_0 period in which the sampler sees the input low, so the dead time after a hit is its width
+--! plus that one period, and a new leading edge in the same clk_0 period as the previous trailing edge is encoded from the
+--! last run of ones of the hit pattern. Without `g_fast_rearm` (the default), the original FSM is used (sends the hit out
+--! after its trailing edge). \ref tb_channel_deadtime.vhd "The dead time testbench" compares the two; the fast re-arm stays
+--! off by default, in this entity and in the 64 channel designs (their `g_fast_rearm`), until its report has
+--! been checked.
+--! 
 --! \author Amitav Mitra, amitra3@jhu.edu
 ---------------------------------------------------------------------------------------------------------
 
@@ -23,17 +32,21 @@ use work.common_types.all;
 --! N+11 bit-long data words, where `N = g_coarse_bits` == the length of the \ref CoarseCounter.vhd "coarse time counter".
 --! The additional factor of 11 comes from the 11-bit concatenation of (5-bit fine time) & (6-bit channel ID).
 --! The fine time is encoded by a 5-bit value representing one of the 32 0.58ns time intervals making up the RF clock period.
+--! With `g_fast_rearm`, the leading edge is sent out once the hit qualifies and the encoder is re-armed by the first clk_0
+--! period in which the input is low (see the file documentation).
 entity encoder is
     generic (
         g_coarse_bits : natural := 28;  --! Number of bits making up the \ref CoarseCounter.vhd "coarse time counter".
         g_channel_id  : natural := 0;   --! Channel ID (number from 0-63).
-        g_sat_duration : natural range 1 to 5 := 3   --! number of clk_0 cycles the signal needs to remain high to be considered valid
+        g_sat_duration : natural range 1 to 7 := 3;  --! number of clk_0 cycles the signal needs to remain high to be considered valid, unless set by `sat_duration_i`
+        g_fast_rearm  : boolean := false --! Send the hit out once it qualifies and re-arm on the first low period, instead of after its trailing edge
     );
     port (
         clk_0       : in std_logic;                                     --! 0-degree phase MMCM output clock
         fine_i      : in std_logic_vector(9 downto 0);                  --! Bits [9:2] are the \ref sampler.vhd "sampler" hit pattern and bits [1:0] are the clk_0 period counter
         reset_i     : in std_logic;                                     --! Active high reset
         coarse_i    : in std_logic_vector(g_coarse_bits-1 downto 0);    --! \ref CoarseCounter.vhd "Coarse time counter" value
+        sat_duration_i : in natural range 1 to 7 := g_sat_duration;     --! Runtime minimum hit width in clk_0 cycles, from the \ref tdc_ctrl.vhd "control block"
         timestamp_o : out std_logic_vector(g_coarse_bits+10 downto 0);  --! Timestamp formed by (coarse time) + [ (5-bit fine time) + (6-bit channel id) ] - 1
         valid_o     : out std_logic                                     --! Output pulse sent when valid fine time is encoded
     );
@@ -57,8 +70,12 @@ architecture Behavioral of encoder is
     );
     signal state : t_state;
 
+    --! Hit pattern of the previous clk_0 period used to encode the leading edge: with `g_fast_rearm`, only its last run
+    --! of ones (the tail of a previous hit in the same period is dropped), otherwise `fine_last[9:2]` as is
+    signal fine_prev : std_logic_vector(7 downto 0);
+
     --! Keeps track of how many clk_0 periods the hit has been high for (saturates the sampler)
-    signal saturation_counter : unsigned(bitSize(g_sat_duration)-1 downto 0);
+    signal saturation_counter : unsigned(2 downto 0);
     signal hit_finished : std_logic;    --! Hit signal has gone low:                        fine_i[9:2] => '0'
     signal is_saturated : std_logic;    --! Hit signal is high and sampler is saturated:    fine_i[9:2] => '1'
 
@@ -84,6 +101,21 @@ begin
     -- Assign the channel ID signal the proper value based on the generic 
     g_channel_id_s <= std_logic_vector(to_unsigned(g_channel_id, 6));
 
+    --! \brief Keep the last run of ones of the previous hit pattern, i.e. the samples since the last rising edge
+    --! \details Bit 0 of the pattern is the latest sample (135 degree falling edge). A pattern like "11100111" means a hit
+    --! ended and the next one started within the same clk_0 period: its leading edge is the one of "00000111".
+    p_fine_prev : process(all)
+    begin
+        fine_prev <= fine_last(9 downto 2);
+        if g_fast_rearm then
+            fine_prev <= (others => '0');
+            for i in 0 to 7 loop
+                exit when fine_last(2 + i) = '0';
+                fine_prev(i) <= '1';
+            end loop;
+        end if;
+    end process p_fine_prev;
+
     --! \brief Register the coarse time counter, fine time hit pattern, and clk_0 period counter signals.
     p_shift : process(all)
     begin 
@@ -99,8 +131,9 @@ begin
     --! \details The FSM has three different states: IDLE, READY, and DONE. 
     --! These states correspond to the status of the sampler, which is recording the hit pattern from the front-end electronics. 
     --! <br> * IDLE: Sampler is not saturated, waiting for a hit to arrive
-    --! <br> * READY: Sampler has been saturated for `g_sat_duration` `clk_0` periods
+    --! <br> * READY: Sampler has been saturated for `sat_duration_i` `clk_0` periods
     --! <br> * DONE: Sampler has been saturated for long enough, wait for hit pulse to go low before sending the encoded data for further processing
+    g_legacy : if not g_fast_rearm generate
     p_is_valid : process(all)
     begin 
         if rising_edge(clk_0) then 
@@ -122,7 +155,8 @@ begin
                         end if;
                     when READY =>
                         -- First check if the hit has been high long enough
-                        if to_integer(saturation_counter) = g_sat_duration-1 then
+                        -- (>= rather than =, so that lowering `sat_duration_i` during a hit cannot skip the comparison)
+                        if to_integer(saturation_counter) >= sat_duration_i-1 then
                             state <= DONE;
                         else
                             -- Otherwise, check if the hit is still high. If not, return to idle state.
@@ -143,6 +177,53 @@ begin
             end if;
         end if;
     end process p_is_valid;
+    end generate g_legacy;
+
+    --! \brief Fast re-arm: send the leading edge out as soon as the hit qualifies, re-arm on the first low period
+    --! \details The hit qualifies like with the FSM above: `is_saturated` for `sat_duration_i-1` consecutive clk_0 periods,
+    --! the partial period of the leading edge making up the rest. The encoding registers only hold the leading edge in
+    --! the first saturated period (they are rewritten in every saturated period), so it is latched there.
+    g_fast : if g_fast_rearm generate
+        signal sat_count : natural range 0 to 7 := 0;                       --! Consecutive saturated periods of the current hit
+        signal armed     : std_logic := '1';                                --! The current hit has not been sent out yet
+        signal lead_ts   : std_logic_vector(g_coarse_bits+10 downto 0);     --! Timestamp of the leading edge of the current hit
+    begin
+        p_fast : process(all)
+            variable ts   : std_logic_vector(g_coarse_bits+10 downto 0);
+            variable need : natural range 1 to 7;
+        begin
+            if rising_edge(clk_0) then
+                valid_o <= '0';
+                need := 1;
+                if sat_duration_i > 2 then
+                    need := sat_duration_i - 1;
+                end if;
+                if reset_i = '1' then
+                    sat_count   <= 0;
+                    armed       <= '1';
+                    timestamp_o <= (others => '0');
+                elsif is_saturated = '0' then
+                    sat_count <= 0;
+                    armed     <= '1';
+                else
+                    if sat_count = 0 then
+                        ts := true_coarse_period & encoded_fine_time & g_channel_id_s;
+                        lead_ts <= ts;
+                    else
+                        ts := lead_ts;
+                    end if;
+                    if sat_count < 7 then
+                        sat_count <= sat_count + 1;
+                    end if;
+                    if (armed = '1') and (sat_count + 1 >= need) then
+                        valid_o     <= '1';
+                        timestamp_o <= ts;
+                        armed       <= '0';
+                    end if;
+                end if;
+            end if;
+        end process p_fast;
+    end generate g_fast;
 
     --! \brief Encode the fine arrival time of the hit within the coarse (RF) clock period. 
     --! \details The fine time will be encoded by a 5-bit value representing one of the 32 0.58ns time intervals making up the RF clock period.
@@ -161,7 +242,7 @@ begin
                 -- Now we have to look at the previous hit state using the fine_last signal which has been delayed by one clk0 cycle.
                 -- Because of the 2 clock0 cycle latency, if the true fine period is 01,10, or 11 (hit arrived after 1/4 of RF period), 
                 -- then we need to decrement the coarse counter (RF bucket ID). Otherwise, use the current RF bucket ID. 
-                if fine_last(9 downto 2) = "00000000" then   -- hit arrived b/w 135fe and 0re
+                if fine_prev = "00000000" then   -- hit arrived b/w 135fe and 0re
                     case true_fine_period is 
                         when "00" =>    -- Range 0-7
                             encoded_fine_time <= std_logic_vector(to_unsigned(7, encoded_fine_time'length));
@@ -191,7 +272,7 @@ begin
                         when others => 
                             null;
                     end case;
-                elsif fine_last(9 downto 2) = "00000001" then   -- hit arrived b/w 90fe and 135fe
+                elsif fine_prev = "00000001" then   -- hit arrived b/w 90fe and 135fe
                     case true_fine_period is 
                         when "00" =>    -- Range 0-7
                             encoded_fine_time <= std_logic_vector(to_unsigned(6, encoded_fine_time'length));
@@ -209,7 +290,7 @@ begin
                         when others => 
                             null;
                     end case;
-                elsif fine_last(9 downto 2) = "00000011" then   -- hit arrived b/w 45fe and 90fe
+                elsif fine_prev = "00000011" then   -- hit arrived b/w 45fe and 90fe
                     case true_fine_period is 
                         when "00" =>    -- Range 0-7
                             encoded_fine_time <= std_logic_vector(to_unsigned(5, encoded_fine_time'length));
@@ -227,7 +308,7 @@ begin
                         when others => 
                             null;
                     end case;
-                elsif fine_last(9 downto 2) = "00000111" then   -- hit arrived b/w 0fe and 45fe
+                elsif fine_prev = "00000111" then   -- hit arrived b/w 0fe and 45fe
                     case true_fine_period is 
                         when "00" =>    -- Range 0-7
                             encoded_fine_time <= std_logic_vector(to_unsigned(4, encoded_fine_time'length));
@@ -245,7 +326,7 @@ begin
                         when others => 
                             null;
                     end case;
-                elsif fine_last(9 downto 2) = "00001111" then   -- hit arrived b/w 135re and 0fe
+                elsif fine_prev = "00001111" then   -- hit arrived b/w 135re and 0fe
                     case true_fine_period is 
                         when "00" =>    -- Range 0-7
                             encoded_fine_time <= std_logic_vector(to_unsigned(3, encoded_fine_time'length));
@@ -263,7 +344,7 @@ begin
                         when others => 
                             null;
                     end case;
-                elsif fine_last(9 downto 2) = "00011111" then   -- hit arrived b/w 90re and 135re
+                elsif fine_prev = "00011111" then   -- hit arrived b/w 90re and 135re
                     case true_fine_period is 
                         when "00" =>    -- Range 0-7
                             encoded_fine_time <= std_logic_vector(to_unsigned(2, encoded_fine_time'length));
@@ -281,7 +362,7 @@ begin
                         when others => 
                             null;
                     end case;
-                elsif fine_last(9 downto 2) = "00111111" then   -- hit arrived b/w 45re and 90re
+                elsif fine_prev = "00111111" then   -- hit arrived b/w 45re and 90re
                     case true_fine_period is 
                         when "00" =>    -- Range 0-7
                             encoded_fine_time <= std_logic_vector(to_unsigned(1, encoded_fine_time'length));
@@ -299,7 +380,7 @@ begin
                         when others => 
                             null;
                     end case;
-                --elsif fine_last(9 downto 2) = "01111111" then   -- hit arrived b/w 0re and 45re
+                --elsif fine_prev = "01111111" then   -- hit arrived b/w 0re and 45re
                 else -- avoid latch being inferred
                     case true_fine_period is 
                         when "00" =>    -- Range 0-7
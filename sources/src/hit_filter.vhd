@@ -0,0 +1,68 @@
+---------------------------------------------------------------------------------------------------------
+--! \file hit_filter.vhd
+--! \brief Per-channel hit filter: channel mask, prescale and rate limit, set at runtime by the \ref tdc_ctrl.vhd "control block".
+--!
+--! \details Sits between a TDC channel and its ring buffer, so that the hits of a masked, prescaled or rate-limited channel
+--! never take up space in the buffers or bandwidth in the arbiter tree. A hit of an enabled channel passes if it is the first
+--! of every `prescale` hits (0 and 1 keep all of them), and if fewer than `limit` hits have passed since the last `limit_tick`
+--! (0 disables the limit). The output is combinational, so the hit data needs no extra register stage.
+--!
+--! \author Amitav Mitra, amitra3@jhu.edu
+---------------------------------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+
+--! \brief Per-channel hit filter: channel mask, prescale and rate limit, set at runtime by the \ref tdc_ctrl.vhd "control block".
+--!
+--! \details See the file documentation.
+entity hit_filter is
+    port (
+        clk0       : in std_logic;                      --! 0 degree (212.4 MHz, 4x RF) clock
+        reset      : in std_logic;                      --! Active high reset
+        enable     : in std_logic;                      --! Channel enabled
+        prescale   : in natural range 0 to 65535;       --! Keep one hit of every `prescale` (0 and 1 keep all)
+        limit      : in natural range 0 to 255;         --! Hits passed per limit period at most (0 => no limit)
+        limit_tick : in std_logic;                      --! Start of a limit period
+        valid_i    : in std_logic;                      --! Hit from the channel
+        valid_o    : out std_logic                      --! Hit passed to the ring buffer
+    );
+end hit_filter;
+
+architecture RTL of hit_filter is
+
+    signal pre_count : natural range 0 to 65535 := 0;  --! Hits of the enabled channel since the last one kept by the prescale
+    signal lim_count : natural range 0 to 255 := 0;    --! Hits passed in the current limit period
+    signal pass      : std_logic;
+
+begin
+
+    pass <= '1' when enable = '1' and pre_count = 0 and (limit = 0 or lim_count < limit) else '0';
+    valid_o <= valid_i and pass;
+
+    --! \brief Count the hits for the prescale and the rate limit
+    p_count : process(all)
+    begin
+        if rising_edge(clk0) then
+            if (reset = '1') then
+                pre_count <= 0;
+                lim_count <= 0;
+            else
+                if (valid_i = '1') and (enable = '1') then
+                    if pre_count + 1 >= prescale then
+                        pre_count <= 0;
+                    else
+                        pre_count <= pre_count + 1;
+                    end if;
+                end if;
+                if (limit_tick = '1') then
+                    lim_count <= 0;
+                elsif (valid_i = '1') and (pass = '1') and (lim_count < 255) then
+                    lim_count <= lim_count + 1;
+                end if;
+            end if;
+        end if;
+    end process p_count;
+
+end RTL;
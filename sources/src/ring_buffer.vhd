@@ -34,7 +34,7 @@ entity ring_buffer is
   
     -- Flags
     empty : out std_logic;        --! High if buffer is empty, low otherwise. Used by arbiter to indicate a request to write to shared memory.
-    empty_next : out std_logic;   --! High if buffer will be empty after next read transaction (currently unused).
+    empty_next : out std_logic;   --! High if buffer will be empty after next read transaction (used by the arbiters to skip a buffer whose last word is being read).
     full : out std_logic;         --! High if buffer is full, low otherwise (currently unused).
     full_next : out std_logic;    --! High if buffer will be full after next write transaction (currently unused).
   
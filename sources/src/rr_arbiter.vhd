@@ -0,0 +1,172 @@
+---------------------------------------------------------------------------------------------------------
+--! \file rr_arbiter.vhd
+--! \brief A pipelined round-robin N:1 arbiter that sends N parallel data streams to one serial output stream.
+--!
+--! \details This module describes a round-robin arbiter with any number of requesters. Every requester is a `ring_buffer`
+--! hit FIFO, whose empty, read_valid and read_data signals are input to this module. The arbiter grants one non-empty FIFO
+--! a read per clock cycle in round robin order (registered grant) and sends the word the FIFO returns downstream together
+--! with a single valid pulse, so a busy arbiter moves one word per clock cycle.
+--!
+--! The empty flag of a FIFO only drops one cycle after the read that emptied it, so a FIFO holding a single word would still
+--! request a read in the cycle its last word is read out and could be granted again for nothing. The `empty_next` flags of
+--! the FIFOs (`empty_next_in`) remove that stale request: a FIFO that is being read this cycle and will be empty after it
+--! does not request. Left open, the stale requests stay and only cost the wasted grant.
+--!
+--! Two generics add register stages for timing closure at higher clk0 frequencies or large fan-in:
+--! - `g_req_stages` registers the request vector (the inverted empty flags) before the arbitration. The arbiter then sees
+--!   the empty flags late and may grant a FIFO that just ran empty; such a read is ignored by the \ref ring_buffer.vhd
+--!   "ring buffer" and only costs one cycle, no word is lost or duplicated.
+--! - `g_out_stages` registers the output word and valid flag, delaying them without changing the throughput.
+--!
+--! Unlike the \ref rr_arbiter_41.vhd "4:1 arbiter", whose valid flag stays high for two or more cycles per word, this
+--! arbiter raises its valid flag for exactly one cycle per word. Trees of these arbiters are built by the
+--! \ref arbiter_tree.vhd "arbiter tree".
+--!
+--! \author Amitav Mitra, amitra3@jhu.edu
+---------------------------------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+
+--! Use SlvArray for data input from requester FIFOs
+use work.common_types.all;
+
+--! \brief A pipelined round-robin N:1 arbiter that sends N parallel data streams to one serial output stream.
+--!
+--! \details Grants one non-empty requester FIFO a read per clock cycle in round robin order and sends the word it returns
+--! downstream with a single valid pulse. `g_req_stages` and `g_out_stages` add register stages on the requests and on the
+--! output for timing closure.
+entity rr_arbiter is
+    generic (
+        DWIDTH       : natural  := 39;  --! Data word width from requester FIFOs
+        g_inputs     : positive := 4;   --! Number of requester FIFOs
+        g_req_stages : natural  := 0;   --! Register stages on the request vector before the arbitration
+        g_out_stages : natural  := 0    --! Register stages on the output word and valid flag
+    );
+    port (
+        -- Input from requesters
+        empty_in : std_logic_vector(0 to g_inputs-1);               --! Empty signals from requester FIFOs. Zero indicates the FIFO requests a read
+        valid_in : std_logic_vector(0 to g_inputs-1);               --! Read valid signals from requester FIFOs. Nonzero values indicate the FIFO is exposing data to be read by the arbiter.
+        data_in  : SlvArray(0 to g_inputs-1)(DWIDTH-1 downto 0);    --! Array of data to be read from requester FIFOs.
+        empty_next_in : std_logic_vector(0 to g_inputs-1) := (others => '0'); --! Empty next signals from requester FIFOs. One indicates the FIFO is empty after its next read
+        -- Control inputs
+        clk      : in std_logic;    --! 4x RF clock
+        rst      : in std_logic;    --! Synchronous, active high reset
+        -- Outputs
+        enable_out : out std_logic_vector(0 to g_inputs-1);     --! Read enable signals sent to requester FIFOs.
+        data_out   : out std_logic_vector(DWIDTH-1 downto 0);   --! Data from granted requester, sent out for further storage.
+        valid_out  : out std_logic                              --! Pulse sent to the write enable port of the next storage module (either intermediate hit buffer or final hit storage BRAM)
+    );
+end rr_arbiter;
+
+architecture Behavioral of rr_arbiter is
+
+    type t_req_pipe is array (0 to g_req_stages) of std_logic_vector(0 to g_inputs-1);
+    type t_data_pipe is array (0 to g_out_stages) of std_logic_vector(DWIDTH-1 downto 0);
+
+    --! Request vector (inverted empty flags) and its register stages, the arbitration uses the last one
+    signal req_pipe   : t_req_pipe;
+    --! Round robin mask: FIFOs after the one granted last, which have priority over the ones up to it
+    signal rr_mask    : std_logic_vector(0 to g_inputs-1) := (others => '0');
+    --! Output word and valid flag and their register stages, the last one is sent out
+    signal data_pipe  : t_data_pipe;
+    signal valid_pipe : std_logic_vector(0 to g_out_stages);
+
+    --! Lowest requesting FIFO, -1 if no FIFO requests a read
+    function first_req(req : std_logic_vector) return integer is
+    begin
+        for i in req'range loop
+            if req(i) = '1' then
+                return i;
+            end if;
+        end loop;
+        return -1;
+    end function;
+
+begin
+
+    -- Invert the empty signals from the FIFOs to act as the request register, without the FIFOs whose last word is being read
+    req_pipe(0) <= not empty_in and not (enable_out and empty_next_in);
+
+    --! \brief Optional register stages on the request vector
+    g_req_pipe : for k in 1 to g_req_stages generate
+        p_req_stage : process(all)
+        begin
+            if rising_edge(clk) then
+                if rst = '1' then
+                    req_pipe(k) <= (others => '0');
+                else
+                    req_pipe(k) <= req_pipe(k-1);
+                end if;
+            end if;
+        end process p_req_stage;
+    end generate g_req_pipe;
+
+    --! \brief Perform the round robin arbitration to grant access to the shared resource.
+    --! \details Two stage pipeline moving one word per clock cycle. In the first stage the next requesting FIFO in round robin
+    --! order is granted a read for one clock period: the lowest requesting FIFO after the one granted last, or the lowest
+    --! requesting FIFO if there is none after it. In the second stage the word a FIFO returns with its read valid flag is sent
+    --! out with a single valid pulse. Only the FIFO granted in the previous cycle can return a read valid flag, so the output
+    --! is the OR of the valid words rather than a priority multiplexer.
+    arbitrate : process(all)
+        variable v_req   : std_logic_vector(0 to g_inputs-1);
+        variable v_grant : integer range -1 to g_inputs-1;
+        variable v_data  : std_logic_vector(DWIDTH-1 downto 0);
+    begin
+        if rising_edge(clk) then
+            if rst = '1' then
+                valid_pipe(0) <= '0';
+                data_pipe(0)  <= (others => '0');
+                enable_out    <= (others => '0');
+                rr_mask       <= (others => '0');
+            else
+                -- Stage 1: grant a read to the next requesting FIFO (round robin)
+                v_req   := req_pipe(g_req_stages);
+                v_grant := first_req(v_req and rr_mask);
+                if v_grant < 0 then
+                    v_grant := first_req(v_req);
+                end if;
+                enable_out <= (others => '0');
+                if v_grant >= 0 then
+                    enable_out(v_grant) <= '1';
+                    for i in 0 to g_inputs-1 loop
+                        if i > v_grant then
+                            rr_mask(i) <= '1';
+                        else
+                            rr_mask(i) <= '0';
+                        end if;
+                    end loop;
+                end if;
+                -- Stage 2: send out the word read by the previous grant
+                v_data := (others => '0');
+                for i in 0 to g_inputs-1 loop
+                    if valid_in(i) = '1' then
+                        v_data := v_data or data_in(i);
+                    end if;
+                end loop;
+                data_pipe(0)  <= v_data;
+                valid_pipe(0) <= or valid_in;
+            end if;
+        end if;
+    end process arbitrate;
+
+    --! \brief Optional register stages on the output word and valid flag
+    g_out_pipe : for k in 1 to g_out_stages generate
+        p_out_stage : process(all)
+        begin
+            if rising_edge(clk) then
+                if rst = '1' then
+                    valid_pipe(k) <= '0';
+                else
+                    valid_pipe(k) <= valid_pipe(k-1);
+                end if;
+                data_pipe(k) <= data_pipe(k-1);
+            end if;
+        end process p_out_stage;
+    end generate g_out_pipe;
+
+    data_out  <= data_pipe(g_out_stages);
+    valid_out <= valid_pipe(g_out_stages);
+
+end Behavioral;
@@ -0,0 +1,310 @@
+---------------------------------------------------------------------------------------------------------
+--! \file tdc_ctrl.vhd
+--! \brief AXI4-Lite control block setting the channel mask, the hit qualification of every channel and the trigger window at runtime.
+--!
+--! \details The channel set, the minimum hit width (`g_sat_duration`) and the per-channel hit rate used to be fixed at
+--! synthesis time. This block holds them in registers that the PS writes at startup, and drives, in the clk0 domain:
+--! - the enable of every channel: the hits of a disabled channel are dropped before its ring buffer
+--! - the minimum width of every channel, in clk0 periods (1 to 7), used by its \ref encoder.vhd "encoder"
+--! - the prescale of every channel: only one hit of every `prescale` is kept (0 and 1 keep all of them)
+--! - the rate limit of every channel: at most `limit` hits per `2^g_limit_bits` clk0 cycles (0 disables the limit)
+--! - the trigger window `[t_trig - lookback, t_trig - lookback + width)` of the \ref trigger_match.vhd "`trigger_match`"
+--!   block, in coarse periods, used by the firmware built in trigger matching mode and ignored otherwise
+--!
+--! The filters are applied by a \ref hit_filter.vhd "`hit_filter`" in front of every channel ring buffer, so a noisy channel
+--! no longer takes up bandwidth in the arbiter tree and the BRAMs. The statistics block still counts the hits out of the
+--! encoder of a filtered channel (CH_HITS), but not in CH_DROPS or CH_WRITTEN.
+--!
+--! The PS writes the settings into shadow registers in the AXI clock domain, then writes `CTRL.APPLY`: all the settings are
+--! copied into the clk0 domain at once, and `CTRL.PENDING` reads 1 until they are. Writes (the settings and `APPLY`) are
+--! ignored while the copy is pending, so the shadow registers are stable while they are sampled from clk0; only the request
+--! and its acknowledge cross the clock domains, through toggle synchronizers, as in the \ref tdc_stats.vhd "statistics block".
+--! Software must therefore wait for `CTRL.PENDING` to read 0 before it writes. An ignored write, or one that is not a full
+--! word, still gets an OKAY response: an SLVERR on a write from the APU is reported as an asynchronous SError, which takes
+--! the whole kernel down rather than the writer. It sets the sticky `CTRL.DROPPED` instead, which reads 1 until CTRL is
+--! read, so software checks it after the apply.
+--! After a reset, every channel is enabled with the minimum width `g_sat_duration`, no prescale and no rate limit, and the
+--! trigger window is the one given by `g_match_lookback` and `g_match_width`, which is how the firmware behaved without this
+--! block.
+--!
+--! Register map (32-bit registers, byte offsets):
+--! \verbatim
+--! 0x000         ID          0x4C434454 ("TDCL" when read as bytes)
+--! 0x004         CTRL        W: [0] APPLY   R: [0] PENDING, [1] DROPPED (a write was ignored, cleared by the read)
+--! 0x008         SEQ         Number of times the settings were applied since reset
+--! 0x00C         CONFIG      [7:0] g_sat_duration, [15:8] channels, [23:16] g_limit_bits, [31:24] version (2)
+--! 0x010         ENABLE_LO   Enable of channels 0-31, one bit per channel (reset: all ones)
+--! 0x014         ENABLE_HI   Enable of channels 32-63
+--! 0x018         MIN_WIDTH   [2:0] minimum width of the channels that do not set their own (reset: g_sat_duration)
+--! 0x01C         LOOKBACK    [g_win_bits-1:0] start of the trigger window before the trigger (reset: g_match_lookback)
+--! 0x020         WIDTH       [g_win_bits-1:0] length of the trigger window (reset: g_match_width)
+--! 0x024         WIN_RESET   R: [15:0] g_match_lookback, [31:16] g_match_width (version 2 on)
+--! 0x100 + 4*ch  CH_CFG      [2:0] minimum width of channel ch (0 => MIN_WIDTH), [15:8] rate limit, [31:16] prescale
+--! \endverbatim
+--!
+--! \author Amitav Mitra, amitra3@jhu.edu
+---------------------------------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+
+--! Use IntArray for the per-channel settings
+use work.common_types.all;
+
+--! \brief AXI4-Lite control block setting the channel mask, the hit qualification of every channel and the trigger window at runtime.
+--!
+--! \details Holds the settings written by the PS and applies them all at once in the clk0 domain. See the file documentation
+--! for the register map.
+entity tdc_ctrl is
+    generic (
+        g_channels     : natural := 64;     --! Number of TDC channels (at most 64)
+        g_sat_duration : natural := 3;      --! Minimum width of every channel after a reset (clk0 periods, 1 to 7)
+        g_limit_bits   : natural := 12;     --! The rate limit period is 2^g_limit_bits clk0 cycles (~19 us by default)
+        g_win_bits     : natural := 16;     --! Width of the trigger window settings (at most 16)
+        g_match_lookback : natural := 0;    --! Start of the trigger window before the trigger after a reset (coarse periods)
+        g_match_width    : natural := 0     --! Length of the trigger window after a reset (coarse periods)
+    );
+    port (
+        -- Settings [clk0]
+        clk0          : in std_logic;                                   --! 0 degree (212.4 MHz, 4x RF) clock
+        reset         : in std_logic;                                   --! Active high reset [clk0], restores the reset settings
+        ch_enable     : out std_logic_vector(0 to g_channels-1);        --! Enable of every channel
+        ch_sat        : out IntArray(0 to g_channels-1);                --! Minimum width of every channel (clk0 periods)
+        ch_prescale   : out IntArray(0 to g_channels-1);                --! Prescale of every channel
+        ch_limit      : out IntArray(0 to g_channels-1);                --! Rate limit of every channel (hits per period)
+        limit_tick    : out std_logic;                                  --! Start of a rate limit period
+        match_lookback : out std_logic_vector(g_win_bits-1 downto 0);  --! Start of the trigger window before the trigger (coarse periods)
+        match_width   : out std_logic_vector(g_win_bits-1 downto 0);   --! Length of the trigger window (coarse periods)
+        -- AXI4-Lite slave [s_axi_aclk]
+        s_axi_aclk    : in std_logic;                       --! AXI clock
+        s_axi_aresetn : in std_logic;                       --! AXI reset, active low
+        s_axi_awaddr  : in std_logic_vector(11 downto 0);   --! Write address
+        s_axi_awvalid : in std_logic;                       --! Write address valid
+        s_axi_awready : out std_logic;                      --! Write address ready
+        s_axi_wdata   : in std_logic_vector(31 downto 0);   --! Write data
+        s_axi_wstrb   : in std_logic_vector(3 downto 0);    --! Write byte strobes (only full word writes are supported)
+        s_axi_wvalid  : in std_logic;                       --! Write data valid
+        s_axi_wready  : out std_logic;                      --! Write data ready
+        s_axi_bresp   : out std_logic_vector(1 downto 0);   --! Write response (always OKAY, see `CTRL.DROPPED`)
+        s_axi_bvalid  : out std_logic;                      --! Write response valid
+        s_axi_bready  : in std_logic;                       --! Write response ready
+        s_axi_araddr  : in std_logic_vector(11 downto 0);   --! Read address
+        s_axi_arvalid : in std_logic;                       --! Read address valid
+        s_axi_arready : out std_logic;                      --! Read address ready
+        s_axi_rdata   : out std_logic_vector(31 downto 0);  --! Read data
+        s_axi_rresp   : out std_logic_vector(1 downto 0);   --! Read response (always OKAY)
+        s_axi_rvalid  : out std_logic;                      --! Read data valid
+        s_axi_rready  : in std_logic                        --! Read data ready
+    );
+end tdc_ctrl;
+
+architecture RTL of tdc_ctrl is
+
+    constant c_id      : std_logic_vector(31 downto 0) := x"4C434454";  --! "TDCL"
+    constant c_version : natural := 2;
+    constant c_lookback_rst : std_logic_vector(g_win_bits-1 downto 0) := std_logic_vector(to_unsigned(g_match_lookback, g_win_bits));
+    constant c_width_rst    : std_logic_vector(g_win_bits-1 downto 0) := std_logic_vector(to_unsigned(g_match_width, g_win_bits));
+
+    type t_reg_array is array (natural range <>) of std_logic_vector(31 downto 0);
+
+    ------------------------------------------------------------------------
+    -- AXI domain: shadow registers written by the PS
+    ------------------------------------------------------------------------
+    signal enable_r    : std_logic_vector(63 downto 0) := (others => '1');
+    signal min_width_r : std_logic_vector(2 downto 0) := std_logic_vector(to_unsigned(g_sat_duration, 3));
+    signal ch_cfg_r    : t_reg_array(0 to g_channels-1) := (others => (others => '0'));
+    signal lookback_r  : std_logic_vector(g_win_bits-1 downto 0) := c_lookback_rst;
+    signal width_r     : std_logic_vector(g_win_bits-1 downto 0) := c_width_rst;
+    signal req_toggle  : std_logic := '0';                              --! Flipped by every apply request
+    signal ack_sync    : std_logic_vector(0 to 1) := (others => '0');   --! Synchronized acknowledge toggle
+    signal pending     : std_logic;                                     --! Apply requested but not done yet
+    signal dropped_r   : std_logic := '0';                              --! A write was ignored since CTRL was last read
+    signal dropped_clr : std_logic := '0';                              --! CTRL was read with DROPPED set
+    signal awready_s   : std_logic := '0';
+    signal bvalid_s    : std_logic := '0';
+    signal arready_s   : std_logic := '0';
+    signal rvalid_s    : std_logic := '0';
+
+    ------------------------------------------------------------------------
+    -- clk0 domain
+    ------------------------------------------------------------------------
+    signal req_sync   : std_logic_vector(0 to 2) := (others => '0');   --! Synchronized request toggle, last two stages detect the change
+    signal ack_toggle : std_logic := '0';                              --! Follows the request toggle once the settings are applied
+    signal apply_seq  : unsigned(31 downto 0) := (others => '0');
+    signal tick_count : unsigned(g_limit_bits-1 downto 0) := (others => '0');
+
+    attribute ASYNC_REG : string;
+    attribute ASYNC_REG of req_sync : signal is "TRUE";
+    attribute ASYNC_REG of ack_sync : signal is "TRUE";
+
+    --! Minimum width of a channel from its CH_CFG register and MIN_WIDTH, at least one clk0 period
+    function width(cfg : std_logic_vector(31 downto 0); global : std_logic_vector(2 downto 0)) return natural is
+        variable w : natural := to_integer(unsigned(cfg(2 downto 0)));
+    begin
+        if w = 0 then
+            w := to_integer(unsigned(global));
+        end if;
+        if w = 0 then
+            return 1;
+        end if;
+        return w;
+    end function;
+
+begin
+
+    assert g_channels <= 64 and g_sat_duration >= 1 and g_sat_duration <= 7
+        report "tdc_ctrl: at most 64 channels, and a minimum width of 1 to 7 clk0 periods" severity failure;
+    assert g_win_bits <= 16 and g_match_lookback < 2**g_win_bits and g_match_width < 2**g_win_bits
+        report "tdc_ctrl: the trigger window settings are at most 16 bits wide" severity failure;
+
+    --! \brief Apply the settings and time the rate limit periods
+    --! \details The settings are copied in the cycle the synchronized request toggle changes. The shadow registers do not
+    --! change while the request is pending, so they are stable when sampled here.
+    p_apply : process(all)
+    begin
+        if rising_edge(clk0) then
+            req_sync   <= req_toggle & req_sync(0 to 1);
+            ack_toggle <= req_sync(2);
+
+            tick_count <= tick_count + 1;
+            limit_tick <= '0';
+            if tick_count = 0 then
+                limit_tick <= '1';
+            end if;
+
+            if (reset = '1') then
+                apply_seq <= (others => '0');
+                for c in 0 to g_channels-1 loop
+                    ch_enable(c)   <= '1';
+                    ch_sat(c)      <= g_sat_duration;
+                    ch_prescale(c) <= 0;
+                    ch_limit(c)    <= 0;
+                end loop;
+                match_lookback <= c_lookback_rst;
+                match_width    <= c_width_rst;
+            elsif req_sync(1) /= req_sync(2) then
+                apply_seq <= apply_seq + 1;
+                for c in 0 to g_channels-1 loop
+                    ch_enable(c)   <= enable_r(c);
+                    ch_sat(c)      <= width(ch_cfg_r(c), min_width_r);
+                    ch_prescale(c) <= to_integer(unsigned(ch_cfg_r(c)(31 downto 16)));
+                    ch_limit(c)    <= to_integer(unsigned(ch_cfg_r(c)(15 downto 8)));
+                end loop;
+                match_lookback <= lookback_r;
+                match_width    <= width_r;
+            end if;
+        end if;
+    end process p_apply;
+
+    ------------------------------------------------------------------------
+    -- AXI4-Lite slave
+    ------------------------------------------------------------------------
+    pending <= req_toggle xor ack_sync(1);
+
+    s_axi_awready <= awready_s;
+    s_axi_wready  <= awready_s;
+    s_axi_bvalid  <= bvalid_s;
+    s_axi_bresp   <= "00";
+    s_axi_arready <= arready_s;
+    s_axi_rvalid  <= rvalid_s;
+    s_axi_rresp   <= "00";
+
+    --! \brief Write channel: accept the address and data together, writes are ignored (and flagged) while an apply is pending
+    p_axi_write : process(all)
+        variable w : natural range 0 to 1023;
+    begin
+        if rising_edge(s_axi_aclk) then
+            ack_sync <= ack_toggle & ack_sync(0);
+            if dropped_clr = '1' then
+                dropped_r <= '0';
+            end if;
+            if s_axi_aresetn = '0' then
+                awready_s   <= '0';
+                bvalid_s    <= '0';
+                req_toggle  <= '0';
+                dropped_r   <= '0';
+                enable_r    <= (others => '1');
+                min_width_r <= std_logic_vector(to_unsigned(g_sat_duration, 3));
+                ch_cfg_r    <= (others => (others => '0'));
+                lookback_r  <= c_lookback_rst;
+                width_r     <= c_width_rst;
+            elsif awready_s = '1' then
+                -- Address and data handshakes complete at this edge
+                awready_s <= '0';
+                bvalid_s  <= '1';
+                w := to_integer(unsigned(s_axi_awaddr(11 downto 2)));
+                if s_axi_wstrb = "1111" and pending = '0' then
+                    case w is
+                        when 1 =>
+                            if s_axi_wdata(0) = '1' then
+                                req_toggle <= not req_toggle;
+                            end if;
+                        when 4 => enable_r(31 downto 0)  <= s_axi_wdata;
+                        when 5 => enable_r(63 downto 32) <= s_axi_wdata;
+                        when 6 => min_width_r <= s_axi_wdata(2 downto 0);
+                        when 7 => lookback_r  <= s_axi_wdata(g_win_bits-1 downto 0);
+                        when 8 => width_r     <= s_axi_wdata(g_win_bits-1 downto 0);
+                        when others =>
+                            if w >= 64 and w < 64 + g_channels then
+                                ch_cfg_r(w - 64) <= s_axi_wdata;
+                            end if;
+                    end case;
+                else
+                    -- After the clear above, so a write ignored as CTRL is read is reported by the next read
+                    dropped_r <= '1';
+                end if;
+            elsif bvalid_s = '1' then
+                if s_axi_bready = '1' then
+                    bvalid_s <= '0';
+                end if;
+            elsif s_axi_awvalid = '1' and s_axi_wvalid = '1' then
+                awready_s <= '1';
+            end if;
+        end if;
+    end process p_axi_write;
+
+    --! \brief Read channel: one register per read, the settings as written (see the register map)
+    p_axi_read : process(all)
+        variable w : natural range 0 to 1023;
+    begin
+        if rising_edge(s_axi_aclk) then
+            dropped_clr <= '0';
+            if s_axi_aresetn = '0' then
+                arready_s <= '0';
+                rvalid_s  <= '0';
+            elsif arready_s = '1' then
+                arready_s   <= '0';
+                rvalid_s    <= '1';
+                w := to_integer(unsigned(s_axi_araddr(11 downto 2)));
+                s_axi_rdata <= (others => '0');
+                case w is
+                    when 0 => s_axi_rdata <= c_id;
+                    when 1 =>
+                        s_axi_rdata(0) <= pending;
+                        s_axi_rdata(1) <= dropped_r;
+                        dropped_clr    <= dropped_r;    -- Only clear what this read reports
+                    when 2 => s_axi_rdata <= std_logic_vector(apply_seq);
+                    when 3 => s_axi_rdata <= std_logic_vector(to_unsigned(g_sat_duration + 256 * g_channels + 65536 * g_limit_bits + 2**24 * c_version, 32));
+                    when 4 => s_axi_rdata <= enable_r(31 downto 0);
+                    when 5 => s_axi_rdata <= enable_r(63 downto 32);
+                    when 6 => s_axi_rdata(2 downto 0) <= min_width_r;
+                    when 7 => s_axi_rdata(g_win_bits-1 downto 0) <= lookback_r;
+                    when 8 => s_axi_rdata(g_win_bits-1 downto 0) <= width_r;
+                    when 9 => s_axi_rdata <= std_logic_vector(to_unsigned(g_match_width, 16)) & std_logic_vector(to_unsigned(g_match_lookback, 16));
+                    when others =>
+                        if w >= 64 and w < 64 + g_channels then
+                            s_axi_rdata <= ch_cfg_r(w - 64);
+                        end if;
+                end case;
+            elsif rvalid_s = '1' then
+                if s_axi_rready = '1' then
+                    rvalid_s <= '0';
+                end if;
+            elsif s_axi_arvalid = '1' then
+                arready_s <= '1';
+            end if;
+        end if;
+    end process p_axi_read;
+
+end RTL;
@@ -0,0 +1,414 @@
+---------------------------------------------------------------------------------------------------------
+--! \file tdc_stats.vhd
+--! \brief AXI4-Lite statistics block counting the hits, overflows and buffer occupancy at every stage of the TDC pipeline.
+--!
+--! \details Hits can be lost at three places between the discriminators and the BRAMs: a channel ring buffer, a layer 1
+--! (`TDC_4ch`) buffer or a layer 2 (arbiter tree) buffer may be full when a hit arrives, or the BRAM may wrap around before
+--! the trigger and overwrite the oldest hits. This module counts, in the clk0 domain:
+--! - per channel: the hits out of the encoder, the hits dropped by the channel's full ring buffer and the hits written to BRAM
+--! - per buffer: the words written, the words dropped because the buffer was full, and the high-water mark of its fill count
+--! - at the BRAM writer: the words written, the words that overwrote an older hit and the high-water mark of the BRAM fill
+--! - the clk0 cycles covered, to turn the counts into rates
+--!
+--! It also times the trigger handshake with the PS on a free-running 64-bit clk0 cycle counter: the trigger accepted by the
+--! BRAM writer, the interrupt raised, `rd_busy` raised by the PS and `rd_busy` lowered again. When `rd_busy` falls, the four
+--! timestamps of the handshake are latched together into the LAT registers and LAT_SEQ is incremented. The LAT registers
+--! only change when `rd_busy` falls, so the PS can read them while it holds `rd_busy` high for the next trigger, or after it
+--! lowered it once LAT_SEQ has moved on, until it raises it again. They are not part of the snapshot.
+--!
+--! The PS reads them over AXI4-Lite through a snapshot: writing `CTRL.SNAPSHOT` copies all counters at once into snapshot
+--! registers (and with `CTRL.CLEAR` also restarts them from zero and the high-water marks from the current fill), and
+--! `CTRL.PENDING` reads 1 until the copy is done. The snapshot registers do not change until the next snapshot, so they are
+--! read from the AXI clock domain while the counters keep running at clk0; only the request and its acknowledge cross the
+--! clock domains, through toggle synchronizers.
+--!
+--! Register map (32-bit registers, byte offsets):
+--! \verbatim
+--! 0x000         ID          0x54534454 ("TDST" when read as bytes)
+--! 0x004         CTRL        W: [0] SNAPSHOT, [1] CLEAR (with SNAPSHOT)   R: [0] PENDING, [1] CLEAR
+--! 0x008         SEQ         Number of snapshots taken since reset
+--! 0x00C         CONFIG      [7:0] buffers, [15:8] channels, [31:24] version (2)
+--! 0x010/0x014   CYCLES      clk0 cycles since the last clear, low/high word
+--! 0x018         OUT_WORDS   Words written to BRAM
+--! 0x01C         OUT_OVERWR  Words written over an older hit (BRAM wrapped around before the trigger)
+--! 0x020         OUT_HWM     High-water mark of the BRAM fill (words)
+--! 0x024/0x028   TIME        Free-running clk0 cycle counter at the snapshot, low/high word
+--! 0x040         LAT_SEQ     Trigger handshakes completed since reset (not a snapshot)
+--! 0x044/0x048   LAT_TRIG    Time of the trigger of the last completed handshake, low/high word
+--! 0x04C         LAT_IRQ     Time the interrupt was raised, low word
+--! 0x050         LAT_BUSY_SET  Time `rd_busy` was raised, low word
+--! 0x054         LAT_BUSY_CLR  Time `rd_busy` was lowered, low word
+--! 0x100 + 16*b  BUF_WRITES  Words written to buffer b (layer 1 buffers first, then layer 2)
+--! 0x104 + 16*b  BUF_DROPS   Words dropped because buffer b was full
+--! 0x108 + 16*b  BUF_HWM     High-water mark of the fill count of buffer b
+--! 0x400 + 4*ch  CH_HITS     Hits out of the encoder of channel ch
+--! 0x500 + 4*ch  CH_DROPS    Hits dropped because the ring buffer of channel ch was full
+--! 0x600 + 4*ch  CH_WRITTEN  Hits of channel ch written to BRAM
+--! \endverbatim
+--! All counters are 32 bits wide and wrap around (except CYCLES); the PS should snapshot with CLEAR often enough that they
+--! do not (at one hit per clk0 cycle a counter wraps after 20 s). The handshake times are in clk0 cycles of the TIME counter,
+--! their differences are valid modulo 2^32 (up to 20 s).
+--!
+--! \author Amitav Mitra, amitra3@jhu.edu
+---------------------------------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+
+--! Use IntArray for the buffer fill counts
+use work.common_types.all;
+
+--! \brief AXI4-Lite statistics block counting the hits, overflows and buffer occupancy at every stage of the TDC pipeline.
+--!
+--! \details Counts per channel, per buffer and at the BRAM writer in the clk0 domain, and exports a snapshot of the counters
+--! to the PS over AXI4-Lite, together with the timestamps of the last trigger handshake. See the file documentation for
+--! the register map.
+entity tdc_stats is
+    generic (
+        g_channels : natural := 64;     --! Number of TDC channels (at most 64)
+        g_buffers  : natural := 20      --! Number of monitored hit buffers (at most 48)
+    );
+    port (
+        -- Monitored signals [clk0]
+        clk0          : in std_logic;                                   --! 0 degree (212.4 MHz, 4x RF) clock
+        reset         : in std_logic;                                   --! Active high reset [clk0], clears the counters
+        ch_hit        : in std_logic_vector(0 to g_channels-1);         --! Hit out of the encoder of every channel
+        ch_drop       : in std_logic_vector(0 to g_channels-1);         --! Hit dropped by the full ring buffer of every channel
+        buf_wr        : in std_logic_vector(0 to g_buffers-1);          --! Write enables of the monitored buffers
+        buf_full      : in std_logic_vector(0 to g_buffers-1);          --! Full flags of the monitored buffers
+        buf_fill      : in IntArray(0 to g_buffers-1);                  --! Fill counts of the monitored buffers
+        out_valid     : in std_logic;                                   --! Word written to BRAM
+        out_channel   : in std_logic_vector(5 downto 0);                --! Channel ID of the word written to BRAM
+        out_overwrite : in std_logic;                                   --! The word written to BRAM overwrote an older hit
+        out_fill      : in natural;                                     --! Fill count (words) of the BRAM being written
+        hs_trig       : in std_logic := '0';                            --! Trigger accepted by the BRAM writer
+        hs_irq        : in std_logic := '0';                            --! Interrupt raised to the PS
+        hs_busy_set   : in std_logic := '0';                            --! `rd_busy` raised by the PS
+        hs_busy_clr   : in std_logic := '0';                            --! `rd_busy` lowered by the PS, end of the handshake
+        -- AXI4-Lite slave [s_axi_aclk]
+        s_axi_aclk    : in std_logic;                       --! AXI clock
+        s_axi_aresetn : in std_logic;                       --! AXI reset, active low
+        s_axi_awaddr  : in std_logic_vector(11 downto 0);   --! Write address
+        s_axi_awvalid : in std_logic;                       --! Write address valid
+        s_axi_awready : out std_logic;                      --! Write address ready
+        s_axi_wdata   : in std_logic_vector(31 downto 0);   --! Write data
+        s_axi_wstrb   : in std_logic_vector(3 downto 0);    --! Write byte strobes
+        s_axi_wvalid  : in std_logic;                       --! Write data valid
+        s_axi_wready  : out std_logic;                      --! Write data ready
+        s_axi_bresp   : out std_logic_vector(1 downto 0);   --! Write response (always OKAY)
+        s_axi_bvalid  : out std_logic;                      --! Write response valid
+        s_axi_bready  : in std_logic;                       --! Write response ready
+        s_axi_araddr  : in std_logic_vector(11 downto 0);   --! Read address
+        s_axi_arvalid : in std_logic;                       --! Read address valid
+        s_axi_arready : out std_logic;                      --! Read address ready
+        s_axi_rdata   : out std_logic_vector(31 downto 0);  --! Read data
+        s_axi_rresp   : out std_logic_vector(1 downto 0);   --! Read response (always OKAY)
+        s_axi_rvalid  : out std_logic;                      --! Read data valid
+        s_axi_rready  : in std_logic                        --! Read data ready
+    );
+end tdc_stats;
+
+architecture RTL of tdc_stats is
+
+    constant c_id      : std_logic_vector(31 downto 0) := x"54534454";  --! "TDST"
+    constant c_version : natural := 2;
+
+    type t_cnt_array is array (natural range <>) of unsigned(31 downto 0);
+
+    ------------------------------------------------------------------------
+    -- clk0 domain
+    ------------------------------------------------------------------------
+    -- Registered inputs
+    signal ch_hit_r        : std_logic_vector(0 to g_channels-1) := (others => '0');
+    signal ch_drop_r       : std_logic_vector(0 to g_channels-1) := (others => '0');
+    signal buf_wr_r        : std_logic_vector(0 to g_buffers-1) := (others => '0');
+    signal buf_full_r      : std_logic_vector(0 to g_buffers-1) := (others => '0');
+    signal buf_fill_r      : IntArray(0 to g_buffers-1) := (others => 0);
+    signal out_valid_r     : std_logic := '0';
+    signal out_channel_r   : std_logic_vector(5 downto 0) := (others => '0');
+    signal out_overwrite_r : std_logic := '0';
+    signal out_fill_r      : natural := 0;
+    signal hs_r            : std_logic_vector(0 to 3) := (others => '0');  --! trig, irq, busy set, busy clear
+    -- Running counters
+    signal cnt_cycles   : unsigned(63 downto 0) := (others => '0');
+    signal cnt_out      : unsigned(31 downto 0) := (others => '0');
+    signal cnt_overwr   : unsigned(31 downto 0) := (others => '0');
+    signal hwm_out      : natural := 0;
+    signal cnt_buf_wr   : t_cnt_array(0 to g_buffers-1) := (others => (others => '0'));
+    signal cnt_buf_drop : t_cnt_array(0 to g_buffers-1) := (others => (others => '0'));
+    signal hwm_buf      : IntArray(0 to g_buffers-1) := (others => 0);
+    signal cnt_ch_hit   : t_cnt_array(0 to g_channels-1) := (others => (others => '0'));
+    signal cnt_ch_drop  : t_cnt_array(0 to g_channels-1) := (others => (others => '0'));
+    signal cnt_ch_out   : t_cnt_array(0 to g_channels-1) := (others => (others => '0'));
+    -- Handshake timing: free-running time, the handshake in progress and the last completed one
+    signal cnt_time     : unsigned(63 downto 0) := (others => '0');
+    signal hs_trig_t    : unsigned(63 downto 0) := (others => '0');
+    signal hs_irq_t     : unsigned(31 downto 0) := (others => '0');
+    signal hs_set_t     : unsigned(31 downto 0) := (others => '0');
+    signal lat_seq      : unsigned(31 downto 0) := (others => '0');    --! Only written when `rd_busy` falls, read from the AXI domain
+    signal lat_trig     : unsigned(63 downto 0) := (others => '0');
+    signal lat_irq      : unsigned(31 downto 0) := (others => '0');
+    signal lat_set      : unsigned(31 downto 0) := (others => '0');
+    signal lat_clr      : unsigned(31 downto 0) := (others => '0');
+    -- Snapshot registers, only written on a snapshot request and read from the AXI domain
+    signal snap_seq      : unsigned(31 downto 0) := (others => '0');
+    signal snap_cycles   : unsigned(63 downto 0) := (others => '0');
+    signal snap_time     : unsigned(63 downto 0) := (others => '0');
+    signal snap_out      : unsigned(31 downto 0) := (others => '0');
+    signal snap_overwr   : unsigned(31 downto 0) := (others => '0');
+    signal snap_hwm_out  : natural := 0;
+    signal snap_buf_wr   : t_cnt_array(0 to g_buffers-1) := (others => (others => '0'));
+    signal snap_buf_drop : t_cnt_array(0 to g_buffers-1) := (others => (others => '0'));
+    signal snap_hwm_buf  : IntArray(0 to g_buffers-1) := (others => 0);
+    signal snap_ch_hit   : t_cnt_array(0 to g_channels-1) := (others => (others => '0'));
+    signal snap_ch_drop  : t_cnt_array(0 to g_channels-1) := (others => (others => '0'));
+    signal snap_ch_out   : t_cnt_array(0 to g_channels-1) := (others => (others => '0'));
+    -- Snapshot request from the AXI domain
+    signal req_sync   : std_logic_vector(0 to 2) := (others => '0');   --! Synchronized request toggle, last two stages detect the change
+    signal clear_sync : std_logic_vector(0 to 1) := (others => '0');   --! Synchronized clear flag, settled before the request toggle
+    signal ack_toggle : std_logic := '0';                              --! Follows the request toggle once the snapshot is taken
+
+    ------------------------------------------------------------------------
+    -- AXI domain
+    ------------------------------------------------------------------------
+    signal req_toggle : std_logic := '0';                              --! Flipped by every snapshot request
+    signal clear_req  : std_logic := '0';                              --! Clear the counters with the requested snapshot
+    signal ack_sync   : std_logic_vector(0 to 1) := (others => '0');   --! Synchronized acknowledge toggle
+    signal pending    : std_logic;                                     --! Snapshot requested but not taken yet
+    signal awready_s  : std_logic := '0';
+    signal bvalid_s   : std_logic := '0';
+    signal arready_s  : std_logic := '0';
+    signal rvalid_s   : std_logic := '0';
+
+    attribute ASYNC_REG : string;
+    attribute ASYNC_REG of req_sync   : signal is "TRUE";
+    attribute ASYNC_REG of clear_sync : signal is "TRUE";
+    attribute ASYNC_REG of ack_sync   : signal is "TRUE";
+
+    --! Counter value after this cycle: restarted from zero by a clear, incremented by an event
+    function bump(c : unsigned; inc : std_logic; clr : boolean) return unsigned is
+        variable v : unsigned(c'range) := c;
+    begin
+        if clr then
+            v := (others => '0');
+        end if;
+        if inc = '1' then
+            v := v + 1;
+        end if;
+        return v;
+    end function;
+
+    --! High-water mark after this cycle: restarted from the current level by a clear
+    function peak(hwm : natural; level : natural; clr : boolean) return natural is
+    begin
+        if clr or level > hwm then
+            return level;
+        end if;
+        return hwm;
+    end function;
+
+    --! 32-bit register value of a count or fill level
+    function u32(n : natural) return std_logic_vector is
+    begin
+        return std_logic_vector(to_unsigned(n, 32));
+    end function;
+
+begin
+
+    assert g_channels <= 64 and g_buffers <= 48
+        report "tdc_stats: at most 64 channels and 48 buffers fit in the register map" severity failure;
+
+    --! \brief Count every monitored event and take the snapshots
+    --! \details The inputs are registered once to keep the counters off the critical paths of the pipeline. A snapshot is
+    --! taken in the cycle the synchronized request toggle changes: every counter is copied as it was before this cycle, and
+    --! a clear restarts it with the events of this cycle, so no event is lost or counted twice between two snapshots.
+    p_count : process(all)
+        variable v_snap  : boolean;
+        variable v_clear : boolean;
+        variable v_inc   : std_logic;
+    begin
+        if rising_edge(clk0) then
+            ch_hit_r        <= ch_hit;
+            ch_drop_r       <= ch_drop;
+            buf_wr_r        <= buf_wr;
+            buf_full_r      <= buf_full;
+            buf_fill_r      <= buf_fill;
+            out_valid_r     <= out_valid;
+            out_channel_r   <= out_channel;
+            out_overwrite_r <= out_overwrite and out_valid;
+            out_fill_r      <= out_fill;
+            hs_r            <= hs_trig & hs_irq & hs_busy_set & hs_busy_clr;
+
+            req_sync   <= req_toggle & req_sync(0 to 1);
+            clear_sync <= clear_req & clear_sync(0);
+            ack_toggle <= req_sync(2);
+
+            v_snap  := req_sync(1) /= req_sync(2);
+            v_clear := (v_snap and clear_sync(1) = '1') or reset = '1';
+
+            if v_snap then
+                snap_seq      <= snap_seq + 1;
+                snap_cycles   <= cnt_cycles;
+                snap_time     <= cnt_time;
+                snap_out      <= cnt_out;
+                snap_overwr   <= cnt_overwr;
+                snap_hwm_out  <= hwm_out;
+                snap_buf_wr   <= cnt_buf_wr;
+                snap_buf_drop <= cnt_buf_drop;
+                snap_hwm_buf  <= hwm_buf;
+                snap_ch_hit   <= cnt_ch_hit;
+                snap_ch_drop  <= cnt_ch_drop;
+                snap_ch_out   <= cnt_ch_out;
+            end if;
+            if reset = '1' then
+                snap_seq <= (others => '0');
+            end if;
+
+            -- Handshake timestamps (the inputs are registered like the others, so all four are one cycle late)
+            cnt_time <= cnt_time + 1;
+            if hs_r(0) = '1' then
+                hs_trig_t <= cnt_time;
+            end if;
+            if hs_r(1) = '1' then
+                hs_irq_t <= cnt_time(31 downto 0);
+            end if;
+            if hs_r(2) = '1' then
+                hs_set_t <= cnt_time(31 downto 0);
+            end if;
+            if hs_r(3) = '1' then
+                lat_seq  <= lat_seq + 1;
+                lat_trig <= hs_trig_t;
+                lat_irq  <= hs_irq_t;
+                lat_set  <= hs_set_t;
+                lat_clr  <= cnt_time(31 downto 0);
+            end if;
+            if reset = '1' then
+                cnt_time <= (others => '0');
+                lat_seq  <= (others => '0');
+            end if;
+
+            if v_clear then
+                cnt_cycles <= (others => '0');
+            else
+                cnt_cycles <= cnt_cycles + 1;
+            end if;
+            cnt_out    <= bump(cnt_out, out_valid_r, v_clear);
+            cnt_overwr <= bump(cnt_overwr, out_overwrite_r, v_clear);
+            hwm_out    <= peak(hwm_out, out_fill_r, v_clear);
+            for b in 0 to g_buffers-1 loop
+                cnt_buf_wr(b)   <= bump(cnt_buf_wr(b), buf_wr_r(b), v_clear);
+                cnt_buf_drop(b) <= bump(cnt_buf_drop(b), buf_wr_r(b) and buf_full_r(b), v_clear);
+                hwm_buf(b)      <= peak(hwm_buf(b), buf_fill_r(b), v_clear);
+            end loop;
+            for c in 0 to g_channels-1 loop
+                cnt_ch_hit(c)  <= bump(cnt_ch_hit(c), ch_hit_r(c), v_clear);
+                cnt_ch_drop(c) <= bump(cnt_ch_drop(c), ch_drop_r(c), v_clear);
+                v_inc := '0';
+                if out_valid_r = '1' and to_integer(unsigned(out_channel_r)) = c then
+                    v_inc := '1';
+                end if;
+                cnt_ch_out(c) <= bump(cnt_ch_out(c), v_inc, v_clear);
+            end loop;
+        end if;
+    end process p_count;
+
+    ------------------------------------------------------------------------
+    -- AXI4-Lite slave
+    ------------------------------------------------------------------------
+    pending <= req_toggle xor ack_sync(1);
+
+    s_axi_awready <= awready_s;
+    s_axi_wready  <= awready_s;
+    s_axi_bvalid  <= bvalid_s;
+    s_axi_bresp   <= "00";
+    s_axi_arready <= arready_s;
+    s_axi_rvalid  <= rvalid_s;
+    s_axi_rresp   <= "00";
+
+    --! \brief Write channel: accept the address and data together, only CTRL is writable
+    p_axi_write : process(all)
+    begin
+        if rising_edge(s_axi_aclk) then
+            ack_sync <= ack_toggle & ack_sync(0);
+            if s_axi_aresetn = '0' then
+                awready_s  <= '0';
+                bvalid_s   <= '0';
+                req_toggle <= '0';
+                clear_req  <= '0';
+            elsif awready_s = '1' then
+                -- Address and data handshakes complete at this edge
+                awready_s <= '0';
+                bvalid_s  <= '1';
+                if unsigned(s_axi_awaddr(11 downto 2)) = 1 and s_axi_wstrb(0) = '1' and s_axi_wdata(0) = '1' and pending = '0' then
+                    clear_req  <= s_axi_wdata(1);
+                    req_toggle <= not req_toggle;
+                end if;
+            elsif bvalid_s = '1' then
+                if s_axi_bready = '1' then
+                    bvalid_s <= '0';
+                end if;
+            elsif s_axi_awvalid = '1' and s_axi_wvalid = '1' then
+                awready_s <= '1';
+            end if;
+        end if;
+    end process p_axi_write;
+
+    --! \brief Read channel: one register per read from the snapshot (see the register map)
+    p_axi_read : process(all)
+        variable w : natural range 0 to 1023;
+    begin
+        if rising_edge(s_axi_aclk) then
+            if s_axi_aresetn = '0' then
+                arready_s <= '0';
+                rvalid_s  <= '0';
+            elsif arready_s = '1' then
+                arready_s   <= '0';
+                rvalid_s    <= '1';
+                w := to_integer(unsigned(s_axi_araddr(11 downto 2)));
+                s_axi_rdata <= (others => '0');
+                case w is
+                    when 0 => s_axi_rdata <= c_id;
+                    when 1 => s_axi_rdata(1 downto 0) <= clear_req & pending;
+                    when 2 => s_axi_rdata <= std_logic_vector(snap_seq);
+                    when 3 => s_axi_rdata <= u32(g_buffers + 256 * g_channels + 2**24 * c_version);
+                    when 4 => s_axi_rdata <= std_logic_vector(snap_cycles(31 downto 0));
+                    when 5 => s_axi_rdata <= std_logic_vector(snap_cycles(63 downto 32));
+                    when 6 => s_axi_rdata <= std_logic_vector(snap_out);
+                    when 7 => s_axi_rdata <= std_logic_vector(snap_overwr);
+                    when 8 => s_axi_rdata <= u32(snap_hwm_out);
+                    when 9 => s_axi_rdata <= std_logic_vector(snap_time(31 downto 0));
+                    when 10 => s_axi_rdata <= std_logic_vector(snap_time(63 downto 32));
+                    when 16 => s_axi_rdata <= std_logic_vector(lat_seq);
+                    when 17 => s_axi_rdata <= std_logic_vector(lat_trig(31 downto 0));
+                    when 18 => s_axi_rdata <= std_logic_vector(lat_trig(63 downto 32));
+                    when 19 => s_axi_rdata <= std_logic_vector(lat_irq);
+                    when 20 => s_axi_rdata <= std_logic_vector(lat_set);
+                    when 21 => s_axi_rdata <= std_logic_vector(lat_clr);
+                    when others =>
+                        if w >= 64 and w < 64 + 4 * g_buffers then
+                            case (w - 64) mod 4 is
+                                when 0      => s_axi_rdata <= std_logic_vector(snap_buf_wr((w - 64) / 4));
+                                when 1      => s_axi_rdata <= std_logic_vector(snap_buf_drop((w - 64) / 4));
+                                when 2      => s_axi_rdata <= u32(snap_hwm_buf((w - 64) / 4));
+                                when others => null;
+                            end case;
+                        elsif w >= 256 and w < 256 + g_channels then
+                            s_axi_rdata <= std_logic_vector(snap_ch_hit(w - 256));
+                        elsif w >= 320 and w < 320 + g_channels then
+                            s_axi_rdata <= std_logic_vector(snap_ch_drop(w - 320));
+                        elsif w >= 384 and w < 384 + g_channels then
+                            s_axi_rdata <= std_logic_vector(snap_ch_out(w - 384));
+                        end if;
+                end case;
+            elsif rvalid_s = '1' then
+                if s_axi_rready = '1' then
+                    rvalid_s <= '0';
+                end if;
+            elsif s_axi_arvalid = '1' then
+                arready_s <= '1';
+            end if;
+        end if;
+    end process p_axi_read;
+
+end RTL;
@@ -14,7 +14,10 @@ entity top_64ch_2BRAM is
         g_chID_start   : natural := 0;
         g_coarse_bits  : natural := 28;
         g_sat_duration : natural := 3;  -- Minimum duration (in clk0 periods) that hit must remain high to be considered valid
-        g_pipe_depth   : natural := 5   -- Max number of hits stored in pipeline
+        g_pipe_depth   : natural := 5;  -- Max number of hits stored in pipeline
+        g_match_enable   : boolean := false;    -- Trigger matching mode: only write the hits in the trigger window to BRAM
+        g_match_lookback : natural := 0;        -- Start of the trigger window before the trigger after a reset (coarse periods), then set through tdc_ctrl
+        g_match_width    : natural := 0         -- Length of the trigger window after a reset (coarse periods), then set through tdc_ctrl
     );
     port (
         -- TDC and system clocks sent to all channels
@@ -33,6 +36,52 @@ entity top_64ch_2BRAM is
         rd_busy : in std_logic;    -- PS -> PL indicating read in progress
         irq_o   : out std_logic;   -- PL -> PS interrupt request
         which_bram : out std_logic_vector(1 downto 0);  -- tell PS which BRAM is being written to currently
+        bram_status : out std_logic_vector(31 downto 0); -- fill count [15:0] and overflow flag [31] of the BRAM handed off to the PS
+        missed_trigs : out std_logic_vector(31 downto 0); -- triggers missed since reset, latched at trigger time
+        ---------------------------------------------
+        -- Statistics block AXI4-Lite slave
+        ---------------------------------------------
+        s_axi_stats_aclk    : in std_logic;
+        s_axi_stats_aresetn : in std_logic;
+        s_axi_stats_awaddr  : in std_logic_vector(11 downto 0);
+        s_axi_stats_awvalid : in std_logic;
+        s_axi_stats_awready : out std_logic;
+        s_axi_stats_wdata   : in std_logic_vector(31 downto 0);
+        s_axi_stats_wstrb   : in std_logic_vector(3 downto 0);
+        s_axi_stats_wvalid  : in std_logic;
+        s_axi_stats_wready  : out std_logic;
+        s_axi_stats_bresp   : out std_logic_vector(1 downto 0);
+        s_axi_stats_bvalid  : out std_logic;
+        s_axi_stats_bready  : in std_logic;
+        s_axi_stats_araddr  : in std_logic_vector(11 downto 0);
+        s_axi_stats_arvalid : in std_logic;
+        s_axi_stats_arready : out std_logic;
+        s_axi_stats_rdata   : out std_logic_vector(31 downto 0);
+        s_axi_stats_rresp   : out std_logic_vector(1 downto 0);
+        s_axi_stats_rvalid  : out std_logic;
+        s_axi_stats_rready  : in std_logic;
+        ---------------------------------------------
+        -- Control block AXI4-Lite slave
+        ---------------------------------------------
+        s_axi_ctrl_aclk    : in std_logic;
+        s_axi_ctrl_aresetn : in std_logic;
+        s_axi_ctrl_awaddr  : in std_logic_vector(11 downto 0);
+        s_axi_ctrl_awvalid : in std_logic;
+        s_axi_ctrl_awready : out std_logic;
+        s_axi_ctrl_wdata   : in std_logic_vector(31 downto 0);
+        s_axi_ctrl_wstrb   : in std_logic_vector(3 downto 0);
+        s_axi_ctrl_wvalid  : in std_logic;
+        s_axi_ctrl_wready  : out std_logic;
+        s_axi_ctrl_bresp   : out std_logic_vector(1 downto 0);
+        s_axi_ctrl_bvalid  : out std_logic;
+        s_axi_ctrl_bready  : in std_logic;
+        s_axi_ctrl_araddr  : in std_logic_vector(11 downto 0);
+        s_axi_ctrl_arvalid : in std_logic;
+        s_axi_ctrl_arready : out std_logic;
+        s_axi_ctrl_rdata   : out std_logic_vector(31 downto 0);
+        s_axi_ctrl_rresp   : out std_logic_vector(1 downto 0);
+        s_axi_ctrl_rvalid  : out std_logic;
+        s_axi_ctrl_rready  : in std_logic;
         ---------------------------------------------
         -- DEBUG ILA
         ---------------------------------------------
@@ -100,6 +149,54 @@ architecture RTL of top_64ch_2BRAM is
     attribute x_interface_info of BRAM_2_en_b : signal is "xilinx.com:interface:bram:1.0 BRAM_2_b EN";
     attribute x_interface_info of BRAM_2_rst_b : signal is "xilinx.com:interface:bram:1.0 BRAM_2_b RST";
     attribute x_interface_info of BRAM_2_we_b : signal is "xilinx.com:interface:bram:1.0 BRAM_2_b WE";
+    -- Statistics block AXI4-Lite slave attributes (clocked by the PS AXI clock, not clk0)
+    attribute x_interface_info of s_axi_stats_aclk : signal is "xilinx.com:signal:clock:1.0 s_axi_stats_aclk CLK";
+    attribute x_interface_parameter of s_axi_stats_aclk : signal is "XIL_INTERFACENAME s_axi_stats_aclk, ASSOCIATED_BUSIF S_AXI_STATS, ASSOCIATED_RESET s_axi_stats_aresetn";
+    attribute x_interface_info of s_axi_stats_aresetn : signal is "xilinx.com:signal:reset:1.0 s_axi_stats_aresetn RST";
+    attribute x_interface_parameter of s_axi_stats_aresetn : signal is "XIL_INTERFACENAME s_axi_stats_aresetn, POLARITY ACTIVE_LOW, INSERT_VIP 0";
+    attribute x_interface_mode of s_axi_stats_awaddr : signal is "slave S_AXI_STATS";
+    attribute x_interface_parameter of s_axi_stats_awaddr : signal is "XIL_INTERFACENAME S_AXI_STATS, PROTOCOL AXI4LITE, DATA_WIDTH 32, ADDR_WIDTH 12, READ_WRITE_MODE READ_WRITE";
+    attribute x_interface_info of s_axi_stats_awaddr : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS AWADDR";
+    attribute x_interface_info of s_axi_stats_awvalid : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS AWVALID";
+    attribute x_interface_info of s_axi_stats_awready : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS AWREADY";
+    attribute x_interface_info of s_axi_stats_wdata : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS WDATA";
+    attribute x_interface_info of s_axi_stats_wstrb : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS WSTRB";
+    attribute x_interface_info of s_axi_stats_wvalid : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS WVALID";
+    attribute x_interface_info of s_axi_stats_wready : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS WREADY";
+    attribute x_interface_info of s_axi_stats_bresp : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS BRESP";
+    attribute x_interface_info of s_axi_stats_bvalid : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS BVALID";
+    attribute x_interface_info of s_axi_stats_bready : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS BREADY";
+    attribute x_interface_info of s_axi_stats_araddr : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS ARADDR";
+    attribute x_interface_info of s_axi_stats_arvalid : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS ARVALID";
+    attribute x_interface_info of s_axi_stats_arready : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS ARREADY";
+    attribute x_interface_info of s_axi_stats_rdata : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS RDATA";
+    attribute x_interface_info of s_axi_stats_rresp : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS RRESP";
+    attribute x_interface_info of s_axi_stats_rvalid : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS RVALID";
+    attribute x_interface_info of s_axi_stats_rready : signal is "xilinx.com:interface:aximm:1.0 S_AXI_STATS RREADY";
+    -- Control block AXI4-Lite slave attributes (clocked by the PS AXI clock, not clk0)
+    attribute x_interface_info of s_axi_ctrl_aclk : signal is "xilinx.com:signal:clock:1.0 s_axi_ctrl_aclk CLK";
+    attribute x_interface_parameter of s_axi_ctrl_aclk : signal is "XIL_INTERFACENAME s_axi_ctrl_aclk, ASSOCIATED_BUSIF S_AXI_CTRL, ASSOCIATED_RESET s_axi_ctrl_aresetn";
+    attribute x_interface_info of s_axi_ctrl_aresetn : signal is "xilinx.com:signal:reset:1.0 s_axi_ctrl_aresetn RST";
+    attribute x_interface_parameter of s_axi_ctrl_aresetn : signal is "XIL_INTERFACENAME s_axi_ctrl_aresetn, POLARITY ACTIVE_LOW, INSERT_VIP 0";
+    attribute x_interface_mode of s_axi_ctrl_awaddr : signal is "slave S_AXI_CTRL";
+    attribute x_interface_parameter of s_axi_ctrl_awaddr : signal is "XIL_INTERFACENAME S_AXI_CTRL, PROTOCOL AXI4LITE, DATA_WIDTH 32, ADDR_WIDTH 12, READ_WRITE_MODE READ_WRITE";
+    attribute x_interface_info of s_axi_ctrl_awaddr : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL AWADDR";
+    attribute x_interface_info of s_axi_ctrl_awvalid : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL AWVALID";
+    attribute x_interface_info of s_axi_ctrl_awready : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL AWREADY";
+    attribute x_interface_info of s_axi_ctrl_wdata : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL WDATA";
+    attribute x_interface_info of s_axi_ctrl_wstrb : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL WSTRB";
+    attribute x_interface_info of s_axi_ctrl_wvalid : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL WVALID";
+    attribute x_interface_info of s_axi_ctrl_wready : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL WREADY";
+    attribute x_interface_info of s_axi_ctrl_bresp : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL BRESP";
+    attribute x_interface_info of s_axi_ctrl_bvalid : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL BVALID";
+    attribute x_interface_info of s_axi_ctrl_bready : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL BREADY";
+    attribute x_interface_info of s_axi_ctrl_araddr : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL ARADDR";
+    attribute x_interface_info of s_axi_ctrl_arvalid : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL ARVALID";
+    attribute x_interface_info of s_axi_ctrl_arready : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL ARREADY";
+    attribute x_interface_info of s_axi_ctrl_rdata : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL RDATA";
+    attribute x_interface_info of s_axi_ctrl_rresp : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL RRESP";
+    attribute x_interface_info of s_axi_ctrl_rvalid : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL RVALID";
+    attribute x_interface_info of s_axi_ctrl_rready : signal is "xilinx.com:interface:aximm:1.0 S_AXI_CTRL RREADY";
    
 
 
@@ -110,7 +207,10 @@ begin
         g_chID_start   => g_chID_start,
         g_coarse_bits  => g_coarse_bits,
         g_sat_duration => g_sat_duration,
-        g_pipe_depth   => g_pipe_depth
+        g_pipe_depth   => g_pipe_depth,
+        g_match_enable   => g_match_enable,
+        g_match_lookback => g_match_lookback,
+        g_match_width    => g_match_width
     )
     port map (
         -- TDC and system clocks sent to all channels
@@ -129,6 +229,52 @@ begin
         rd_busy => rd_busy,    -- PS -> PL indicating read in progress
         irq_o   => irq_o,   -- PL -> PS interrupt request
         which_bram => which_bram,  -- tell PS which BRAM is being written to currently
+        bram_status => bram_status, -- fill count and overflow flag of the BRAM handed off to the PS
+        missed_trigs => missed_trigs, -- triggers missed since reset, latched at trigger time
+        ---------------------------------------------
+        -- Statistics block AXI4-Lite slave
+        ---------------------------------------------
+        s_axi_stats_aclk    => s_axi_stats_aclk,
+        s_axi_stats_aresetn => s_axi_stats_aresetn,
+        s_axi_stats_awaddr  => s_axi_stats_awaddr,
+        s_axi_stats_awvalid => s_axi_stats_awvalid,
+        s_axi_stats_awready => s_axi_stats_awready,
+        s_axi_stats_wdata   => s_axi_stats_wdata,
+        s_axi_stats_wstrb   => s_axi_stats_wstrb,
+        s_axi_stats_wvalid  => s_axi_stats_wvalid,
+        s_axi_stats_wready  => s_axi_stats_wready,
+        s_axi_stats_bresp   => s_axi_stats_bresp,
+        s_axi_stats_bvalid  => s_axi_stats_bvalid,
+        s_axi_stats_bready  => s_axi_stats_bready,
+        s_axi_stats_araddr  => s_axi_stats_araddr,
+        s_axi_stats_arvalid => s_axi_stats_arvalid,
+        s_axi_stats_arready => s_axi_stats_arready,
+        s_axi_stats_rdata   => s_axi_stats_rdata,
+        s_axi_stats_rresp   => s_axi_stats_rresp,
+        s_axi_stats_rvalid  => s_axi_stats_rvalid,
+        s_axi_stats_rready  => s_axi_stats_rready,
+        ---------------------------------------------
+        -- Control block AXI4-Lite slave
+        ---------------------------------------------
+        s_axi_ctrl_aclk    => s_axi_ctrl_aclk,
+        s_axi_ctrl_aresetn => s_axi_ctrl_aresetn,
+        s_axi_ctrl_awaddr  => s_axi_ctrl_awaddr,
+        s_axi_ctrl_awvalid => s_axi_ctrl_awvalid,
+        s_axi_ctrl_awready => s_axi_ctrl_awready,
+        s_axi_ctrl_wdata   => s_axi_ctrl_wdata,
+        s_axi_ctrl_wstrb   => s_axi_ctrl_wstrb,
+        s_axi_ctrl_wvalid  => s_axi_ctrl_wvalid,
+        s_axi_ctrl_wready  => s_axi_ctrl_wready,
+        s_axi_ctrl_bresp   => s_axi_ctrl_bresp,
+        s_axi_ctrl_bvalid  => s_axi_ctrl_bvalid,
+        s_axi_ctrl_bready  => s_axi_ctrl_bready,
+        s_axi_ctrl_araddr  => s_axi_ctrl_araddr,
+        s_axi_ctrl_arvalid => s_axi_ctrl_arvalid,
+        s_axi_ctrl_arready => s_axi_ctrl_arready,
+        s_axi_ctrl_rdata   => s_axi_ctrl_rdata,
+        s_axi_ctrl_rresp   => s_axi_ctrl_rresp,
+        s_axi_ctrl_rvalid  => s_axi_ctrl_rvalid,
+        s_axi_ctrl_rready  => s_axi_ctrl_rready,
         ---------------------------------------------
         -- DEBUG ILA
         ---------------------------------------------
@@ -0,0 +1,108 @@
+---------------------------------------------------------------------------------------------------------
+--! \file top_DMA.vhd
+--! \brief Wrapper around the top-level 64 channel (AXI-Stream/DMA) TDC module since VHDL 2008 is not compatible with block design
+--! \author Amitav Mitra, amitra3@jhu.edu
+---------------------------------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+use work.common_types.all;
+
+entity top_64ch_DMA is 
+    generic (
+        g_chID_start   : natural := 0;
+        g_coarse_bits  : natural := 28;
+        g_sat_duration : natural := 3;  -- Minimum duration (in clk0 periods) that hit must remain high to be considered valid
+        g_pipe_depth   : natural := 5   -- Max number of hits stored in pipeline
+    );
+    port (
+        -- TDC and system clocks sent to all channels
+        clk0    : in std_logic;
+        clk45   : in std_logic;
+        clk90   : in std_logic;
+        clk135  : in std_logic;
+        clk_sys : in std_logic;
+        -- Control
+        reset   : in std_logic; -- active high
+        enable  : in std_logic; -- active high
+        -- Data input from detector
+        hits    : in std_logic_vector(0 to 63);
+        trigger : in std_logic;
+        ---------------------------------------------
+        -- DEBUG ILA
+        ---------------------------------------------
+        DEBUG_data  : out std_logic_vector(g_coarse_bits+10 downto 0);
+        DEBUG_valid : out std_logic;
+        DEBUG_grant : out std_logic_vector(3 downto 0);
+        ---------------------------------------------
+        -- AXI-Stream output to the DMA (clk0 domain)
+        ---------------------------------------------
+        m_axis_tdata  : out std_logic_vector(63 downto 0);
+        m_axis_tvalid : out std_logic;
+        m_axis_tready : in std_logic;
+        m_axis_tlast  : out std_logic
+    );
+end top_64ch_DMA;
+
+architecture RTL of top_64ch_DMA is
+
+    ----------------------------------------------------------------------------
+    -- Set up bus interface in RTL directly to avoid needing to use IP packager
+    ----------------------------------------------------------------------------
+    attribute x_interface_info : string;
+    attribute x_interface_mode : string;
+    attribute x_interface_parameter : string;
+    -- Reset attributes (slave, active high)
+    attribute x_interface_info of reset : signal is "xilinx.com:signal:reset:1.0 reset RST";
+    attribute x_interface_mode of reset : signal is "slave reset";
+    attribute x_interface_parameter of reset : signal is "XIL_INTERFACENAME reset, POLARITY ACTIVE_HIGH, INSERT_VIP 0";
+    -- The stream is clocked by the 0 degree TDC clock, the clock crossing to the AXI clock is done by a FIFO in the block design
+    attribute x_interface_info of clk0 : signal is "xilinx.com:signal:clock:1.0 clk0 CLK";
+    attribute x_interface_parameter of clk0 : signal is "XIL_INTERFACENAME clk0, ASSOCIATED_BUSIF M_AXIS, ASSOCIATED_RESET reset";
+    -- AXI-Stream master attributes (64 bit data, TLAST marks the trailer word closing each event)
+    attribute x_interface_info of m_axis_tdata : signal is "xilinx.com:interface:axis:1.0 M_AXIS TDATA";
+    attribute x_interface_mode of m_axis_tdata : signal is "master M_AXIS";
+    attribute x_interface_parameter of m_axis_tdata : signal is "XIL_INTERFACENAME M_AXIS, TDATA_NUM_BYTES 8, TDEST_WIDTH 0, TID_WIDTH 0, TUSER_WIDTH 0, HAS_TREADY 1, HAS_TSTRB 0, HAS_TKEEP 0, HAS_TLAST 1";
+    attribute x_interface_info of m_axis_tvalid : signal is "xilinx.com:interface:axis:1.0 M_AXIS TVALID";
+    attribute x_interface_info of m_axis_tready : signal is "xilinx.com:interface:axis:1.0 M_AXIS TREADY";
+    attribute x_interface_info of m_axis_tlast : signal is "xilinx.com:interface:axis:1.0 M_AXIS TLAST";
+
+begin
+
+    e_tdc_64ch : entity work.TDC_64ch_DMA
+    generic map (
+        g_chID_start   => g_chID_start,
+        g_coarse_bits  => g_coarse_bits,
+        g_sat_duration => g_sat_duration,
+        g_pipe_depth   => g_pipe_depth
+    )
+    port map (
+        -- TDC and system clocks sent to all channels
+        clk0    => clk0,
+        clk45   => clk45,
+        clk90   => clk90,
+        clk135  => clk135,
+        clk_sys => clk_sys,
+        -- Control
+        reset   => reset, -- active high
+        enable  => enable, -- active high
+        -- Data input from detector
+        hits    => hits,
+        trigger => trigger,
+        ---------------------------------------------
+        -- DEBUG ILA
+        ---------------------------------------------
+        DEBUG_data  => DEBUG_data,
+        DEBUG_valid => DEBUG_valid,
+        DEBUG_grant => DEBUG_grant, 
+        ---------------------------------------------
+        -- AXI-Stream output to the DMA
+        ---------------------------------------------
+        m_axis_tdata  => m_axis_tdata,
+        m_axis_tvalid => m_axis_tvalid,
+        m_axis_tready => m_axis_tready,
+        m_axis_tlast  => m_axis_tlast
+    );
+
+end RTL;
@@ -0,0 +1,191 @@
+---------------------------------------------------------------------------------------------------------
+--! \file trigger_match.vhd
+--! \brief Trigger matching: keep a history of recent hits and extract the ones in a time window around each trigger.
+--!
+--! \details All hits out of the arbiter tree are written into a circular history buffer (block RAM) that is continuously
+--! overwritten. On `start` (a trigger accepted by the BRAM writer), the current coarse time is latched and the window
+--! \verbatim
+--!     [t_trig - lookback, t_trig - lookback + width)      (coarse time units, modulo 2^g_coarse_bits)
+--! \endverbatim
+--! is matched against the history. The module first waits until the end of the window is `g_latency` coarse periods in the
+--! past, so that the hits of the window still travelling through the channel and arbiter tree buffers have arrived. It then
+--! looks for the start of the window, scanning the history backwards from the newest hit until the first hit older than the
+--! start of the window by more than `g_latency` (the arbiter tree delivers hits in time order up to that skew), or until it
+--! runs out of history. Finally it reads the history forwards from there and sends out every hit whose coarse time lies in
+--! the window, in the order they arrived, i.e. as roughly time ordered as without trigger matching. `done_o` is pulsed the
+--! cycle after the last hit was sent out.
+--!
+--! Both scans read one history word per clk0 cycle, so with beam-structured data the extraction of a window takes about
+--! twice as many cycles as there are hits in the window, plus the ones received after it. Hits still arriving during the
+--! extraction are written to the history as usual. History entries are tracked by sequence number, so that an entry
+--! overwritten before the scan got to it is skipped rather than read.
+--!
+--! \author Amitav Mitra, amitra3@jhu.edu
+---------------------------------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+
+--! \brief Trigger matching: keep a history of recent hits and extract the ones in a time window around each trigger.
+--!
+--! \details See the file documentation for the window definition and the scan.
+entity trigger_match is
+    generic (
+        g_coarse_bits : natural := 28;      --! Number of bits in the \ref CoarseCounter.vhd "coarse counter"
+        g_depth       : natural := 2048;    --! Number of hits kept in the history (power of two)
+        g_win_bits    : natural := 16;      --! Width of the `lookback` and `width` settings
+        g_latency     : natural := 64       --! Coarse periods a hit may take to reach this module, and its skew w.r.t. other hits
+    );
+    port (
+        clk0      : in std_logic;                                       --! 0 degree (212.4 MHz, 4x RF) clock
+        reset     : in std_logic;                                       --! Active high reset, clears the history
+        coarse_i  : in std_logic_vector(g_coarse_bits-1 downto 0);      --! Current coarse time
+        lookback  : in std_logic_vector(g_win_bits-1 downto 0);         --! Start of the window before the trigger (coarse periods), sampled at `start`
+        width     : in std_logic_vector(g_win_bits-1 downto 0);         --! Length of the window (coarse periods), sampled at `start`
+        -- Hits from the arbiter tree
+        in_valid  : in std_logic;                                       --! Hit valid
+        in_data   : in std_logic_vector(g_coarse_bits+10 downto 0);     --! Hit word
+        -- Window extraction
+        start     : in std_logic;                                       --! Trigger accepted: latch the coarse time and extract its window
+        out_valid : out std_logic;                                      --! Matched hit valid
+        out_data  : out std_logic_vector(g_coarse_bits+10 downto 0);    --! Matched hit word
+        busy_o    : out std_logic;                                      --! Extraction in progress (from `start` to `done_o`)
+        done_o    : out std_logic                                       --! All matched hits have been sent out (one clk0 pulse)
+    );
+end trigger_match;
+
+architecture RTL of trigger_match is
+
+    type t_history is array (0 to g_depth-1) of std_logic_vector(g_coarse_bits+10 downto 0);
+    signal history : t_history;                                         --! Circular hit history (inferred block RAM)
+    attribute ram_style : string;
+    attribute ram_style of history : signal is "block";
+
+    -- History entries are numbered by a sequence number that wraps around at 2^32, entry q being stored at q mod g_depth
+    signal wr_seq  : unsigned(31 downto 0) := (others => '0');          --! Sequence number of the next hit written
+    signal fill    : natural range 0 to g_depth := 0;                   --! Valid history entries
+    signal seq     : unsigned(31 downto 0) := (others => '0');          --! Entry read in the current cycle
+    signal seq_hi  : unsigned(31 downto 0) := (others => '0');          --! Newest entry when the window closed
+    signal rd_data : std_logic_vector(g_coarse_bits+10 downto 0);       --! Entry read in the previous cycle
+    signal rd_pend : std_logic := '0';                                  --! `rd_data` holds an entry to be matched
+
+    signal coarse_s  : unsigned(g_coarse_bits-1 downto 0);              --! Coarse time registered into the clk0 domain
+    signal win_start : unsigned(g_coarse_bits-1 downto 0);              --! Coarse time of the start of the window
+    signal win_width : unsigned(g_coarse_bits-1 downto 0);              --! Length of the window, latched with its start
+
+    type t_state is (
+        s_idle, -- Waiting for a trigger
+        s_wait, -- Waiting for the hits of the window to arrive
+        s_find, -- Scanning the history backwards for the start of the window
+        s_emit, -- Scanning the history forwards, sending out the hits in the window
+        s_done  -- Signal the end of the extraction
+    );
+    signal state : t_state := s_idle;
+
+begin
+
+    --! \brief Write every hit into the history, overwriting the oldest one, and read the entry addressed by the scans
+    p_history : process(all)
+    begin
+        if rising_edge(clk0) then
+            if (in_valid = '1') then
+                history(to_integer(wr_seq mod g_depth)) <= in_data;
+            end if;
+            rd_data <= history(to_integer(seq mod g_depth));
+        end if;
+    end process p_history;
+
+    --! \brief Number the hits written to the history, count the valid entries and register the coarse time
+    p_fill : process(all)
+    begin
+        if rising_edge(clk0) then
+            coarse_s <= unsigned(coarse_i);
+            if (reset = '1') then
+                wr_seq <= (others => '0');
+                fill   <= 0;
+            elsif (in_valid = '1') then
+                wr_seq <= wr_seq + 1;
+                if fill < g_depth then
+                    fill <= fill + 1;
+                end if;
+            end if;
+        end if;
+    end process p_fill;
+
+    --! \brief Wait for the window to close, find its start in the history, then send out the hits in the window
+    p_match : process(all)
+        variable hit_t  : unsigned(g_coarse_bits-1 downto 0);
+        variable age    : unsigned(g_coarse_bits-1 downto 0);
+        variable oldest : unsigned(31 downto 0);
+        variable avail  : unsigned(31 downto 0);
+        variable past   : unsigned(31 downto 0);
+    begin
+        if rising_edge(clk0) then
+            out_valid <= '0';
+            done_o    <= '0';
+            rd_pend   <= '0';
+            -- Oldest entry that is valid and not overwritten in this very cycle
+            oldest := wr_seq - fill;
+            if (in_valid = '1') and (fill = g_depth) then
+                oldest := oldest + 1;
+            end if;
+            avail := seq - oldest;      -- Negative if entry seq is not in the history
+            past  := seq_hi - seq;      -- Negative once the forward scan is past the newest entry
+            hit_t := unsigned(rd_data(g_coarse_bits+10 downto 11));
+            age   := win_start - hit_t;
+            if (reset = '1') then
+                state <= s_idle;
+            else
+                case state is
+                    when s_idle =>
+                        if (start = '1') then
+                            win_start <= coarse_s - resize(unsigned(lookback), g_coarse_bits);
+                            win_width <= resize(unsigned(width), g_coarse_bits);
+                            state <= s_wait;
+                        end if;
+                    when s_wait =>  -- The elapsed time since the window start grows from `lookback` at the trigger
+                        if (coarse_s - win_start) >= win_width + g_latency then
+                            seq    <= wr_seq - 1;   -- Newest entry first (one written in this cycle is after the window)
+                            seq_hi <= wr_seq - 1;
+                            state  <= s_find;
+                        end if;
+                    when s_find =>
+                        if (rd_pend = '1') and (age > g_latency) and (age(g_coarse_bits-1) = '0') then
+                            -- Entry seq + 1 is older than the window start, past the skew: the window starts after it
+                            seq   <= seq + 2;
+                            state <= s_emit;
+                        elsif (avail(31) = '1') then
+                            -- Out of history: the window starts at the oldest entry read
+                            seq   <= seq + 1;
+                            state <= s_emit;
+                        else
+                            rd_pend <= '1';
+                            seq     <= seq - 1;
+                        end if;
+                    when s_emit =>
+                        if (rd_pend = '1') and ((hit_t - win_start) < win_width) then
+                            out_valid <= '1';
+                            out_data  <= rd_data;
+                        end if;
+                        if (past(31) = '1') then
+                            state <= s_done;
+                        else
+                            if (avail(31) = '0') then    -- Skip entries overwritten since the backward scan
+                                rd_pend <= '1';
+                            end if;
+                            seq <= seq + 1;
+                        end if;
+                    when s_done =>
+                        done_o <= '1';
+                        state  <= s_idle;
+                    when others =>
+                        NULL;
+                end case;
+            end if;
+        end if;
+    end process p_match;
+
+    busy_o <= '0' when state = s_idle else '1';
+
+end RTL;
@@ -88,7 +88,7 @@ void ISR(void * CallBackRef) {
 
     // 2. Check ID of the BRAM currently being written to. Choose other BRAM for the ID
     u32 bram_id;
-    bram_id = XGpio_DiscreteRead(&READ_BUSY, 1);
+    bram_id = XGpio_DiscreteRead(&WHICH_BRAM, 1);
     u32 bram_addr;
     if (bram_id == 1) {
         bram_addr = XPAR_AXI_BRAM_2_CTRL_BASEADDR;   // misspelled "AXI" -> "AX" in the block design gg
@@ -98,26 +98,28 @@ void ISR(void * CallBackRef) {
     }
     else {
         xil_printf("[ISR] ERROR: BRAM ID #%d invalid - expect ID = 1 or 2...\n\r",bram_id);
+        XGpio_DiscreteWrite(&READ_BUSY, 1, 0x0);
+        IntIDFull = XScuGic_CPUReadReg(&GIC, XSCUGIC_INT_ACK_OFFSET);
+        XScuGic_CPUWriteReg(&GIC, XSCUGIC_EOI_OFFSET, IntIDFull);
+        return;
     }
 
-    // Just read out from both BRAMs
-    u32 bram1_addr = XPAR_AXI_BRAM_1_CTRL_BASEADDR;
-    u32 bram2_addr = XPAR_AXI_BRAM_2_CTRL_BASEADDR;
-    u64 bram1_data;
-    u64 bram2_data;
-
-    // 3. Read out the entire BRAM - print value at each address to serial port. 
-    for (int i=0; i<8192; i=i+8) {    // 64b data words = 8 bytes, increment address by 8 (byte addressing)
-        // bram_data = XBram_ReadReg(bram_addr, i);
-        // printf("BRAM %u : addr  %d\t 0x%lx\n\r",bram_id, i, bram_data);
-        // fflush (stdout); 
+    // Number of words the PL wrote to that BRAM [15:0] and overflow flag [31], latched at trigger time
+    u32 bram_status = XGpio_DiscreteRead(&WHICH_BRAM, 2);
+    u32 n_words = bram_status & 0xFFFF;
+    if (n_words > 1024) {
+        n_words = 1024;
+    }
+    if (bram_status & 0x80000000) {
+        xil_printf("[ISR] WARNING: BRAM overflowed, oldest hits were overwritten\n\r");
+    }
 
-        bram1_data = XBram_ReadReg(bram1_addr, i);
-        bram2_data = XBram_ReadReg(bram2_addr, i);
-        printf("BRAM 1 : addr  %d\t 0x%lx\n\r",i, bram1_data);
-        printf("BRAM 2 : addr  %d\t 0x%lx\n\r",i, bram2_data);
-        fflush (stdout);
+    // 3. Read out the filled part of the BRAM - print value at each address to serial port. 
+    for (u32 i=0; i<8*n_words; i=i+8) {    // 64b data words = 8 bytes, increment address by 8 (byte addressing)
+        bram_data = XBram_ReadReg(bram_addr, i);
+        printf("BRAM %u : addr  %lu\t 0x%lx\n\r", (bram_id == 1) ? 2 : 1, (unsigned long)i, bram_data);
     }
+    fflush (stdout);
 
     usleep(5);
 
@@ -157,6 +159,7 @@ int main()
     }
     // Data Direction Reg (input is 1, output is 0)
     XGpio_SetDataDirection(&WHICH_BRAM, 1, 1);
+    XGpio_SetDataDirection(&WHICH_BRAM, 2, 0xFFFFFFFF);   // BRAM fill count / overflow flag
     XGpio_SetDataDirection(&READ_BUSY, 1, 0);
     // BRAM 1 initialization
     BRAM_1_CFG = XBram_LookupConfig(XPAR_AXI_BRAM_1_CTRL_BASEADDR);
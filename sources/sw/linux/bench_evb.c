@@ -0,0 +1,306 @@
+/*
+* Host-side benchmark of the event builder (tdc_evb.h) against simulated boards
+*
+* For 1, 2, 4, ... up to max_boards boards, runs the event builder on loopback TCP connections
+* from simulated board daemons. Every board sends one frame of hits_per_frame hits per trigger
+* as fast as TCP lets it, except for the triggers it misses (chosen pseudo-randomly per board,
+* missing_permille of them), which it reports through missed_trigs like a busy PL. Every board
+* starts from a different trigger count, close to the 32-bit wraparound.
+*
+* Every built event is checked against what the boards sent: trigger order, the boards present
+* and the trigger numbers of the fragments. The built events/s and MB/s are reported per
+* number of boards, so that changes to the builder can be compared on any Linux machine.
+*
+* usage: bench_evb [-n max_boards] [-e events] [-H hits_per_frame] [-m missing_permille]
+*                  [-q queue_depth] [-t timeout_ms]
+*   -n max_boards        largest number of boards, default 8
+*   -e events            triggers sent by every board, default 100000
+*   -H hits_per_frame    hits in every frame, default 32
+*   -m missing_permille  triggers missed by every board per 1000, default 10
+*   -q queue_depth       fragments buffered per board, default 1024
+*   -t timeout_ms        builder timeout, default 500
+*
+* Returns 1 if any built event did not match what the boards sent.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <inttypes.h>
+
+#include "tdc_evb.h"
+
+struct board {
+    unsigned id;
+    int fd;
+    pthread_t thread;
+};
+
+struct bench {
+    unsigned n_boards;
+    uint64_t events;
+    unsigned hits;
+    unsigned missing_permille;
+    // Merge thread only
+    uint64_t next;                  // Next trigger expected to be built
+    uint64_t built, incomplete, errors;
+};
+
+static struct bench b;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Trigger count of the first frame of every board
+static uint32_t first_trigger(unsigned board)
+{
+    return 0xfffff000u + 7919u * board;
+}
+
+// Whether board missed trigger i. Trigger 0 is never missed: the builder numbers the triggers
+// of every board from its first frame.
+static int missed(unsigned board, uint64_t i)
+{
+    uint64_t x = i * 0x9e3779b97f4a7c15ull ^ (board + 1) * 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 31;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 29;
+    return i > 0 && x % 1000 < b.missing_permille;
+}
+
+static uint64_t present_mask(uint64_t i)
+{
+    uint64_t mask = 0;
+    for (unsigned s = 0; s < b.n_boards; s++)
+        if (!missed(s, i))
+            mask |= 1ull << s;
+    return mask;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void *board_thread(void *arg)
+{
+    struct board *bd = arg;
+    size_t len = sizeof(struct tdc_frame_header) + (size_t)b.hits * sizeof(uint64_t);
+    uint8_t *buf = malloc(len);
+    struct tdc_frame_header *hdr = (struct tdc_frame_header *)buf;
+    uint64_t *words = (uint64_t *)(buf + sizeof(*hdr));
+    uint32_t trigger = first_trigger(bd->id), n_missed = 0, n_dropped = 0;
+
+    if (buf == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        close(bd->fd);
+        return NULL;
+    }
+    // Unused upper bits of every hit word are set by the firmware
+    for (unsigned i = 0; i < b.hits; i++)
+        words[i] = (UINT64_MAX << 39) | ((uint64_t)(i * 97) << 11) | ((i % 32) << 6) | (i % 64);
+
+    for (uint64_t i = 0; i < b.events; i++) {
+        if (missed(bd->id, i)) {
+            n_missed++;
+            n_dropped++;
+            continue;
+        }
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->magic        = TDC_FRAME_MAGIC;
+        hdr->version      = TDC_FRAME_VERSION;
+        hdr->header_len   = sizeof(*hdr);
+        hdr->trigger      = trigger++;
+        hdr->bram_id      = 1 + (i & 1);
+        hdr->n_words      = b.hits;
+        hdr->missed_trigs = n_missed;
+        hdr->timestamp_ns = now_ns();
+        hdr->n_dropped    = n_dropped;
+        n_dropped = 0;
+        if (write_full(bd->fd, buf, len) < 0) {
+            perror("send");
+            break;
+        }
+    }
+    free(buf);
+    close(bd->fd);
+    return NULL;
+}
+
+static int bench_write(void *ctx, const struct tdc_evb_event *ev)
+{
+    (void)ctx;
+    // Triggers that no board sent are never built
+    while (b.next < b.events && present_mask(b.next) == 0)
+        b.next++;
+    uint64_t mask = present_mask(b.next);
+    if (ev->hdr.seq != b.next || ev->hdr.present != mask || ev->hdr.n_sources != b.n_boards) {
+        if (b.errors++ < 10)
+            fprintf(stderr, "Built trigger %" PRIu64 " boards %#" PRIx64 ", expected trigger %" PRIu64
+                    " boards %#" PRIx64 "\n", ev->hdr.seq, ev->hdr.present, b.next, mask);
+    }
+    for (unsigned i = 0; i < ev->hdr.n_fragments; i++) {
+        const struct tdc_frame_header *hdr = (const struct tdc_frame_header *)ev->data[i];
+        unsigned s = ev->frag[i].source;
+        if (hdr->trigger + hdr->missed_trigs - first_trigger(s) != (uint32_t)ev->hdr.seq ||
+            hdr->n_words != b.hits || ev->frag[i].len != sizeof(*hdr) + b.hits * sizeof(uint64_t)) {
+            if (b.errors++ < 10)
+                fprintf(stderr, "Trigger %" PRIu64 ": wrong fragment from board %u (trigger %u, missed %u)\n",
+                        ev->hdr.seq, s, hdr->trigger, hdr->missed_trigs);
+        }
+    }
+    b.built++;
+    if (ev->hdr.flags & TDC_EVB_FLAG_INCOMPLETE)
+        b.incomplete++;
+    b.next = ev->hdr.seq + 1;
+    return 0;
+}
+
+// Run n boards through the builder, returns 0 if every event matched
+static int run(unsigned n, unsigned queue_depth, uint64_t timeout_ns)
+{
+    static struct board boards[TDC_EVB_MAX_SOURCES];
+    static int fds[TDC_EVB_MAX_SOURCES];
+
+    b.n_boards = n;
+    b.next = b.built = b.incomplete = b.errors = 0;
+
+    // One loopback connection per board, accepted in board order
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 1) < 0 ||
+        getsockname(lfd, (struct sockaddr *)&addr, &alen) < 0) {
+        perror("listen");
+        return -1;
+    }
+    for (unsigned s = 0; s < n; s++) {
+        boards[s].id = s;
+        boards[s].fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (boards[s].fd < 0 || connect(boards[s].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            (fds[s] = accept(lfd, NULL, NULL)) < 0) {
+            perror("connect");
+            return -1;
+        }
+    }
+    close(lfd);
+
+    struct tdc_evb_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.n_sources = n;
+    cfg.fds = fds;
+    cfg.queue_depth = queue_depth;
+    cfg.timeout_ns = timeout_ns;
+    cfg.write = bench_write;
+    struct tdc_evb *evb = tdc_evb_create(&cfg);
+    if (evb == NULL || tdc_evb_start(evb) < 0)
+        return -1;
+
+    uint64_t t0 = now_ns();
+    for (unsigned s = 0; s < n; s++)
+        pthread_create(&boards[s].thread, NULL, board_thread, &boards[s]);
+    for (unsigned s = 0; s < n; s++)
+        pthread_join(boards[s].thread, NULL);
+    tdc_evb_wait(evb);
+    double dt = (now_ns() - t0) / 1e9;
+
+    struct tdc_evb_stats st;
+    tdc_evb_get_stats(evb, &st);
+    tdc_evb_destroy(evb);
+    for (unsigned s = 0; s < n; s++)
+        close(fds[s]);
+
+    // What should have been built
+    uint64_t exp_built = 0, exp_incomplete = 0, exp_missing = 0, missing = 0, late = 0;
+    uint64_t all = (n == 64) ? UINT64_MAX : (1ull << n) - 1;
+    for (uint64_t i = 0; i < b.events; i++) {
+        uint64_t mask = present_mask(i);
+        if (mask == 0)
+            continue;
+        exp_built++;
+        exp_incomplete += mask != all;
+        exp_missing += n - __builtin_popcountll(mask);
+    }
+    for (unsigned s = 0; s < n; s++) {
+        missing += st.missing[s];
+        late += st.late[s];
+    }
+    if (b.built != exp_built || b.incomplete != exp_incomplete || missing != exp_missing || late != 0)
+        b.errors++;
+
+    printf("%2u boards: %8" PRIu64 " events in %6.3f s: %9.0f events/s, %8.2f MB/s, %" PRIu64
+           " incomplete, %" PRIu64 " after timeout, %" PRIu64 " late: %s\n",
+           n, b.built, dt, b.built / dt, st.bytes / dt / 1e6, b.incomplete, st.timeouts, late,
+           b.errors == 0 ? "OK" : "FAILED");
+    if (b.built != exp_built || b.incomplete != exp_incomplete || missing != exp_missing)
+        printf("           expected %" PRIu64 " events, %" PRIu64 " incomplete, %" PRIu64
+               " fragments missing, got %" PRIu64 "\n", exp_built, exp_incomplete, exp_missing, missing);
+    return b.errors == 0 ? 0 : -1;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage %s [-n max_boards] [-e events] [-H hits_per_frame] [-m missing_permille] "
+            "[-q queue_depth] [-t timeout_ms]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned max_boards = 8, queue_depth = 1024;
+    double timeout_ms = 500.0;
+    int opt, ok = 1;
+
+    b.events = 100000;
+    b.hits = 32;
+    b.missing_permille = 10;
+    while ((opt = getopt(argc, argv, "n:e:H:m:q:t:")) != -1) {
+        switch (opt) {
+            case 'n': max_boards = (unsigned)atoi(optarg); break;
+            case 'e': b.events = strtoull(optarg, NULL, 0); break;
+            case 'H': b.hits = (unsigned)atoi(optarg); break;
+            case 'm': b.missing_permille = (unsigned)atoi(optarg); break;
+            case 'q': queue_depth = (unsigned)atoi(optarg); break;
+            case 't': timeout_ms = atof(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || max_boards == 0 || max_boards > TDC_EVB_MAX_SOURCES || b.events == 0 ||
+        b.missing_permille > 1000)
+        usage(argv[0]);
+
+    printf("%" PRIu64 " triggers per board, %u hits per frame, %u/1000 triggers missed per board\n",
+           b.events, b.hits, b.missing_permille);
+    for (unsigned n = 1; ; n = (n * 2 < max_boards) ? n * 2 : max_boards) {
+        if (run(n, queue_depth, (uint64_t)(timeout_ms * 1e6)) < 0)
+            ok = 0;
+        if (n == max_boards)
+            break;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+/*
+* Benchmark of the time ordering stage (tdc_order.h) against a plain qsort()
+*
+* Builds events whose hits arrive as a Poisson process and leave the arbiter tree after a
+* random delay of up to max_delay clock cycles, which gives the bounded disorder seen in the
+* BRAM, then sorts copies of them over and over with tdc_order_hits() and with qsort() on the
+* same key. The result of tdc_order_hits() is checked against a stable reference sort, and the
+* rates are reported for events that are in order, slightly out of order (normal running) and
+* far out of order (every buffer of the tree full), some of them straddling the wrap of the
+* coarse counter.
+*
+* usage: bench_order [words_per_event] [seconds]
+*   words_per_event  hit words per event, default 1024 (one full BRAM)
+*   seconds          time spent on each method and disorder, default 1
+*
+* Returns 1 if tdc_order_hits() gave a wrong result.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "tdc_order.h"
+
+#define N_EVENTS    64
+#define COARSE_MASK ((1u << 28) - 1)
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift64(uint64_t *s)
+{
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+static inline uint32_t rel_key(uint64_t w, uint32_t ref)
+{
+    return ((uint32_t)(w >> 11) - ref + (1u << 27)) & COARSE_MASK;
+}
+
+// Reference for qsort(): the same key as tdc_order_hits(), relative to the first word
+static uint32_t qsort_ref;
+
+static int cmp_coarse(const void *a, const void *b)
+{
+    uint32_t ka = rel_key(*(const uint64_t *)a, qsort_ref);
+    uint32_t kb = rel_key(*(const uint64_t *)b, qsort_ref);
+    return (ka > kb) - (ka < kb);
+}
+
+struct arrival {
+    uint64_t t_out;
+    uint64_t word;
+};
+
+static int cmp_arrival(const void *a, const void *b)
+{
+    uint64_t ta = ((const struct arrival *)a)->t_out, tb = ((const struct arrival *)b)->t_out;
+    return (ta > tb) - (ta < tb);
+}
+
+// One event: hits every ~4 clocks on average, each delayed by up to max_delay clocks
+static void make_event(uint64_t *words, size_t n, unsigned max_delay, uint64_t *seed, struct arrival *a)
+{
+    uint64_t t = xorshift64(seed) & COARSE_MASK;
+    for (size_t i = 0; i < n; i++) {
+        double u = ((xorshift64(seed) >> 11) + 1) * (1.0 / 9007199254740992.0);
+        t += (uint64_t)(-log(u) * 4.0);
+        uint64_t r = xorshift64(seed);
+        a[i].t_out = t + (max_delay ? r % (max_delay + 1) : 0);
+        a[i].word  = (~0ull << 39) | ((t & COARSE_MASK) << 11) | (((r >> 32) & 0x1f) << 6) | ((r >> 40) & 0x3f);
+    }
+    qsort(a, n, sizeof(*a), cmp_arrival);
+    for (size_t i = 0; i < n; i++)
+        words[i] = a[i].word;
+}
+
+// Stable reference: plain insertion sort on the same key
+static void reference_sort(uint64_t *w, size_t n)
+{
+    uint32_t ref = (uint32_t)(w[0] >> 11) & COARSE_MASK;
+    for (size_t i = 1; i < n; i++) {
+        uint64_t x = w[i];
+        size_t j = i;
+        while (j > 0 && rel_key(w[j - 1], ref) > rel_key(x, ref)) {
+            w[j] = w[j - 1];
+            j--;
+        }
+        w[j] = x;
+    }
+}
+
+// Returns the sort rate in events/s
+static double run_order(const uint64_t *events, size_t n, uint64_t *work, uint64_t *tmp, double seconds,
+                        uint64_t method_count[3])
+{
+    uint64_t calls = 0;
+    double t0 = now_s(), t;
+    do {
+        for (int k = 0; k < N_EVENTS; k++) {
+            memcpy(work, events + k * n, n * sizeof(*work));
+            method_count[tdc_order_hits(work, n, tmp)]++;
+        }
+        calls += N_EVENTS;
+        t = now_s();
+    } while (t - t0 < seconds);
+    return calls / (t - t0);
+}
+
+static double run_qsort(const uint64_t *events, size_t n, uint64_t *work, double seconds)
+{
+    uint64_t calls = 0;
+    double t0 = now_s(), t;
+    do {
+        for (int k = 0; k < N_EVENTS; k++) {
+            memcpy(work, events + k * n, n * sizeof(*work));
+            qsort_ref = (uint32_t)(work[0] >> 11) & COARSE_MASK;
+            qsort(work, n, sizeof(*work), cmp_coarse);
+        }
+        calls += N_EVENTS;
+        t = now_s();
+    } while (t - t0 < seconds);
+    return calls / (t - t0);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1024;
+    double seconds = (argc > 2) ? atof(argv[2]) : 1.0;
+    static const unsigned delays[] = { 0, 16, 512 };
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+    int ok = 1;
+
+    if (n == 0) {
+        fprintf(stderr, "usage %s [words_per_event] [seconds]\n", argv[0]);
+        return 1;
+    }
+    uint64_t *events = malloc(N_EVENTS * n * sizeof(uint64_t));
+    uint64_t *work = malloc(n * sizeof(uint64_t));
+    uint64_t *tmp = malloc(n * sizeof(uint64_t));
+    uint64_t *check = malloc(n * sizeof(uint64_t));
+    struct arrival *a = malloc(n * sizeof(*a));
+    if (!events || !work || !tmp || !check || !a)
+        return 1;
+
+    printf("%zu words per event\n", n);
+    for (size_t d = 0; d < sizeof(delays) / sizeof(delays[0]); d++) {
+        for (int k = 0; k < N_EVENTS; k++)
+            make_event(events + k * n, n, delays[d], &seed, a);
+
+        // tdc_order_hits() must match the stable reference word for word
+        for (int k = 0; k < N_EVENTS; k++) {
+            memcpy(work, events + k * n, n * sizeof(*work));
+            memcpy(check, events + k * n, n * sizeof(*check));
+            tdc_order_hits(work, n, tmp);
+            reference_sort(check, n);
+            if (memcmp(work, check, n * sizeof(*work)) != 0)
+                ok = 0;
+        }
+
+        uint64_t methods[3] = { 0 };
+        double r_order = run_order(events, n, work, tmp, seconds, methods);
+        double r_qsort = run_qsort(events, n, work, seconds);
+        uint64_t total = methods[0] + methods[1] + methods[2];
+        printf("max delay %4u clocks: tdc_order %9.0f events/s (%6.2f ns/hit)  qsort %9.0f events/s (%6.2f ns/hit)  x%.1f"
+               "  [sorted %.0f%%, insertion %.0f%%, radix %.0f%%]\n",
+               delays[d], r_order, 1e9 / (r_order * n), r_qsort, 1e9 / (r_qsort * n), r_order / r_qsort,
+               100.0 * methods[TDC_ORDER_SORTED] / total, 100.0 * methods[TDC_ORDER_INSERTION] / total,
+               100.0 * methods[TDC_ORDER_RADIX] / total);
+    }
+    printf("Check against the reference sort: %s\n", ok ? "OK" : "FAILED");
+
+    free(events);
+    free(work);
+    free(tmp);
+    free(check);
+    free(a);
+    return ok ? 0 : 1;
+}
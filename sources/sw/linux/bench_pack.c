@@ -0,0 +1,192 @@
+/*
+* Round trip check and benchmark of the packed hit encoding (tdc_pack.h)
+*
+* First packs and unpacks a set of corner cases (empty and single hit events, coarse counter
+* wrap, unordered events, packing in place) and checks that corrupted payloads are rejected.
+* Then builds events of hits arriving as a Poisson process, sorted by coarse time as the
+* daemon sends them with -z, and reports the packed size per hit and the pack and unpack
+* rates, checking every round trip.
+*
+* usage: bench_pack [words_per_event] [mean_gap_clocks] [seconds]
+*   words_per_event  hit words per event, default 1024 (one full BRAM)
+*   mean_gap_clocks  mean coarse time between two hits, default 4
+*   seconds          time spent on packing and on unpacking, default 1
+*
+* Returns 1 if any check failed.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "tdc_pack.h"
+#include "tdc_order.h"
+
+#define N_EVENTS    64
+#define HIT_PAD     (~0ull << 39)
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift64(uint64_t *s)
+{
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+static uint64_t hit(uint32_t coarse, unsigned fine, unsigned channel)
+{
+    return HIT_PAD | (uint64_t)(coarse & 0xfffffff) << 11 | (fine & 0x1f) << 6 | (channel & 0x3f);
+}
+
+// Pack and unpack n words, 0 if the round trip is exact
+static int round_trip(const char *name, const uint64_t *words, size_t n)
+{
+    static uint8_t buf[TDC_FRAME_PACKED_MAX_LEN(TDC_FRAME_MAX_WORDS)];
+    static uint64_t back[TDC_FRAME_MAX_WORDS], inplace[TDC_FRAME_MAX_WORDS];
+
+    ssize_t len = tdc_pack_hits(words, n, buf);
+    if (len < 0 || tdc_unpack_hits(buf, (size_t)len, back, n) < 0 || memcmp(words, back, n * sizeof(*words)) != 0) {
+        printf("round trip %-24s FAILED\n", name);
+        return -1;
+    }
+    // Packing in place must give the same bytes
+    memcpy(inplace, words, n * sizeof(*words));
+    if (tdc_pack_hits(inplace, n, (uint8_t *)inplace) != len || memcmp(inplace, buf, (size_t)len) != 0) {
+        printf("in place %-24s FAILED\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+// Corner cases and malformed payloads. Returns 0 if everything passed.
+static int check_corner_cases(uint64_t *seed)
+{
+    static uint64_t w[4096], back[4096];
+    uint8_t buf[TDC_FRAME_PACKED_MAX_LEN(4096)];
+    int fail = 0;
+
+    fail |= round_trip("empty", w, 0);
+    w[0] = hit(0xfffffff, 31, 63);
+    fail |= round_trip("single max hit", w, 1);
+    for (unsigned i = 0; i < 256; i++)
+        w[i] = hit(0xfffff80 + i, i, i);
+    fail |= round_trip("coarse counter wrap", w, 256);
+    for (unsigned i = 0; i < 4096; i++) {
+        uint64_t r = xorshift64(seed);
+        w[i] = hit((uint32_t)r, (unsigned)(r >> 32), (unsigned)(r >> 40));
+    }
+    fail |= round_trip("random order", w, 4096);
+    for (unsigned i = 0; i < 4096; i++)
+        w[i] = hit(1000 + i / 8, i, i);
+    fail |= round_trip("same coarse time", w, 4096);
+
+    // Rejected input: a word that is not a hit, truncated and over-long payloads, too long a varint
+    uint64_t bad = hit(1, 2, 3) & ~(1ull << 50);
+    ssize_t len = tdc_pack_hits(w, 16, buf);
+    uint8_t six[7] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01 };
+    if (tdc_pack_hits(&bad, 1, buf + 256) != -1 ||
+        tdc_unpack_hits(buf, (size_t)len - 1, back, 16) != -1 ||
+        tdc_unpack_hits(buf, (size_t)len, back, 15) != -1 ||
+        tdc_unpack_hits(buf, (size_t)len, back, 17) != -1 ||
+        tdc_unpack_hits(six, sizeof(six), back, 1) != -1) {
+        printf("malformed input not rejected: FAILED\n");
+        fail = -1;
+    }
+    return fail;
+}
+
+// Events of hits every mean_gap clocks on average, in coarse time order
+static void make_events(uint64_t *words, size_t n, double mean_gap, uint64_t *seed, uint64_t *tmp)
+{
+    for (int k = 0; k < N_EVENTS; k++) {
+        uint64_t *ev = words + k * n;
+        uint64_t t = xorshift64(seed);
+        for (size_t i = 0; i < n; i++) {
+            double u = ((xorshift64(seed) >> 11) + 1) * (1.0 / 9007199254740992.0);
+            t += (uint64_t)(-log(u) * mean_gap);
+            uint64_t r = xorshift64(seed);
+            ev[i] = hit((uint32_t)t, (unsigned)(r >> 32), (unsigned)(r >> 40));
+        }
+        tdc_order_hits(ev, n, tmp);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1024;
+    double mean_gap = (argc > 2) ? atof(argv[2]) : 4.0;
+    double seconds = (argc > 3) ? atof(argv[3]) : 1.0;
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+
+    if (n == 0 || n > TDC_FRAME_MAX_WORDS || mean_gap < 0) {
+        fprintf(stderr, "usage %s [words_per_event] [mean_gap_clocks] [seconds]\n", argv[0]);
+        return 1;
+    }
+    int ok = check_corner_cases(&seed) == 0;
+    printf("Corner cases: %s\n", ok ? "OK" : "FAILED");
+
+    uint64_t *events = malloc(N_EVENTS * n * sizeof(uint64_t));
+    uint64_t *back = malloc(n * sizeof(uint64_t));
+    uint8_t *packed = malloc(N_EVENTS * TDC_FRAME_PACKED_MAX_LEN(n));
+    size_t *len = malloc(N_EVENTS * sizeof(size_t));
+    if (!events || !back || !packed || !len)
+        return 1;
+    make_events(events, n, mean_gap, &seed, back);
+
+    // Pack
+    size_t total = 0;
+    uint64_t calls = 0;
+    double t0 = now_s(), t;
+    do {
+        total = 0;
+        for (int k = 0; k < N_EVENTS; k++) {
+            ssize_t l = tdc_pack_hits(events + k * n, n, packed + k * TDC_FRAME_PACKED_MAX_LEN(n));
+            len[k] = (size_t)l;
+            total += len[k];
+        }
+        calls += N_EVENTS;
+        t = now_s();
+    } while (t - t0 < seconds);
+    double r_pack = calls * n / (t - t0);
+
+    // Unpack, checking every round trip once
+    for (int k = 0; k < N_EVENTS; k++) {
+        if (tdc_unpack_hits(packed + k * TDC_FRAME_PACKED_MAX_LEN(n), len[k], back, n) < 0 ||
+            memcmp(back, events + k * n, n * sizeof(*back)) != 0)
+            ok = 0;
+    }
+    calls = 0;
+    t0 = now_s();
+    do {
+        for (int k = 0; k < N_EVENTS; k++)
+            tdc_unpack_hits(packed + k * TDC_FRAME_PACKED_MAX_LEN(n), len[k], back, n);
+        calls += N_EVENTS;
+        t = now_s();
+    } while (t - t0 < seconds);
+    double r_unpack = calls * n / (t - t0);
+
+    double bytes_per_hit = (double)total / (N_EVENTS * n);
+    printf("%zu words per event, mean gap %.1f clocks: %.2f bytes/hit (%.1f%% of 8), "
+           "frame %zu -> %.0f bytes with the header\n",
+           n, mean_gap, bytes_per_hit, 100.0 * bytes_per_hit / 8,
+           sizeof(struct tdc_frame_header) + n * 8, sizeof(struct tdc_frame_header) + bytes_per_hit * n);
+    printf("pack   %8.1f Mhits/s  (%.2f ns/hit)\n", r_pack / 1e6, 1e9 / r_pack);
+    printf("unpack %8.1f Mhits/s  (%.2f ns/hit)\n", r_unpack / 1e6, 1e9 / r_unpack);
+    printf("Round trip: %s\n", ok ? "OK" : "FAILED");
+
+    free(events);
+    free(back);
+    free(packed);
+    free(len);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+/*
+* Host-side benchmark of the readout path (tdc_readout.h) against the firmware emulator (tdc_emu.h)
+*
+* Runs the readout library exactly as the daemon does, but on top of emulated UIO devices, with
+* triggers and hits arriving as Poisson processes. Every event is checked against what the
+* emulated PL handed off (hit count, hit word format), and at the end the trigger and hit rates,
+* the readout latency percentiles and the triggers lost at every stage are reported, so that
+* changes to the readout can be compared on any Linux machine.
+*
+* usage: bench_readout [-b banks] [-t trigger_rate] [-H hit_rate] [-s seconds] [-p pool_size]
+*                      [-d send_delay_us] [-r irq_priority] [-o]
+*   -b banks          emulate the N bank firmware with that many banks, default the 2 BRAM firmware
+*   -t trigger_rate   mean trigger rate in Hz, default 10000
+*   -H hit_rate       mean hit rate of all channels in Hz, default 1000000
+*   -s seconds        length of the run, default 5
+*   -p pool_size      event buffers of the readout, default 256
+*   -d send_delay_us  time the consumer spends on every event (slow network), default 0
+*   -r irq_priority   SCHED_FIFO priority of the IRQ thread, default 0 (normal scheduling)
+*   -o                sort every event by coarse time (tdc_order.h)
+*
+* Returns 1 if any event did not match the emulated PL.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "tdc_readout.h"
+#include "tdc_emu.h"
+
+struct bench {
+    struct tdc_emu *emu;
+    uint64_t delay_ns;
+    // Sender thread only
+    uint64_t events, hits, mismatches, bad_words, unknown;
+    struct tdc_emu_hist e2e;
+};
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int bench_send(void *ctx, const struct tdc_event *ev)
+{
+    struct bench *b = ctx;
+    uint64_t t_trig, t = now_ns();
+    uint32_t n_hits;
+
+    if (tdc_emu_trigger_info(b->emu, ev->hdr.trigger, &t_trig, &n_hits) == 0) {
+        tdc_emu_hist_add(&b->e2e, t - t_trig);
+        if (n_hits != ev->hdr.n_words)
+            b->mismatches++;
+    } else {
+        b->unknown++;
+    }
+    // Unused upper bits of every hit word are set by the firmware
+    for (uint32_t i = 0; i < ev->hdr.n_words; i++)
+        if ((ev->words[i] >> 39) != (UINT64_MAX >> 39))
+            b->bad_words++;
+    b->events++;
+    b->hits += ev->hdr.n_words;
+
+    while (b->delay_ns > 0 && now_ns() - t < b->delay_ns)
+        ;
+    return 0;
+}
+
+static void print_hist(const char *name, const struct tdc_emu_hist *h)
+{
+    printf("%-28s p50 %8.2f us  p90 %8.2f us  p99 %8.2f us  p99.9 %8.2f us  max %8.2f us\n", name,
+           tdc_emu_hist_percentile(h, 50) / 1e3, tdc_emu_hist_percentile(h, 90) / 1e3,
+           tdc_emu_hist_percentile(h, 99) / 1e3, tdc_emu_hist_percentile(h, 99.9) / 1e3, h->max_ns / 1e3);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage %s [-b banks] [-t trigger_rate] [-H hit_rate] [-s seconds] [-p pool_size] "
+            "[-d send_delay_us] [-r irq_priority] [-o]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct tdc_emu_config ecfg = { 0, 10000.0, 1e6, -1, 0 };
+    struct tdc_readout_config rcfg;
+    static struct bench b;
+    double seconds = 5.0;
+    int opt;
+
+    memset(&rcfg, 0, sizeof(rcfg));
+    rcfg.pool_size = 256;
+    rcfg.irq_cpu = rcfg.send_cpu = -1;
+    while ((opt = getopt(argc, argv, "b:t:H:s:p:d:r:o")) != -1) {
+        switch (opt) {
+            case 'b': ecfg.banks = rcfg.banks = (unsigned)atoi(optarg); break;
+            case 't': ecfg.trigger_rate = atof(optarg); break;
+            case 'H': ecfg.hit_rate = atof(optarg); break;
+            case 's': seconds = atof(optarg); break;
+            case 'p': rcfg.pool_size = (unsigned)atoi(optarg); break;
+            case 'd': b.delay_ns = (uint64_t)(atof(optarg) * 1e3); break;
+            case 'r': rcfg.irq_priority = atoi(optarg); break;
+            case 'o': rcfg.order = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || seconds <= 0)
+        usage(argv[0]);
+
+    b.emu = tdc_emu_create(&ecfg);
+    if (b.emu == NULL)
+        return 1;
+    rcfg.dev_fds = tdc_emu_fds(b.emu);
+    rcfg.send = bench_send;
+    rcfg.send_ctx = &b;
+    struct tdc_readout *rd = tdc_readout_create(&rcfg);
+    if (rd == NULL || tdc_readout_start(rd) < 0 || tdc_emu_start(b.emu) < 0)
+        return 1;
+    printf("Emulating the %s firmware: %.0f triggers/s, %.0f hits/s for %.1f s\n",
+           ecfg.banks ? "N bank" : "2 BRAM", ecfg.trigger_rate, ecfg.hit_rate, seconds);
+
+    uint64_t t0 = now_ns();
+    struct timespec ts = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+    nanosleep(&ts, NULL);
+    // No new triggers, then let the readout finish what was handed off and drain its queue
+    tdc_emu_stop(b.emu);
+    double dt = (now_ns() - t0) / 1e9;
+    ts.tv_sec = 0;
+    ts.tv_nsec = 100000000;
+    nanosleep(&ts, NULL);
+    tdc_readout_stop(rd);
+
+    struct tdc_emu_stats es;
+    struct tdc_readout_stats rs;
+    tdc_emu_get_stats(b.emu, &es);
+    tdc_readout_get_stats(rd, &rs, 0);
+
+    printf("Emulated PL: %" PRIu64 " triggers (%.0f/s), accepted %" PRIu64 ", missed %" PRIu64 " (%.3f%%), "
+           "%" PRIu64 " hits (%.0f/s), %" PRIu64 " banks overflowed\n",
+           es.triggers, es.triggers / dt, es.accepted, es.missed,
+           es.triggers ? 100.0 * es.missed / es.triggers : 0.0, es.hits, es.hits / dt, es.overflows);
+    printf("Readout:     %" PRIu64 " interrupts, %" PRIu64 " events sent (%.0f/s), %" PRIu64 " hits sent (%.0f/s, %.2f MB/s)\n",
+           rs.triggers, b.events, b.events / dt, b.hits, b.hits / dt, b.hits * 8.0 / dt / 1e6);
+    printf("Lost:        PL busy %" PRIu64 ", missed interrupts %" PRIu64 ", pool exhausted %" PRIu64
+           ", queue high water %u, PL banks high water %u\n",
+           rs.pl_missed, rs.irq_missed, rs.pool_exhausted, rs.queue_high_water, rs.pl_banks_high_water);
+    print_hist("Interrupt -> busy low (PL):", &es.handshake);
+    print_hist("Trigger -> sent:", &b.e2e);
+    if (rs.lat_n > 0)
+        printf("Interrupt -> busy low (PS):  mean %.2f us over %" PRIu64 " triggers\n",
+               (double)rs.lat_sum_ns / rs.lat_n / 1e3, rs.lat_n);
+
+    int ok = b.mismatches == 0 && b.bad_words == 0;
+    printf("Check:       %" PRIu64 " hit count mismatches, %" PRIu64 " bad words, %" PRIu64 " events not matched to a trigger: %s\n",
+           b.mismatches, b.bad_words, b.unknown, ok ? "OK" : "FAILED");
+
+    tdc_readout_destroy(rd);
+    tdc_emu_destroy(b.emu);
+    return ok ? 0 : 1;
+}
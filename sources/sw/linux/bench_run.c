@@ -0,0 +1,196 @@
+/*
+* Round trip check and benchmark of the run file writer and reader (tdc_run.h)
+*
+* Writes a run of frames as fast as the caller can produce them, with the trigger counter
+* wrapping halfway through, and reports the write rate, whether O_DIRECT was used and how many
+* frames the writer had to drop. Then maps the file and checks it: a full scan in trigger
+* order, random seeks by trigger and by time (reporting the seek rate), and the same scan after
+* cutting off the index, as if the writer had been killed.
+*
+* usage: bench_run [-f path] [-e events] [-H hits_per_frame] [-b block_kib] [-p blocks] [-l lookups]
+*   -f path            run file, default bench_run.tdc in the current directory (removed at the end)
+*   -e events          frames written, default 1000000
+*   -H hits_per_frame  hit words per frame, default 64
+*   -b block_kib       block size in KiB, default 4096
+*   -p blocks          block buffers of the writer, default 8
+*   -l lookups         random seeks by trigger and by time, default 100000
+*
+* Returns 1 if any check failed.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "tdc_run.h"
+
+#define HIT_PAD     (~0ull << 39)
+#define T0_NS       1700000000000000000ull
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift64(uint64_t *s)
+{
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+// Frame i carries its own trigger in the coarse time of every hit, and is stamped i us after T0_NS
+static int frame_ok(const struct tdc_run_frame *f, uint64_t first, unsigned hits)
+{
+    const uint64_t *w = f->payload;
+    uint64_t i = f->trigger - first;
+    if (f->hdr->n_words != hits || (uint32_t)f->trigger != f->hdr->trigger || f->hdr->timestamp_ns != T0_NS + i * 1000)
+        return 0;
+    for (unsigned k = 0; k < hits; k++)
+        if (w[k] != (HIT_PAD | (uint64_t)(f->hdr->trigger & 0xfffffff) << 11 | (k & 0x3f)))
+            return 0;
+    return 1;
+}
+
+// Read every frame in order. Returns the number of frames, or -1 if one is wrong.
+static int64_t scan(const struct tdc_run *r, uint64_t first, unsigned hits)
+{
+    struct tdc_run_cursor c;
+    struct tdc_run_frame f;
+    uint64_t n = 0, last = 0;
+
+    tdc_run_rewind(r, &c);
+    while (tdc_run_next(r, &c, &f) == 0) {
+        if ((n > 0 && f.trigger <= last) || !frame_ok(&f, first, hits))
+            return -1;
+        last = f.trigger;
+        n++;
+    }
+    return (int64_t)n;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage %s [-f path] [-e events] [-H hits_per_frame] [-b block_kib] [-p blocks] [-l lookups]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct tdc_run_writer_config cfg = { "bench_run.tdc", 0, 0, -1 };
+    uint64_t events = 1000000, lookups = 100000, seed = 88172645463325252ull;
+    unsigned hits = 64;
+    int opt, ok = 1;
+
+    while ((opt = getopt(argc, argv, "f:e:H:b:p:l:")) != -1) {
+        switch (opt) {
+            case 'f': cfg.path = optarg; break;
+            case 'e': events = strtoull(optarg, NULL, 0); break;
+            case 'H': hits = (unsigned)atoi(optarg); break;
+            case 'b': cfg.block_size = (uint32_t)atoi(optarg) * 1024; break;
+            case 'p': cfg.n_blocks = (unsigned)atoi(optarg); break;
+            case 'l': lookups = strtoull(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || events == 0 || hits > TDC_FRAME_MAX_WORDS)
+        usage(argv[0]);
+
+    // Write
+    static struct {
+        struct tdc_frame_header hdr;
+        uint64_t words[4096];
+    } ev;
+    uint64_t *words = (hits <= 4096) ? ev.words : malloc(hits * sizeof(uint64_t));
+    uint32_t first = (uint32_t)-(int64_t)(events / 2);     // Wraps halfway through
+    if (words == NULL)
+        return 1;
+    struct tdc_run_writer *w = tdc_run_writer_create(&cfg);
+    if (w == NULL)
+        return 1;
+    double t0 = now_s();
+    for (uint64_t i = 0; i < events; i++) {
+        uint32_t trigger = first + (uint32_t)i;
+        memset(&ev.hdr, 0, sizeof(ev.hdr));
+        ev.hdr.magic        = TDC_FRAME_MAGIC;
+        ev.hdr.version      = TDC_FRAME_VERSION;
+        ev.hdr.header_len   = sizeof(ev.hdr);
+        ev.hdr.trigger      = trigger;
+        ev.hdr.bram_id      = 1 + (i & 1);
+        ev.hdr.n_words      = hits;
+        ev.hdr.timestamp_ns = T0_NS + i * 1000;
+        for (unsigned k = 0; k < hits; k++)
+            words[k] = HIT_PAD | (uint64_t)(trigger & 0xfffffff) << 11 | (k & 0x3f);
+        tdc_run_write(w, &ev.hdr, words);
+    }
+    struct tdc_run_writer_stats ws;
+    tdc_run_writer_get_stats(w, &ws);
+    if (tdc_run_writer_close(w) < 0)
+        ok = 0;
+    double dt = now_s() - t0;
+    printf("Write:  %" PRIu64 " frames, %.1f MB in %.3f s = %.0f MB/s (%s), %" PRIu64 " dropped, "
+           "queue high water %u\n", ws.frames, ws.bytes / 1e6, dt, ws.bytes / dt / 1e6,
+           ws.direct ? "O_DIRECT" : "buffered", ws.dropped, ws.queue_high_water);
+
+    // Full scan
+    struct tdc_run r;
+    if (tdc_run_open(&r, cfg.path) < 0)
+        return 1;
+    t0 = now_s();
+    int64_t n = scan(&r, first, hits);
+    dt = now_s() - t0;
+    int scan_ok = n >= 0 && (uint64_t)n == ws.frames && r.n_frames == ws.frames && !r.recovered;
+    printf("Scan:   %" PRId64 " frames in %.3f s = %.0f frames/s: %s\n", n, dt, n / dt, scan_ok ? "OK" : "FAILED");
+    ok &= scan_ok;
+
+    // Random seeks. With dropped frames, a seek can land on a later trigger, or on none at all
+    // after the last frame written.
+    uint64_t bad = 0, last = r.n_index ? r.index[r.n_index - 1].last_trigger : 0;
+    t0 = now_s();
+    for (uint64_t l = 0; l < lookups; l++) {
+        struct tdc_run_cursor c;
+        struct tdc_run_frame f;
+        uint64_t i = xorshift64(&seed) % events;
+        if (first + i > last) {
+            bad += tdc_run_find_trigger(&r, first + i, &c) == 0;
+            bad += tdc_run_find_time(&r, T0_NS + i * 1000, &c) == 0;
+            continue;
+        }
+        if (tdc_run_find_trigger(&r, first + i, &c) < 0 || tdc_run_next(&r, &c, &f) < 0 ||
+            f.trigger < first + i || (ws.dropped == 0 && f.trigger != first + i) || !frame_ok(&f, first, hits))
+            bad++;
+        if (tdc_run_find_time(&r, T0_NS + i * 1000, &c) < 0 || tdc_run_next(&r, &c, &f) < 0 ||
+            f.hdr->timestamp_ns < T0_NS + i * 1000 || (ws.dropped == 0 && f.trigger != first + i))
+            bad++;
+    }
+    dt = now_s() - t0;
+    printf("Seek:   %" PRIu64 " trigger + time seeks in %.3f s = %.0f seeks/s, %" PRIu64 " wrong: %s\n",
+           2 * lookups, dt, 2 * lookups / dt, bad, bad == 0 ? "OK" : "FAILED");
+    ok &= bad == 0;
+
+    // Cut the index off and read the file again
+    const struct tdc_run_trailer *t = (const struct tdc_run_trailer *)(r.map + r.len - sizeof(*t));
+    uint64_t index_offset = t->index_offset;
+    tdc_run_close(&r);
+    if (truncate(cfg.path, (off_t)index_offset) < 0 || tdc_run_open(&r, cfg.path) < 0) {
+        perror("truncate");
+        return 1;
+    }
+    n = scan(&r, first, hits);
+    int rec_ok = r.recovered && n >= 0 && (uint64_t)n == ws.frames;
+    printf("Recover: %" PRId64 " frames without the index: %s\n", n, rec_ok ? "OK" : "FAILED");
+    ok &= rec_ok;
+    tdc_run_close(&r);
+
+    unlink(cfg.path);
+    if (words != ev.words)
+        free(words);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+/*
+* Local consumer of the events fanned out by the daemon (tdc_fan.h)
+*
+* Attaches to the shared memory ring of a daemon running on the same board and reads every
+* event it publishes in place, without opening the UIO devices or slowing the readout down.
+* Every second it reports the frame and hit rate, the frames it did not get (held back for a
+* throttling consumer) and how far behind the daemon it is. A starting point for monitoring,
+* disk writers or a second network sender, and a way to try the slow consumer policies out:
+*
+* usage: consumer [-n fan_name] [-p drop|throttle] [-d delay_us] [-o outfile] [-t seconds]
+*   -n fan_name    abstract socket of the daemon (daemon -F), default tdc_fan
+*   -p policy      what the daemon does when this consumer falls a whole ring behind: drop
+*                  (detach it, the default) or throttle (hold frames back for everyone)
+*   -d delay_us    sleep this long after every frame, to play a slow consumer
+*   -o outfile     append every frame (header + payload) to outfile, as sent on the network
+*   -t seconds     stop after this long, default: until the daemon stops or detaches us
+*
+* Build with: make consumer
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "tdc_fan.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *name = TDC_FAN_SOCK_NAME;
+    enum tdc_fan_policy policy = TDC_FAN_DROP;
+    unsigned delay_us = 0;
+    double seconds = 0;
+    FILE *out = NULL;
+    struct tdc_fan_client c;
+    int opt, ret = 0;
+
+    while ((opt = getopt(argc, argv, "n:p:d:o:t:")) != -1) {
+        switch (opt) {
+            case 'n': name = optarg; break;
+            case 'p':
+                if (strcmp(optarg, "drop") != 0 && strcmp(optarg, "throttle") != 0)
+                    goto usage;
+                policy = (optarg[0] == 't') ? TDC_FAN_THROTTLE : TDC_FAN_DROP;
+                break;
+            case 'd': delay_us = (unsigned)atoi(optarg); break;
+            case 'o':
+                out = fopen(optarg, "ab");
+                if (out == NULL) {
+                    perror(optarg);
+                    exit(1);
+                }
+                break;
+            case 't': seconds = atof(optarg); break;
+            default:
+            usage:
+                fprintf(stderr, "usage %s [-n fan_name] [-p drop|throttle] [-d delay_us] [-o outfile] [-t seconds]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (tdc_fan_attach(&c, name, policy, "consumer") < 0)
+        exit(1);
+    fprintf(stderr, "Attached to @%s, %" PRIu64 " MB ring\n", name, c.ring->size >> 20);
+
+    double start = now(), last = start;
+    uint64_t frames = 0, hits = 0, last_frames = 0, last_hits = 0;
+    while (seconds <= 0 || now() - start < seconds) {
+        const struct tdc_frame_header *hdr;
+        const void *payload;
+        int n = tdc_fan_next(&c, &hdr, &payload, 200);
+        if (n < 0) {
+            ret = 1;
+            break;
+        }
+        if (n > 0) {
+            size_t plen = tdc_frame_payload_len(hdr);
+            frames++;
+            hits += hdr->n_words;
+            if (out != NULL && (fwrite(hdr, hdr->header_len, 1, out) != 1 ||
+                                (plen > 0 && fwrite(payload, plen, 1, out) != 1))) {
+                perror("Failed to write the output file");
+                ret = 1;
+                break;
+            }
+            if (delay_us)
+                usleep(delay_us);
+            if (tdc_fan_release(&c) < 0) {
+                fprintf(stderr, "Detached while reading a frame, it may be corrupt\n");
+                ret = 1;
+                break;
+            }
+        }
+        double t = now();
+        if (t - last >= 1.0) {
+            fprintf(stderr, "%.0f frames/s, %.0f hits/s, %" PRIu64 " frames not received, lag %.1f%% of the ring\n",
+                    (frames - last_frames) / (t - last), (hits - last_hits) / (t - last), c.lost,
+                    100.0 * tdc_fan_lag(&c) / c.ring->size);
+            last = t;
+            last_frames = frames;
+            last_hits = hits;
+        }
+    }
+    fprintf(stderr, "%" PRIu64 " frames, %" PRIu64 " hits received, %" PRIu64 " frames not received\n",
+            frames, hits, c.lost);
+    tdc_fan_detach(&c);
+    if (out != NULL)
+        fclose(out);
+    return ret;
+}
@@ -1,45 +1,167 @@
 /*
-* Daemon to handle interrupts from the PL
-* 
-* Uses the following UIO devices:
+* Readout daemon of the TDC: sends every event the PL reads out to the DAQ host
+*
+* Reads the PL out through the readout library (tdc_readout.h), whose IRQ thread services the
+* trigger interrupt and the rd_busy handshake on a core of its own with a real-time priority,
+* so nothing below can delay it. Every event it reads out goes, on the main thread, to:
+*   - the DAQ host, as a binary frame (tdc_frame.h) on a TCP connection, plain or packed (-z,
+*     tdc_pack.h, about a quarter of the size), its hits sorted by coarse time with -o or -z
+*     (tdc_order.h). The connection is made without blocking and retried every second while the
+*     host is down; events read out meanwhile are discarded and counted as send errors
+*   - a run file on local storage (-w, tdc_run.h), written by a thread of its own, also while
+*     the host is down; runfile.c reads it back by trigger or time
+*   - the online monitoring histograms (tdc_mon.h), in shared memory for monitor.c
+*   - local consumers (consumer.c, fanout.py), through the shared memory ring of tdc_fan.h; a
+*     consumer that falls a whole ring behind is detached or holds the ring back, never the
+*     readout
+*   - the fine time histograms of every channel (-c, tdc_calib.h). Every CALIB_REBUILD_HITS hits
+*     a copy is built into calibration tables and saved to calib_file by a thread of its own,
+*     and the histograms are halved so the tables follow drifts. The file is reloaded at the
+*     next start; receiver -d and runfile -c decode the hit times with it.
+* If the host falls behind for long enough to use up every event buffer, triggers are still
+* acknowledged but their hits are dropped and counted as "pool exhausted".
+*
+* The main thread runs an epoll event loop over the readout eventfd, the data socket (a frame
+* that does not fit in the socket buffer is finished when it becomes writable again), the
+* control socket (-C, text commands, see ctrl_command()), the fan-out socket, a signalfd
+* (SIGINT/SIGTERM stop the daemon after sending the queued events) and a one second timer. On
+* the timer it prints the readout latency and backpressure, and every stats_period seconds the
+* per-stage counters of the PL (tdc_stats.h) and the percentiles of the handshake latency the
+* PL measured (tdc_latency.h).
+*
+* With -f, the channel mask, minimum hit width, prescale and rate limit of every channel and the
+* trigger window are set in the PL (tdc_ctrl.h) from ctrl_file before the readout starts, and
+* again by the "config" control command after the file was edited.
+*
+* Uses the following UIO devices (opened by the readout library, see tdc_readout.c):
 *   - uio0: tdc_int                (PL -> PS interrupt)
 *   - uio1: axi_bram_ctrl@a0000000 (BRAM 1)
 *   - uio2: axi_bram_ctrl@a0002000 (BRAM 2)
 *   - uio3: gpio@a0010000          (read_busy)
-*   - uio4: gpio@a0002000          (which_bram)
+*   - uio4: gpio@a0020000          (which_bram)
+* or, with the N bank firmware (-b banks), uio1 maps all the banks, uio2 is read_busy and uio3
+* is bank_sel. The statistics and control blocks are found by name.
 *
-* General description of functionality:
-*   - create socket
-*   - connect to socket
-*   - wait for interrupt
-*   - if interrupt:
-*       - raise PS -> PL "read busy" flag 
-*       - read PL -> PS signal describing which BRAM to read from 
-*       - open UIOX file descriptor corresponding to that BRAM
-*       - loop over BRAM, get data, send 
-*       - close fds
-*   - lower PS -> PL busy flag
+* usage: daemon [options] hostname port [pool_size] [irq_cpu] [loop_cpu], see usage()
 *
+* The frames can be received and decoded on the DAQ host with receiver.c
 */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
 #include <netinet/in.h>
-#include <netdb.h> 
-#include <fcntl.h>
+#include <netdb.h>
 #include <inttypes.h>
-#include <limits.h>     // CHAR_BIT
 
-#define UIO_INTR    "/dev/uio0"
-#define UIO_BRAM1   "/dev/uio1"
-#define UIO_BRAM2   "/dev/uio2"
-#define UIO_RDBUSY  "/dev/uio3"
-#define UIO_BRAMSEL "/dev/uio4"
+#include "tdc_frame.h"
+#include "tdc_readout.h"
+#include "tdc_calib.h"
+#include "tdc_pack.h"
+#include "tdc_stats.h"
+#include "tdc_latency.h"
+#include "tdc_ctrl.h"
+#include "tdc_mon.h"
+#include "tdc_run.h"
+#include "tdc_fan.h"
+
+// Defaults, can be overridden on the command line
+#define DEFAULT_POOL_SIZE       64      // Event buffers (64 x 8 KB)
+#define DEFAULT_IRQ_CPU         1
+#define DEFAULT_LOOP_CPU        2
+#define DEFAULT_IRQ_PRIORITY    50      // SCHED_FIFO
+#define DEFAULT_PL_STATS_PERIOD 10      // Seconds between PL statistics snapshots, 0 => off
+
+// Rebuild and save the fine time calibration every N hits, then halve the histograms
+#define CALIB_REBUILD_HITS  (1u << 22)
+#define CALIB_DECAY_SHIFT   1
+
+#define MAX_EPOLL_EVENTS    16
+#define CTRL_LINE_MAX       256
+
+// What an epoll event refers to
+enum source_type { SRC_EVENTS, SRC_DATA, SRC_CTRL_LISTEN, SRC_CTRL_CLIENT, SRC_TIMER, SRC_SIGNAL, SRC_FAN_LISTEN, SRC_FAN_CLIENT };
+
+struct source {
+    enum source_type type;
+    int fd;
+};
+
+struct ctrl_client {
+    struct source src;      // Must be first
+    char line[CTRL_LINE_MAX];
+    size_t len;
+};
+
+struct daemon {
+    int epfd;
+    struct tdc_readout *rd;
+    int stop;
+
+    // Data connection to the DAQ host
+    struct sockaddr_in addr;
+    struct source data;         // data.fd = -1 while disconnected
+    int connecting;             // Non-blocking connect() in progress
+    uint32_t data_events;       // Events data.fd is currently registered for
+    struct tdc_event *cur;      // Event being written, NULL if none
+    size_t cur_off;             // Bytes of cur already written
+    uint32_t unsent;            // Triggers of discarded events, added to n_dropped of the next frame
+    int pack;                   // Send packed frames (-z)
+
+    struct source events, ctrl, timer, sig;
+
+    // Online fine time calibration: the event loop fills calib, the calibration thread builds
+    // and saves a copy of it (calib_snap), so the file I/O never holds the loop up
+    struct tdc_calib *calib;    // NULL => no online calibration
+    const char *calib_path;
+    uint64_t calib_hits;        // Hits added since the last rebuild
+    struct tdc_calib *calib_snap;
+    pthread_t calib_thread;
+    pthread_mutex_t calib_lock;
+    pthread_cond_t calib_cond;
+    int calib_pending;          // calib_snap waits to be built, under calib_lock
+    int calib_stop;
+
+    // PL statistics block (tdc_stats.h)
+    struct uio_dev pl_stats;
+    int pl_stats_ok;            // Block found, snapshots are taken
+    unsigned pl_stats_period;   // Timer ticks (seconds) between snapshots
+    unsigned pl_stats_ticks;
+    char pl_stats_text[2048];   // Last report, for the control socket
+    struct tdc_latency pl_lat;  // Handshake latency of the events since the last report
+    int pl_lat_ok;              // The firmware timestamps the handshake
+    char pl_lat_text[1024];     // Last report, for the control socket
+
+    // PL control block (tdc_ctrl.h), only opened with -f
+    struct uio_dev pl_ctrl;
+    const char *ctrl_path;      // Settings file, NULL => the PL settings are left alone
+
+    // Online monitoring histograms (tdc_mon.h), filled by the event loop thread
+    struct tdc_mon mon;
+    int mon_ok;
+
+    // Local recording (-w), NULL => off
+    struct tdc_run_writer *run;
+
+    // Fan-out to local consumers (tdc_fan.h)
+    struct tdc_fan fan;
+    int fan_ok;
+    struct source fan_listen;
+    uint64_t fan_skipped;       // Frames held back, as of the last report
+};
 
 void error(const char *msg)
 {
@@ -47,172 +169,759 @@ void error(const char *msg)
     exit(0);
 }
 
-int main(int argc, char *argv[])
+static void usage(const char *prog)
 {
-    // Networking
-    int sockfd, portno, n;
-    struct sockaddr_in serv_addr;
-    struct hostent *server;
+    fprintf(stderr, "usage %s [options] hostname port [pool_size] [irq_cpu] [loop_cpu]\n"
+            "  -b banks         N bank firmware with this many banks (default: 2 BRAM firmware)\n"
+            "  -c calib_file    build the fine time calibration online and save it to calib_file\n"
+            "  -C ctrl_port     accept control commands on this TCP port\n"
+            "  -f ctrl_file     apply the PL channel settings and trigger window of ctrl_file\n"
+            "  -F fan_name      abstract socket of the fan-out to local consumers (default %s)\n"
+            "  -m mon_shm       shared memory name of the monitoring histograms (default %s)\n"
+            "  -o               sort the hits of every event by coarse time\n"
+            "  -r irq_priority  SCHED_FIFO priority of the IRQ thread, 0 => normal (default %d)\n"
+            "  -s stats_period  seconds between PL statistics reports, 0 => off (default %d)\n"
+            "  -w run_file      record every event to run_file\n"
+            "  -z               send packed frames (implies -o)\n",
+            prog, TDC_FAN_SOCK_NAME, TDC_MON_SHM_NAME, DEFAULT_IRQ_PRIORITY, DEFAULT_PL_STATS_PERIOD);
+    exit(0);
+}
 
-    // File descriptors
-    int uio_intr_fd;
-    int uio_bram_fd;
-    int uio_rdbusy_fd;
-    int uio_bramsel_fd;
+static void watch(struct daemon *d, struct source *src, uint32_t events)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = src };
+    if (epoll_ctl(d->epfd, EPOLL_CTL_ADD, src->fd, &ev) < 0)
+        error("epoll_ctl");
+}
 
-    // Pointers
-    volatile unsigned int *uio_intr_ptr;
-    volatile unsigned int *uio_bram_ptr;
-    volatile unsigned int *uio_rdbusy_ptr;
-    volatile unsigned int *uio_bramsel_ptr;
+static void set_data_events(struct daemon *d, uint32_t events)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = &d->data };
+    if (events == d->data_events)
+        return;
+    if (epoll_ctl(d->epfd, EPOLL_CTL_MOD, d->data.fd, &ev) < 0)
+        error("epoll_ctl");
+    d->data_events = events;
+}
 
-    // Memory ranges (HARD-CODED FOR NOW - FIX ME)
-    size_t uio_bram_len = 8192;
-    size_t uio_rdbusy_len = 65536;
-    size_t uio_bramsel_len = 65536;
+// Calibration thread: build and save every copy of the histograms handed over by calib_rebuild()
+static void *calib_thread(void *arg)
+{
+    struct daemon *d = arg;
 
-    // Offsets (HARD-CODED FOR NOW - FIX ME)
-    off_t offset = 0;
+    pthread_mutex_lock(&d->calib_lock);
+    while (1) {
+        while (!d->calib_pending && !d->calib_stop)
+            pthread_cond_wait(&d->calib_cond, &d->calib_lock);
+        if (!d->calib_pending)
+            break;
+        pthread_mutex_unlock(&d->calib_lock);
 
-    // BRAM selection
-    int which_bram;
+        unsigned n = tdc_calib_build(d->calib_snap, TDC_CALIB_MIN_ENTRIES);
+        if (tdc_calib_save(d->calib_snap, d->calib_path) == 0)
+            printf("Fine time calibration rebuilt: %u/%u channels calibrated, saved to %s\n",
+                   n, TDC_DECODE_CHANNELS, d->calib_path);
 
-    // Create socket, connect
-    if (argc < 3) {
-       fprintf(stderr,"usage %s hostname port\n", argv[0]);
-       exit(0);
+        pthread_mutex_lock(&d->calib_lock);
+        d->calib_pending = 0;
+        pthread_cond_broadcast(&d->calib_cond);
     }
-    portno = atoi(argv[2]);
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) 
-        error("ERROR opening socket");
-    else
-        printf("Successfully opened socket\n");
-    server = gethostbyname(argv[1]);
-    if (server == NULL) {
-        fprintf(stderr,"ERROR, no such host\n");
-        exit(0);
+    pthread_mutex_unlock(&d->calib_lock);
+    return NULL;
+}
+
+// Hand a copy of the histograms to the calibration thread and decay them. Returns 0, or -1 if
+// the thread is still busy with the previous copy (wait => wait for it instead).
+static int calib_rebuild(struct daemon *d, int wait)
+{
+    pthread_mutex_lock(&d->calib_lock);
+    while (wait && d->calib_pending)
+        pthread_cond_wait(&d->calib_cond, &d->calib_lock);
+    if (d->calib_pending) {
+        pthread_mutex_unlock(&d->calib_lock);
+        return -1;
     }
-    bzero((char *) &serv_addr, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    bcopy((char *)server->h_addr, 
-         (char *)&serv_addr.sin_addr.s_addr,
-         server->h_length);
-    serv_addr.sin_port = htons(portno);
-    if (connect(sockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr)) < 0) 
-        error("ERROR connecting");
-    else 
-        printf("Successfully connected to socket\n");
+    *d->calib_snap = *d->calib;
+    d->calib_pending = 1;
+    pthread_cond_broadcast(&d->calib_cond);
+    pthread_mutex_unlock(&d->calib_lock);
 
-    // Open the TDC interrupt UIO device
-    uio_intr_fd = open(UIO_INTR, O_RDWR);
-    if (uio_intr_fd < 0) {
-        close(uio_intr_fd);
-        error("Failed to open the TDC interrupt UIO device");
+    tdc_calib_decay(d->calib, CALIB_DECAY_SHIFT);
+    d->calib_hits = 0;
+    return 0;
+}
+
+static int calib_start(struct daemon *d)
+{
+    d->calib_snap = malloc(sizeof(*d->calib_snap));
+    if (d->calib_snap == NULL) {
+        perror("Failed to allocate the calibration");
+        return -1;
     }
-    else {
-        printf("Opened the TDC interrupt UIO device...\n");
+    pthread_mutex_init(&d->calib_lock, NULL);
+    pthread_cond_init(&d->calib_cond, NULL);
+    if (pthread_create(&d->calib_thread, NULL, calib_thread, d) != 0) {
+        fprintf(stderr, "Failed to start the calibration thread\n");
+        free(d->calib_snap);
+        return -1;
     }
+    return 0;
+}
 
-    while (1) {
-
-        printf("Daemon waiting for interrupts (triggers)...\n");
+// Rebuild and save the calibration one last time and stop its thread
+static void calib_finish(struct daemon *d)
+{
+    calib_rebuild(d, 1);
+    pthread_mutex_lock(&d->calib_lock);
+    d->calib_stop = 1;
+    pthread_cond_broadcast(&d->calib_cond);
+    pthread_mutex_unlock(&d->calib_lock);
+    pthread_join(d->calib_thread, NULL);
+    free(d->calib_snap);
+}
 
-        // Unmask (clear) interrupt
-        uint32_t info = 1; 
-        ssize_t nb = write(uio_intr_fd, &info, sizeof(info));
-        if (nb != (ssize_t)sizeof(info)) {
-            close(uio_intr_fd);
-            error("Failed to write to (clear) TDC interrupt UIO device");
-        }
-        else {
-            printf("Successfully unmasked tdc interrupt\n");
-        }              
-
-        // Wait for interrupt
-        nb = read(uio_intr_fd, &info, sizeof(info));
-        if (nb == (ssize_t)sizeof(info)) {
-            printf("Trigger received. Interrupt #%u\n", info);
+// Take the next event from the readout library, adding its hits to the monitoring and
+// calibration histograms and its handshake to the latency histograms, packing it in place
+// with -z (the words are not needed after that), recording it with -w and publishing it to
+// the local consumers
+static struct tdc_event *event_take(struct daemon *d)
+{
+    struct tdc_event *ev = tdc_readout_next(d->rd);
+    if (ev == NULL)
+        return NULL;
+    if (d->mon_ok)
+        tdc_mon_fill(tdc_mon_writer(&d->mon, 0), ev->words, ev->hdr.n_words);
+    if (d->pl_lat_ok)
+        tdc_latency_add(&d->pl_lat, &ev->pl_hs);
+    if (d->calib != NULL) {
+        tdc_calib_fill(d->calib, ev->words, ev->hdr.n_words);
+        d->calib_hits += ev->hdr.n_words;
+        if (d->calib_hits >= CALIB_REBUILD_HITS)
+            calib_rebuild(d, 0);    // retried with the next event while the thread is busy
+    }
+    if (d->pack) {
+        // Sent as plain words if a word is not a hit
+        ssize_t len = tdc_pack_hits(ev->words, ev->hdr.n_words, (uint8_t *)ev->words);
+        if (len >= 0) {
+            ev->hdr.flags |= TDC_FRAME_FLAG_PACKED;
+            ev->hdr.packed_len = (uint32_t)len;
         }
+    }
+    // Recorded as sent; the file has no gaps from network outages, so n_dropped is not adjusted
+    if (d->run != NULL)
+        tdc_run_write(d->run, &ev->hdr, ev->words);
+    if (d->fan_ok)
+        tdc_fan_publish(&d->fan, &ev->hdr, ev->words);
+    return ev;
+}
 
-        // 1. Raise PS -> PL "read busy" flag 
-        uio_rdbusy_fd = open(UIO_RDBUSY, O_RDWR);
-        if (uio_rdbusy_fd < 0) {
-            error("Failed to open the read_busy UIO device");
-        }
-        else {
-            printf("Opened the read_busy UIO device\n");
+// Hand an event back to the readout library
+static void event_done(struct daemon *d, struct tdc_event *ev, int status)
+{
+    tdc_readout_release(d->rd, ev, status);
+}
+
+// Events that cannot be sent while the data connection is down. The triggers they stood for
+// (including the ones they already reported as dropped) are reported by the next frame sent.
+static void drop_queued(struct daemon *d)
+{
+    struct tdc_event *ev;
+    if (d->cur != NULL) {
+        d->unsent += 1 + d->cur->hdr.n_dropped;
+        event_done(d, d->cur, -1);
+        d->cur = NULL;
+    }
+    while ((ev = event_take(d)) != NULL) {
+        d->unsent += 1 + ev->hdr.n_dropped;
+        event_done(d, ev, -1);
+    }
+}
+
+static void data_close(struct daemon *d, const char *why)
+{
+    if (d->connecting)
+        fprintf(stderr, "Cannot connect to the DAQ host (%s), retrying...\n", why);
+    else
+        fprintf(stderr, "Data connection lost (%s), reconnecting...\n", why);
+    close(d->data.fd);     // also removes it from the epoll set
+    d->data.fd = -1;
+    d->connecting = 0;
+    drop_queued(d);
+}
+
+// Start a non-blocking connect to the DAQ host, completed in data_ready()
+static void data_connect(struct daemon *d)
+{
+    d->data.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (d->data.fd < 0) {
+        perror("ERROR opening socket");
+        return;
+    }
+    d->connecting = 1;
+    d->data_events = EPOLLOUT;
+    watch(d, &d->data, EPOLLOUT);
+    if (connect(d->data.fd, (struct sockaddr *)&d->addr, sizeof(d->addr)) < 0 && errno != EINPROGRESS)
+        data_close(d, strerror(errno));
+}
+
+// Write as much of the queued events as the socket takes without blocking
+static void data_flush(struct daemon *d)
+{
+    while (1) {
+        if (d->cur == NULL) {
+            d->cur = event_take(d);
+            if (d->cur == NULL)
+                break;
+            d->cur_off = 0;
+            d->cur->hdr.n_dropped += d->unsent;
+            d->unsent = 0;
         }
-        // Memory map the UIO device
-        uio_rdbusy_ptr = mmap(NULL, uio_rdbusy_len, PROT_READ | PROT_WRITE, MAP_SHARED, uio_rdbusy_fd, offset);
-        if (uio_rdbusy_ptr == MAP_FAILED) {
-            error("Failed to mmap read_busy UIO device");
+
+        // Header + payload, minus whatever was already written
+        struct iovec iov[2];
+        size_t hlen = sizeof(d->cur->hdr);
+        size_t wlen = tdc_frame_payload_len(&d->cur->hdr);
+        int nv = 0;
+        if (d->cur_off < hlen) {
+            iov[nv].iov_base = (char *)&d->cur->hdr + d->cur_off;
+            iov[nv++].iov_len = hlen - d->cur_off;
         }
-        else {
-            printf("successfully mmap'd read_busy UIO device\n");
+        if (wlen > 0) {
+            size_t off = (d->cur_off > hlen) ? d->cur_off - hlen : 0;
+            iov[nv].iov_base = (char *)d->cur->words + off;
+            iov[nv++].iov_len = wlen - off;
         }
-        // Write to the read_busy AXI GPIO data register
-        uio_rdbusy_ptr[0] = 0x01;
 
-        // 2. read PL -> PS signal describing which BRAM to read from 
-        uio_bramsel_fd = open(UIO_BRAMSEL, O_RDWR);
-        if (uio_bramsel_fd < 0) {
-            error("Failed to open the which_bram UIO device");
+        ssize_t n = writev(d->data.fd, iov, nv);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Finish the frame once the socket drains
+                set_data_events(d, EPOLLIN | EPOLLOUT);
+                return;
+            }
+            data_close(d, strerror(errno));
+            return;
         }
-        else {
-            printf("Opened the which_bram UIO device\n");
+        d->cur_off += n;
+        if (d->cur_off == hlen + wlen) {
+            event_done(d, d->cur, 0);
+            d->cur = NULL;
         }
-        // Memory map the UIO device
-        uio_bramsel_ptr = mmap(NULL, uio_bramsel_len, PROT_READ | PROT_WRITE, MAP_SHARED, uio_bramsel_fd, offset);
-        if (uio_bramsel_ptr == MAP_FAILED) {
-            error("Failed to mmap which_bram UIO device");
-        }
-        else {
-            printf("successfully mmap'd which_bram UIO device\n");
+    }
+    set_data_events(d, EPOLLIN);
+}
+
+static void data_ready(struct daemon *d, uint32_t events)
+{
+    if (d->connecting) {
+        int err = 0;
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            return;
+        socklen_t len = sizeof(err);
+        getsockopt(d->data.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            data_close(d, strerror(err));
+            return;
         }
-        // Read from the which_bram AXI GPIO data register
-        which_bram = *(volatile uint32_t *)(uio_bramsel_ptr + offset);
-        printf("which_bram: 0x%08x\n", which_bram);
-        printf("Opening BRAM %d\n", which_bram);
-        // Unmap the memory and close the UIO device
-        munmap(uio_bramsel_ptr, uio_bramsel_len);
-        close(uio_bramsel_fd);
-
-        // 3. open UIOX file descriptor corresponding to that BRAM
-        if (which_bram == 1) {
-            uio_bram_fd = open(UIO_BRAM1, O_RDWR);
+        d->connecting = 0;
+        printf("Successfully connected to socket\n");
+        data_flush(d);
+        return;
+    }
+    // The host never sends anything, so readable means closed
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        char c;
+        ssize_t n = recv(d->data.fd, &c, 1, MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            data_close(d, n == 0 ? "closed by peer" : strerror(errno));
+            return;
         }
-        else {
-            uio_bram_fd = open(UIO_BRAM2, O_RDWR);
+    }
+    if (events & EPOLLOUT)
+        data_flush(d);
+}
+
+static void events_ready(struct daemon *d)
+{
+    uint64_t n;
+    // Clear the eventfd first, so an event queued from here on wakes the loop up again
+    if (read(d->events.fd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+        perror("Failed to read the readout eventfd");
+    if (d->data.fd < 0)
+        drop_queued(d);
+    else if (!d->connecting && !(d->data_events & EPOLLOUT))
+        data_flush(d);
+    // else: still connecting, or waiting for the socket to drain
+}
+
+void stats_format(const struct tdc_readout_stats *s, char *buf, size_t len)
+{
+    // Every trigger seen by the PL is either sent, or lost in one of four places
+    uint64_t total = s->triggers + s->pl_missed + s->irq_missed;
+    uint64_t lost  = s->pl_missed + s->irq_missed + s->pool_exhausted + s->send_errors;
+    int n = snprintf(buf, len, "Triggers %" PRIu64 ", sent %" PRIu64 ", send errors %" PRIu64
+                     ", pool exhausted %" PRIu64 ", queue %u (high water %u, PL banks %u)\n"
+                     "Lost triggers %" PRIu64 " = %.3f%% dead time (PL busy %" PRIu64 ", missed interrupts %" PRIu64 ")\n",
+                     s->triggers, s->events_sent, s->send_errors, s->pool_exhausted,
+                     s->queue_depth, s->queue_high_water, s->pl_banks_high_water,
+                     lost, total ? 100.0 * lost / total : 0.0, s->pl_missed, s->irq_missed);
+    if (s->lat_n == 0 || n < 0 || (size_t)n >= len)
+        return;
+    snprintf(buf + n, len - n, "Readout latency over %" PRIu64 " triggers: min %.2f us, mean %.2f us, max %.2f us\n",
+             s->lat_n, s->lat_min_ns / 1e3, (double)s->lat_sum_ns / s->lat_n / 1e3, s->lat_max_ns / 1e3);
+}
+
+static void timer_ready(struct daemon *d)
+{
+    struct tdc_readout_stats stats;
+    char buf[768];
+    uint64_t n;
+
+    if (read(d->timer.fd, &n, sizeof(n)) < 0)
+        return;
+    tdc_readout_get_stats(d->rd, &stats, 1);
+    stats_format(&stats, buf, sizeof(buf));
+    fputs(buf, stdout);
+    if (d->mon_ok)
+        tdc_mon_tick(&d->mon);
+    if (d->run != NULL) {
+        // Bounds what a crash can lose to one second of events
+        struct tdc_run_writer_stats rs;
+        tdc_run_flush(d->run);
+        tdc_run_writer_get_stats(d->run, &rs);
+        if (rs.dropped != 0 || rs.write_errors != 0)
+            printf("Run file: %" PRIu64 " frames recorded, %" PRIu64 " dropped, %" PRIu64 " blocks not written\n",
+                   rs.frames, rs.dropped, rs.write_errors);
+    }
+    if (d->fan_ok && d->fan.ring->skipped != d->fan_skipped) {
+        printf("Fan-out: %" PRIu64 " frames held back for slow consumers\n", d->fan.ring->skipped - d->fan_skipped);
+        d->fan_skipped = d->fan.ring->skipped;
+    }
+    if (d->pl_stats_ok && ++d->pl_stats_ticks >= d->pl_stats_period) {
+        // Restart the PL counters with every snapshot, so each report covers one period
+        struct tdc_pl_stats pl;
+        d->pl_stats_ticks = 0;
+        if (tdc_stats_snapshot(&d->pl_stats, 1, &pl) == 0) {
+            tdc_stats_format(&pl, d->pl_stats_text, sizeof(d->pl_stats_text));
+            fputs(d->pl_stats_text, stdout);
         }
-        if (uio_bram_fd < 0) {
-            error("Failed to open the BRAM UIO device");
+        if (d->pl_lat_ok) {
+            tdc_latency_format(&d->pl_lat, d->pl_lat_text, sizeof(d->pl_lat_text));
+            fputs(d->pl_lat_text, stdout);
+            tdc_latency_clear(&d->pl_lat);
         }
-        else {
-            printf("Opened the BRAM UIO device\n");
+    }
+    fflush(stdout);
+    if (d->data.fd < 0)
+        data_connect(d);
+}
+
+// Apply the settings file on top of the firmware defaults, summary of the result in buf
+static int ctrl_config_apply(struct daemon *d, char *buf, size_t len)
+{
+    struct tdc_ctrl_config c;
+
+    tdc_ctrl_defaults(&d->pl_ctrl, &c);
+    if (tdc_ctrl_load(d->ctrl_path, &c) < 0 || tdc_ctrl_apply(&d->pl_ctrl, &c) < 0)
+        return -1;
+    tdc_ctrl_format(&c, buf, len);
+    return 0;
+}
+
+/*
+* Control commands, one per line:
+*   stats   reply with the counters (latency since the last report)
+*   plstats reply with the last snapshot of the PL counters
+*   latency reply with the last report of the PL handshake latency percentiles
+*   mon     reply with the monitoring histograms (rates over the last second)
+*   fanout  reply with the fan-out ring and the lag of every local consumer
+*   calib   hand the fine time histograms to the calibration thread to rebuild and save now
+*   config  reload the settings file (-f) into the PL control block, reply with the settings
+*   stop    stop the daemon
+*/
+static void ctrl_command(struct daemon *d, struct ctrl_client *c, const char *cmd)
+{
+    char buf[768];
+
+    if (strcmp(cmd, "stats") == 0) {
+        struct tdc_readout_stats stats;
+        tdc_readout_get_stats(d->rd, &stats, 0);
+        stats_format(&stats, buf, sizeof(buf));
+    } else if (strcmp(cmd, "plstats") == 0) {
+        const char *reply = d->pl_stats_text;
+        if (!d->pl_stats_ok)
+            reply = "ERROR no PL statistics block\n";
+        else if (reply[0] == '\0')
+            reply = "ERROR no PL statistics snapshot yet\n";
+        if (send(c->src.fd, reply, strlen(reply), MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && errno != EAGAIN)
+            perror("Failed to reply to the control client");
+        return;
+    } else if (strcmp(cmd, "latency") == 0) {
+        const char *reply = d->pl_lat_text;
+        if (!d->pl_lat_ok)
+            reply = "ERROR the firmware does not time the trigger handshake\n";
+        else if (reply[0] == '\0')
+            reply = "ERROR no latency report yet\n";
+        if (send(c->src.fd, reply, strlen(reply), MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && errno != EAGAIN)
+            perror("Failed to reply to the control client");
+        return;
+    } else if (strcmp(cmd, "mon") == 0) {
+        static char text[8192];
+        if (d->mon_ok)
+            tdc_mon_format(&d->mon, text, sizeof(text));
+        else
+            snprintf(text, sizeof(text), "ERROR no monitoring histograms\n");
+        if (send(c->src.fd, text, strlen(text), MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && errno != EAGAIN)
+            perror("Failed to reply to the control client");
+        return;
+    } else if (strcmp(cmd, "fanout") == 0) {
+        static char text[4096];
+        if (d->fan_ok)
+            tdc_fan_format(&d->fan, text, sizeof(text));
+        else
+            snprintf(text, sizeof(text), "ERROR no fan-out ring\n");
+        if (send(c->src.fd, text, strlen(text), MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && errno != EAGAIN)
+            perror("Failed to reply to the control client");
+        return;
+    } else if (strcmp(cmd, "calib") == 0) {
+        if (d->calib == NULL) {
+            snprintf(buf, sizeof(buf), "ERROR no calibration file (-c)\n");
+        } else if (calib_rebuild(d, 0) < 0) {
+            snprintf(buf, sizeof(buf), "ERROR still saving the previous calibration, try again\n");
+        } else {
+            snprintf(buf, sizeof(buf), "OK\n");
         }
-        // Map the BRAM memory into user space
-        uio_bram_ptr = (volatile uint64_t *)mmap(NULL, uio_bram_len, PROT_READ | PROT_WRITE, MAP_SHARED, uio_bram_fd, offset);
-        if (uio_bram_ptr == MAP_FAILED) {
-            error("Failed to mmap BRAM");
+    } else if (strcmp(cmd, "config") == 0) {
+        static char text[4096];
+        if (d->ctrl_path == NULL)
+            snprintf(text, sizeof(text), "ERROR no settings file (-f)\n");
+        else if (ctrl_config_apply(d, text + 3, sizeof(text) - 3) < 0)
+            snprintf(text, sizeof(text), "ERROR failed to apply %s, the PL settings may be partly updated\n", d->ctrl_path);
+        else
+            memcpy(text, "OK\n", 3);
+        if (send(c->src.fd, text, strlen(text), MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && errno != EAGAIN)
+            perror("Failed to reply to the control client");
+        return;
+    } else if (strcmp(cmd, "stop") == 0) {
+        d->stop = 1;
+        snprintf(buf, sizeof(buf), "OK\n");
+    } else if (cmd[0] == '\0') {
+        return;
+    } else {
+        snprintf(buf, sizeof(buf), "ERROR unknown command '%s' (stats, plstats, latency, mon, fanout, calib, config, stop)\n", cmd);
+    }
+    // Replies are short; a client that does not read them just misses them
+    if (send(c->src.fd, buf, strlen(buf), MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && errno != EAGAIN)
+        perror("Failed to reply to the control client");
+}
+
+static void ctrl_client_ready(struct daemon *d, struct ctrl_client *c)
+{
+    ssize_t n = recv(c->src.fd, c->line + c->len, sizeof(c->line) - 1 - c->len, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+    if (n <= 0) {
+        close(c->src.fd);
+        free(c);
+        return;
+    }
+    c->len += n;
+    c->line[c->len] = '\0';
+
+    char *start = c->line, *end;
+    while ((end = strpbrk(start, "\r\n")) != NULL) {
+        *end = '\0';
+        ctrl_command(d, c, start);
+        start = end + 1;
+    }
+    c->len = strlen(start);
+    memmove(c->line, start, c->len + 1);
+    if (c->len == sizeof(c->line) - 1)
+        c->len = 0;     // Overlong line, drop it
+}
+
+static void ctrl_accept(struct daemon *d)
+{
+    int fd = accept4(d->ctrl.fd, NULL, NULL, SOCK_NONBLOCK);
+    if (fd < 0) {
+        perror("ERROR on accept");
+        return;
+    }
+    struct ctrl_client *c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        close(fd);
+        return;
+    }
+    c->src.type = SRC_CTRL_CLIENT;
+    c->src.fd = fd;
+    watch(d, &c->src, EPOLLIN);
+}
+
+static void fan_accept(struct daemon *d)
+{
+    struct source *src = calloc(1, sizeof(*src));
+    if (src == NULL)
+        return;
+    src->type = SRC_FAN_CLIENT;
+    src->fd = tdc_fan_accept(&d->fan);
+    if (src->fd < 0) {
+        free(src);
+        return;
+    }
+    watch(d, src, EPOLLIN);
+}
+
+static void fan_client_ready(struct daemon *d, struct source *src)
+{
+    // The consumer is gone and its socket closed
+    if (tdc_fan_client_ready(&d->fan, src->fd) < 0)
+        free(src);
+}
+
+static int ctrl_listen(int port)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        error("ERROR opening control socket");
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        error("ERROR on binding control socket");
+    listen(fd, 4);
+    printf("Control commands accepted on port %d\n", port);
+    return fd;
+}
+
+int main(int argc, char *argv[])
+{
+    // Networking
+    int portno, ctrl_port = 0;
+    struct hostent *server;
+
+    struct daemon d;
+    struct tdc_readout_config cfg;
+    struct tdc_readout_stats stats;
+    static struct tdc_calib calib;
+    char buf[768];
+    const char *mon_name = TDC_MON_SHM_NAME;
+    const char *run_path = NULL;
+    const char *fan_name = TDC_FAN_SOCK_NAME;
+    int loop_cpu, opt;
+
+    memset(&d, 0, sizeof(d));
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.irq_priority = DEFAULT_IRQ_PRIORITY;
+    d.pl_stats_period = DEFAULT_PL_STATS_PERIOD;
+    while ((opt = getopt(argc, argv, "b:c:C:f:F:m:or:s:w:z")) != -1) {
+        switch (opt) {
+            case 'b': cfg.banks = (unsigned)atoi(optarg); break;
+            case 'c': d.calib_path = optarg; break;
+            case 'C': ctrl_port = atoi(optarg); break;
+            case 'f': d.ctrl_path = optarg; break;
+            case 'F': fan_name = optarg; break;
+            case 'm': mon_name = optarg; break;
+            case 'o': cfg.order = 1; break;
+            case 'r': cfg.irq_priority = atoi(optarg); break;
+            case 's': d.pl_stats_period = (unsigned)atoi(optarg); break;
+            case 'w': run_path = optarg; break;
+            case 'z': d.pack = cfg.order = 1; break;
+            default: usage(argv[0]);
         }
+    }
+    const char *prog = argv[0];
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    // Create socket, connect
+    if (argc < 3)
+        usage(prog);
+    portno = atoi(argv[2]);
+    cfg.pool_size = (argc > 3) ? (unsigned)atoi(argv[3]) : DEFAULT_POOL_SIZE;
+    cfg.irq_cpu   = (argc > 4) ? atoi(argv[4]) : DEFAULT_IRQ_CPU;
+    loop_cpu      = (argc > 5) ? atoi(argv[5]) : DEFAULT_LOOP_CPU;
+    cfg.send_cpu  = -1;
+    cfg.send      = NULL;   // events are sent from the event loop below
 
-        // 4. Loop over the BRAM addresses
-        for (int i=0; i<250; i+=1) {
-            uint64_t bram_data = uio_bram_ptr[i];
-            printf("%#018"PRIx64"\n", bram_data);
+    // Continue from the saved calibration if there is one
+    if (d.calib_path != NULL) {
+        if (tdc_calib_load(&calib, d.calib_path) < 0) {
+            printf("Starting a new fine time calibration in %s\n", d.calib_path);
+            tdc_calib_init(&calib, TDC_FINE_BIN_PS_Q16);
         }
+        d.calib = &calib;
+        if (calib_start(&d) < 0)
+            exit(0);
+    }
 
-        // Lower the read_busy flag
-        uio_rdbusy_ptr[0] = 0x0;
+    // The data connection is made from the event loop (data_connect()), so the readout and the
+    // recording start even if the DAQ host is not up yet
+    server = gethostbyname(argv[1]);
+    if (server == NULL) {
+        fprintf(stderr,"ERROR, no such host\n");
+        exit(0);
+    }
+    bzero((char *) &d.addr, sizeof(d.addr));
+    d.addr.sin_family = AF_INET;
+    bcopy((char *)server->h_addr,
+         (char *)&d.addr.sin_addr.s_addr,
+         server->h_length);
+    d.addr.sin_port = htons(portno);
+
+    // The channel settings must be in place before the first trigger is read out
+    if (d.ctrl_path != NULL) {
+        static char text[4096];
+        if (tdc_ctrl_open(&d.pl_ctrl) < 0 || ctrl_config_apply(&d, text, sizeof(text)) < 0)
+            exit(0);
+        printf("Applied the channel settings of %s:\n%s", d.ctrl_path, text);
+    }
+
+    // Firmware without the statistics block still reads out, just without the PL counters
+    if (d.pl_stats_period > 0) {
+        d.pl_stats_ok = tdc_stats_open(&d.pl_stats) == 0;
+        if (d.pl_stats_ok)
+            tdc_stats_snapshot(&d.pl_stats, 1, &(struct tdc_pl_stats){ 0 });   // Start the first period now
+        else
+            fprintf(stderr, "No PL statistics block, running without it\n");
+        // The IRQ thread reads the handshake timestamps of every event from the same block
+        d.pl_lat_ok = d.pl_stats_ok && tdc_stats_has_handshake(&d.pl_stats);
+        if (d.pl_lat_ok)
+            cfg.pl_stats = &d.pl_stats;
+    }
 
-        // Unmap the memory and close the read_busy UIO device
-        munmap(uio_rdbusy_ptr, uio_rdbusy_len);
-        close(uio_rdbusy_fd);
+    // Open and map all of the UIO devices once and allocate the event buffers
+    d.rd = tdc_readout_create(&cfg);
+    if (d.rd == NULL)
+        exit(0);
+    d.mon_ok = tdc_mon_create(&d.mon, mon_name, 1) == 0;
+    if (d.mon_ok)
+        printf("Monitoring histograms in shared memory %s\n", mon_name);
+    else
+        fprintf(stderr, "Running without the monitoring histograms\n");
+    if (run_path != NULL) {
+        struct tdc_run_writer_config rcfg = { run_path, 0, 0, -1 };
+        d.run = tdc_run_writer_create(&rcfg);
+        if (d.run == NULL)
+            exit(0);
+        printf("Recording to %s\n", run_path);
+    }
+    d.fan_ok = tdc_fan_create(&d.fan, fan_name, 0) == 0;
+    if (d.fan_ok)
+        printf("Publishing events to local consumers on @%s\n", fan_name);
+    else
+        fprintf(stderr, "Running without the fan-out to local consumers\n");
+
+    // Event loop sources
+    d.epfd = epoll_create1(0);
+    if (d.epfd < 0)
+        error("epoll_create1");
+    d.data = (struct source){ SRC_DATA, -1 };
+    data_connect(&d);       // retried every second by timer_ready() until the host answers
+    d.events = (struct source){ SRC_EVENTS, tdc_readout_fd(d.rd) };
+    watch(&d, &d.events, EPOLLIN);
+
+    struct itimerspec period = { { 1, 0 }, { 1, 0 } };
+    d.timer = (struct source){ SRC_TIMER, timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK) };
+    if (d.timer.fd < 0 || timerfd_settime(d.timer.fd, 0, &period, NULL) < 0)
+        error("timerfd");
+    watch(&d, &d.timer, EPOLLIN);
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);    // before the readout threads exist, so they inherit it
+    d.sig = (struct source){ SRC_SIGNAL, signalfd(-1, &mask, SFD_NONBLOCK) };
+    if (d.sig.fd < 0)
+        error("signalfd");
+    watch(&d, &d.sig, EPOLLIN);
+    signal(SIGPIPE, SIG_IGN);   // a closed socket shows up as a write error instead
+
+    if (d.fan_ok) {
+        d.fan_listen = (struct source){ SRC_FAN_LISTEN, tdc_fan_listen_fd(&d.fan) };
+        watch(&d, &d.fan_listen, EPOLLIN);
+    }
+    if (ctrl_port > 0) {
+        d.ctrl = (struct source){ SRC_CTRL_LISTEN, ctrl_listen(ctrl_port) };
+        watch(&d, &d.ctrl, EPOLLIN);
+    }
+
+    if (loop_cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(loop_cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0)
+            fprintf(stderr, "Failed to pin the event loop to CPU %d\n", loop_cpu);
+    }
+
+    if (tdc_readout_start(d.rd) < 0) {
+        tdc_readout_destroy(d.rd);
+        exit(0);
+    }
+    printf("Daemon waiting for interrupts (triggers), %u event buffers, IRQ thread on CPU %d, event loop on CPU %d...\n",
+           cfg.pool_size, cfg.irq_cpu, loop_cpu);
+
+    while (!d.stop) {
+        struct epoll_event evs[MAX_EPOLL_EVENTS];
+        int n = epoll_wait(d.epfd, evs, MAX_EPOLL_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            error("epoll_wait");
+        }
+        for (int i = 0; i < n; i++) {
+            struct source *src = evs[i].data.ptr;
+            switch (src->type) {
+                case SRC_EVENTS:      events_ready(&d); break;
+                case SRC_DATA:        if (d.data.fd >= 0) data_ready(&d, evs[i].events); break;
+                case SRC_CTRL_LISTEN: ctrl_accept(&d); break;
+                case SRC_CTRL_CLIENT: ctrl_client_ready(&d, (struct ctrl_client *)src); break;
+                case SRC_TIMER:       timer_ready(&d); break;
+                case SRC_SIGNAL:      d.stop = 1; break;
+                case SRC_FAN_LISTEN:  fan_accept(&d); break;
+                case SRC_FAN_CLIENT:  fan_client_ready(&d, src); break;
+            }
+        }
+    }
+
+    // Stop the IRQ thread, then send whatever is still queued with a blocking socket
+    printf("Stopping, sending the queued events...\n");
+    tdc_readout_stop(d.rd);
+    if (d.data.fd >= 0 && !d.connecting) {
+        fcntl(d.data.fd, F_SETFL, fcntl(d.data.fd, F_GETFL) & ~O_NONBLOCK);
+        data_flush(&d);
+    }
+    if (d.data.fd >= 0)
+        close(d.data.fd);
+    d.data.fd = -1;
+    drop_queued(&d);
 
-        // Close the other file descriptors
-        close(uio_bram_fd);
-        close(uio_bramsel_fd);
+    tdc_readout_get_stats(d.rd, &stats, 0);
+    stats_format(&stats, buf, sizeof(buf));
+    fputs(buf, stdout);
+    if (d.calib != NULL)
+        calib_finish(&d);
+    if (d.pl_stats_ok)
+        uio_close(&d.pl_stats);
+    if (d.ctrl_path != NULL)
+        uio_close(&d.pl_ctrl);
+    if (d.mon_ok)
+        tdc_mon_close(&d.mon);
+    if (d.fan_ok)
+        tdc_fan_close(&d.fan);      // the consumers read what is left in the ring, then see the end
+    if (d.run != NULL) {
+        struct tdc_run_writer_stats rs;
+        tdc_run_writer_get_stats(d.run, &rs);
+        int err = tdc_run_writer_close(d.run);
+        printf("Run file %s: %" PRIu64 " frames, %" PRIu64 " dropped%s\n", run_path, rs.frames, rs.dropped,
+               err < 0 ? ", NOT complete (read it back with runfile to recover the blocks)" : "");
     }
-    
+    tdc_readout_destroy(d.rd);
+    return 0;
 }
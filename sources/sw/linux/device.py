@@ -6,6 +6,8 @@ import os
 import re
 import ctypes
 import struct
+import select
+import numpy as np
 from os import O_RDWR, O_CLOEXEC, O_NONBLOCK
 from stat import S_ISCHR
 from mmap import mmap
@@ -16,6 +18,82 @@ PAGE_SHIFT = 12
 PAGE_SIZE = 1 << PAGE_SHIFT
 PAGE_MASK = -PAGE_SIZE
 
+# TDC hit word layout (see tdc_frame.h)
+HIT_CHANNEL_MASK = 0x3f
+HIT_FINE_SHIFT = 6
+HIT_FINE_MASK = 0x1f
+HIT_COARSE_SHIFT = 11
+HIT_COARSE_MASK = ( 1 << 28 ) - 1
+
+# split an array of hit words into channel, fine and coarse time arrays (no Python loop)
+def hit_fields( words ):
+    words = np.asarray( words, dtype=np.uint64 )
+    channel = ( words & np.uint64( HIT_CHANNEL_MASK ) ).astype( np.uint8 )
+    fine = ( ( words >> np.uint64( HIT_FINE_SHIFT ) ) & np.uint64( HIT_FINE_MASK ) ).astype( np.uint8 )
+    coarse = ( ( words >> np.uint64( HIT_COARSE_SHIFT ) ) & np.uint64( HIT_COARSE_MASK ) ).astype( np.uint32 )
+    return channel, fine, coarse
+
+# nominal fine time bin width of the 53.1 MHz RF clock in ps, Q16 (see tdc_decode.h)
+FINE_BIN_PS_Q16 = int( 65536.0 * 1e12 / 53.1e6 / 32 + 0.5 )
+CALIB_MAGIC = 0x43434454
+CALIB_HEADER = struct.Struct( '<IHBBII' )
+
+# fine time calibration saved by the daemon -c (see tdc_calib.h): the nominal bin width and the
+# start of every fine bin, both in ps Q16, the table indexed [ channel, fine ]
+def load_calib( path ):
+    data = Path( path ).read_bytes()
+    magic, version, n_ch, n_bins, bin_ps_q16, _ = CALIB_HEADER.unpack_from( data )
+    if magic != CALIB_MAGIC or version != 1 or ( n_ch, n_bins ) != ( 64, 32 ):
+        raise ValueError( f"{path} is not a valid calibration file" )
+    off = CALIB_HEADER.size + n_ch * n_bins * 8     # after the histograms
+    lut = np.frombuffer( data, dtype='<u4', count=n_ch * n_bins, offset=off ).reshape( n_ch, n_bins )
+    return bin_ps_q16, lut
+
+# hit times in ps, bit-identical to tdc_decode(): with the equal nominal bins, or with the
+# measured bin edges of a calibration returned by load_calib()
+def hit_time( words, calib=None ):
+    channel, fine, coarse = hit_fields( words )
+    if calib is None:
+        bin_q16 = FINE_BIN_PS_Q16
+        fine_q16 = fine.astype( np.uint64 ) * np.uint64( bin_q16 )
+    else:
+        bin_q16, lut = calib
+        fine_q16 = lut[ channel, fine ].astype( np.uint64 )
+    t = coarse.astype( np.uint64 ) * np.uint64( bin_q16 << 5 ) + fine_q16 + np.uint64( 0x8000 )
+    return t >> np.uint64( 16 )
+
+# fill count [15:0] and overflow flag [31] of a BRAM / bank status register
+def bram_fill( status ):
+    return status & 0xffff, bool( status & 0x80000000 )
+
+# CTRL register of the tdc_ctrl block (see tdc_ctrl.vhd and tdc_ctrl.h)
+CTRL_REG = 0x004
+CTRL_APPLY = 1 << 0         # W: apply the settings, R: apply pending
+CTRL_DROPPED = 1 << 1       # R: a write was ignored since CTRL was last read (cleared by the read)
+CTRL_POLLS = 100000
+
+# write settings, a dict { byte offset: 32-bit value }, to the tdc_ctrl block ctrl (a region or
+# Uio) and apply them.  the block ignores writes while an apply is pending and still answers them
+# OKAY (an error would be an SError on the APU), so wait for the previous apply first and check
+# DROPPED after.
+def ctrl_apply( ctrl, settings ):
+    # returns CTRL once the apply is done, with DROPPED or-ed in from every read on the way
+    def ctrl_wait( what ):
+        status = 0
+        for _ in range( CTRL_POLLS ):
+            status |= ctrl.read( ctypes.c_uint32, offset=CTRL_REG )
+            if not status & CTRL_APPLY:
+                return status
+            status &= ~CTRL_APPLY
+        raise TimeoutError( f"tdc_ctrl {what} timed out (is clk0 running?)" )
+
+    ctrl_wait( "previous apply" )       # also clears a DROPPED left by another writer
+    for offset, value in settings.items():
+        ctrl.write( ctypes.c_uint32( value ), offset )
+    ctrl.write( ctypes.c_uint32( CTRL_APPLY ), CTRL_REG )
+    if ctrl_wait( "apply" ) & CTRL_DROPPED:
+        raise RuntimeError( "tdc_ctrl ignored some of the settings (written by another process meanwhile?)" )
+
 # a physical memory region associated with an uio device
 class MemRegion:
     def __init__( rgn, parent, address, size, name=None, uio=None, index=None ):
@@ -171,6 +249,27 @@ class MemRegion:
             return rgn._mmap[ offset : end ]                                                  
                                                                                               
         raise TypeError( "first argument should be length or ctypes type" )                   
+
+    # view count 64-bit words at given byte offset as a uint64 array, without copying.
+    # writes to the array go straight to the device.
+    def words( rgn, count=None, offset=0 ):
+        if rgn._mmap is None:
+            raise RuntimeError( "memory region cannot be mapped" )
+        if offset < 0 or offset & 7:
+            raise ValueError( "offset must be a non-negative multiple of 8" )
+        avail = ( rgn.mappable - offset ) // 8
+        if count is None:
+            count = avail
+        if count not in range( avail + 1 ):
+            raise ValueError( "words extend beyond mappable area" )
+        return np.frombuffer( rgn._mmap, dtype=np.uint64, count=count, offset=offset )
+
+    # zero count 64-bit words at given byte offset in one go.  copies from a zero
+    # buffer (like write) rather than using memset, which may use cache maintenance
+    # instructions that fault on device memory.
+    def clear( rgn, count=None, offset=0 ):
+        view = rgn.words( count, offset )
+        np.copyto( view, np.zeros( len( view ), dtype=np.uint64 ) )
                                                                                               
                                                                                               
 # uio device object                                                                           
@@ -242,6 +341,14 @@ class Uio:
     # shortcut to fill bytes in default region (index 0)                                      
     def fill( self, length=None, offset=0, value=0 ):                                         
         return self.region().fill( length, offset, value )                                    
+
+    # shortcut to view words of default region (index 0)
+    def words( self, count=None, offset=0 ):
+        return self.region().words( count, offset )
+
+    # shortcut to clear words of default region (index 0)
+    def clear( self, count=None, offset=0 ):
+        return self.region().clear( count, offset )
                                                                                               
                                                                                               
     # TODO determine if the device has any irq                                                
@@ -267,4 +374,21 @@ class Uio:
                                                                                      
     # note: irq is disabled once received.  you need to reenable it                           
     #   - before handling it, if edge-triggered                                               
-    #   - after handling it, if level-triggered  
+    #   - after handling it, if level-triggered
+
+    # wait for the next interrupt and return ( counter, words ), the filled prefix of region
+    # as given by the fill count in the status register at status_offset of status (a region
+    # or Uio), e.g. the bram_status channel of the which_bram GPIO.  the words are a view of
+    # the device memory: copy them if they are needed after the region has been reused.
+    # returns None if no interrupt arrived within timeout seconds.
+    def wait_and_read( self, region, status, status_offset=0x8, timeout=None ):
+        self.irq_enable()
+        if not select.select( [ self ], [], [], timeout )[0]:
+            return None
+        counter = self.irq_recv()
+        if counter is None:
+            return None
+        n_words, _ = bram_fill( status.read( ctypes.c_uint32, offset=status_offset ) )
+        if isinstance( region, Uio ):
+            region = region.region()
+        return counter, region.words( min( n_words, region.mappable // 8 ) )
@@ -0,0 +1,386 @@
+/*
+* Daemon to read out the DMA firmware (TDC_64ch_DMA)
+*
+* In this build the top level arbiter output is streamed by the PL through an AXI DMA (S2MM,
+* scatter-gather) into a ring of DDR buffers, so the PS never copies hits out of a BRAM and the
+* number of hits per trigger is no longer limited to one BRAM. Every trigger closes the current
+* DMA packet with a trailer word (see tdc_frame.h), so each completed packet is one event.
+*
+* Uses the following UIO devices, looked up by name in /sys/class/uio:
+*   - dma:         axi_dma@a0000000 registers + s2mm_introut interrupt
+*   - tdc_dma_buf: 64 MB of reserved DDR @60000000 (see kernel/configs/TDC_64ch_DMA/hw_user)
+*
+* Layout of the reserved DDR:
+*   +------------------------------+  0
+*   | DMA_MAX_BD buffer descriptors|
+*   +------------------------------+  DMA_DATA_OFFSET
+*   | buffer 0 (DMA_BD_LEN bytes)  |
+*   | buffer 1                     |
+*   | ...                          |
+*   +------------------------------+
+*
+* The descriptors are linked in a ring. The DMA fills buffers up to the tail descriptor; after
+* an event has been sent, its descriptors are cleared and handed back by moving the tail pointer.
+* If the PS falls behind, the DMA stalls at the tail, the PL FIFO fills up and the PL drops hits,
+* which is reported in the event trailer and in the TDC_FRAME_FLAG_DROPPED frame flag.
+*
+* General description of functionality:
+*   - create socket, connect to socket
+*   - find, open and mmap the DMA registers and the DDR buffer
+*   - reset the DMA, build the descriptor ring and start the S2MM channel
+*   - wait for the completion interrupt
+*   - if interrupt:
+*       - acknowledge it in the DMA status register
+*       - send every completed packet as one binary frame (see tdc_frame.h)
+*       - give the descriptors back to the DMA
+*
+* The frames can be received and decoded on the DAQ host with receiver.c
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <inttypes.h>
+
+#include "tdc_frame.h"
+#include "tdc_uio.h"
+
+#define UIO_NAME_DMA    "dma"
+#define UIO_NAME_BUF    "tdc_dma_buf"
+
+// AXI DMA S2MM registers (32-bit word offsets)
+#define S2MM_DMACR          (0x30 / 4)
+#define S2MM_DMASR          (0x34 / 4)
+#define S2MM_CURDESC        (0x38 / 4)
+#define S2MM_CURDESC_MSB    (0x3c / 4)
+#define S2MM_TAILDESC       (0x40 / 4)
+#define S2MM_TAILDESC_MSB   (0x44 / 4)
+
+#define DMACR_RS            (1u << 0)
+#define DMACR_RESET         (1u << 2)
+#define DMACR_IOC_IRQ_EN    (1u << 12)
+#define DMACR_ERR_IRQ_EN    (1u << 14)
+#define DMACR_IRQ_THRESHOLD(n) (((uint32_t)(n) & 0xff) << 16)
+
+#define DMASR_HALTED        (1u << 0)
+#define DMASR_ERR_MASK      0x00000770u         // DMA/SG internal, slave and decode errors
+#define DMASR_IOC_IRQ       (1u << 12)
+#define DMASR_DLY_IRQ       (1u << 13)
+#define DMASR_ERR_IRQ       (1u << 14)
+
+// Scatter-gather buffer descriptor (must be 64 byte aligned)
+struct dma_bd {
+    uint32_t next;
+    uint32_t next_msb;
+    uint32_t buf;
+    uint32_t buf_msb;
+    uint32_t reserved[2];
+    uint32_t control;
+    uint32_t status;
+    uint32_t app[5];
+    uint32_t pad[3];
+};
+
+_Static_assert(sizeof(struct dma_bd) == 64, "dma_bd must be 64 bytes");
+
+#define BD_LEN_MASK         0x03ffffffu         // c_sg_length_width = 26
+#define BD_STS_RXEOF        (1u << 26)
+#define BD_STS_RXSOF        (1u << 27)
+#define BD_STS_ERR_MASK     (7u << 28)
+#define BD_STS_CMPLT        (1u << 31)
+
+// Layout of the reserved DDR
+#define DMA_DATA_OFFSET     0x10000             // descriptors live in the first 64 KB
+#define DMA_BD_LEN          (2u << 20)          // 2 MB per descriptor
+#define DMA_MAX_BD          64
+
+// Print the readout rate every REPORT_INTERVAL seconds
+#define REPORT_INTERVAL 1
+
+void error(const char *msg)
+{
+    perror(msg);
+    exit(0);
+}
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Send one event frame (header + hit words) with a single writev(), finishing any partial write
+void send_frame(int sockfd, struct tdc_frame_header *hdr, const volatile uint64_t *words)
+{
+    struct iovec iov[2];
+    iov[0].iov_base = hdr;
+    iov[0].iov_len  = sizeof(*hdr);
+    iov[1].iov_base = (void *)words;
+    iov[1].iov_len  = (size_t)hdr->n_words * sizeof(uint64_t);
+
+    struct iovec *v = iov;
+    int nv = 2;
+    while (nv > 0) {
+        ssize_t n = writev(sockfd, v, nv);
+        if (n < 0)
+            error("Failed to send event frame");
+        // Skip over whatever was written
+        while (nv > 0 && (size_t)n >= v->iov_len) {
+            n -= v->iov_len;
+            v++;
+            nv--;
+        }
+        if (nv > 0) {
+            v->iov_base = (char *)v->iov_base + n;
+            v->iov_len -= n;
+        }
+    }
+}
+
+// Physical address of descriptor i
+static inline uint32_t bd_phys(const struct uio_dev *buf, unsigned i)
+{
+    return (uint32_t)(buf->phys + i * sizeof(struct dma_bd));
+}
+
+// Reset the S2MM channel, build the descriptor ring over the reserved DDR and start the channel
+unsigned dma_start(volatile uint32_t *regs, const struct uio_dev *buf)
+{
+    volatile struct dma_bd *bd = (volatile struct dma_bd *)buf->ptr;
+    unsigned n_bd = (buf->len - DMA_DATA_OFFSET) / DMA_BD_LEN;
+    if (n_bd > DMA_MAX_BD)
+        n_bd = DMA_MAX_BD;
+    if (n_bd < 2) {
+        fprintf(stderr, "DMA buffer too small (%zu bytes)\n", buf->len);
+        exit(0);
+    }
+    if (buf->phys + buf->len > 0x100000000ull) {
+        fprintf(stderr, "DMA buffer must be below 4 GB (c_addr_width = 32)\n");
+        exit(0);
+    }
+
+    regs[S2MM_DMACR] = DMACR_RESET;
+    while (regs[S2MM_DMACR] & DMACR_RESET)
+        ;
+
+    for (unsigned i = 0; i < n_bd; i++) {
+        bd[i].next     = bd_phys(buf, (i + 1) % n_bd);
+        bd[i].next_msb = 0;
+        bd[i].buf      = (uint32_t)(buf->phys + DMA_DATA_OFFSET + (uint64_t)i * DMA_BD_LEN);
+        bd[i].buf_msb  = 0;
+        bd[i].control  = DMA_BD_LEN;
+        bd[i].status   = 0;
+    }
+    __sync_synchronize();
+
+    // One interrupt per completed descriptor, the whole ring is available to the DMA
+    regs[S2MM_CURDESC]     = bd_phys(buf, 0);
+    regs[S2MM_CURDESC_MSB] = 0;
+    regs[S2MM_DMACR]       = DMACR_RS | DMACR_IOC_IRQ_EN | DMACR_ERR_IRQ_EN | DMACR_IRQ_THRESHOLD(1);
+    regs[S2MM_TAILDESC_MSB] = 0;
+    regs[S2MM_TAILDESC]    = bd_phys(buf, n_bd - 1);
+
+    printf("DMA started with %u descriptors of %u bytes\n", n_bd, DMA_BD_LEN);
+    return n_bd;
+}
+
+int main(int argc, char *argv[])
+{
+    // Networking
+    int sockfd, portno;
+    struct sockaddr_in serv_addr;
+    struct hostent *server;
+
+    // UIO devices, held open for the lifetime of the daemon
+    struct uio_dev uio_dma, uio_buf;
+    volatile uint32_t *regs;
+    volatile struct dma_bd *bd;
+    volatile uint8_t *data;
+    unsigned n_bd, head = 0;
+
+    // Events spanning several descriptors are collected here before being sent
+    uint64_t *event;
+    uint32_t n_event = 0;
+    int truncated = 0;
+
+    struct tdc_frame_header hdr;
+    uint32_t last_trigger = 0, missed = 0;
+
+    // Rate report
+    uint64_t n_frames = 0, n_words = 0, last_frames = 0, last_words = 0;
+    uint64_t t_last;
+
+    // Exit status, 1 after a DMA or UIO error
+    int ret = 0;
+
+    // Create socket, connect
+    if (argc < 3) {
+       fprintf(stderr,"usage %s hostname port\n", argv[0]);
+       exit(0);
+    }
+    portno = atoi(argv[2]);
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0)
+        error("ERROR opening socket");
+    else
+        printf("Successfully opened socket\n");
+    server = gethostbyname(argv[1]);
+    if (server == NULL) {
+        fprintf(stderr,"ERROR, no such host\n");
+        exit(0);
+    }
+    bzero((char *) &serv_addr, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    bcopy((char *)server->h_addr,
+         (char *)&serv_addr.sin_addr.s_addr,
+         server->h_length);
+    serv_addr.sin_port = htons(portno);
+    if (connect(sockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr)) < 0)
+        error("ERROR connecting");
+    else
+        printf("Successfully connected to socket\n");
+
+    event = malloc((size_t)TDC_FRAME_MAX_WORDS * sizeof(uint64_t));
+    if (event == NULL)
+        error("Failed to allocate event buffer");
+
+    // Open and map the DMA registers and the DDR ring once
+    if (uio_open_by_name(&uio_dma, UIO_NAME_DMA) < 0 ||
+        uio_open_by_name(&uio_buf, UIO_NAME_BUF) < 0)
+        exit(0);
+    regs = (volatile uint32_t *)uio_dma.ptr;
+    bd   = (volatile struct dma_bd *)uio_buf.ptr;
+    data = (volatile uint8_t *)uio_buf.ptr + DMA_DATA_OFFSET;
+    n_bd = dma_start(regs, &uio_buf);
+
+    hdr.magic      = TDC_FRAME_MAGIC;
+    hdr.version    = TDC_FRAME_VERSION;
+    hdr.header_len = sizeof(hdr);
+    hdr.bram_id    = TDC_FRAME_BRAM_DMA;
+    hdr.packed_len = 0;
+
+    t_last = now_ns();
+    printf("Daemon waiting for DMA completions...\n");
+
+    while (1) {
+
+        // Acknowledge the interrupt in the DMA before looking at the descriptors, so that a
+        // descriptor completing while they are processed raises a new one
+        uint32_t sr = regs[S2MM_DMASR];
+        regs[S2MM_DMASR] = sr & (DMASR_IOC_IRQ | DMASR_DLY_IRQ | DMASR_ERR_IRQ);
+        if (sr & DMASR_ERR_MASK) {
+            fprintf(stderr, "DMA error, S2MM_DMASR = 0x%08x\n", sr);
+            ret = 1;
+            goto out;
+        }
+
+        // Send every completed packet and hand its descriptors back to the DMA
+        while (bd[head].status & BD_STS_CMPLT) {
+            uint32_t status = bd[head].status;
+            uint32_t n = (status & BD_LEN_MASK) / sizeof(uint64_t);
+            const volatile uint64_t *words = (const volatile uint64_t *)(data + (size_t)head * DMA_BD_LEN);
+
+            if (status & BD_STS_ERR_MASK) {
+                fprintf(stderr, "DMA descriptor %u error, status = 0x%08x\n", head, status);
+                ret = 1;
+                goto out;
+            }
+
+            if (status & BD_STS_RXEOF) {
+                // The last word of the packet is the trailer closing the event
+                uint64_t trailer = n > 0 ? words[n - 1] : 0;
+                uint32_t n_hits = n > 0 ? n - 1 : 0;
+                const volatile uint64_t *hits = words;
+
+                if (!tdc_is_trailer(trailer))
+                    fprintf(stderr, "Packet in descriptor %u does not end with a trailer (0x%016" PRIx64 ")\n",
+                            head, trailer);
+
+                // Packets that started in an earlier descriptor were collected in the event buffer
+                if (n_event > 0 || !(status & BD_STS_RXSOF)) {
+                    for (uint32_t i = 0; i < n_hits; i++) {
+                        if (n_event == TDC_FRAME_MAX_WORDS) {
+                            truncated = 1;
+                            break;
+                        }
+                        event[n_event++] = words[i];
+                    }
+                    hits = event;
+                    n_hits = n_event;
+                }
+
+                hdr.timestamp_ns = realtime_ns();
+                hdr.trigger      = tdc_trailer_trigger(trailer);
+                hdr.n_dropped    = (n_frames > 0) ? hdr.trigger - last_trigger - 1 : 0;
+                missed += hdr.n_dropped;
+                last_trigger     = hdr.trigger;
+                hdr.missed_trigs = missed;
+                hdr.flags        = (tdc_trailer_dropped(trailer) ? TDC_FRAME_FLAG_DROPPED : 0) |
+                                   (truncated ? TDC_FRAME_FLAG_OVERFLOW : 0);
+                hdr.n_words      = n_hits;
+                send_frame(sockfd, &hdr, hits);
+
+                n_frames++;
+                n_words += n_hits;
+                n_event = 0;
+                truncated = 0;
+            } else {
+                // Event continues in the next descriptor
+                for (uint32_t i = 0; i < n; i++) {
+                    if (n_event == TDC_FRAME_MAX_WORDS) {
+                        truncated = 1;
+                        break;
+                    }
+                    event[n_event++] = words[i];
+                }
+            }
+
+            // Give the descriptor back: it becomes the new tail of the ring
+            bd[head].status = 0;
+            __sync_synchronize();
+            regs[S2MM_TAILDESC] = bd_phys(&uio_buf, head);
+            head = (head + 1) % n_bd;
+        }
+
+        uint64_t t = now_ns();
+        if (t - t_last >= REPORT_INTERVAL * 1000000000ull) {
+            double dt = (t - t_last) / 1e9;
+            printf("%.0f events/s, %.0f hits/s (%" PRIu64 " events, %u missed triggers)\n",
+                   (n_frames - last_frames) / dt, (n_words - last_words) / dt, n_frames, missed);
+            last_frames = n_frames;
+            last_words = n_words;
+            t_last = t;
+        }
+
+        // Unmask the interrupt and wait for the next completion
+        uint32_t info;
+        if (uio_irq_unmask(&uio_dma) < 0 || uio_irq_wait(&uio_dma, &info) < 0) {
+            ret = 1;
+            goto out;
+        }
+    }
+
+out:
+    // Stop the DMA and release everything on the way out of an error
+    regs[S2MM_DMACR] = 0;
+    free(event);
+    uio_close(&uio_buf);
+    uio_close(&uio_dma);
+    close(sockfd);
+    return ret;
+}
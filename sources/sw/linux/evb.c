@@ -0,0 +1,171 @@
+/*
+* Multi-board event builder for the DAQ host
+*
+* Listens on a TCP port for the daemons (daemon.c) of n_boards boards, then merges their frame
+* streams into one built event per trigger (tdc_evb.h), written to a file in the built event
+* format. Board indices follow the order in which the daemons connect. Every second the build
+* rate and the fragments missing per board are reported on stderr; the run ends when every
+* daemon has closed its connection, or on SIGINT/SIGTERM.
+*
+* usage: evb [-o outfile] [-t timeout_ms] [-q queue_depth] port n_boards
+*   -o outfile      append every built event to outfile (otherwise events are only counted)
+*   -t timeout_ms   longest wait for the fragment of a board with nothing queued, default 100
+*   -q queue_depth  fragments buffered per board (power of two), default 1024
+*
+* Build with: make evb
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <inttypes.h>
+
+#include "tdc_evb.h"
+
+static volatile sig_atomic_t quit = 0;
+
+void error(const char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    quit = 1;
+}
+
+static int write_event(void *ctx, const struct tdc_evb_event *ev)
+{
+    FILE *out = ctx;
+    return out != NULL ? tdc_evb_fwrite(out, ev) : 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage %s [-o outfile] [-t timeout_ms] [-q queue_depth] port n_boards\n", prog);
+    exit(1);
+}
+
+static void print_stats(const struct tdc_evb_stats *s, unsigned n_boards)
+{
+    fprintf(stderr, "  %" PRIu64 " events, %" PRIu64 " incomplete, %" PRIu64 " after timeout, %" PRIu64
+            " write errors, %.1f MB received\n",
+            s->events, s->incomplete, s->timeouts, s->write_errors, s->bytes / 1e6);
+    for (unsigned b = 0; b < n_boards; b++)
+        fprintf(stderr, "  board %u: %" PRIu64 " fragments, %" PRIu64 " missing, %" PRIu64
+                " late, queue high water %u\n",
+                b, s->fragments[b], s->missing[b], s->late[b], s->queue_high_water[b]);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *outname = NULL;
+    struct tdc_evb_config cfg;
+    int opt;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.queue_depth = 1024;
+    cfg.timeout_ns = 100000000ull;
+    while ((opt = getopt(argc, argv, "o:t:q:")) != -1) {
+        switch (opt) {
+            case 'o': outname = optarg; break;
+            case 't': cfg.timeout_ns = (uint64_t)(atof(optarg) * 1e6); break;
+            case 'q': cfg.queue_depth = (unsigned)atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2)
+        usage(argv[0]);
+    int portno = atoi(argv[optind]);
+    cfg.n_sources = (unsigned)atoi(argv[optind + 1]);
+    if (cfg.n_sources == 0 || cfg.n_sources > TDC_EVB_MAX_SOURCES) {
+        fprintf(stderr, "n_boards must be 1 to %d\n", TDC_EVB_MAX_SOURCES);
+        exit(1);
+    }
+
+    FILE *out = NULL;
+    if (outname != NULL) {
+        out = fopen(outname, "ab");
+        if (out == NULL)
+            error("Failed to open output file");
+        // Events are written in large chunks rather than one fwrite() syscall each
+        setvbuf(out, NULL, _IOFBF, 4 << 20);
+    }
+
+    // Listen for the board daemons
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0)
+        error("ERROR opening socket");
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(portno);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        error("ERROR on bind");
+    listen(lfd, (int)cfg.n_sources);
+    fprintf(stderr, "Waiting for %u board connections on port %d...\n", cfg.n_sources, portno);
+
+    static int fds[TDC_EVB_MAX_SOURCES];
+    for (unsigned b = 0; b < cfg.n_sources; b++) {
+        struct sockaddr_in peer;
+        socklen_t plen = sizeof(peer);
+        fds[b] = accept(lfd, (struct sockaddr *)&peer, &plen);
+        if (fds[b] < 0)
+            error("ERROR on accept");
+        int rcvbuf = 4 << 20;
+        setsockopt(fds[b], SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        fprintf(stderr, "Board %u connected from %s\n", b, inet_ntoa(peer.sin_addr));
+    }
+    close(lfd);
+
+    cfg.fds = fds;
+    cfg.write = write_event;
+    cfg.write_ctx = out;
+    struct tdc_evb *evb = tdc_evb_create(&cfg);
+    if (evb == NULL || tdc_evb_start(evb) < 0)
+        exit(1);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    struct tdc_evb_stats s;
+    uint64_t last_events = 0, last_bytes = 0;
+    do {
+        sleep(1);
+        tdc_evb_get_stats(evb, &s);
+        fprintf(stderr, "%" PRIu64 " events/s, %.2f MB/s, %u boards connected\n",
+                s.events - last_events, (s.bytes - last_bytes) / 1e6, s.sources_open);
+        last_events = s.events;
+        last_bytes = s.bytes;
+    } while (!quit && s.sources_open > 0);
+
+    if (quit)
+        tdc_evb_stop(evb);
+    else
+        tdc_evb_wait(evb);
+    tdc_evb_get_stats(evb, &s);
+    fprintf(stderr, "Done:\n");
+    print_stats(&s, cfg.n_sources);
+
+    tdc_evb_destroy(evb);
+    for (unsigned b = 0; b < cfg.n_sources; b++)
+        close(fds[b]);
+    if (out != NULL)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,218 @@
+'''
+Local consumer of the events fanned out by the readout daemon (see tdc_fan.h)
+
+Attaches to the shared memory ring of a daemon running on the same board and hands out every
+event it publishes in place, as views of the ring like the device memory views of device.py:
+
+    from fanout import FanConsumer, hit_fields
+    with FanConsumer( policy='drop', who='my monitor' ) as fan:
+        for hdr, words in fan:
+            channel, fine, coarse = hit_fields( words )
+            ...
+
+The words (or the packed payload) are only valid until the next frame is taken or the frame
+is released: copy them if they are needed for longer, and keep up, or the daemon detaches the
+consumer (policy 'drop') or holds the ring back for everyone (policy 'throttle').
+'''
+
+import os
+import mmap
+import select
+import socket
+import struct
+from collections import namedtuple
+
+import numpy as np
+
+from device import hit_fields, hit_time, load_calib
+
+FAN_SOCK_NAME = 'tdc_fan'
+FAN_MAGIC = 0x4e464454
+FAN_VERSION = 1
+POLICIES = { 'drop': 0, 'throttle': 1 }
+
+FAN_ATTACHED = 1
+FAN_DETACHED = 2
+FAN_REC_PAD = 0x0001
+FRAME_FLAG_PACKED = 0x0008
+
+# struct tdc_fan_hello, tdc_fan_welcome, tdc_fan_rec and tdc_frame_header
+HELLO = struct.Struct( '<IHH32s' )
+WELCOME = struct.Struct( '<IHHIIQ' )
+REC = struct.Struct( '<IIQ' )
+FRAME = struct.Struct( '<IHHIHHIIQII' )
+
+# offsets of the 64-bit fields of struct tdc_fan_ring, in words
+RING_SIZE = 2
+RING_HEAD = 8
+RING_FRAMES = 9
+RING_SKIPPED = 10
+RING_DETACHED = 11
+
+# offsets in struct tdc_fan_cursor: tail (64-bit word 0), waiting and state (32-bit words 2, 16)
+CUR_TAIL = 0
+CUR_WAITING = 2
+CUR_STATE = 16
+
+# Python cannot order its loads and stores like tdc_fan.c does, so a wake-up may be missed:
+# never sleep longer than this before looking at the ring again
+MAX_SLEEP = 0.05
+
+FrameHeader = namedtuple( 'FrameHeader', 'magic version header_len trigger bram_id flags n_words '
+                                         'missed_trigs timestamp_ns n_dropped packed_len' )
+
+
+class DetachedError( Exception ):
+    pass
+
+
+# consumer of the fan-out ring, see tdc_fan_attach() and friends in tdc_fan.c
+class FanConsumer:
+    def __init__( self, name=FAN_SOCK_NAME, policy='drop', who='python' ):
+        if policy not in POLICIES:
+            raise ValueError( "policy must be 'drop' or 'throttle'" )
+        self._sock = socket.socket( socket.AF_UNIX, socket.SOCK_SEQPACKET )
+        self._sock.settimeout( 5 )
+        self._sock.connect( '\0' + name )
+        self._sock.send( HELLO.pack( FAN_MAGIC, FAN_VERSION, POLICIES[ policy ], who.encode()[ :31 ] ) )
+        msg, fds, _, _ = socket.recv_fds( self._sock, WELCOME.size, 3 )
+        try:
+            if len( msg ) != WELCOME.size:
+                raise RuntimeError( f"@{name} is not a fan-out socket" )
+            magic, version, self.slot, status, _, map_len = WELCOME.unpack( msg )
+            if magic != FAN_MAGIC or version != FAN_VERSION:
+                raise RuntimeError( f"@{name} is not a version {FAN_VERSION} fan-out socket" )
+            if status != 0 or len( fds ) != 3:
+                reason = { 1: 'version not supported', 2: 'too many consumers', 3: 'daemon failed' }
+                raise RuntimeError( "attach refused: " + reason.get( status, 'unknown reason' ) )
+
+            # the ring can only be mapped read-only, the cursor is ours to write
+            self._ring = memoryview( mmap.mmap( fds[0], map_len, prot=mmap.PROT_READ ) )
+            self._cur = memoryview( mmap.mmap( fds[1], mmap.PAGESIZE ) )
+        finally:
+            for fd in fds[ :2 ]:
+                os.close( fd )
+        self._evfd = fds[2]
+
+        self._rq = self._ring.cast( 'Q' )
+        self._cq = self._cur.cast( 'Q' )
+        self._ci = self._cur.cast( 'I' )
+        data_off = self._ring.cast( 'I' )[2]
+        self.size = self._rq[ RING_SIZE ]
+        self._data = self._ring[ data_off : data_off + self.size ]
+
+        self._tail = self._cq[ CUR_TAIL ]
+        self._held = 0
+        self._gone = False
+        self._next_seq = None
+        self.frames = 0     # frames received
+        self.lost = 0       # frames published or held back before a received one, and not received
+
+    def __enter__( self ):
+        return self
+
+    def __exit__( self, *exc ):
+        self.close()
+
+    def close( self ):
+        if self._sock is None:
+            return
+        self.release()
+        # views of the mappings must go before the mappings can; a frame still referenced
+        # keeps the ring mapped until it is garbage collected
+        for view in ( self._rq, self._cq, self._ci, self._data, self._ring, self._cur ):
+            try:
+                view.release()
+            except BufferError:
+                pass
+        os.close( self._evfd )
+        self._sock.close()
+        self._sock = None
+
+    # bytes published but not yet released
+    @property
+    def lag( self ):
+        return self._rq[ RING_HEAD ] - self._cq[ CUR_TAIL ]
+
+    @property
+    def detached( self ):
+        return self._ci[ CUR_STATE ] == FAN_DETACHED
+
+    # hand the frame returned by next() back. returns False if the daemon detached us meanwhile,
+    # in which case the frame may have been overwritten while it was read.
+    def release( self ):
+        if not self._held:
+            return True
+        ok = not self.detached
+        self._tail += self._held
+        self._held = 0
+        self._cq[ CUR_TAIL ] = self._tail
+        return ok
+
+    # wait up to timeout seconds (None => forever) for the next frame and return ( header, payload ),
+    # the payload a uint64 array of the words, or a memoryview of the bytes of a packed frame, both
+    # views of the ring.  returns None on timeout, raises DetachedError once the daemon has gone
+    # (after every frame it published was received) or detached us.
+    def next( self, timeout=None ):
+        self.release()
+        while True:
+            if self.detached:
+                raise DetachedError( "detached by the daemon for being too slow" )
+            head = self._rq[ RING_HEAD ]
+            while self._tail != head:
+                pos = self._tail % self.size
+                length, flags, seq = REC.unpack_from( self._data, pos )
+                if length < REC.size or length % 16 or length > self.size - pos or length > head - self._tail:
+                    raise RuntimeError( f"corrupt record at {self._tail}" )
+                if flags & FAN_REC_PAD:
+                    self._tail += length
+                    continue
+                hdr = FrameHeader._make( FRAME.unpack_from( self._data, pos + REC.size ) )
+                if self._next_seq is not None and seq > self._next_seq:
+                    self.lost += seq - self._next_seq
+                self._next_seq = seq + 1
+                self.frames += 1
+                self._held = length
+                off = pos + REC.size + hdr.header_len
+                if hdr.flags & FRAME_FLAG_PACKED:
+                    return hdr, self._data[ off : off + hdr.packed_len ]
+                return hdr, np.frombuffer( self._data, dtype=np.uint64, count=hdr.n_words, offset=off )
+
+            # padding skipped above must not hold the daemon back
+            self._cq[ CUR_TAIL ] = self._tail
+            if self._gone:
+                raise DetachedError( "the daemon closed the ring" )
+            if timeout == 0:
+                return None
+
+            # ask to be woken, then look again before going to sleep
+            self._ci[ CUR_WAITING ] = 1
+            if self._rq[ RING_HEAD ] != self._tail:
+                continue
+            wait = MAX_SLEEP if timeout is None else min( timeout, MAX_SLEEP )
+            ready = select.select( [ self._evfd, self._sock ], [], [], wait )[0]
+            if self._evfd in ready:
+                os.read( self._evfd, 8 )
+            if self._sock in ready:
+                self._gone = True
+            elif not ready and timeout is not None:
+                timeout = max( timeout - wait, 0 )
+                if timeout == 0 and self._rq[ RING_HEAD ] == self._tail:
+                    return None
+
+    # iterate over the frames until the daemon goes away; each frame is released when the next
+    # one is taken
+    def __iter__( self ):
+        while True:
+            try:
+                yield self.next()
+            except DetachedError:
+                return
+
+    # counters of the whole ring
+    def ring_stats( self ):
+        return { 'frames': self._rq[ RING_FRAMES ], 'skipped': self._rq[ RING_SKIPPED ],
+                 'detached': self._rq[ RING_DETACHED ], 'size': self.size }
+
+
+__all__ = [ 'FanConsumer', 'DetachedError', 'FrameHeader', 'hit_fields', 'hit_time', 'load_calib', 'FAN_SOCK_NAME' ]
@@ -0,0 +1,55 @@
+/*
+* Live view of the online monitoring histograms of the daemon (tdc_mon.h)
+*
+* Maps the shared memory segment of a daemon running on the same board read-only and prints
+* its report every interval: event rate, hits per trigger, and the rate, share of the hits,
+* hits per trigger and fine time spread of every channel. Reading the segment never slows the
+* readout down.
+*
+* usage: monitor [-n mon_shm] [-i interval_s] [-1]
+*   -n mon_shm     name of the segment (daemon -m), default /tdc_mon
+*   -i interval_s  seconds between reports, default 1
+*   -1             print one report and exit
+*
+* Build with: make monitor
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tdc_mon.h"
+
+int main(int argc, char *argv[])
+{
+    const char *name = TDC_MON_SHM_NAME;
+    unsigned interval = 1;
+    int once = 0, opt;
+    static char text[8192];
+    struct tdc_mon mon;
+
+    while ((opt = getopt(argc, argv, "n:i:1")) != -1) {
+        switch (opt) {
+            case 'n': name = optarg; break;
+            case 'i': interval = (unsigned)atoi(optarg); break;
+            case '1': once = 1; break;
+            default:
+                fprintf(stderr, "usage %s [-n mon_shm] [-i interval_s] [-1]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (tdc_mon_attach(&mon, name) < 0)
+        exit(1);
+    while (1) {
+        tdc_mon_format(&mon, text, sizeof(text));
+        // Clear the terminal between reports, unless the output goes to a file
+        if (!once && isatty(STDOUT_FILENO))
+            fputs("\033[H\033[2J", stdout);
+        fputs(text, stdout);
+        fflush(stdout);
+        if (once)
+            break;
+        sleep(interval ? interval : 1);
+    }
+    tdc_mon_close(&mon);
+    return 0;
+}
@@ -0,0 +1,219 @@
+/*
+* DAQ host receiver for the binary event frames sent by daemon.c
+*
+* Listens on a TCP port, accepts the connection from the board daemon and decodes
+* the stream of event frames described in tdc_frame.h. Frames can optionally be
+* written verbatim to a file for offline analysis, and individual hits can be dumped
+* to stdout for debugging. Every second the receive rate is reported on stderr.
+*
+* usage: receiver [-o outfile] [-d] [-c calib_file] port
+*   -o outfile     append every received frame (header + payload) to outfile, as received
+*   -d             print the decoded hits of every frame (slow, for debugging only)
+*   -c calib_file  fine time calibration saved by the daemon (tdc_calib.h), used for the
+*                  hit times printed by -d. Without it the fine bins are taken to be equal.
+*
+* Packed frames (daemon -z, see tdc_frame.h) are unpacked to the plain words on arrival.
+*
+* Build with: make receiver
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <inttypes.h>
+
+#include "tdc_frame.h"
+#include "tdc_decode.h"
+#include "tdc_calib.h"
+#include "tdc_pack.h"
+
+void error(const char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+// Read exactly len bytes. Returns 0 on success, -1 if the peer closed the connection.
+int read_full(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, MSG_WAITALL);
+        if (n < 0)
+            error("recv");
+        if (n == 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *outname = NULL;
+    const char *calname = NULL;
+    int dump = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:dc:")) != -1) {
+        switch (opt) {
+            case 'o': outname = optarg; break;
+            case 'd': dump = 1; break;
+            case 'c': calname = optarg; break;
+            default:
+                fprintf(stderr, "usage %s [-o outfile] [-d] [-c calib_file] port\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage %s [-o outfile] [-d] [-c calib_file] port\n", argv[0]);
+        exit(1);
+    }
+    int portno = atoi(argv[optind]);
+
+    FILE *out = NULL;
+    if (outname != NULL) {
+        out = fopen(outname, "ab");
+        if (out == NULL)
+            error("Failed to open output file");
+        // Frames are written in large chunks rather than one fwrite() syscall each
+        setvbuf(out, NULL, _IOFBF, 1 << 20);
+    }
+
+    // Listen for the board daemon
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0)
+        error("ERROR opening socket");
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(portno);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        error("ERROR on bind");
+    listen(lfd, 1);
+    fprintf(stderr, "Waiting for board connection on port %d...\n", portno);
+
+    struct sockaddr_in peer;
+    socklen_t plen = sizeof(peer);
+    int fd = accept(lfd, (struct sockaddr *)&peer, &plen);
+    if (fd < 0)
+        error("ERROR on accept");
+    fprintf(stderr, "Board connected\n");
+
+    int rcvbuf = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    // Decoded hits, for -d
+    static struct tdc_calib calib;
+    static uint8_t hit_channel[TDC_FRAME_MAX_WORDS], hit_fine[TDC_FRAME_MAX_WORDS];
+    static uint32_t hit_coarse[TDC_FRAME_MAX_WORDS];
+    static uint64_t hit_time[TDC_FRAME_MAX_WORDS];
+    struct tdc_hits hits = { hit_channel, hit_fine, hit_coarse, hit_time };
+    struct tdc_decode_cal cal;
+    tdc_decode_cal_default(&cal);
+    if (calname != NULL) {
+        if (tdc_calib_load(&calib, calname) < 0)
+            exit(1);
+        tdc_calib_apply(&calib, &cal);
+    }
+
+    static uint64_t words[TDC_FRAME_MAX_WORDS];
+    static uint8_t packed[TDC_FRAME_PACKED_MAX_LEN(TDC_FRAME_MAX_WORDS)];
+    unsigned char hbuf[256];
+    struct tdc_frame_header *hdr = (struct tdc_frame_header *)hbuf;
+
+    uint64_t n_frames = 0, n_words = 0, n_bytes = 0, n_gaps = 0, n_dropped = 0;
+    uint64_t last_frames = 0, last_words = 0, last_bytes = 0;
+    uint32_t last_trigger = 0;
+    double t_last = now_s();
+
+    while (1) {
+        // Version 1 part of the header first, then whatever extension the sender declared
+        memset(hbuf, 0, sizeof(struct tdc_frame_header));
+        if (read_full(fd, hbuf, TDC_FRAME_HEADER_V1_LEN) < 0)
+            break;
+        if (tdc_frame_check(hdr) < 0 || hdr->header_len > sizeof(hbuf)) {
+            fprintf(stderr, "Bad frame header after %" PRIu64 " frames, giving up\n", n_frames);
+            break;
+        }
+        if (hdr->header_len > TDC_FRAME_HEADER_V1_LEN &&
+            read_full(fd, hbuf + TDC_FRAME_HEADER_V1_LEN,
+                      hdr->header_len - TDC_FRAME_HEADER_V1_LEN) < 0)
+            break;
+        size_t payload_len = tdc_frame_payload_len(hdr);
+        const void *payload = words;
+        if (hdr->flags & TDC_FRAME_FLAG_PACKED) {
+            if (read_full(fd, packed, payload_len) < 0)
+                break;
+            if (tdc_unpack_hits(packed, payload_len, words, hdr->n_words) < 0) {
+                fprintf(stderr, "Bad packed payload after %" PRIu64 " frames, giving up\n", n_frames);
+                break;
+            }
+            payload = packed;
+        } else if (read_full(fd, words, payload_len) < 0) {
+            break;
+        }
+
+        if (n_frames > 0 && hdr->trigger != last_trigger + 1)
+            n_gaps++;
+        last_trigger = hdr->trigger;
+        n_dropped += tdc_frame_dropped(hdr);
+
+        if (out != NULL) {
+            fwrite(hbuf, 1, hdr->header_len, out);
+            fwrite(payload, 1, payload_len, out);
+        }
+        if (dump) {
+            printf("trigger %u bram %u words %u flags %#x missed %u dropped %u t %" PRIu64 "\n",
+                   hdr->trigger, hdr->bram_id, hdr->n_words, hdr->flags, hdr->missed_trigs,
+                   tdc_frame_dropped(hdr), hdr->timestamp_ns);
+            tdc_decode(words, hdr->n_words, &hits, &cal);
+            for (uint32_t i = 0; i < hdr->n_words; i++) {
+                printf("  ch %2u fine %2u coarse %9u t %15" PRIu64 " ps\n",
+                       hit_channel[i], hit_fine[i], hit_coarse[i], hit_time[i]);
+            }
+        }
+
+        n_frames++;
+        n_words += hdr->n_words;
+        n_bytes += hdr->header_len + payload_len;
+
+        double t = now_s();
+        if (t - t_last >= 1.0) {
+            double dt = t - t_last;
+            fprintf(stderr, "%.0f frames/s, %.0f hits/s, %.2f MB/s (%" PRIu64 " frames, %" PRIu64 " trigger gaps, "
+                    "%" PRIu64 " triggers dropped = %.3f%% dead time)\n",
+                    (n_frames - last_frames) / dt, (n_words - last_words) / dt,
+                    (n_bytes - last_bytes) / dt / 1e6, n_frames, n_gaps,
+                    n_dropped, 100.0 * n_dropped / (n_frames + n_dropped));
+            last_frames = n_frames;
+            last_words = n_words;
+            last_bytes = n_bytes;
+            t_last = t;
+        }
+    }
+
+    fprintf(stderr, "Connection closed: %" PRIu64 " frames, %" PRIu64 " hits, %" PRIu64 " bytes, %" PRIu64 " triggers dropped\n",
+            n_frames, n_words, n_bytes, n_dropped);
+    if (out != NULL)
+        fclose(out);
+    close(fd);
+    close(lfd);
+    return 0;
+}
@@ -0,0 +1,128 @@
+/*
+* Inspect a run file (tdc_run.h) written by daemon -w
+*
+* Prints what the run holds (frames, triggers, time span, frames dropped by the writer) and
+* optionally the index, then, with -t or -T, seeks straight to a trigger or a time and
+* prints the frames from there, without reading the rest of the file.
+*
+* usage: runfile [-i] [-t trigger | -T time_ns] [-n count] [-d] [-c calib_file] file
+*   -i             print the index (one entry per chunk of frames)
+*   -t trigger     print frames from the first one with an extended trigger >= trigger
+*   -T time_ns     print frames from the first one with a timestamp >= time_ns (CLOCK_REALTIME)
+*   -n count       frames to print, default 1
+*   -d             also print the hits of every frame
+*   -c calib_file  fine time calibration saved by the daemon (tdc_calib.h), used for the hit
+*                  times printed by -d. Without it the fine bins are taken to be equal.
+*
+* Build with: make runfile
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "tdc_run.h"
+#include "tdc_pack.h"
+#include "tdc_calib.h"
+
+static struct tdc_decode_cal cal;
+
+static void print_frame(const struct tdc_run_frame *f, int dump)
+{
+    static uint64_t words[TDC_FRAME_MAX_WORDS];
+    static uint8_t hit_channel[TDC_FRAME_MAX_WORDS], hit_fine[TDC_FRAME_MAX_WORDS];
+    static uint32_t hit_coarse[TDC_FRAME_MAX_WORDS];
+    static uint64_t hit_time[TDC_FRAME_MAX_WORDS];
+    struct tdc_hits hits = { hit_channel, hit_fine, hit_coarse, hit_time };
+    const struct tdc_frame_header *hdr = f->hdr;
+    const uint64_t *w = f->payload;
+
+    printf("trigger %" PRIu64 " (%u) bram %u words %u flags %#x missed %u dropped %u t %" PRIu64 "\n",
+           f->trigger, hdr->trigger, hdr->bram_id, hdr->n_words, hdr->flags, hdr->missed_trigs,
+           tdc_frame_dropped(hdr), hdr->timestamp_ns);
+    if (!dump)
+        return;
+    if (hdr->flags & TDC_FRAME_FLAG_PACKED) {
+        if (hdr->n_words > TDC_FRAME_MAX_WORDS ||
+            tdc_unpack_hits(f->payload, hdr->packed_len, words, hdr->n_words) < 0) {
+            printf("  bad packed payload\n");
+            return;
+        }
+        w = words;
+    }
+    if (hdr->n_words > TDC_FRAME_MAX_WORDS) {
+        printf("  bad frame length\n");
+        return;
+    }
+    tdc_decode(w, hdr->n_words, &hits, &cal);
+    for (uint32_t i = 0; i < hdr->n_words; i++)
+        printf("  ch %2u fine %2u coarse %9u t %15" PRIu64 " ps\n",
+               hit_channel[i], hit_fine[i], hit_coarse[i], hit_time[i]);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage %s [-i] [-t trigger | -T time_ns] [-n count] [-d] [-c calib_file] file\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int index = 0, dump = 0, seek = 0, opt;
+    uint64_t key = 0, count = 1;
+    struct tdc_run r;
+    static struct tdc_calib calib;
+    const char *calname = NULL;
+
+    while ((opt = getopt(argc, argv, "it:T:n:dc:")) != -1) {
+        switch (opt) {
+            case 'i': index = 1; break;
+            case 't': seek = 't'; key = strtoull(optarg, NULL, 0); break;
+            case 'T': seek = 'T'; key = strtoull(optarg, NULL, 0); break;
+            case 'n': count = strtoull(optarg, NULL, 0); break;
+            case 'd': dump = 1; break;
+            case 'c': calname = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (argc - optind != 1)
+        usage(argv[0]);
+    tdc_decode_cal_default(&cal);
+    if (calname != NULL) {
+        if (tdc_calib_load(&calib, calname) < 0)
+            return 1;
+        tdc_calib_apply(&calib, &cal);
+    }
+    if (tdc_run_open(&r, argv[optind]) < 0)
+        return 1;
+
+    printf("%s: %" PRIu64 " frames, %" PRIu64 " index entries, blocks of up to %u bytes%s\n", argv[optind],
+           r.n_frames, r.n_index, r.hdr->block_size, r.recovered ? " (not closed, index rebuilt from the blocks)" : "");
+    if (r.n_index > 0)
+        printf("Triggers %" PRIu64 " - %" PRIu64 ", %.3f s from %" PRIu64 " to %" PRIu64 " ns\n",
+               r.index[0].first_trigger, r.index[r.n_index - 1].last_trigger,
+               (r.index[r.n_index - 1].last_ns - r.index[0].first_ns) / 1e9,
+               r.index[0].first_ns, r.index[r.n_index - 1].last_ns);
+    if (!r.recovered) {
+        const struct tdc_run_trailer *t = (const struct tdc_run_trailer *)(r.map + r.len - sizeof(*t));
+        printf("Frames dropped by the writer: %" PRIu64 "\n", t->dropped);
+    }
+    if (index)
+        for (uint64_t e = 0; e < r.n_index; e++)
+            printf("  entry %6" PRIu64 " at %12" PRIu64 " + %7u: %6u frames, triggers %" PRIu64 " - %" PRIu64
+                   ", t %" PRIu64 " - %" PRIu64 "\n", e, r.index[e].offset, r.index[e].frame_off, r.index[e].n_frames,
+                   r.index[e].first_trigger, r.index[e].last_trigger, r.index[e].first_ns, r.index[e].last_ns);
+
+    if (seek) {
+        struct tdc_run_cursor c;
+        struct tdc_run_frame f;
+        int found = (seek == 't') ? tdc_run_find_trigger(&r, key, &c) : tdc_run_find_time(&r, key, &c);
+        if (found < 0)
+            printf("No frame at or after %s %" PRIu64 "\n", seek == 't' ? "trigger" : "time", key);
+        for (uint64_t i = 0; found == 0 && i < count && tdc_run_next(&r, &c, &f) == 0; i++)
+            print_frame(&f, dump);
+    }
+    tdc_run_close(&r);
+    return 0;
+}
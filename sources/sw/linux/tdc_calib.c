@@ -0,0 +1,151 @@
+/*
+* Online per-channel fine time calibration (see tdc_calib.h)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tdc_calib.h"
+#include "tdc_frame.h"
+
+// On-disk layout: this header, then hist[][], lut[] and calibrated[], all little endian
+struct tdc_calib_file_header {
+    uint32_t magic;         // TDC_CALIB_MAGIC
+    uint16_t version;       // TDC_CALIB_VERSION
+    uint8_t  n_channels;    // TDC_DECODE_CHANNELS
+    uint8_t  n_bins;        // TDC_DECODE_FINE_BINS
+    uint32_t bin_ps_q16;
+    uint32_t reserved;
+} __attribute__((packed));
+
+static void nominal_channel(struct tdc_calib *c, unsigned ch)
+{
+    for (unsigned f = 0; f < TDC_DECODE_FINE_BINS; f++)
+        c->lut[ch * TDC_DECODE_FINE_BINS + f] = f * c->bin_ps_q16;
+    c->calibrated[ch] = 0;
+}
+
+void tdc_calib_init(struct tdc_calib *c, uint32_t bin_ps_q16)
+{
+    memset(c, 0, sizeof(*c));
+    c->bin_ps_q16 = bin_ps_q16;
+    for (unsigned ch = 0; ch < TDC_DECODE_CHANNELS; ch++)
+        nominal_channel(c, ch);
+}
+
+void tdc_calib_fill(struct tdc_calib *c, const uint64_t *words, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        c->hist[tdc_hit_channel(words[i])][tdc_hit_fine(words[i])]++;
+}
+
+unsigned tdc_calib_build(struct tdc_calib *c, uint64_t min_entries)
+{
+    uint64_t period = (uint64_t)c->bin_ps_q16 * TDC_DECODE_FINE_BINS;
+    unsigned n_cal = 0;
+
+    for (unsigned ch = 0; ch < TDC_DECODE_CHANNELS; ch++) {
+        uint64_t total = 0;
+        for (unsigned f = 0; f < TDC_DECODE_FINE_BINS; f++)
+            total += c->hist[ch][f];
+        c->entries[ch] = total;
+        if (total == 0 || total < min_entries) {
+            nominal_channel(c, ch);
+            continue;
+        }
+        // Edge of bin f = period * (hits below f) / total, rounded. The products are computed
+        // in double, exact enough for any realistic number of hits (< 2^53 / period).
+        uint64_t below = 0;
+        for (unsigned f = 0; f < TDC_DECODE_FINE_BINS; f++) {
+            c->lut[ch * TDC_DECODE_FINE_BINS + f] = (uint32_t)((double)period * below / total + 0.5);
+            below += c->hist[ch][f];
+        }
+        c->calibrated[ch] = 1;
+        n_cal++;
+    }
+    return n_cal;
+}
+
+void tdc_calib_decay(struct tdc_calib *c, unsigned shift)
+{
+    for (unsigned ch = 0; ch < TDC_DECODE_CHANNELS; ch++) {
+        uint64_t total = 0;
+        for (unsigned f = 0; f < TDC_DECODE_FINE_BINS; f++) {
+            c->hist[ch][f] = (shift < 64) ? c->hist[ch][f] >> shift : 0;
+            total += c->hist[ch][f];
+        }
+        c->entries[ch] = total;
+    }
+}
+
+void tdc_calib_apply(const struct tdc_calib *c, struct tdc_decode_cal *cal)
+{
+    cal->bin_ps_q16 = c->bin_ps_q16;
+    cal->fine_lut   = c->lut;
+}
+
+int tdc_calib_save(const struct tdc_calib *c, const char *path)
+{
+    struct tdc_calib_file_header h = {
+        TDC_CALIB_MAGIC, TDC_CALIB_VERSION, TDC_DECODE_CHANNELS, TDC_DECODE_FINE_BINS, c->bin_ps_q16, 0
+    };
+    char tmp[4096];
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open %s: ", tmp);
+        perror("fopen");
+        return -1;
+    }
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+             fwrite(c->hist, sizeof(c->hist), 1, f) == 1 &&
+             fwrite(c->lut, sizeof(c->lut), 1, f) == 1 &&
+             fwrite(c->calibrated, sizeof(c->calibrated), 1, f) == 1;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "Failed to write calibration %s: ", path);
+        perror("");
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int tdc_calib_load(struct tdc_calib *c, const char *path)
+{
+    struct tdc_calib_file_header h;
+    struct tdc_calib *tmp = malloc(sizeof(*tmp));
+    FILE *f = fopen(path, "rb");
+
+    if (f == NULL || tmp == NULL) {
+        fprintf(stderr, "Failed to open %s: ", path);
+        perror("");
+        if (f != NULL)
+            fclose(f);
+        free(tmp);
+        return -1;
+    }
+    int ok = fread(&h, sizeof(h), 1, f) == 1 &&
+             h.magic == TDC_CALIB_MAGIC && h.version == TDC_CALIB_VERSION &&
+             h.n_channels == TDC_DECODE_CHANNELS && h.n_bins == TDC_DECODE_FINE_BINS;
+    if (ok) {
+        tdc_calib_init(tmp, h.bin_ps_q16);
+        ok = fread(tmp->hist, sizeof(tmp->hist), 1, f) == 1 &&
+             fread(tmp->lut, sizeof(tmp->lut), 1, f) == 1 &&
+             fread(tmp->calibrated, sizeof(tmp->calibrated), 1, f) == 1;
+    }
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "%s is not a valid calibration file\n", path);
+        free(tmp);
+        return -1;
+    }
+    for (unsigned ch = 0; ch < TDC_DECODE_CHANNELS; ch++)
+        for (unsigned b = 0; b < TDC_DECODE_FINE_BINS; b++)
+            tmp->entries[ch] += tmp->hist[ch][b];
+    *c = *tmp;
+    free(tmp);
+    return 0;
+}
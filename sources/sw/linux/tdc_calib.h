@@ -0,0 +1,69 @@
+/*
+* Online per-channel fine time calibration (code density test)
+*
+* The encoder assumes the 32 fine time bins of an RF period are all 1/32 of the period wide,
+* but the bins are set by the phases of the four sampling clocks and the routing of each
+* channel in sampler.vhd, so their real widths differ from bin to bin and from channel to
+* channel. Hits are uncorrelated with the RF clock, so over many hits each bin fills in
+* proportion to its width. The fine time histograms of every channel are accumulated as hits
+* stream through the readout, and turned into a table of bin edges:
+*
+*   edge[ch][f] = period * (hits in bins 0..f-1 of ch) / (hits in ch)
+*
+* which tdc_decode() applies with one lookup per hit (struct tdc_decode_cal::fine_lut).
+* Channels with fewer than min_entries hits keep the nominal, equal bins, so a table that was
+* never built decodes exactly like no table at all.
+*
+* The histograms and tables are saved to a small binary file and reloaded at startup, so the
+* calibration is usable straight away and keeps improving as more hits come in. Decaying the
+* histograms after every build (tdc_calib_decay()) weights the recent hits more, so the tables
+* follow the bin widths as they drift with temperature instead of freezing on the first hours.
+*
+* A struct tdc_calib is not locked: fill, build, save and the decode that uses its table must
+* all run on the same thread, or on a copy (the daemon fills the histograms on its event loop
+* and builds and saves a copy of them on a thread of its own).
+*/
+#ifndef TDC_CALIB_H
+#define TDC_CALIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tdc_decode.h"
+
+#define TDC_CALIB_MAGIC         0x43434454u     // "TDCC" when read as bytes
+#define TDC_CALIB_VERSION       1
+
+// Hits per channel needed before its table replaces the nominal bins (~100 per bin)
+#define TDC_CALIB_MIN_ENTRIES   (TDC_DECODE_FINE_BINS * 100)
+
+struct tdc_calib {
+    uint32_t bin_ps_q16;                                            // Nominal bin width (see tdc_decode.h)
+    uint64_t hist[TDC_DECODE_CHANNELS][TDC_DECODE_FINE_BINS];       // Fine time histograms
+    uint64_t entries[TDC_DECODE_CHANNELS];                          // Hits per channel
+    uint32_t lut[TDC_DECODE_CHANNELS * TDC_DECODE_FINE_BINS];       // Bin edges in ps, Q16
+    uint8_t calibrated[TDC_DECODE_CHANNELS];                        // lut of the channel comes from its histogram
+};
+
+// Empty histograms and nominal (equal) bins
+void tdc_calib_init(struct tdc_calib *c, uint32_t bin_ps_q16);
+
+// Add the hits of n raw BRAM words to the histograms
+void tdc_calib_fill(struct tdc_calib *c, const uint64_t *words, size_t n);
+
+// Rebuild the table of every channel with at least min_entries hits. Returns the number of
+// calibrated channels.
+unsigned tdc_calib_build(struct tdc_calib *c, uint64_t min_entries);
+
+// Divide the histograms by 2^shift (shift >= 64 empties them); the tables are left as they are
+void tdc_calib_decay(struct tdc_calib *c, unsigned shift);
+
+// Point the decoder at the table of c
+void tdc_calib_apply(const struct tdc_calib *c, struct tdc_decode_cal *cal);
+
+// Save to / load from path. Saving goes through a temporary file so that a crash never leaves
+// a truncated table behind. Both return 0, or -1 on error (load leaves c untouched).
+int tdc_calib_save(const struct tdc_calib *c, const char *path);
+int tdc_calib_load(struct tdc_calib *c, const char *path);
+
+#endif
@@ -0,0 +1,308 @@
+/*
+* Runtime channel mask, hit qualification and trigger window settings of the TDC firmware
+* (see tdc_ctrl.h)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "tdc_ctrl.h"
+
+// Register map of tdc_ctrl.vhd (32-bit word offsets)
+#define REG_ID              (0x000 / 4)
+#define REG_CTRL            (0x004 / 4)
+#define REG_SEQ             (0x008 / 4)
+#define REG_CONFIG          (0x00C / 4)
+#define REG_ENABLE_LO       (0x010 / 4)
+#define REG_ENABLE_HI       (0x014 / 4)
+#define REG_MIN_WIDTH       (0x018 / 4)
+#define REG_LOOKBACK        (0x01C / 4)     // Version 2 on
+#define REG_WIDTH           (0x020 / 4)
+#define REG_WIN_RESET       (0x024 / 4)     // [15:0] lookback, [31:16] width after a reset
+#define REG_CH_CFG(ch)      ((0x100 + 4 * (ch)) / 4)    // [2:0] min width (0: MIN_WIDTH), [15:8] limit, [31:16] prescale
+
+#define CTRL_ID             0x4C434454u     // "TDCL"
+#define CTRL_APPLY          (1u << 0)       // W: copy the settings into the PL, R: copy pending
+#define CTRL_DROPPED        (1u << 1)       // R: a write was ignored since CTRL was last read (cleared by the read)
+#define CTRL_WINDOW_VERSION 2               // First version with the trigger window
+
+#define CTRL_REG_SIZE       0x1000
+#define APPLY_POLLS         100000          // An apply takes a few clk0 + AXI clock cycles
+
+int tdc_ctrl_open(struct uio_dev *dev)
+{
+    if (uio_open_by_name(dev, TDC_CTRL_UIO_NAME) < 0)
+        return -1;
+    volatile uint32_t *r = dev->ptr;
+    if (dev->len < CTRL_REG_SIZE || r[REG_ID] != CTRL_ID) {
+        fprintf(stderr, "%s is not a TDC control block (ID 0x%08x)\n", dev->path,
+                dev->len >= 4 ? r[REG_ID] : 0);
+        uio_close(dev);
+        return -1;
+    }
+    return 0;
+}
+
+void tdc_ctrl_defaults(struct uio_dev *dev, struct tdc_ctrl_config *c)
+{
+    volatile uint32_t *r = dev->ptr;
+    unsigned width = r[REG_CONFIG] & 0xff;
+
+    if (width < 1 || width > TDC_CTRL_MAX_WIDTH)
+        width = 3;
+    memset(c, 0, sizeof(*c));
+    c->enable = ~0ull;
+    memset(c->min_width, (int)width, sizeof(c->min_width));
+    c->limit_bits = (r[REG_CONFIG] >> 16) & 0xff;
+    c->version = r[REG_CONFIG] >> 24;
+    if (c->version >= CTRL_WINDOW_VERSION) {
+        c->lookback = (uint16_t)r[REG_WIN_RESET];
+        c->width    = (uint16_t)(r[REG_WIN_RESET] >> 16);
+    }
+}
+
+// Parse a channel list ("all", or e.g. "0-15,32") into a mask. Returns -1 if it is not one.
+static int parse_channels(const char *s, uint64_t *mask)
+{
+    *mask = 0;
+    if (strcmp(s, "all") == 0) {
+        *mask = ~0ull;
+        return 0;
+    }
+    while (*s) {
+        char *end;
+        long first = strtol(s, &end, 10), last = first;
+        if (end == s)
+            return -1;
+        if (*end == '-') {
+            s = end + 1;
+            last = strtol(s, &end, 10);
+            if (end == s)
+                return -1;
+        }
+        if (first < 0 || last >= TDC_CTRL_MAX_CHANNELS || first > last)
+            return -1;
+        for (long ch = first; ch <= last; ch++)
+            *mask |= 1ull << ch;
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -1;
+        s = end;
+    }
+    return *mask != 0 ? 0 : -1;
+}
+
+int tdc_ctrl_load(const char *path, struct tdc_ctrl_config *c)
+{
+    FILE *f = fopen(path, "r");
+    char line[512];
+    int n = 0;
+
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open %s: ", path);
+        perror("");
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *tok[4], *save = NULL;
+        int ntok = 0;
+        uint64_t mask = ~0ull;
+        long value = 0;
+
+        n++;
+        line[strcspn(line, "#\n")] = '\0';
+        for (char *t = strtok_r(line, " \t\r", &save); t != NULL; t = strtok_r(NULL, " \t\r", &save)) {
+            if (ntok == 4)
+                goto bad;
+            tok[ntok++] = t;
+        }
+        if (ntok == 0)
+            continue;
+
+        if (strcmp(tok[0], "enable") == 0 || strcmp(tok[0], "disable") == 0) {
+            if (ntok != 2 || parse_channels(tok[1], &mask) < 0)
+                goto bad;
+            if (tok[0][0] == 'e')
+                c->enable |= mask;
+            else
+                c->enable &= ~mask;
+            continue;
+        }
+
+        char *end;
+        if (strcmp(tok[0], "window") == 0) {
+            if (ntok != 3)
+                goto bad;
+            long lookback = strtol(tok[1], &end, 0);
+            if (*end != '\0' || lookback < 0 || lookback > TDC_CTRL_MAX_WINDOW)
+                goto bad;
+            value = strtol(tok[2], &end, 0);
+            if (*end != '\0' || value < 0 || value > TDC_CTRL_MAX_WINDOW)
+                goto bad;
+            c->lookback = (uint16_t)lookback;
+            c->width    = (uint16_t)value;
+            continue;
+        }
+
+        // <setting> <n> [channels]
+        if (ntok < 2 || ntok > 3)
+            goto bad;
+        value = strtol(tok[1], &end, 0);
+        if (*end != '\0' || (ntok == 3 && parse_channels(tok[2], &mask) < 0))
+            goto bad;
+        for (unsigned ch = 0; ch < TDC_CTRL_MAX_CHANNELS; ch++) {
+            if (!(mask >> ch & 1))
+                continue;
+            if (strcmp(tok[0], "min_width") == 0 && value >= 1 && value <= TDC_CTRL_MAX_WIDTH)
+                c->min_width[ch] = (uint8_t)value;
+            else if (strcmp(tok[0], "prescale") == 0 && value >= 0 && value <= TDC_CTRL_MAX_PRESCALE)
+                c->prescale[ch] = (uint16_t)value;
+            else if (strcmp(tok[0], "limit") == 0 && value >= 0 && value <= TDC_CTRL_MAX_LIMIT)
+                c->limit[ch] = (uint8_t)value;
+            else
+                goto bad;
+        }
+    }
+    fclose(f);
+    return 0;
+
+bad:
+    fprintf(stderr, "%s:%d: invalid setting (see tdc_ctrl.h for the syntax)\n", path, n);
+    fclose(f);
+    return -1;
+}
+
+int tdc_ctrl_apply(struct uio_dev *dev, const struct tdc_ctrl_config *c)
+{
+    volatile uint32_t *r = dev->ptr;
+    uint32_t ctrl, dropped = 0;
+    unsigned i;
+
+    if (c->version < CTRL_WINDOW_VERSION && (c->lookback != 0 || c->width != 0)) {
+        fprintf(stderr, "The TDC control block (version %u) has no trigger window setting\n", c->version);
+        return -1;
+    }
+    // The PL ignores writes while the previous apply is pending, and answers them OKAY all the
+    // same: wait for it, which also clears a DROPPED left by another writer
+    for (i = 0; i < APPLY_POLLS && (r[REG_CTRL] & CTRL_APPLY); i++)
+        ;
+    if (i == APPLY_POLLS) {
+        fprintf(stderr, "TDC control block busy with a previous apply (is clk0 running?)\n");
+        return -1;
+    }
+    if (c->version >= CTRL_WINDOW_VERSION) {
+        r[REG_LOOKBACK] = c->lookback;
+        r[REG_WIDTH]    = c->width;
+    }
+    r[REG_ENABLE_LO] = (uint32_t)c->enable;
+    r[REG_ENABLE_HI] = (uint32_t)(c->enable >> 32);
+    for (unsigned ch = 0; ch < TDC_CTRL_MAX_CHANNELS; ch++)
+        r[REG_CH_CFG(ch)] = (uint32_t)c->prescale[ch] << 16 | (uint32_t)c->limit[ch] << 8 | (c->min_width[ch] & 0x7);
+    r[REG_CTRL] = CTRL_APPLY;
+    // Every read of CTRL clears DROPPED, so collect it from all of them
+    for (i = 0; i < APPLY_POLLS; i++) {
+        ctrl = r[REG_CTRL];
+        dropped |= ctrl;
+        if (!(ctrl & CTRL_APPLY))
+            break;
+    }
+    if (i == APPLY_POLLS) {
+        fprintf(stderr, "TDC control block apply timed out (is clk0 running?)\n");
+        return -1;
+    }
+    if (dropped & CTRL_DROPPED) {
+        fprintf(stderr, "TDC control block ignored some of the settings (written by another process meanwhile?)\n");
+        return -1;
+    }
+    return 0;
+}
+
+int tdc_ctrl_read(struct uio_dev *dev, struct tdc_ctrl_config *c, uint32_t *seq)
+{
+    volatile uint32_t *r = dev->ptr;
+    unsigned global = r[REG_MIN_WIDTH] & 0x7;
+    unsigned n_channels = (r[REG_CONFIG] >> 8) & 0xff;
+
+    memset(c, 0, sizeof(*c));
+    if (n_channels > TDC_CTRL_MAX_CHANNELS)
+        n_channels = TDC_CTRL_MAX_CHANNELS;
+    c->enable = (uint64_t)r[REG_ENABLE_HI] << 32 | r[REG_ENABLE_LO];
+    c->limit_bits = (r[REG_CONFIG] >> 16) & 0xff;
+    c->version = r[REG_CONFIG] >> 24;
+    if (c->version >= CTRL_WINDOW_VERSION) {
+        c->lookback = (uint16_t)r[REG_LOOKBACK];
+        c->width    = (uint16_t)r[REG_WIDTH];
+    }
+    if (n_channels < 64)
+        c->enable &= (1ull << n_channels) - 1;
+    for (unsigned ch = 0; ch < n_channels; ch++) {
+        uint32_t cfg = r[REG_CH_CFG(ch)];
+        c->min_width[ch] = (cfg & 0x7) ? (cfg & 0x7) : (global ? global : 1);
+        c->limit[ch]     = (uint8_t)(cfg >> 8);
+        c->prescale[ch]  = (uint16_t)(cfg >> 16);
+    }
+    if (seq != NULL)
+        *seq = r[REG_SEQ];
+    return 0;
+}
+
+// snprintf at buf + *off, keeping *off within len
+static void append(char *buf, size_t len, size_t *off, const char *fmt, ...)
+{
+    va_list ap;
+    if (*off >= len)
+        return;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *off, len - *off, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        *off = (*off + n < len) ? *off + n : len;
+}
+
+// Print a channel mask as a list of ranges
+static void append_channels(char *buf, size_t len, size_t *off, uint64_t mask)
+{
+    int first = 1;
+    for (unsigned ch = 0; ch < TDC_CTRL_MAX_CHANNELS; ch++) {
+        if (!(mask >> ch & 1))
+            continue;
+        unsigned last = ch;
+        while (last + 1 < TDC_CTRL_MAX_CHANNELS && (mask >> (last + 1) & 1))
+            last++;
+        if (last == ch)
+            append(buf, len, off, "%s%u", first ? "" : ",", ch);
+        else
+            append(buf, len, off, "%s%u-%u", first ? "" : ",", ch, last);
+        first = 0;
+        ch = last;
+    }
+    if (first)
+        append(buf, len, off, "none");
+}
+
+void tdc_ctrl_format(const struct tdc_ctrl_config *c, char *buf, size_t len)
+{
+    double period_us = (double)(1ull << (c->limit_bits & 63)) / TDC_CTRL_CLK0_HZ * 1e6;
+    size_t off = 0;
+
+    buf[0] = '\0';
+    append(buf, len, &off, "Channels enabled: ");
+    append_channels(buf, len, &off, c->enable);
+    append(buf, len, &off, "\n");
+    for (unsigned ch = 0; ch < TDC_CTRL_MAX_CHANNELS; ch++) {
+        if (!(c->enable >> ch & 1) || (c->prescale[ch] <= 1 && c->limit[ch] == 0 && c->min_width[ch] == c->min_width[0]))
+            continue;
+        append(buf, len, &off, "  Channel %u: min width %u", ch, c->min_width[ch]);
+        if (c->prescale[ch] > 1)
+            append(buf, len, &off, ", prescale %u", c->prescale[ch]);
+        if (c->limit[ch] > 0)
+            append(buf, len, &off, ", limit %u per %.1f us", c->limit[ch], period_us);
+        append(buf, len, &off, "\n");
+    }
+    append(buf, len, &off, "Minimum width of the other channels: %u clk0 periods\n", c->min_width[0]);
+    if (c->version >= CTRL_WINDOW_VERSION)
+        append(buf, len, &off, "Trigger window (trigger matching firmware): from %.1f ns before the trigger, %.1f ns long\n",
+               c->lookback / TDC_CTRL_COARSE_HZ * 1e9, c->width / TDC_CTRL_COARSE_HZ * 1e9);
+}
@@ -0,0 +1,80 @@
+/*
+* Runtime channel mask, hit qualification and trigger window settings of the TDC firmware
+* (tdc_ctrl.vhd)
+*
+* The control block sets, per channel, whether its hits are kept, the minimum width of a hit
+* (in clk0 periods, 4.7 ns), a prescale (keep one hit of every n) and a rate limit (at most n
+* hits per limit period, 2^12 clk0 cycles = 19.3 us). The hits of a disabled, prescaled or rate
+* limited channel are dropped before its FIFO, so a noisy channel no longer costs bandwidth in
+* the arbiter tree. Firmware built in trigger matching mode also takes its trigger window from
+* the block: only the hits in [t - lookback, t - lookback + width) coarse periods (18.8 ns) of
+* the trigger time t are read out.
+*
+* The settings are loaded from a text file, one setting per line, '#' starting a comment:
+*   enable  <channels>                  keep the hits of these channels
+*   disable <channels>                  drop all hits of these channels
+*   min_width <n> [channels]            minimum width, 1-7 clk0 periods (all channels if none given)
+*   prescale  <n> [channels]            keep one hit of every n, 0 or 1 keep all of them
+*   limit     <n> [channels]            at most n hits per limit period, 0 for no limit
+*   window <lookback> <width>           trigger window, coarse periods (0-65535 each)
+* where <channels> is "all" or a comma separated list of channels and ranges, e.g. 0-15,32,40-47.
+* Lines are applied in order on top of the defaults (every channel enabled, the minimum width
+* and trigger window of the firmware, no prescale or limit), so later lines override earlier
+* ones.
+*
+* The block is a generic-uio device named "tdc_ctrl" (a 4 KB register page); see tdc_ctrl.vhd
+* for the register map. The block ignores writes while an apply is pending, but answers them
+* like any other (an error response would be an SError): wait for CTRL.PENDING to read 0 before
+* writing and check CTRL.DROPPED afterwards, as tdc_ctrl_apply() does.
+*
+* All functions print what failed to stderr and return -1 on error.
+*/
+#ifndef TDC_CTRL_H
+#define TDC_CTRL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tdc_uio.h"
+
+#define TDC_CTRL_UIO_NAME       "tdc_ctrl"
+#define TDC_CTRL_MAX_CHANNELS   64
+#define TDC_CTRL_MAX_WIDTH      7
+#define TDC_CTRL_MAX_PRESCALE   65535
+#define TDC_CTRL_MAX_LIMIT      255
+#define TDC_CTRL_MAX_WINDOW     65535
+#define TDC_CTRL_CLK0_HZ        212.4e6
+#define TDC_CTRL_COARSE_HZ      53.1e6
+
+struct tdc_ctrl_config {
+    uint64_t enable;                                // Bit ch set: channel ch enabled
+    uint8_t min_width[TDC_CTRL_MAX_CHANNELS];       // clk0 periods, 1-7
+    uint16_t prescale[TDC_CTRL_MAX_CHANNELS];       // 0 and 1: keep every hit
+    uint8_t limit[TDC_CTRL_MAX_CHANNELS];           // Hits per limit period, 0: no limit
+    uint16_t lookback;                              // Start of the trigger window before the trigger, coarse periods
+    uint16_t width;                                 // Length of the trigger window, coarse periods
+    unsigned limit_bits;                            // The limit period is 2^limit_bits clk0 cycles (read only)
+    unsigned version;                               // Version of the block (read only), the window needs 2
+};
+
+// Find the control block, map it and check its ID
+int tdc_ctrl_open(struct uio_dev *dev);
+
+// Settings of the firmware after a reset: every channel enabled with the minimum width it was
+// built with (g_sat_duration), no prescale or rate limit, the trigger window it was built with
+void tdc_ctrl_defaults(struct uio_dev *dev, struct tdc_ctrl_config *c);
+
+// Apply the settings file at path on top of c. On error, c may be partly modified.
+int tdc_ctrl_load(const char *path, struct tdc_ctrl_config *c);
+
+// Write c to the control block and wait until the PL uses it. Fails if the block ignored any of
+// the writes (CTRL.DROPPED), e.g. because another process applied settings at the same time.
+int tdc_ctrl_apply(struct uio_dev *dev, const struct tdc_ctrl_config *c);
+
+// Read the settings from the control block (as last written, and the number of applies)
+int tdc_ctrl_read(struct uio_dev *dev, struct tdc_ctrl_config *c, uint32_t *seq);
+
+// Human readable summary: enabled channels, then every channel with a non-default setting
+void tdc_ctrl_format(const struct tdc_ctrl_config *c, char *buf, size_t len);
+
+#endif
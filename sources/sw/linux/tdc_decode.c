@@ -0,0 +1,125 @@
+/*
+* Bulk decoder for TDC hit words (see tdc_decode.h)
+*/
+#include "tdc_decode.h"
+#include "tdc_frame.h"
+
+// The NEON kernel is only built on request (make NEON=1), until bench_decode has checked it
+// against the scalar code on the A53
+#ifdef TDC_DECODE_NEON
+#if !defined(__aarch64__) || !defined(__ARM_NEON)
+#error "TDC_DECODE_NEON needs an ARMv8 target with NEON"
+#endif
+#include <arm_neon.h>
+#endif
+
+// coarse * 32 * bin + fine_ps, rounded to the nearest ps. Both terms fit in 32 x 32 -> 64 bit
+// multiplies and a 32-bit fine offset, which is what the NEON kernel computes.
+static inline uint64_t hit_time_ps(uint32_t coarse, uint32_t fine_ps, uint32_t bin)
+{
+    return ((uint64_t)coarse * (bin << 5) + fine_ps + 0x8000) >> 16;
+}
+
+void tdc_decode_scalar(const uint64_t *words, size_t n, const struct tdc_hits *out, const struct tdc_decode_cal *cal)
+{
+    uint32_t bin = cal->bin_ps_q16;
+    const uint32_t *lut = cal->fine_lut;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t w = words[i];
+        uint32_t channel = tdc_hit_channel(w);
+        uint32_t fine = tdc_hit_fine(w);
+        uint32_t coarse = tdc_hit_coarse(w);
+        uint32_t fine_ps = lut ? lut[channel * TDC_DECODE_FINE_BINS + fine] : fine * bin;
+        out->channel[i] = (uint8_t)channel;
+        out->fine[i]    = (uint8_t)fine;
+        out->coarse[i]  = coarse;
+        out->time_ps[i] = hit_time_ps(coarse, fine_ps, bin);
+    }
+}
+
+#ifdef TDC_DECODE_NEON
+// 8 words per iteration: the channel and fine time come from the low 32 bits of each word,
+// the coarse time from a narrowing shift by 11, and the time from a widening multiply-add of
+// the coarse time plus the fine offset. NEON has no gather, so the table entries are fetched
+// with scalar loads.
+static void decode_neon(const uint64_t *words, size_t n, const struct tdc_hits *out, const struct tdc_decode_cal *cal)
+{
+    const uint32_t bin = cal->bin_ps_q16;
+    const uint32_t *lut = cal->fine_lut;
+    const uint32x4_t m_channel = vdupq_n_u32(0x3f);
+    const uint32x4_t m_fine    = vdupq_n_u32(0x1f);
+    const uint32x4_t m_coarse  = vdupq_n_u32(0xfffffff);
+    const uint32x2_t k_coarse  = vdup_n_u32(bin << 5);
+    const uint32x4_t k_fine    = vdupq_n_u32(bin);
+    const uint64x2_t round     = vdupq_n_u64(0x8000);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint64x2_t w0 = vld1q_u64(words + i);
+        uint64x2_t w1 = vld1q_u64(words + i + 2);
+        uint64x2_t w2 = vld1q_u64(words + i + 4);
+        uint64x2_t w3 = vld1q_u64(words + i + 6);
+
+        uint32x4_t lo_a = vcombine_u32(vmovn_u64(w0), vmovn_u64(w1));
+        uint32x4_t lo_b = vcombine_u32(vmovn_u64(w2), vmovn_u64(w3));
+        uint32x4_t coarse_a = vandq_u32(vcombine_u32(vshrn_n_u64(w0, 11), vshrn_n_u64(w1, 11)), m_coarse);
+        uint32x4_t coarse_b = vandq_u32(vcombine_u32(vshrn_n_u64(w2, 11), vshrn_n_u64(w3, 11)), m_coarse);
+        uint32x4_t channel_a = vandq_u32(lo_a, m_channel);
+        uint32x4_t channel_b = vandq_u32(lo_b, m_channel);
+        uint32x4_t fine_a = vandq_u32(vshrq_n_u32(lo_a, 6), m_fine);
+        uint32x4_t fine_b = vandq_u32(vshrq_n_u32(lo_b, 6), m_fine);
+
+        vst1_u8(out->channel + i, vmovn_u16(vcombine_u16(vmovn_u32(channel_a), vmovn_u32(channel_b))));
+        vst1_u8(out->fine + i, vmovn_u16(vcombine_u16(vmovn_u32(fine_a), vmovn_u32(fine_b))));
+        vst1q_u32(out->coarse + i, coarse_a);
+        vst1q_u32(out->coarse + i + 4, coarse_b);
+
+        uint32x4_t fine_ps_a, fine_ps_b;
+        if (lut != NULL) {
+            uint32_t idx[8], ps[8];
+            vst1q_u32(idx,     vorrq_u32(vshlq_n_u32(channel_a, 5), fine_a));
+            vst1q_u32(idx + 4, vorrq_u32(vshlq_n_u32(channel_b, 5), fine_b));
+            for (int k = 0; k < 8; k++)
+                ps[k] = lut[idx[k]];
+            fine_ps_a = vld1q_u32(ps);
+            fine_ps_b = vld1q_u32(ps + 4);
+        } else {
+            fine_ps_a = vmulq_u32(fine_a, k_fine);
+            fine_ps_b = vmulq_u32(fine_b, k_fine);
+        }
+
+        uint64x2_t t0 = vaddw_u32(vmlal_u32(round, vget_low_u32(coarse_a),  k_coarse), vget_low_u32(fine_ps_a));
+        uint64x2_t t1 = vaddw_u32(vmlal_u32(round, vget_high_u32(coarse_a), k_coarse), vget_high_u32(fine_ps_a));
+        uint64x2_t t2 = vaddw_u32(vmlal_u32(round, vget_low_u32(coarse_b),  k_coarse), vget_low_u32(fine_ps_b));
+        uint64x2_t t3 = vaddw_u32(vmlal_u32(round, vget_high_u32(coarse_b), k_coarse), vget_high_u32(fine_ps_b));
+        vst1q_u64(out->time_ps + i,     vshrq_n_u64(t0, 16));
+        vst1q_u64(out->time_ps + i + 2, vshrq_n_u64(t1, 16));
+        vst1q_u64(out->time_ps + i + 4, vshrq_n_u64(t2, 16));
+        vst1q_u64(out->time_ps + i + 6, vshrq_n_u64(t3, 16));
+    }
+
+    // Remaining 0-7 words
+    if (i < n) {
+        struct tdc_hits tail = { out->channel + i, out->fine + i, out->coarse + i, out->time_ps + i };
+        tdc_decode_scalar(words + i, n - i, &tail, cal);
+    }
+}
+#endif
+
+void tdc_decode(const uint64_t *words, size_t n, const struct tdc_hits *out, const struct tdc_decode_cal *cal)
+{
+#ifdef TDC_DECODE_NEON
+    decode_neon(words, n, out, cal);
+#else
+    tdc_decode_scalar(words, n, out, cal);
+#endif
+}
+
+const char *tdc_decode_kernel(void)
+{
+#ifdef TDC_DECODE_NEON
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
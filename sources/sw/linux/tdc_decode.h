@@ -0,0 +1,64 @@
+/*
+* Bulk decoder for TDC hit words
+*
+* Turns an array of raw 64-bit BRAM words (see tdc_frame.h for the layout) into separate
+* arrays of channel, fine time, coarse time and calibrated time, so that later processing
+* (histograms, sorting, calibration) streams through one field at a time.
+*
+* The calibrated time is
+*   time_ps = coarse * 32 * bin_ps + fine_ps[channel][fine]
+* where bin_ps is the nominal width of one fine time bin (1/32 of the RF period) and fine_ps
+* the start of the fine bin within the RF period. Without a table (fine_lut == NULL) the bins
+* are taken to be equal, fine_ps = fine * bin_ps; with one, the measured bin edges built by
+* tdc_calib.h are used at the cost of a single lookup per hit. All of the arithmetic is done
+* in integers, with bin_ps and the table entries as Q16 fixed point values, so that the NEON
+* kernel for the A53 and the portable scalar code give bit-identical results.
+*
+* The NEON kernel has not been run on the board yet, so it is only built with
+* -DTDC_DECODE_NEON (make NEON=1, ARMv8 only); bench_decode then checks it against the scalar
+* code. Otherwise tdc_decode() is the scalar code.
+*/
+#ifndef TDC_DECODE_H
+#define TDC_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// RF clock (53.1 MHz) and the width of one of the 32 fine time bins in Q16 ps (~588.5 ps)
+#define TDC_RF_FREQ_HZ          53.1e6
+#define TDC_FINE_BIN_PS_Q16     ((uint32_t)(65536.0 * 1e12 / TDC_RF_FREQ_HZ / 32 + 0.5))
+
+// Output arrays, each must hold at least n entries
+struct tdc_hits {
+    uint8_t  *channel;
+    uint8_t  *fine;
+    uint32_t *coarse;
+    uint64_t *time_ps;
+};
+
+// Fine time table dimensions: one entry per (channel, fine time) pair, indexed channel * 32 + fine
+#define TDC_DECODE_CHANNELS     64
+#define TDC_DECODE_FINE_BINS    32
+
+struct tdc_decode_cal {
+    uint32_t bin_ps_q16;        // Nominal fine bin width in ps, Q16. Must be < 2^27 (2 ns).
+    const uint32_t *fine_lut;   // NULL, or start of each fine bin in ps, Q16 (see tdc_calib.h)
+};
+
+// Default calibration: nominal fine bin width of the 53.1 MHz RF clock, equal bins
+static inline void tdc_decode_cal_default(struct tdc_decode_cal *cal)
+{
+    cal->bin_ps_q16 = TDC_FINE_BIN_PS_Q16;
+    cal->fine_lut   = NULL;
+}
+
+// Decode n words, using the NEON kernel when built with TDC_DECODE_NEON
+void tdc_decode(const uint64_t *words, size_t n, const struct tdc_hits *out, const struct tdc_decode_cal *cal);
+
+// Portable reference implementation, always available
+void tdc_decode_scalar(const uint64_t *words, size_t n, const struct tdc_hits *out, const struct tdc_decode_cal *cal);
+
+// Name of the kernel used by tdc_decode() ("neon" or "scalar")
+const char *tdc_decode_kernel(void);
+
+#endif
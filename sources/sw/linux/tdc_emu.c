@@ -0,0 +1,540 @@
+/*
+* Software stand-in for the PL side of the 2 BRAM and N bank TDC firmware (see tdc_emu.h)
+*
+* Emulates the following UIO devices, indexed like tdc_readout.c opens them:
+*
+*   2 BRAM firmware                         N bank firmware
+*   - uio0: tdc_int                         - uio0: tdc_int
+*   - uio1: BRAM 1                          - uio1: all banks
+*   - uio2: BRAM 2                          - uio2: read_busy / missed trigger count
+*   - uio3: read_busy / missed trigger count - uio3: bank_sel / bank status
+*   - uio4: which_bram / BRAM status
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "tdc_emu.h"
+#include "tdc_readout.h"
+#include "tdc_decode.h"
+
+#define BANK_WORDS      1024                    // 8 KB BRAM / bank
+#define BANK_LEN        (BANK_WORDS * 8)
+#define GPIO_LEN        65536                   // AXI GPIO register space
+#define MAX_BANKS       16
+
+// AXI GPIO data registers (32-bit word offsets)
+#define GPIO_DATA       0
+#define GPIO2_DATA      2
+
+#define STATUS_OVERFLOW 0x80000000u
+#define COARSE_MASK     0xfffffffu              // g_coarse_bits = 28
+
+// Longest sleep of an idle emulator thread, so that it notices tdc_emu_stop() quickly
+#define IDLE_SLEEP_NS   10000000ull
+// Below this the emulator yields instead of sleeping until the next trigger
+#define SPIN_NS         50000ull
+
+enum emu_state {
+    S_IDLE,     // Waiting for a bank to be queued
+    S_TRIGD,    // Interrupt raised, waiting for rd_busy high
+    S_BUSY      // PS reading, waiting for rd_busy low
+};
+
+// Per-trigger record for tdc_emu_trigger_info(), written as a seqlock: count is 0 while the
+// entry is being updated
+struct emu_trigger {
+    _Atomic uint32_t count;
+    _Atomic uint64_t t_ns;
+    _Atomic uint32_t n_hits;
+};
+
+struct tdc_emu {
+    struct tdc_emu_config cfg;
+    unsigned n_banks;           // Banks in the rotation (2 for the 2 BRAM firmware)
+
+    // Devices: memory regions shared with the readout, and the PL end of the interrupt
+    int mem_fd[3];              // BRAMs (one region per BRAM, or one for all banks), read_busy, select
+    size_t mem_len[3];
+    void *mem[3];
+    int bram2_fd;               // 2 BRAM firmware only
+    void *bram2;
+    int irq_fd[2];              // [0] handed out as the UIO device, [1] the emulator end
+    int dev_fd[TDC_READOUT_DEVS];   // Descriptors by UIO number, for tdc_emu_fds()
+
+    volatile uint64_t *bank[MAX_BANKS];
+    volatile uint32_t *rdbusy, *sel;
+
+    pthread_t thread;
+    atomic_int stop;
+    int running;
+
+    // PL state, emulator thread only
+    uint64_t rng;
+    uint64_t t0, next_trig, next_hit;
+    unsigned wr_bank, rd_bank, n_queued;
+    uint32_t wr_addr;
+    int wr_ovf;
+    uint32_t bank_status[MAX_BANKS], bank_missed[MAX_BANKS], bank_hits[MAX_BANKS];
+    uint64_t bank_t[MAX_BANKS];
+    uint32_t missed_count;
+    enum emu_state state;
+    uint64_t t_irq;
+    uint64_t t_unmask;          // When the PS last unmasked the interrupt (kernel timestamp)
+    uint64_t bank_free[MAX_BANKS];  // Trigger time + dead time of the last readout of each bank
+    // Interrupt state, as kept by the UIO driver
+    uint32_t irq_count;
+    int masked, pending;
+    int irq_sent;               // The interrupt of the current handshake has reached the PS
+    int ps_done;                // ... and the PS unmasked again since, so its readout is over
+
+    pthread_mutex_t lock;       // Protects stats
+    struct tdc_emu_stats stats;
+
+    struct emu_trigger ring[TDC_EMU_RING];
+};
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t xorshift64(uint64_t *s)
+{
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+// Time to the next event of a Poisson process of the given rate, in ns
+static uint64_t exp_ns(uint64_t *rng, double rate)
+{
+    if (rate <= 0)
+        return UINT64_MAX / 2;
+    double u = ((xorshift64(rng) >> 11) + 1) * 0x1p-53;    // (0, 1]
+    return (uint64_t)(-log(u) / rate * 1e9) + 1;
+}
+
+void tdc_emu_hist_add(struct tdc_emu_hist *h, uint64_t ns)
+{
+    unsigned idx;
+    if (ns < 16) {
+        idx = ns;
+    } else {
+        unsigned e = 63 - __builtin_clzll(ns);
+        idx = (e - 3) * 16 + ((ns >> (e - 4)) & 15);
+    }
+    if (idx >= TDC_EMU_HIST_BINS)
+        idx = TDC_EMU_HIST_BINS - 1;
+    h->bins[idx]++;
+    h->n++;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+}
+
+// Lower edge of bin idx
+static uint64_t hist_bin_ns(unsigned idx)
+{
+    if (idx < 16)
+        return idx;
+    unsigned e = idx / 16 + 3;
+    return (16ull + idx % 16) << (e - 4);
+}
+
+uint64_t tdc_emu_hist_percentile(const struct tdc_emu_hist *h, double p)
+{
+    if (h->n == 0)
+        return 0;
+    uint64_t target = (uint64_t)ceil(p / 100.0 * h->n), seen = 0;
+    if (target == 0)
+        target = 1;
+    for (unsigned i = 0; i < TDC_EMU_HIST_BINS; i++) {
+        seen += h->bins[i];
+        if (seen >= target) {
+            // Middle of the bin, but never beyond the largest value seen
+            uint64_t mid = (hist_bin_ns(i) + hist_bin_ns(i + 1)) / 2;
+            return mid < h->max_ns ? mid : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+// Write the hits that arrived up to time t into the bank being written
+static void emu_hits(struct tdc_emu *emu, uint64_t t)
+{
+    volatile uint64_t *bank = emu->bank[emu->wr_bank];
+    uint64_t n = 0;
+
+    while (emu->next_hit <= t) {
+        uint64_t r = xorshift64(&emu->rng);
+        uint64_t coarse = (uint64_t)((emu->next_hit - emu->t0) * (TDC_RF_FREQ_HZ / 1e9)) & COARSE_MASK;
+        bank[emu->wr_addr] = ~((1ull << 39) - 1) | (coarse << 11) | (((r >> 8) & 0x1f) << 6) | (r & 0x3f);
+        if (emu->wr_addr == BANK_WORDS - 1) {
+            emu->wr_addr = 0;
+            emu->wr_ovf = 1;
+        } else {
+            emu->wr_addr++;
+        }
+        n++;
+        emu->next_hit += exp_ns(&emu->rng, emu->cfg.hit_rate);
+    }
+    if (n > 0) {
+        pthread_mutex_lock(&emu->lock);
+        emu->stats.hits += n;
+        pthread_mutex_unlock(&emu->lock);
+    }
+}
+
+static void irq_send(struct tdc_emu *emu)
+{
+    if (send(emu->irq_fd[1], &emu->irq_count, sizeof(emu->irq_count), MSG_DONTWAIT) < 0)
+        perror("tdc_emu: failed to raise the interrupt");
+    emu->masked = 1;
+    emu->irq_sent = 1;
+}
+
+// Raise the interrupt; like the UIO driver, interrupts raised while masked are merged into one
+static void irq_raise(struct tdc_emu *emu)
+{
+    emu->irq_count++;
+    emu->irq_sent = 0;
+    emu->ps_done = 0;
+    if (emu->masked)
+        emu->pending = 1;
+    else
+        irq_send(emu);
+}
+
+// Apply the unmask writes of the PS, noting when the last one was sent
+static void irq_poll_unmask(struct tdc_emu *emu, uint64_t now)
+{
+    uint32_t info;
+    union {
+        char buf[CMSG_SPACE(sizeof(struct timespec))];
+        struct cmsghdr align;
+    } ctl;
+    struct iovec iov = { &info, sizeof(info) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    while (1) {
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = sizeof(ctl.buf);
+        if (recvmsg(emu->irq_fd[1], &msg, MSG_DONTWAIT) != (ssize_t)sizeof(info))
+            break;
+        // SO_TIMESTAMPNS is CLOCK_REALTIME: the age of the message gives its monotonic time
+        emu->t_unmask = now;
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        if (c != NULL && c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts, real;
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            clock_gettime(CLOCK_REALTIME, &real);
+            int64_t age = (int64_t)(real.tv_sec - ts.tv_sec) * 1000000000ll + (real.tv_nsec - ts.tv_nsec);
+            if (age > 0 && (uint64_t)age < now - emu->t_irq)
+                emu->t_unmask = now - (uint64_t)age;
+        }
+        if (emu->irq_sent)
+            emu->ps_done = 1;
+        emu->masked = 0;
+        if (emu->pending) {
+            emu->pending = 0;
+            irq_send(emu);
+        }
+    }
+}
+
+// A trigger arrived at time t: hand the bank being written off if the firmware would
+static void emu_trigger(struct tdc_emu *emu, uint64_t t)
+{
+    int accept;
+
+    emu_hits(emu, t);
+    // Banks read out already were still held at t if their readout took longer
+    unsigned queued = emu->n_queued;
+    for (unsigned b = 0; b < emu->n_banks; b++)
+        queued += emu->bank_free[b] > t;
+    if (emu->cfg.banks > 0)
+        accept = queued < emu->n_banks - 1;
+    else    // s_idle and rd_busy low
+        accept = emu->state == S_IDLE && queued == 0 && *emu->rdbusy == 0;
+
+    pthread_mutex_lock(&emu->lock);
+    emu->stats.triggers++;
+    if (accept) {
+        emu->stats.accepted++;
+        emu->stats.overflows += emu->wr_ovf;
+    } else {
+        emu->stats.missed++;
+    }
+    pthread_mutex_unlock(&emu->lock);
+    if (!accept) {
+        emu->missed_count++;
+        return;
+    }
+
+    unsigned b = emu->wr_bank;
+    emu->bank_hits[b]   = emu->wr_ovf ? BANK_WORDS : emu->wr_addr;
+    emu->bank_status[b] = emu->bank_hits[b] | (emu->wr_ovf ? STATUS_OVERFLOW : 0);
+    emu->bank_missed[b] = emu->missed_count;
+    emu->bank_t[b]      = t;
+    emu->bank_free[b]   = 0;
+    emu->wr_bank = (b + 1) % emu->n_banks;
+    emu->wr_addr = 0;
+    emu->wr_ovf  = 0;
+    emu->n_queued++;
+    if (emu->cfg.banks == 0)
+        emu->sel[GPIO_DATA] = (emu->wr_bank == 0) ? 0x1 : 0x2;
+}
+
+// One pass of the readout handshake FSM
+static void emu_handshake(struct tdc_emu *emu, uint64_t now)
+{
+    uint32_t busy = *emu->rdbusy & 0x1;
+
+    switch (emu->state) {
+    case S_IDLE:
+        if (emu->n_queued == 0)
+            break;
+        // Export the oldest queued bank, record it, then interrupt
+        unsigned b = emu->rd_bank;
+        if (emu->cfg.banks > 0)
+            emu->sel[GPIO_DATA] = (emu->n_queued << 4) | b;
+        emu->sel[GPIO2_DATA]    = emu->bank_status[b];
+        emu->rdbusy[GPIO2_DATA] = emu->bank_missed[b];
+        struct emu_trigger *r = &emu->ring[(emu->irq_count + 1) % TDC_EMU_RING];
+        atomic_store_explicit(&r->count, 0, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        atomic_store_explicit(&r->t_ns, emu->bank_t[b], memory_order_relaxed);
+        atomic_store_explicit(&r->n_hits, emu->bank_hits[b], memory_order_relaxed);
+        atomic_store_explicit(&r->count, emu->irq_count + 1, memory_order_release);
+        emu->t_irq = now;
+        emu->state = S_TRIGD;
+        irq_raise(emu);
+        break;
+    case S_TRIGD:
+    case S_BUSY:
+        if (busy) {
+            emu->state = S_BUSY;
+            break;
+        }
+        // The PL samples rd_busy every clock cycle and never misses the pulse. The emulator can
+        // be descheduled while the PS raises and lowers it, so an unmask after the interrupt was
+        // delivered also counts as the end of the readout (tdc_readout unmasks only after it).
+        if (emu->state == S_BUSY || emu->ps_done) {
+            // rd_busy fell before the PS unmasked, if it already did, and before now anyway.
+            // The PL would have interrupted at the trigger, not when the emulator got to it.
+            uint64_t t_end = emu->ps_done ? emu->t_unmask : now;
+            emu->bank_free[emu->rd_bank] = emu->bank_t[emu->rd_bank] + (t_end - emu->t_irq);
+            pthread_mutex_lock(&emu->lock);
+            emu->stats.readouts++;
+            tdc_emu_hist_add(&emu->stats.handshake, t_end - emu->t_irq);
+            pthread_mutex_unlock(&emu->lock);
+            emu->rd_bank = (emu->rd_bank + 1) % emu->n_banks;
+            emu->n_queued--;
+            emu->state = S_IDLE;
+        }
+        break;
+    }
+}
+
+static void *emu_thread(void *arg)
+{
+    struct tdc_emu *emu = arg;
+
+    if (emu->cfg.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(emu->cfg.cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            fprintf(stderr, "Failed to pin the emulator thread to CPU %d\n", emu->cfg.cpu);
+    }
+    emu->t0 = now_ns();
+    emu->next_trig = emu->t0 + exp_ns(&emu->rng, emu->cfg.trigger_rate);
+    emu->next_hit  = emu->t0 + exp_ns(&emu->rng, emu->cfg.hit_rate);
+
+    while (!atomic_load_explicit(&emu->stop, memory_order_relaxed)) {
+        uint64_t now = now_ns();
+        // A trigger can only be judged once every readout that may still have held a bank at
+        // its time is over: the emulator runs late, the PL does not
+        irq_poll_unmask(emu, now);
+        emu_handshake(emu, now);
+        while (emu->next_trig <= now && emu->n_queued < emu->n_banks - 1) {
+            emu_trigger(emu, emu->next_trig);
+            emu->next_trig += exp_ns(&emu->rng, emu->cfg.trigger_rate);
+        }
+        emu_handshake(emu, now);
+
+        // Poll while a readout is going on, otherwise sleep until the next trigger
+        uint64_t wait = emu->next_trig - now;
+        if (emu->state != S_IDLE || emu->n_queued > 0 || wait < SPIN_NS) {
+            sched_yield();
+        } else {
+            if (wait > IDLE_SLEEP_NS)
+                wait = IDLE_SLEEP_NS;
+            struct timespec ts = { (time_t)(wait / 1000000000ull), (long)(wait % 1000000000ull) };
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+// memfd region of len bytes, mapped here and handed out as UIO device n
+static int emu_region(struct tdc_emu *emu, unsigned n, size_t len, int *fd, void **p)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "tdc_emu_uio%u", n);
+    *fd = memfd_create(name, MFD_CLOEXEC);
+    if (*fd < 0) {
+        perror("memfd_create");
+        return -1;
+    }
+    if (ftruncate(*fd, len) < 0) {
+        perror("ftruncate");
+        return -1;
+    }
+    *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if (*p == MAP_FAILED) {
+        *p = NULL;
+        perror("mmap");
+        return -1;
+    }
+    emu->dev_fd[n] = *fd;
+    return 0;
+}
+
+struct tdc_emu *tdc_emu_create(const struct tdc_emu_config *cfg)
+{
+    struct tdc_emu *emu;
+
+    if (cfg->banks == 1 || cfg->banks > MAX_BANKS) {
+        fprintf(stderr, "tdc_emu: the N bank firmware has 2 to %d banks\n", MAX_BANKS);
+        return NULL;
+    }
+    emu = calloc(1, sizeof(*emu));
+    if (emu == NULL)
+        return NULL;
+    emu->cfg = *cfg;
+    emu->n_banks = (cfg->banks > 0) ? cfg->banks : 2;
+    emu->rng = cfg->seed ? cfg->seed : 0x9e3779b97f4a7c15ull;
+    emu->mem_fd[0] = emu->mem_fd[1] = emu->mem_fd[2] = emu->bram2_fd = -1;
+    emu->irq_fd[0] = emu->irq_fd[1] = -1;
+    for (unsigned i = 0; i < TDC_READOUT_DEVS; i++)
+        emu->dev_fd[i] = -1;
+    pthread_mutex_init(&emu->lock, NULL);
+
+    int one = 1;
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, emu->irq_fd) < 0 ||
+        setsockopt(emu->irq_fd[1], SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) < 0) {
+        perror("socketpair");
+        goto fail;
+    }
+    emu->dev_fd[0] = emu->irq_fd[0];
+
+    if (cfg->banks > 0) {
+        if (emu_region(emu, 1, (size_t)cfg->banks * BANK_LEN, &emu->mem_fd[0], &emu->mem[0]) < 0 ||
+            emu_region(emu, 2, GPIO_LEN, &emu->mem_fd[1], &emu->mem[1]) < 0 ||
+            emu_region(emu, 3, GPIO_LEN, &emu->mem_fd[2], &emu->mem[2]) < 0)
+            goto fail;
+        emu->mem_len[0] = (size_t)cfg->banks * BANK_LEN;
+        for (unsigned b = 0; b < cfg->banks; b++)
+            emu->bank[b] = (volatile uint64_t *)emu->mem[0] + (size_t)b * BANK_WORDS;
+    } else {
+        if (emu_region(emu, 1, BANK_LEN, &emu->mem_fd[0], &emu->mem[0]) < 0 ||
+            emu_region(emu, 2, BANK_LEN, &emu->bram2_fd, &emu->bram2) < 0 ||
+            emu_region(emu, 3, GPIO_LEN, &emu->mem_fd[1], &emu->mem[1]) < 0 ||
+            emu_region(emu, 4, GPIO_LEN, &emu->mem_fd[2], &emu->mem[2]) < 0)
+            goto fail;
+        emu->mem_len[0] = BANK_LEN;
+        emu->bank[0] = emu->mem[0];
+        emu->bank[1] = emu->bram2;
+    }
+    emu->mem_len[1] = emu->mem_len[2] = GPIO_LEN;
+    emu->rdbusy = emu->mem[1];
+    emu->sel    = emu->mem[2];
+    if (cfg->banks == 0)
+        emu->sel[GPIO_DATA] = 0x1;  // Writing to BRAM 1
+    return emu;
+
+fail:
+    tdc_emu_destroy(emu);
+    return NULL;
+}
+
+const int *tdc_emu_fds(const struct tdc_emu *emu)
+{
+    return emu->dev_fd;
+}
+
+int tdc_emu_start(struct tdc_emu *emu)
+{
+    atomic_store(&emu->stop, 0);
+    if (pthread_create(&emu->thread, NULL, emu_thread, emu) != 0) {
+        perror("Failed to start the emulator thread");
+        return -1;
+    }
+    emu->running = 1;
+    return 0;
+}
+
+void tdc_emu_stop(struct tdc_emu *emu)
+{
+    if (!emu->running)
+        return;
+    atomic_store(&emu->stop, 1);
+    pthread_join(emu->thread, NULL);
+    emu->running = 0;
+}
+
+void tdc_emu_destroy(struct tdc_emu *emu)
+{
+    if (emu == NULL)
+        return;
+    tdc_emu_stop(emu);
+    for (int i = 0; i < 3; i++) {
+        if (emu->mem[i] != NULL)
+            munmap(emu->mem[i], emu->mem_len[i]);
+        if (emu->mem_fd[i] >= 0)
+            close(emu->mem_fd[i]);
+    }
+    if (emu->bram2 != NULL)
+        munmap(emu->bram2, BANK_LEN);
+    if (emu->bram2_fd >= 0)
+        close(emu->bram2_fd);
+    for (int i = 0; i < 2; i++)
+        if (emu->irq_fd[i] >= 0)
+            close(emu->irq_fd[i]);
+    pthread_mutex_destroy(&emu->lock);
+    free(emu);
+}
+
+void tdc_emu_get_stats(struct tdc_emu *emu, struct tdc_emu_stats *s)
+{
+    pthread_mutex_lock(&emu->lock);
+    *s = emu->stats;
+    pthread_mutex_unlock(&emu->lock);
+}
+
+int tdc_emu_trigger_info(struct tdc_emu *emu, uint32_t count, uint64_t *t_ns, uint32_t *n_hits)
+{
+    struct emu_trigger *r = &emu->ring[count % TDC_EMU_RING];
+    if (count == 0 || atomic_load_explicit(&r->count, memory_order_acquire) != count)
+        return -1;
+    *t_ns   = atomic_load_explicit(&r->t_ns, memory_order_relaxed);
+    *n_hits = atomic_load_explicit(&r->n_hits, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    return (atomic_load_explicit(&r->count, memory_order_relaxed) == count) ? 0 : -1;
+}
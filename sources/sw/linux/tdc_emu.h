@@ -0,0 +1,97 @@
+/*
+* Software stand-in for the PL side of the 2 BRAM and N bank TDC firmware
+*
+* Lets the readout library (tdc_readout.h), and the daemon built on it, run on any Linux host
+* without a Kria board or a bitstream. The emulator provides the UIO devices tdc_readout opens:
+*
+*   - the BRAMs (or the banked BRAM) and both AXI GPIOs are memfd regions, mapped by the
+*     readout exactly like the real devices
+*   - the interrupt is one end of a SOCK_SEQPACKET socket pair: reading it returns the
+*     interrupt count, writing it unmasks the interrupt, with the same semantics as the UIO
+*     driver (interrupts raised while masked are merged into one)
+*
+* and hands their descriptors to the readout through struct tdc_readout_config::dev_fds
+* (tdc_emu_fds()), indexed by the /dev/uioN numbers tdc_readout uses, so the readout code under
+* test is exactly the code that runs on the board. Nothing is registered globally: only a
+* readout created with these descriptors talks to the emulator.
+*
+* A thread plays the role of p_handle_BRAM_rw: triggers arrive as a Poisson process at
+* trigger_rate, and hits at hit_rate into the BRAM or bank being written. Every trigger is
+* accepted or counted as missed by the same rules as the firmware, and every accepted trigger
+* goes through the interrupt / rd_busy handshake. Hits are generated lazily when a bank is
+* handed off, so the emulator only needs CPU time around triggers.
+*
+* The emulator thread only runs when the host schedules it, so it sees triggers and the PS
+* lowering rd_busy late, while the PL would have interrupted at the trigger and seen rd_busy fall
+* at once. So that this does not count as dead time, a readout ends at the kernel timestamp of
+* the unmask the PS sends right after lowering rd_busy, and holds its bank from its trigger for
+* as long as it took the PS; a trigger is only judged once every readout that may have held a
+* bank at its time is over, and missed only if it arrived while a readout was really going on (2
+* BRAM firmware), or while every other bank was (N bank firmware). The time between raising the
+* interrupt and the end of the readout (the dead time each readout costs the PL) is
+* histogrammed, and the trigger time and hit count of every accepted trigger are kept for the last TDC_EMU_RING triggers so that a consumer can check the events
+* it receives and measure their latency.
+*/
+#ifndef TDC_EMU_H
+#define TDC_EMU_H
+
+#include <stdint.h>
+
+// Triggers whose time and hit count are kept (indexed by interrupt count)
+#define TDC_EMU_RING        65536
+
+// Log-linear latency histogram: 16 bins per power of two, ~6% resolution up to hours
+#define TDC_EMU_HIST_BINS   640
+
+struct tdc_emu_hist {
+    uint64_t n;
+    uint64_t max_ns;
+    uint64_t bins[TDC_EMU_HIST_BINS];
+};
+
+struct tdc_emu_config {
+    unsigned banks;         // 0 => 2 BRAM firmware, else N bank firmware (as tdc_readout_config::banks)
+    double trigger_rate;    // Mean trigger rate (Hz)
+    double hit_rate;        // Mean hit rate of all 64 channels together (Hz)
+    int cpu;                // Core for the emulator thread, -1 => not pinned
+    uint64_t seed;          // Random seed, 0 => fixed default
+};
+
+struct tdc_emu_stats {
+    uint64_t triggers;      // Triggers generated
+    uint64_t accepted;      // Triggers accepted (one interrupt each)
+    uint64_t missed;        // Triggers missed by the emulated PL
+    uint64_t readouts;      // Completed rd_busy handshakes
+    uint64_t hits;          // Hits written
+    uint64_t overflows;     // Banks that wrapped around before they were handed off
+    struct tdc_emu_hist handshake;  // Interrupt -> rd_busy low
+};
+
+struct tdc_emu;
+
+// Create the devices. Returns NULL on error.
+struct tdc_emu *tdc_emu_create(const struct tdc_emu_config *cfg);
+
+// Descriptors of the devices indexed by UIO number, for tdc_readout_config::dev_fds; valid until
+// tdc_emu_destroy(), the readout maps duplicates of them
+const int *tdc_emu_fds(const struct tdc_emu *emu);
+
+// Start / stop the PL thread. Returns 0, or -1 on error.
+int tdc_emu_start(struct tdc_emu *emu);
+void tdc_emu_stop(struct tdc_emu *emu);
+
+// Release the devices (stops the thread if needed)
+void tdc_emu_destroy(struct tdc_emu *emu);
+
+// Snapshot of the counters
+void tdc_emu_get_stats(struct tdc_emu *emu, struct tdc_emu_stats *s);
+
+// CLOCK_MONOTONIC time (ns) and number of hits handed to the PS of the trigger that raised
+// interrupt number count. Returns 0, or -1 if it is no longer (or not yet) in the ring.
+int tdc_emu_trigger_info(struct tdc_emu *emu, uint32_t count, uint64_t *t_ns, uint32_t *n_hits);
+
+// Histogram helpers
+void tdc_emu_hist_add(struct tdc_emu_hist *h, uint64_t ns);
+uint64_t tdc_emu_hist_percentile(const struct tdc_emu_hist *h, double p);
+
+#endif
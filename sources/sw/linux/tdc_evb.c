@@ -0,0 +1,529 @@
+/*
+* Event builder: merges the frame streams of several board daemons (see tdc_evb.h)
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "tdc_evb.h"
+#include "tdc_spsc.h"
+
+// Largest frame header read (header_len may grow in later frame versions)
+#define MAX_HEADER_LEN  256
+
+// One received frame
+struct fragment {
+    uint64_t seq;           // Trigger number relative to the first frame of the board
+    uint32_t len;           // Bytes of buf used: frame header + payload
+    size_t cap;
+    uint8_t *buf;
+};
+
+// A thread that sleeps until another thread has queued something for it. The waker only makes
+// the eventfd syscall if the sleeper announced itself, so a busy pipeline makes none.
+struct waiter {
+    atomic_int sleeping;
+    int efd;
+};
+
+struct source {
+    struct tdc_evb *evb;
+    unsigned id;
+    int fd;
+
+    struct fragment *pool;
+    void **full_slots, **free_slots;
+    struct tdc_spsc full;           // receiver -> merge thread
+    struct tdc_spsc free;           // merge thread -> receiver
+    struct waiter free_wait;        // Receiver waiting for a free buffer
+    atomic_int done;                // Receiver has exited, nothing more will be queued
+    pthread_t thread;
+
+    // Receiver only
+    uint32_t last_raw;              // trigger + missed_trigs of the previous frame
+    uint64_t seq;
+    int have_raw;
+
+    // Merge thread only
+    struct fragment *head;          // Oldest queued fragment, taken off the queue
+    int stalled;                    // Timed out with nothing queued, not waited for until it sends again
+
+    // Counters, written by one thread each
+    _Atomic uint64_t fragments, bytes, missing, late;
+    _Atomic uint32_t queue_high_water;
+};
+
+struct tdc_evb {
+    struct tdc_evb_config cfg;
+    struct source *src;
+    struct waiter merge_wait;       // Merge thread waiting for fragments
+    atomic_int stop;
+    atomic_uint n_done;             // Receivers that have exited
+    pthread_t merge_thread;
+    int running;
+
+    _Atomic uint64_t events, incomplete, timeouts, write_errors;
+
+    // Merge thread only
+    struct tdc_evb_event ev;
+    struct fragment *in_event[TDC_EVB_MAX_SOURCES];
+    unsigned done_seen;             // n_done when the queues were last looked at
+};
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void waiter_wake(struct waiter *w)
+{
+    uint64_t one = 1;
+    // Pairs with the fence in waiter_sleep(): either the sleeper sees what was queued before
+    // this, or this sees the sleeper's flag
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&w->sleeping, memory_order_relaxed) && atomic_exchange(&w->sleeping, 0))
+        if (write(w->efd, &one, sizeof(one)) != (ssize_t)sizeof(one))
+            perror("tdc_evb: eventfd");
+}
+
+// Sleep until woken or timeout_ns (0 => no timeout) has passed, unless ready() is already true
+static void waiter_sleep(struct waiter *w, int (*ready)(void *), void *arg, uint64_t timeout_ns)
+{
+    struct pollfd pfd = { .fd = w->efd, .events = POLLIN };
+    struct timespec ts = { (time_t)(timeout_ns / 1000000000ull), (long)(timeout_ns % 1000000000ull) };
+    uint64_t n;
+
+    atomic_store(&w->sleeping, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!ready(arg) && ppoll(&pfd, 1, timeout_ns ? &ts : NULL, NULL) > 0)
+        if (read(w->efd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+            perror("tdc_evb: eventfd");
+    atomic_store(&w->sleeping, 0);
+}
+
+// Read exactly len bytes. Returns 0, or -1 if the connection was closed or failed.
+static int read_full(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, MSG_WAITALL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n < 0)
+                perror("tdc_evb: recv");
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Read the next frame of src into f. Returns 0, or -1 at the end of the stream.
+static int read_frame(struct source *src, struct fragment *f)
+{
+    uint8_t hbuf[MAX_HEADER_LEN];
+    struct tdc_frame_header *hdr = (struct tdc_frame_header *)hbuf;
+
+    // Version 1 part of the header first, then whatever extension the sender declared
+    memset(hbuf, 0, sizeof(struct tdc_frame_header));
+    if (read_full(src->fd, hbuf, TDC_FRAME_HEADER_V1_LEN) < 0)
+        return -1;
+    if (tdc_frame_check(hdr) < 0 || hdr->header_len > sizeof(hbuf)) {
+        fprintf(stderr, "tdc_evb: bad frame header from board %u, closing its stream\n", src->id);
+        return -1;
+    }
+    if (hdr->header_len > TDC_FRAME_HEADER_V1_LEN &&
+        read_full(src->fd, hbuf + TDC_FRAME_HEADER_V1_LEN, hdr->header_len - TDC_FRAME_HEADER_V1_LEN) < 0)
+        return -1;
+
+    size_t len = hdr->header_len + tdc_frame_payload_len(hdr);
+    if (len > f->cap) {
+        uint8_t *buf = realloc(f->buf, len);
+        if (buf == NULL) {
+            fprintf(stderr, "tdc_evb: out of memory for a %zu byte frame from board %u\n", len, src->id);
+            return -1;
+        }
+        f->buf = buf;
+        f->cap = len;
+    }
+    memcpy(f->buf, hbuf, hdr->header_len);
+    if (read_full(src->fd, f->buf + hdr->header_len, len - hdr->header_len) < 0)
+        return -1;
+    f->len = (uint32_t)len;
+
+    // Every trigger the board received is counted either by the PS or by the PL
+    uint32_t raw = hdr->trigger + hdr->missed_trigs;
+    if (src->have_raw)
+        src->seq += (uint32_t)(raw - src->last_raw);
+    src->last_raw = raw;
+    src->have_raw = 1;
+    f->seq = src->seq;
+    return 0;
+}
+
+static int free_ready(void *arg)
+{
+    struct source *src = arg;
+    return tdc_spsc_count(&src->free) > 0 || atomic_load(&src->evb->stop);
+}
+
+static void *receiver_thread(void *arg)
+{
+    struct source *src = arg;
+    struct tdc_evb *evb = src->evb;
+    struct fragment *f = NULL;
+
+    while (!atomic_load(&evb->stop)) {
+        if (f == NULL && (f = tdc_spsc_pop(&src->free)) == NULL) {
+            // Every buffer is queued: stop reading, TCP pushes back on the daemon
+            waiter_sleep(&src->free_wait, free_ready, src, 0);
+            continue;
+        }
+        if (read_frame(src, f) < 0)
+            break;
+        uint32_t len = f->len;
+        // Cannot fail: the queue holds as many entries as there are buffers
+        tdc_spsc_push(&src->full, f);
+        f = NULL;
+        uint32_t depth = tdc_spsc_count(&src->full);
+        if (depth > atomic_load_explicit(&src->queue_high_water, memory_order_relaxed))
+            atomic_store_explicit(&src->queue_high_water, depth, memory_order_relaxed);
+        atomic_fetch_add_explicit(&src->fragments, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&src->bytes, len, memory_order_relaxed);
+        waiter_wake(&evb->merge_wait);
+    }
+    // A buffer still held here is simply not returned, the pool is freed as a whole
+    atomic_store(&src->done, 1);
+    atomic_fetch_add(&evb->n_done, 1);
+    waiter_wake(&evb->merge_wait);
+    return NULL;
+}
+
+static void release(struct source *src, struct fragment *f)
+{
+    // Cannot fail: the queue holds as many entries as there are buffers
+    tdc_spsc_push(&src->free, f);
+    waiter_wake(&src->free_wait);
+}
+
+static int fragments_ready(void *arg)
+{
+    struct tdc_evb *evb = arg;
+    for (unsigned s = 0; s < evb->cfg.n_sources; s++)
+        if (tdc_spsc_count(&evb->src[s].full) > 0)
+            return 1;
+    return atomic_load(&evb->n_done) != evb->done_seen;
+}
+
+// Hand the event of trigger seq, made of the fragments at the heads of the queues, to the
+// write callback and return the fragments to their boards
+static void build(struct tdc_evb *evb, uint64_t seq, int timed_out)
+{
+    struct tdc_evb_event *ev = &evb->ev;
+    unsigned n = 0;
+    uint64_t ts_min = UINT64_MAX;
+
+    memset(&ev->hdr, 0, sizeof(ev->hdr));
+    ev->hdr.magic      = TDC_EVB_MAGIC;
+    ev->hdr.version    = TDC_EVB_VERSION;
+    ev->hdr.header_len = sizeof(ev->hdr);
+    ev->hdr.seq        = seq;
+    ev->hdr.n_sources  = evb->cfg.n_sources;
+    for (unsigned s = 0; s < evb->cfg.n_sources; s++) {
+        struct source *src = &evb->src[s];
+        if (src->head == NULL || src->head->seq != seq) {
+            atomic_fetch_add_explicit(&src->missing, 1, memory_order_relaxed);
+            continue;
+        }
+        struct fragment *f = src->head;
+        uint64_t ts;
+        memcpy(&ts, f->buf + offsetof(struct tdc_frame_header, timestamp_ns), sizeof(ts));
+        if (ts < ts_min)
+            ts_min = ts;
+        ev->frag[n].source   = (uint16_t)s;
+        ev->frag[n].reserved = 0;
+        ev->frag[n].len      = f->len;
+        ev->data[n]          = f->buf;
+        ev->hdr.present     |= 1ull << s;
+        ev->hdr.total_len   += sizeof(struct tdc_evb_fragment) + f->len;
+        evb->in_event[n++]   = f;
+        src->head = NULL;
+    }
+    ev->hdr.n_fragments  = (uint16_t)n;
+    ev->hdr.timestamp_ns = ts_min;
+    if (n < evb->cfg.n_sources) {
+        ev->hdr.flags |= TDC_EVB_FLAG_INCOMPLETE;
+        atomic_fetch_add_explicit(&evb->incomplete, 1, memory_order_relaxed);
+    }
+    if (timed_out)
+        atomic_fetch_add_explicit(&evb->timeouts, 1, memory_order_relaxed);
+
+    if (evb->cfg.write(evb->cfg.write_ctx, ev) < 0)
+        atomic_fetch_add_explicit(&evb->write_errors, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&evb->events, 1, memory_order_relaxed);
+
+    for (unsigned i = 0; i < n; i++)
+        release(&evb->src[ev->frag[i].source], evb->in_event[i]);
+}
+
+/*
+* Build the events in trigger order. Each pass looks at the oldest fragment of every board:
+*   - fragments older than the trigger being built (next) arrived too late and are dropped
+*   - if a board has nothing queued and is still connected, wait for it (up to timeout_ns)
+*   - otherwise build next from the boards whose oldest fragment is next; the others have no
+*     fragment for it, since every board sends in trigger order
+*   - a trigger no board has a fragment for is skipped
+*/
+static void *merge_thread(void *arg)
+{
+    struct tdc_evb *evb = arg;
+    uint64_t next = 0, wait_start = 0;
+    int have_next = 0;
+
+    while (1) {
+        unsigned n_have = 0, n_waiting = 0, n_queued = 0;
+        uint64_t min_seq = UINT64_MAX;
+
+        evb->done_seen = atomic_load(&evb->n_done);
+
+        for (unsigned s = 0; s < evb->cfg.n_sources; s++) {
+            struct source *src = &evb->src[s];
+            if (src->head == NULL) {
+                // done is set after the last push, so look at the queue once more after it
+                int done = atomic_load(&src->done);
+                src->head = tdc_spsc_pop(&src->full);
+                if (src->head == NULL) {
+                    if (!done && !src->stalled)
+                        n_waiting++;
+                    continue;
+                }
+            }
+            src->stalled = 0;
+            while (have_next && src->head != NULL && src->head->seq < next) {
+                atomic_fetch_add_explicit(&src->late, 1, memory_order_relaxed);
+                release(src, src->head);
+                src->head = tdc_spsc_pop(&src->full);
+            }
+            if (src->head == NULL) {
+                if (!atomic_load(&src->done))
+                    n_waiting++;
+                continue;
+            }
+            n_queued++;
+            if (src->head->seq < min_seq)
+                min_seq = src->head->seq;
+            if (have_next && src->head->seq == next)
+                n_have++;
+        }
+
+        if (n_queued == 0) {
+            int open = 0;
+            for (unsigned s = 0; s < evb->cfg.n_sources; s++)
+                open |= !atomic_load(&evb->src[s].done) || tdc_spsc_count(&evb->src[s].full) > 0;
+            if (!open)
+                break;
+            wait_start = 0;
+            waiter_sleep(&evb->merge_wait, fragments_ready, evb, 0);
+            continue;
+        }
+        if (!have_next || (n_have == 0 && n_waiting == 0)) {
+            // Start with, or skip ahead to, the oldest trigger any board has a fragment of
+            next = min_seq;
+            have_next = 1;
+            continue;
+        }
+
+        int timed_out = 0;
+        if (n_waiting > 0) {
+            uint64_t t = now_ns();
+            if (wait_start == 0)
+                wait_start = t;
+            if (t - wait_start < evb->cfg.timeout_ns) {
+                waiter_sleep(&evb->merge_wait, fragments_ready, evb, evb->cfg.timeout_ns - (t - wait_start));
+                continue;
+            }
+            // Do not wait for these boards again until they send something
+            for (unsigned s = 0; s < evb->cfg.n_sources; s++)
+                if (evb->src[s].head == NULL && !atomic_load(&evb->src[s].done))
+                    evb->src[s].stalled = 1;
+            timed_out = 1;
+        }
+        wait_start = 0;
+        if (n_have > 0)
+            build(evb, next, timed_out);
+        next++;
+    }
+    return NULL;
+}
+
+struct tdc_evb *tdc_evb_create(const struct tdc_evb_config *cfg)
+{
+    struct tdc_evb *evb;
+    unsigned n = cfg->queue_depth;
+
+    if (cfg->n_sources == 0 || cfg->n_sources > TDC_EVB_MAX_SOURCES) {
+        fprintf(stderr, "tdc_evb: 1 to %d boards\n", TDC_EVB_MAX_SOURCES);
+        return NULL;
+    }
+    if (n == 0 || (n & (n - 1)) != 0) {
+        fprintf(stderr, "tdc_evb: queue depth must be a power of two\n");
+        return NULL;
+    }
+    if (cfg->write == NULL) {
+        fprintf(stderr, "tdc_evb: no write callback\n");
+        return NULL;
+    }
+    evb = calloc(1, sizeof(*evb));
+    if (evb == NULL)
+        return NULL;
+    evb->cfg = *cfg;
+    evb->merge_wait.efd = eventfd(0, EFD_NONBLOCK);
+    if (posix_memalign((void **)&evb->src, TDC_CACHE_LINE, cfg->n_sources * sizeof(struct source)) != 0) {
+        evb->src = NULL;
+        goto fail;
+    }
+    memset(evb->src, 0, cfg->n_sources * sizeof(struct source));
+    for (unsigned s = 0; s < cfg->n_sources; s++)
+        evb->src[s].free_wait.efd = -1;
+    if (evb->merge_wait.efd < 0) {
+        perror("eventfd");
+        goto fail;
+    }
+
+    for (unsigned s = 0; s < cfg->n_sources; s++) {
+        struct source *src = &evb->src[s];
+        src->evb = evb;
+        src->id = s;
+        src->fd = cfg->fds[s];
+        src->free_wait.efd = eventfd(0, EFD_NONBLOCK);
+        src->pool = calloc(n, sizeof(struct fragment));
+        src->full_slots = calloc(n, sizeof(void *));
+        src->free_slots = calloc(n, sizeof(void *));
+        if (src->free_wait.efd < 0 || src->pool == NULL || src->full_slots == NULL || src->free_slots == NULL)
+            goto fail;
+        tdc_spsc_init(&src->full, src->full_slots, n);
+        tdc_spsc_init(&src->free, src->free_slots, n);
+        for (unsigned i = 0; i < n; i++)
+            tdc_spsc_push(&src->free, &src->pool[i]);
+    }
+    return evb;
+
+fail:
+    fprintf(stderr, "tdc_evb: failed to allocate the fragment buffers\n");
+    tdc_evb_destroy(evb);
+    return NULL;
+}
+
+int tdc_evb_start(struct tdc_evb *evb)
+{
+    unsigned started = 0;
+
+    atomic_store(&evb->stop, 0);
+    for (; started < evb->cfg.n_sources; started++) {
+        if (pthread_create(&evb->src[started].thread, NULL, receiver_thread, &evb->src[started]) != 0) {
+            perror("Failed to start a receiver thread");
+            break;
+        }
+    }
+    if (started == evb->cfg.n_sources && pthread_create(&evb->merge_thread, NULL, merge_thread, evb) == 0) {
+        evb->running = 1;
+        return 0;
+    }
+    if (started == evb->cfg.n_sources)
+        perror("Failed to start the merge thread");
+    atomic_store(&evb->stop, 1);
+    for (unsigned s = 0; s < started; s++) {
+        shutdown(evb->src[s].fd, SHUT_RD);
+        waiter_wake(&evb->src[s].free_wait);
+        pthread_join(evb->src[s].thread, NULL);
+    }
+    return -1;
+}
+
+void tdc_evb_wait(struct tdc_evb *evb)
+{
+    if (!evb->running)
+        return;
+    for (unsigned s = 0; s < evb->cfg.n_sources; s++)
+        pthread_join(evb->src[s].thread, NULL);
+    pthread_join(evb->merge_thread, NULL);
+    evb->running = 0;
+}
+
+void tdc_evb_stop(struct tdc_evb *evb)
+{
+    if (!evb->running)
+        return;
+    atomic_store(&evb->stop, 1);
+    for (unsigned s = 0; s < evb->cfg.n_sources; s++) {
+        // Unblocks a receiver waiting in recv()
+        shutdown(evb->src[s].fd, SHUT_RD);
+        waiter_wake(&evb->src[s].free_wait);
+    }
+    tdc_evb_wait(evb);
+}
+
+void tdc_evb_get_stats(struct tdc_evb *evb, struct tdc_evb_stats *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->events       = atomic_load_explicit(&evb->events, memory_order_relaxed);
+    s->incomplete   = atomic_load_explicit(&evb->incomplete, memory_order_relaxed);
+    s->timeouts     = atomic_load_explicit(&evb->timeouts, memory_order_relaxed);
+    s->write_errors = atomic_load_explicit(&evb->write_errors, memory_order_relaxed);
+    for (unsigned i = 0; i < evb->cfg.n_sources; i++) {
+        struct source *src = &evb->src[i];
+        s->fragments[i]        = atomic_load_explicit(&src->fragments, memory_order_relaxed);
+        s->missing[i]          = atomic_load_explicit(&src->missing, memory_order_relaxed);
+        s->late[i]             = atomic_load_explicit(&src->late, memory_order_relaxed);
+        s->queue_high_water[i] = atomic_load_explicit(&src->queue_high_water, memory_order_relaxed);
+        s->bytes              += atomic_load_explicit(&src->bytes, memory_order_relaxed);
+        s->sources_open       += !atomic_load(&src->done);
+    }
+}
+
+void tdc_evb_destroy(struct tdc_evb *evb)
+{
+    if (evb == NULL)
+        return;
+    tdc_evb_stop(evb);
+    for (unsigned s = 0; evb->src != NULL && s < evb->cfg.n_sources; s++) {
+        struct source *src = &evb->src[s];
+        for (unsigned i = 0; src->pool != NULL && i < evb->cfg.queue_depth; i++)
+            free(src->pool[i].buf);
+        free(src->pool);
+        free(src->full_slots);
+        free(src->free_slots);
+        if (src->free_wait.efd >= 0)
+            close(src->free_wait.efd);
+    }
+    free(evb->src);
+    if (evb->merge_wait.efd >= 0)
+        close(evb->merge_wait.efd);
+    free(evb);
+}
+
+int tdc_evb_fwrite(FILE *f, const struct tdc_evb_event *ev)
+{
+    if (fwrite(&ev->hdr, sizeof(ev->hdr), 1, f) != 1)
+        return -1;
+    for (unsigned i = 0; i < ev->hdr.n_fragments; i++) {
+        if (fwrite(&ev->frag[i], sizeof(ev->frag[i]), 1, f) != 1 ||
+            fwrite(ev->data[i], 1, ev->frag[i].len, f) != ev->frag[i].len)
+            return -1;
+    }
+    return 0;
+}
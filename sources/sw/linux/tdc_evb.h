@@ -0,0 +1,134 @@
+/*
+* Event builder: merges the frame streams of several board daemons into one event per trigger
+*
+* Every board runs its own daemon (daemon.c) and sends one frame (tdc_frame.h) per trigger over
+* its own TCP connection. The builder reads each connection on its own receiver thread, and a
+* single merge thread assembles the fragments of the same trigger from all boards into a built
+* event:
+*
+*   receiver thread (one per board): read a frame into a free fragment buffer of its board,
+*                                    number it, queue it for the merge thread
+*   merge thread:                    take the oldest fragment of every board, build the event of
+*                                    the lowest trigger number, hand it to the write callback,
+*                                    return the fragment buffers to their boards
+*
+* Fragments travel between each receiver and the merge thread through a pair of lock-free SPSC
+* queues (tdc_spsc.h), like the events of the readout library (tdc_readout.h): one of queued
+* fragments and one of free fragment buffers, so the number of fragments buffered per board is
+* bounded by queue_depth. A receiver with no free buffer stops reading its socket, which pushes
+* back on its daemon through TCP flow control rather than dropping data.
+*
+* Trigger numbers: the trigger field of a frame counts the interrupts seen by the board's PS,
+* and missed_trigs counts the triggers the PL missed while busy, so trigger + missed_trigs
+* counts every trigger the board received. The builder numbers the fragments of every board
+* with this count relative to the first frame of that board, so all daemons must be connected
+* before the first trigger of the run (their UIO interrupt counts start at different values).
+*
+* Since every board sends its frames in trigger order, a board whose oldest queued fragment
+* belongs to a later trigger has no fragment for the trigger being built, which is then built
+* without it right away. Only a board with no queued fragment at all is waited for, up to
+* timeout_ns after the first fragment of the trigger was available; after that the event is
+* built without it too. Fragments that arrive after their event was built are dropped and
+* counted as late. A board that closes its connection is no longer waited for.
+*
+* Built events are passed to the write callback as a header and the fragments, each being the
+* frame exactly as received (packed frames stay packed); tdc_evb_fwrite() writes them to a file
+* in the format below. All functions print what failed to stderr and return -1 on error.
+*
+* Built event file format (little endian), one record per event:
+*   struct tdc_evb_header
+*   n_fragments x { struct tdc_evb_fragment, frame (header_len + payload bytes) }
+*/
+#ifndef TDC_EVB_H
+#define TDC_EVB_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "tdc_frame.h"
+
+#define TDC_EVB_MAGIC       0x45434454u     // "TDCE" when read as bytes
+#define TDC_EVB_VERSION     1
+#define TDC_EVB_MAX_SOURCES 64
+
+// Built event flags
+#define TDC_EVB_FLAG_INCOMPLETE 0x0001      // At least one board has no fragment in the event
+
+struct tdc_evb_header {
+    uint32_t magic;         // TDC_EVB_MAGIC
+    uint16_t version;       // TDC_EVB_VERSION
+    uint16_t header_len;    // Size of this header in bytes
+    uint64_t seq;           // Trigger number, counted from the first trigger of the run
+    uint64_t present;       // Bit s set if board s sent a fragment for this trigger
+    uint64_t timestamp_ns;  // Earliest interrupt time of the fragments (CLOCK_REALTIME of its board)
+    uint16_t n_sources;     // Boards of the builder
+    uint16_t n_fragments;   // Fragments following
+    uint16_t flags;         // TDC_EVB_FLAG_*
+    uint16_t reserved;
+    uint32_t total_len;     // Bytes following this header
+    uint32_t reserved2;
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct tdc_evb_header) == 48, "tdc_evb_header must be 48 bytes");
+
+struct tdc_evb_fragment {
+    uint16_t source;        // Board index (order of the connections given to the builder)
+    uint16_t reserved;
+    uint32_t len;           // Bytes of the frame following
+} __attribute__((packed));
+
+// One event as passed to the write callback. frag[i] and data[i] describe fragment i.
+struct tdc_evb_event {
+    struct tdc_evb_header hdr;
+    struct tdc_evb_fragment frag[TDC_EVB_MAX_SOURCES];
+    const uint8_t *data[TDC_EVB_MAX_SOURCES];   // Frame as received: header, then payload
+};
+
+// Called by the merge thread for every built event. Return < 0 to report a failed write.
+typedef int (*tdc_evb_write_fn)(void *ctx, const struct tdc_evb_event *ev);
+
+struct tdc_evb_config {
+    unsigned n_sources;         // Boards, at most TDC_EVB_MAX_SOURCES
+    const int *fds;             // Connected socket of every board, read by the receiver threads
+    unsigned queue_depth;       // Fragment buffers per board, must be a power of two
+    uint64_t timeout_ns;        // Longest wait for the fragment of a board with nothing queued
+    tdc_evb_write_fn write;
+    void *write_ctx;
+};
+
+struct tdc_evb_stats {
+    uint64_t events;            // Events built
+    uint64_t incomplete;        // Events built without the fragment of at least one board
+    uint64_t timeouts;          // Events built after waiting timeout_ns for a board
+    uint64_t bytes;             // Frame bytes received
+    uint64_t write_errors;      // Write callback returned < 0
+    unsigned sources_open;      // Boards still connected
+    uint64_t fragments[TDC_EVB_MAX_SOURCES];    // Frames received from every board
+    uint64_t missing[TDC_EVB_MAX_SOURCES];      // Events built without every board
+    uint64_t late[TDC_EVB_MAX_SOURCES];         // Frames dropped because their event was already built
+    uint32_t queue_high_water[TDC_EVB_MAX_SOURCES];
+};
+
+struct tdc_evb;
+
+// Allocate the fragment buffers. The sockets are not read before tdc_evb_start().
+struct tdc_evb *tdc_evb_create(const struct tdc_evb_config *cfg);
+
+// Start the receiver and merge threads
+int tdc_evb_start(struct tdc_evb *evb);
+
+// Wait until every board has closed its connection and all of its fragments are built
+void tdc_evb_wait(struct tdc_evb *evb);
+
+// Stop reading the sockets, build what is queued and stop the threads
+void tdc_evb_stop(struct tdc_evb *evb);
+
+void tdc_evb_get_stats(struct tdc_evb *evb, struct tdc_evb_stats *s);
+
+// Stop the threads if running, free everything. Does not close the sockets.
+void tdc_evb_destroy(struct tdc_evb *evb);
+
+// Write a built event to f in the file format above
+int tdc_evb_fwrite(FILE *f, const struct tdc_evb_event *ev);
+
+#endif
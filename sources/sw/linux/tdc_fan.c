@@ -0,0 +1,603 @@
+/*
+* Event fan-out to local consumers through a shared memory ring (see tdc_fan.h)
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include "tdc_fan.h"
+
+static const char *const policy_names[] = { "drop", "throttle" };
+
+static inline uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Abstract socket address of name, returns its length
+static socklen_t fan_addr(struct sockaddr_un *a, const char *name)
+{
+    size_t n = strlen(name);
+    if (n > sizeof(a->sun_path) - 1)
+        n = sizeof(a->sun_path) - 1;
+    memset(a, 0, sizeof(*a));
+    a->sun_family = AF_UNIX;
+    memcpy(a->sun_path + 1, name, n);
+    return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + n);
+}
+
+// ------------------------------------------------------------------
+// Publisher
+// ------------------------------------------------------------------
+
+int tdc_fan_create(struct tdc_fan *f, const char *name, size_t size)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    struct sockaddr_un addr;
+    char path[64];
+
+    memset(f, 0, sizeof(*f));
+    f->listen_fd = f->memfd = f->ro_fd = -1;
+    for (unsigned i = 0; i < TDC_FAN_MAX_CONSUMERS; i++)
+        f->c[i].sock = f->c[i].evfd = f->c[i].curfd = -1;
+    snprintf(f->name, sizeof(f->name), "%s", name);
+    if (size == 0)
+        size = TDC_FAN_RING_SIZE;
+    size &= ~(size_t)(TDC_FAN_REC_ALIGN - 1);
+    if (size < (64u << 10)) {
+        fprintf(stderr, "Fan-out: the ring must hold at least 64 KB\n");
+        return -1;
+    }
+    f->map_len = (size_t)page + size;
+
+    f->memfd = memfd_create("tdc_fan", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (f->memfd < 0) {
+        fprintf(stderr, "Fan-out: failed to create the ring memfd: %m\n");
+        goto fail;
+    }
+    if (ftruncate(f->memfd, (off_t)f->map_len) < 0) {
+        fprintf(stderr, "Fan-out: failed to size the ring memfd: %m\n");
+        goto fail;
+    }
+    void *p = mmap(NULL, f->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, f->memfd, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Fan-out: failed to map the ring: %m\n");
+        goto fail;
+    }
+    f->ring = p;
+    f->data = (uint8_t *)p + page;
+
+    // What the consumers get: a read-only descriptor of a file that can neither change size nor
+    // be mapped writable again (the mapping above stays writable)
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", f->memfd);
+    f->ro_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (f->ro_fd < 0) {
+        fprintf(stderr, "Fan-out: failed to reopen the ring read-only: %m\n");
+        goto fail;
+    }
+    int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+#ifdef F_SEAL_FUTURE_WRITE
+    seals |= F_SEAL_FUTURE_WRITE;
+#endif
+    if (fcntl(f->memfd, F_ADD_SEALS, seals) < 0) {
+        fprintf(stderr, "Fan-out: failed to seal the ring memfd: %m\n");
+        goto fail;
+    }
+
+    f->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (f->listen_fd < 0) {
+        fprintf(stderr, "Fan-out: failed to open the consumer socket: %m\n");
+        goto fail;
+    }
+    socklen_t alen = fan_addr(&addr, name);
+    if (bind(f->listen_fd, (struct sockaddr *)&addr, alen) < 0 || listen(f->listen_fd, 8) < 0) {
+        fprintf(stderr, "Fan-out: failed to listen on @%s: %m\n", name);
+        goto fail;
+    }
+
+    struct tdc_fan_ring *r = f->ring;
+    r->version       = TDC_FAN_VERSION;
+    r->max_consumers = TDC_FAN_MAX_CONSUMERS;
+    r->data_off      = (uint32_t)page;
+    r->size          = size;
+    r->start_ns      = realtime_ns();
+    __atomic_store_n(&r->magic, TDC_FAN_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+
+fail:
+    tdc_fan_close(f);
+    return -1;
+}
+
+// Forget a consumer whose socket is gone
+static void consumer_free(struct tdc_fan *f, struct tdc_fan_consumer *c)
+{
+    if (c->attached)
+        f->n_attached--;
+    if (c->cur != NULL)
+        munmap(c->cur, (size_t)sysconf(_SC_PAGESIZE));
+    if (c->curfd >= 0)
+        close(c->curfd);
+    if (c->evfd >= 0)
+        close(c->evfd);
+    close(c->sock);
+    memset(c, 0, sizeof(*c));
+    c->sock = c->evfd = c->curfd = -1;
+}
+
+void tdc_fan_close(struct tdc_fan *f)
+{
+    for (unsigned i = 0; i < TDC_FAN_MAX_CONSUMERS; i++)
+        if (f->c[i].sock >= 0)
+            consumer_free(f, &f->c[i]);
+    if (f->listen_fd >= 0)
+        close(f->listen_fd);
+    if (f->ring != NULL)
+        munmap(f->ring, f->map_len);
+    if (f->ro_fd >= 0)
+        close(f->ro_fd);
+    if (f->memfd >= 0)
+        close(f->memfd);
+    f->listen_fd = f->memfd = f->ro_fd = -1;
+    f->ring = NULL;
+}
+
+static void send_welcome(int sock, unsigned slot, uint32_t status, const int *fds, unsigned n_fds, size_t map_len)
+{
+    struct tdc_fan_welcome w = { TDC_FAN_MAGIC, TDC_FAN_VERSION, (uint16_t)slot, status, 0, map_len };
+    struct iovec iov = { &w, sizeof(w) };
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } u;
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    if (n_fds > 0) {
+        memset(&u, 0, sizeof(u));
+        msg.msg_control = u.buf;
+        msg.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+        memcpy(CMSG_DATA(cm), fds, n_fds * sizeof(int));
+    }
+    if (sendmsg(sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+        fprintf(stderr, "Fan-out: failed to answer consumer %u: %m\n", slot);
+}
+
+int tdc_fan_accept(struct tdc_fan *f)
+{
+    int fd = accept4(f->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            fprintf(stderr, "Fan-out: failed to accept a consumer: %m\n");
+        return -1;
+    }
+    for (unsigned i = 0; i < TDC_FAN_MAX_CONSUMERS; i++) {
+        struct tdc_fan_consumer *c = &f->c[i];
+        if (c->sock >= 0)
+            continue;
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        c->sock = fd;
+        c->pid = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 ? cred.pid : 0;
+        return fd;
+    }
+    send_welcome(fd, 0, TDC_FAN_ERR_FULL, NULL, 0, 0);
+    fprintf(stderr, "Fan-out: consumer refused, %d attached already\n", TDC_FAN_MAX_CONSUMERS);
+    close(fd);
+    return -1;
+}
+
+// Answer the hello of consumer c with its cursor page, eventfd and the ring
+static int consumer_setup(struct tdc_fan *f, struct tdc_fan_consumer *c, unsigned slot, const struct tdc_fan_hello *h)
+{
+    long page = sysconf(_SC_PAGESIZE);
+
+    c->curfd = memfd_create("tdc_fan_cursor", MFD_CLOEXEC);
+    if (c->curfd < 0 || ftruncate(c->curfd, page) < 0) {
+        fprintf(stderr, "Fan-out: failed to create the cursor of consumer %u: %m\n", slot);
+        return -1;
+    }
+    void *p = mmap(NULL, (size_t)page, PROT_READ | PROT_WRITE, MAP_SHARED, c->curfd, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Fan-out: failed to map the cursor of consumer %u: %m\n", slot);
+        return -1;
+    }
+    c->cur = p;
+    c->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (c->evfd < 0) {
+        fprintf(stderr, "Fan-out: failed to create the eventfd of consumer %u: %m\n", slot);
+        return -1;
+    }
+    // The consumer starts with the next frame published
+    c->cur->tail   = f->ring->head;
+    c->cur->policy = h->policy;
+    c->cur->state  = TDC_FAN_ATTACHED;
+    memcpy(c->name, h->name, sizeof(c->name));
+    c->name[sizeof(c->name) - 1] = '\0';
+
+    int fds[3] = { f->ro_fd, c->curfd, c->evfd };
+    send_welcome(c->sock, slot, TDC_FAN_OK, fds, 3, f->map_len);
+    c->attached = 1;
+    f->n_attached++;
+    printf("Fan-out: consumer %u '%s' (pid %d) attached, policy %s\n", slot, c->name, (int)c->pid,
+           policy_names[h->policy]);
+    return 0;
+}
+
+int tdc_fan_client_ready(struct tdc_fan *f, int fd)
+{
+    struct tdc_fan_consumer *c = NULL;
+    struct tdc_fan_hello h;
+    unsigned slot;
+
+    for (slot = 0; slot < TDC_FAN_MAX_CONSUMERS && c == NULL; slot++)
+        if (f->c[slot].sock == fd)
+            c = &f->c[slot];
+    if (c == NULL) {
+        close(fd);
+        return -1;
+    }
+    slot--;
+    ssize_t n = recv(fd, &h, sizeof(h), MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+    // Nothing is expected after the hello: anything else is the end of the consumer
+    if (n <= 0 || c->cur != NULL) {
+        if (c->attached)
+            printf("Fan-out: consumer %u '%s' (pid %d) detached\n", slot, c->name, (int)c->pid);
+        consumer_free(f, c);
+        return -1;
+    }
+    if ((size_t)n != sizeof(h) || h.magic != TDC_FAN_MAGIC || h.version != TDC_FAN_VERSION ||
+        h.policy > TDC_FAN_THROTTLE) {
+        fprintf(stderr, "Fan-out: consumer %u (pid %d) sent no version %d hello\n", slot, (int)c->pid, TDC_FAN_VERSION);
+        send_welcome(fd, slot, TDC_FAN_ERR_VERSION, NULL, 0, 0);
+        consumer_free(f, c);
+        return -1;
+    }
+    if (consumer_setup(f, c, slot, &h) < 0) {
+        send_welcome(fd, slot, TDC_FAN_ERR_SYS, NULL, 0, 0);
+        consumer_free(f, c);
+        return -1;
+    }
+    return 0;
+}
+
+// Stop publishing for a consumer that is in the way. Its socket is shut down, so the daemon
+// frees the slot through tdc_fan_client_ready() once the consumer is gone.
+static void consumer_drop(struct tdc_fan *f, struct tdc_fan_consumer *c, uint64_t lag, const char *why)
+{
+    uint64_t one = 1;
+
+    __atomic_store_n(&c->cur->state, TDC_FAN_DETACHED, __ATOMIC_RELEASE);
+    // Before any of its unread records is overwritten, see tdc_fan_release()
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    c->attached = 0;
+    f->n_attached--;
+    f->ring->detached++;
+    if (write(c->evfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        fprintf(stderr, "Fan-out: failed to wake consumer '%s': %m\n", c->name);
+    shutdown(c->sock, SHUT_RDWR);
+    fprintf(stderr, "Fan-out: consumer '%s' (pid %d) detached, %s (%" PRIu64 " bytes behind)\n",
+            c->name, (int)c->pid, why, lag);
+}
+
+int tdc_fan_publish(struct tdc_fan *f, const struct tdc_frame_header *hdr, const void *payload)
+{
+    struct tdc_fan_ring *r = f->ring;
+    size_t plen = tdc_frame_payload_len(hdr);
+    uint64_t len = (sizeof(struct tdc_fan_rec) + sizeof(*hdr) + plen + TDC_FAN_REC_ALIGN - 1) &
+                   ~(uint64_t)(TDC_FAN_REC_ALIGN - 1);
+    uint64_t head = r->head, pos = head % r->size;
+    uint64_t pad = (pos + len > r->size) ? r->size - pos : 0;
+    int hold = 0;
+
+    if (f->n_attached == 0)
+        return 0;
+    if (len > r->size / 4) {
+        r->skipped++;
+        return 0;
+    }
+    for (unsigned i = 0; i < TDC_FAN_MAX_CONSUMERS; i++) {
+        struct tdc_fan_consumer *c = &f->c[i];
+        if (!c->attached)
+            continue;
+        uint64_t lag = head - __atomic_load_n(&c->cur->tail, __ATOMIC_ACQUIRE);
+        if (lag > r->size) {
+            consumer_drop(f, c, lag, "cursor out of range");
+            continue;
+        }
+        if (lag > c->cur->max_lag)
+            c->cur->max_lag = lag;
+        if (lag + pad + len <= r->size)
+            continue;
+        if (c->cur->policy == TDC_FAN_THROTTLE)
+            hold = 1;
+        else
+            consumer_drop(f, c, lag, "too slow");
+    }
+    if (hold) {
+        r->skipped++;
+        return 0;
+    }
+
+    if (pad != 0) {
+        struct tdc_fan_rec *p = (struct tdc_fan_rec *)(f->data + pos);
+        p->len   = (uint32_t)pad;
+        p->flags = TDC_FAN_REC_PAD;
+        p->seq   = 0;
+        pos = 0;
+    }
+    struct tdc_fan_rec *rec = (struct tdc_fan_rec *)(f->data + pos);
+    rec->len   = (uint32_t)len;
+    rec->flags = 0;
+    rec->seq   = r->frames + r->skipped;     // Frames held back leave a gap
+    memcpy(rec + 1, hdr, sizeof(*hdr));
+    memcpy((uint8_t *)(rec + 1) + sizeof(*hdr), payload, plen);
+    __atomic_store_n(&r->frames, r->frames + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&r->head, head + pad + len, __ATOMIC_RELEASE);
+
+    // Pairs with the fence in tdc_fan_next(): either the consumer sees the new head, or the
+    // daemon sees it waiting
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (unsigned i = 0; i < TDC_FAN_MAX_CONSUMERS; i++) {
+        struct tdc_fan_consumer *c = &f->c[i];
+        uint64_t one = 1;
+        if (!c->attached || !__atomic_load_n(&c->cur->waiting, __ATOMIC_RELAXED))
+            continue;
+        if (__atomic_exchange_n(&c->cur->waiting, 0, __ATOMIC_ACQ_REL) &&
+            write(c->evfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            fprintf(stderr, "Fan-out: failed to wake consumer '%s': %m\n", c->name);
+    }
+    return 1;
+}
+
+// snprintf at buf + *off, keeping *off within len
+static void append(char *buf, size_t len, size_t *off, const char *fmt, ...)
+{
+    va_list ap;
+    if (*off >= len)
+        return;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *off, len - *off, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        *off = (*off + n < len) ? *off + n : len;
+}
+
+void tdc_fan_format(const struct tdc_fan *f, char *buf, size_t len)
+{
+    const struct tdc_fan_ring *r = f->ring;
+    size_t off = 0;
+
+    buf[0] = '\0';
+    append(buf, len, &off, "Fan-out @%s, %" PRIu64 " MB ring: %" PRIu64 " frames published, %" PRIu64
+           " held back, %" PRIu64 " consumers detached for being slow, %u attached\n", f->name, r->size >> 20,
+           r->frames, r->skipped, r->detached, f->n_attached);
+    for (unsigned i = 0; i < TDC_FAN_MAX_CONSUMERS; i++) {
+        const struct tdc_fan_consumer *c = &f->c[i];
+        if (!c->attached)
+            continue;
+        uint64_t lag = r->head - __atomic_load_n(&c->cur->tail, __ATOMIC_RELAXED);
+        append(buf, len, &off, "  %2u %-31s pid %-7d %-8s lag %5.1f%% (max %5.1f%%) of the ring\n", i, c->name,
+               (int)c->pid, policy_names[c->cur->policy], 100.0 * lag / r->size, 100.0 * c->cur->max_lag / r->size);
+    }
+}
+
+// ------------------------------------------------------------------
+// Consumer
+// ------------------------------------------------------------------
+
+int tdc_fan_attach(struct tdc_fan_client *c, const char *name, enum tdc_fan_policy policy, const char *who)
+{
+    static const char *const errors[] = { "", "version not supported", "too many consumers", "daemon failed" };
+    struct tdc_fan_hello h = { TDC_FAN_MAGIC, TDC_FAN_VERSION, (uint16_t)policy, { 0 } };
+    struct tdc_fan_welcome w;
+    struct sockaddr_un addr;
+    struct timeval tv = { 5, 0 };
+    int fds[3] = { -1, -1, -1 };
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } u;
+    struct iovec iov = { &w, sizeof(w) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = u.buf, .msg_controllen = sizeof(u.buf) };
+
+    memset(c, 0, sizeof(*c));
+    c->evfd = -1;
+    if (name == NULL)
+        name = TDC_FAN_SOCK_NAME;
+    snprintf(h.name, sizeof(h.name), "%s", who ? who : "");
+    c->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (c->sock < 0) {
+        fprintf(stderr, "Fan-out: failed to open a socket: %m\n");
+        return -1;
+    }
+    socklen_t alen = fan_addr(&addr, name);
+    setsockopt(c->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (connect(c->sock, (struct sockaddr *)&addr, alen) < 0) {
+        fprintf(stderr, "Fan-out: failed to connect to @%s (is the daemon running?): %m\n", name);
+        goto fail;
+    }
+    if (send(c->sock, &h, sizeof(h), MSG_NOSIGNAL) != sizeof(h)) {
+        fprintf(stderr, "Fan-out: failed to send the hello: %m\n");
+        goto fail;
+    }
+    ssize_t n = recvmsg(c->sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0) {
+        fprintf(stderr, "Fan-out: no answer from the daemon: %m\n");
+        goto fail;
+    }
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS && cm->cmsg_len == CMSG_LEN(sizeof(fds)))
+            memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+    if ((size_t)n != sizeof(w) || w.magic != TDC_FAN_MAGIC || w.version != TDC_FAN_VERSION) {
+        fprintf(stderr, "Fan-out: @%s is not a version %d fan-out socket\n", name, TDC_FAN_VERSION);
+        goto fail;
+    }
+    if (w.status != TDC_FAN_OK || fds[2] < 0) {
+        fprintf(stderr, "Fan-out: attach refused: %s\n", w.status < 4 ? errors[w.status] : "unknown reason");
+        goto fail;
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    void *p = mmap(NULL, w.map_len, PROT_READ, MAP_SHARED, fds[0], 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Fan-out: failed to map the ring: %m\n");
+        goto fail;
+    }
+    c->ring = p;
+    c->map_len = w.map_len;
+    p = mmap(NULL, (size_t)page, PROT_READ | PROT_WRITE, MAP_SHARED, fds[1], 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Fan-out: failed to map the cursor: %m\n");
+        goto fail;
+    }
+    c->cur = p;
+    c->evfd = fds[2];
+    close(fds[0]);
+    close(fds[1]);
+    fds[0] = fds[1] = fds[2] = -1;
+    if (c->ring->magic != TDC_FAN_MAGIC || c->ring->version != TDC_FAN_VERSION ||
+        c->ring->data_off + c->ring->size != c->map_len) {
+        fprintf(stderr, "Fan-out: the ring of @%s is not a version %d ring\n", name, TDC_FAN_VERSION);
+        goto fail;
+    }
+    c->data = (const uint8_t *)c->ring + c->ring->data_off;
+    c->tail = c->cur->tail;
+    c->next_seq = UINT64_MAX;
+    return 0;
+
+fail:
+    for (unsigned i = 0; i < 3; i++)
+        if (fds[i] >= 0)
+            close(fds[i]);
+    tdc_fan_detach(c);
+    return -1;
+}
+
+void tdc_fan_detach(struct tdc_fan_client *c)
+{
+    if (c->held)
+        tdc_fan_release(c);
+    if (c->cur != NULL)
+        munmap(c->cur, (size_t)sysconf(_SC_PAGESIZE));
+    if (c->ring != NULL)
+        munmap((void *)c->ring, c->map_len);
+    if (c->evfd >= 0)
+        close(c->evfd);
+    if (c->sock >= 0)
+        close(c->sock);
+    c->cur = NULL;
+    c->ring = NULL;
+    c->evfd = c->sock = -1;
+}
+
+static int detached(const struct tdc_fan_client *c)
+{
+    return __atomic_load_n(&c->cur->state, __ATOMIC_ACQUIRE) == TDC_FAN_DETACHED;
+}
+
+int tdc_fan_next(struct tdc_fan_client *c, const struct tdc_frame_header **hdr, const void **payload, int timeout_ms)
+{
+    const uint64_t size = c->ring->size;
+    int gone = 0;
+
+    if (c->held)
+        tdc_fan_release(c);
+    while (1) {
+        if (detached(c)) {
+            fprintf(stderr, "Fan-out: detached by the daemon for being too slow\n");
+            return -1;
+        }
+        uint64_t head = __atomic_load_n(&c->ring->head, __ATOMIC_ACQUIRE);
+        while (c->tail != head) {
+            uint64_t pos = c->tail % size;
+            const struct tdc_fan_rec *rec = (const struct tdc_fan_rec *)(c->data + pos);
+            const struct tdc_frame_header *h = (const struct tdc_frame_header *)(rec + 1);
+            if (rec->len < sizeof(*rec) || rec->len % TDC_FAN_REC_ALIGN != 0 || rec->len > size - pos ||
+                rec->len > head - c->tail) {
+                fprintf(stderr, "Fan-out: corrupt record at %" PRIu64 "\n", c->tail);
+                return -1;
+            }
+            if (rec->flags & TDC_FAN_REC_PAD) {
+                c->tail += rec->len;
+                continue;
+            }
+            if (rec->len < sizeof(*rec) + TDC_FRAME_HEADER_V1_LEN || h->header_len > rec->len - sizeof(*rec)) {
+                fprintf(stderr, "Fan-out: corrupt frame at %" PRIu64 "\n", c->tail);
+                return -1;
+            }
+            if (c->next_seq != UINT64_MAX && rec->seq > c->next_seq)
+                c->lost += rec->seq - c->next_seq;
+            c->next_seq = rec->seq + 1;
+            c->frames++;
+            c->held = rec->len;
+            *hdr = h;
+            *payload = (const uint8_t *)h + h->header_len;
+            return 1;
+        }
+        // Padding skipped above must not hold the daemon back
+        __atomic_store_n(&c->cur->tail, c->tail, __ATOMIC_RELEASE);
+        if (gone) {
+            fprintf(stderr, "Fan-out: the daemon closed the ring\n");
+            return -1;
+        }
+        if (timeout_ms == 0)
+            return 0;
+
+        // Ask to be woken, then look again: the daemon either publishes after it sees the flag,
+        // or before, in which case the new head is seen here
+        __atomic_store_n(&c->cur->waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&c->ring->head, __ATOMIC_ACQUIRE) != c->tail)
+            continue;
+        struct pollfd pfd[2] = { { c->evfd, POLLIN, 0 }, { c->sock, POLLIN, 0 } };
+        int n = poll(pfd, 2, timeout_ms);
+        if (n < 0 && errno != EINTR) {
+            fprintf(stderr, "Fan-out: poll failed: %m\n");
+            return -1;
+        }
+        if (n == 0)
+            return 0;
+        if (pfd[0].revents & POLLIN) {
+            uint64_t v;
+            if (read(c->evfd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+                fprintf(stderr, "Fan-out: failed to read the eventfd: %m\n");
+        }
+        // Daemon stopped or shut the consumer out: take what is left in the ring, then stop
+        if (pfd[1].revents)
+            gone = 1;
+    }
+}
+
+int tdc_fan_release(struct tdc_fan_client *c)
+{
+    if (!c->held)
+        return 0;
+    // The frame was read before this point; if the daemon overwrote it meanwhile, it set the
+    // state before doing so (see consumer_drop())
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int lost = detached(c);
+    c->tail += c->held;
+    c->held = 0;
+    __atomic_store_n(&c->cur->tail, c->tail, __ATOMIC_RELEASE);
+    return lost ? -1 : 0;
+}
@@ -0,0 +1,228 @@
+/*
+* Event fan-out to local consumers through a shared memory ring
+*
+* The daemon publishes every event it reads out, as the frame it sends (tdc_frame.h), into one
+* ring in a sealed memfd, so any number of processes on the board (a monitor, a disk writer, a
+* second network sender) can see the event stream without opening the UIO devices, racing the
+* rd_busy handshake or costing the daemon one copy per consumer.
+*
+* Attaching: a consumer connects to the daemon's abstract UNIX socket (SOCK_SEQPACKET, name
+* TDC_FAN_SOCK_NAME by default) and sends a struct tdc_fan_hello. The daemon answers with a
+* struct tdc_fan_welcome and three file descriptors:
+*   - the ring memfd, opened read-only and sealed against resizing and new writable mappings:
+*     struct tdc_fan_ring in the first page, the ring data from data_off on
+*   - a one page memfd of its own, struct tdc_fan_cursor, mapped read-write: the consumer's
+*     read position in the ring, and what the daemon tells it
+*   - an eventfd the daemon signals when a frame is published while the consumer sleeps
+* The socket stays open while attached; closing it detaches, and the daemon going away shows up
+* on it as end of file.
+*
+* Ring: head and the consumer tails count bytes published / consumed since the ring was created,
+* the position in the ring is modulo size. Every record is a struct tdc_fan_rec, the frame header
+* and the payload, padded to TDC_FAN_REC_ALIGN bytes; a record never wraps, the end of the ring
+* is filled with a padding record instead. Records are written before head is advanced (release),
+* consumers read head with acquire and advance their tail with release once they are done with a
+* record, so a frame is read in place, with no copy, for as long as the consumer needs it.
+*
+* Slow consumers: a frame is only published if it does not overwrite what an attached consumer
+* has yet to read. A consumer that is in the way is, depending on the policy it asked for:
+*   TDC_FAN_DROP      detached: state is set to TDC_FAN_DETACHED, its socket shut down, and the
+*                     frame published for the others (for monitoring, which may miss events)
+*   TDC_FAN_THROTTLE  waited for: the frame is not published, for any consumer, and counted in
+*                     skipped; consumers see the gap in the record sequence numbers (for a disk
+*                     writer, which wants everything it can get)
+* Either way the readout and the network stream never wait for a consumer. The largest lag of
+* every consumer is kept in its cursor and reported by tdc_fan_format().
+*
+* Publisher (daemon): not thread safe, call everything from the event loop thread. Consumer
+* (client): one struct tdc_fan_client per thread.
+*
+* All functions print what failed to stderr and return -1 on error.
+*/
+#ifndef TDC_FAN_H
+#define TDC_FAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tdc_frame.h"
+#include "tdc_spsc.h"
+
+#define TDC_FAN_SOCK_NAME       "tdc_fan"       // Abstract socket name (no file, no leading '\0')
+#define TDC_FAN_MAGIC           0x4e464454u     // "TDFN" when read as bytes
+#define TDC_FAN_VERSION         1
+#define TDC_FAN_MAX_CONSUMERS   16
+#define TDC_FAN_RING_SIZE       (16u << 20)     // Default ring size, bytes
+#define TDC_FAN_REC_ALIGN       16
+
+enum tdc_fan_policy {
+    TDC_FAN_DROP,           // Detach the consumer when it falls a whole ring behind
+    TDC_FAN_THROTTLE        // Hold frames back until the consumer catches up
+};
+
+// Cursor state, written by the daemon
+enum {
+    TDC_FAN_ATTACHED = 1,
+    TDC_FAN_DETACHED = 2    // Too slow (TDC_FAN_DROP): frames may have been overwritten
+};
+
+// Record flags
+#define TDC_FAN_REC_PAD     0x0001  // Padding to the end of the ring, no frame
+
+// Start of the ring memfd, read-only for consumers
+struct tdc_fan_ring {
+    uint32_t magic;             // TDC_FAN_MAGIC, written last by tdc_fan_create()
+    uint16_t version;           // TDC_FAN_VERSION
+    uint16_t max_consumers;     // TDC_FAN_MAX_CONSUMERS
+    uint32_t data_off;          // Offset of the ring data in the memfd (one page)
+    uint32_t reserved;
+    uint64_t size;              // Bytes of ring data, a multiple of TDC_FAN_REC_ALIGN
+    uint64_t start_ns;          // CLOCK_REALTIME when the ring was created
+    // Written by the daemon for every frame
+    _Alignas(TDC_CACHE_LINE) uint64_t head;     // Bytes published
+    uint64_t frames;            // Frames published
+    uint64_t skipped;           // Frames held back by a throttling consumer or too large for the ring
+    uint64_t detached;          // Consumers detached for being too slow
+};
+
+// Record header in the ring, followed by the frame header and payload
+struct tdc_fan_rec {
+    uint32_t len;               // Bytes of the record including this header and the padding
+    uint32_t flags;             // TDC_FAN_REC_*
+    uint64_t seq;               // Frames published or skipped before this one
+};
+
+_Static_assert(sizeof(struct tdc_fan_rec) % 8 == 0, "tdc_fan_rec must keep the payload 8-byte aligned");
+
+// Per-consumer page, read-write for its consumer
+struct tdc_fan_cursor {
+    // Written by the consumer
+    _Alignas(TDC_CACHE_LINE) uint64_t tail;     // Bytes consumed
+    uint32_t waiting;           // 1: about to sleep on the eventfd, wake me with the next frame
+    uint32_t reserved;
+    // Written by the daemon
+    _Alignas(TDC_CACHE_LINE) uint32_t state;    // TDC_FAN_ATTACHED or TDC_FAN_DETACHED
+    uint32_t policy;            // enum tdc_fan_policy
+    uint64_t max_lag;           // Largest head - tail seen when publishing, bytes
+};
+
+// Attach request, consumer -> daemon
+struct tdc_fan_hello {
+    uint32_t magic;             // TDC_FAN_MAGIC
+    uint16_t version;           // TDC_FAN_VERSION
+    uint16_t policy;            // enum tdc_fan_policy
+    char name[32];              // Shown in the daemon's reports
+};
+
+// Welcome status
+enum {
+    TDC_FAN_OK,
+    TDC_FAN_ERR_VERSION,        // Hello not understood
+    TDC_FAN_ERR_FULL,           // TDC_FAN_MAX_CONSUMERS attached already
+    TDC_FAN_ERR_SYS             // Daemon failed to set the consumer up
+};
+
+// Attach reply, daemon -> consumer, with the ring, cursor and eventfd descriptors if status is TDC_FAN_OK
+struct tdc_fan_welcome {
+    uint32_t magic;             // TDC_FAN_MAGIC
+    uint16_t version;           // TDC_FAN_VERSION
+    uint16_t slot;              // Consumer number
+    uint32_t status;            // TDC_FAN_OK or TDC_FAN_ERR_*
+    uint32_t reserved;
+    uint64_t map_len;           // Size of the ring memfd
+};
+
+// ------------------------------------------------------------------
+// Publisher (daemon)
+// ------------------------------------------------------------------
+
+struct tdc_fan_consumer {
+    int sock;                   // -1 => slot free
+    int evfd, curfd;
+    struct tdc_fan_cursor *cur; // NULL until the hello was answered
+    int attached;               // Frames are published for it
+    pid_t pid;
+    char name[32];
+};
+
+struct tdc_fan {
+    int listen_fd;
+    int memfd, ro_fd;           // Ring read-write (daemon) and read-only (consumers)
+    struct tdc_fan_ring *ring;
+    uint8_t *data;
+    size_t map_len;
+    unsigned n_attached;
+    struct tdc_fan_consumer c[TDC_FAN_MAX_CONSUMERS];
+    char name[64];
+};
+
+// Create a ring of size bytes (0 => TDC_FAN_RING_SIZE) and listen for consumers on the abstract
+// socket name
+int tdc_fan_create(struct tdc_fan *f, const char *name, size_t size);
+
+// Detach every consumer and free the ring (the consumers keep their mappings)
+void tdc_fan_close(struct tdc_fan *f);
+
+// Socket to watch for new consumers
+static inline int tdc_fan_listen_fd(const struct tdc_fan *f)
+{
+    return f->listen_fd;
+}
+
+// Accept a new consumer. Returns its socket, to be watched for input and passed to
+// tdc_fan_client_ready(), or -1.
+int tdc_fan_accept(struct tdc_fan *f);
+
+// Handle input on the socket of a consumer: its hello, or its end. Returns 0 while the consumer
+// is connected, -1 once it is gone and fd was closed.
+int tdc_fan_client_ready(struct tdc_fan *f, int fd);
+
+// Publish a frame to the attached consumers. Returns 1 if it was published, 0 if there is no
+// consumer or it was held back (counted in skipped).
+int tdc_fan_publish(struct tdc_fan *f, const struct tdc_frame_header *hdr, const void *payload);
+
+// Human readable report: frames published and skipped, and the policy, lag and largest lag of
+// every consumer
+void tdc_fan_format(const struct tdc_fan *f, char *buf, size_t len);
+
+// ------------------------------------------------------------------
+// Consumer (client library)
+// ------------------------------------------------------------------
+
+struct tdc_fan_client {
+    int sock, evfd;
+    const struct tdc_fan_ring *ring;
+    const uint8_t *data;
+    size_t map_len;
+    struct tdc_fan_cursor *cur;
+    uint64_t tail;              // Read position, ahead of cur->tail while a frame is held
+    uint32_t held;              // Length of the record handed out by tdc_fan_next(), 0 if none
+    uint64_t frames;            // Frames received
+    uint64_t lost;              // Frames published before this one that were not received
+    uint64_t next_seq;          // Expected sequence number of the next frame
+};
+
+// Attach to the daemon's ring on the abstract socket name (NULL => TDC_FAN_SOCK_NAME); who names
+// the consumer in the daemon's reports
+int tdc_fan_attach(struct tdc_fan_client *c, const char *name, enum tdc_fan_policy policy, const char *who);
+
+// Detach and unmap; a frame still held is released
+void tdc_fan_detach(struct tdc_fan_client *c);
+
+// Wait up to timeout_ms (-1 => forever) for the next frame. Returns 1 with *hdr and *payload
+// pointing into the ring, valid until tdc_fan_release(); 0 on timeout; -1 once the daemon has
+// gone (after every frame it published was received) or detached the consumer.
+int tdc_fan_next(struct tdc_fan_client *c, const struct tdc_frame_header **hdr, const void **payload, int timeout_ms);
+
+// Hand the frame from tdc_fan_next() back. Returns -1 if the consumer was detached meanwhile, in
+// which case the frame may have been overwritten while it was read.
+int tdc_fan_release(struct tdc_fan_client *c);
+
+// Bytes published but not yet released by this consumer
+static inline uint64_t tdc_fan_lag(const struct tdc_fan_client *c)
+{
+    return __atomic_load_n(&c->ring->head, __ATOMIC_RELAXED) - c->cur->tail;
+}
+
+#endif
@@ -0,0 +1,136 @@
+/*
+* Binary event frame sent by the readout daemon for every trigger
+*
+* Each frame is a fixed header followed by n_words raw 64-bit BRAM words:
+*
+*   +----------------------------+  0
+*   | struct tdc_frame_header    |
+*   +----------------------------+  header_len
+*   | uint64_t word[0]           |
+*   | ...                        |
+*   | uint64_t word[n_words-1]   |
+*   +----------------------------+  header_len + 8*n_words
+*
+* All fields are little endian (native on both the A53 and x86 DAQ hosts). Readers
+* must use header_len rather than sizeof(struct tdc_frame_header) to find the start
+* of the payload, so that fields can be appended to the header in later versions.
+*
+* Version history:
+*   1: 32-byte header
+*   2: 40-byte header, adds n_dropped. Version 1 readers still work, they skip the new fields.
+*   3: packed payload (TDC_FRAME_FLAG_PACKED, packed_len replaces reserved). Only sent when
+*      asked for (daemon -z), older readers cannot read packed frames.
+*
+* Every trigger that does not make it into a frame is accounted for in n_dropped of the next
+* frame that is sent: triggers missed by the PL while the previous one was read out, interrupts
+* the PS did not see separately, and events the PS had to discard (no free buffer, data
+* connection down). The sum of n_dropped over a run divided by the number of frames plus that
+* sum is the fraction of triggers lost to dead time.
+*
+* Each BRAM word holds one hit in its lower g_coarse_bits+11 bits:
+*   [5:0]   channel ID
+*   [10:6]  fine time
+*   [38:11] coarse time
+*
+* The same word format is used by the DMA firmware (TDC_64ch_DMA), which in addition closes every
+* event in the DDR stream with a trailer word (stripped by dma_daemon.c before the frame is sent):
+*   [63:56] TDC_DMA_TRAILER_MARKER
+*   [55:32] hits dropped by the PL in this event
+*   [31:0]  trigger number
+*
+* A packed payload (TDC_FRAME_FLAG_PACKED) drops the upper 25 bits of every word, which are
+* always set, and stores the coarse time as the difference to the previous hit: every hit is the
+* LEB128 varint (7 bits per byte, lowest first, top bit set on all but the last byte) of
+*   (coarse - previous coarse) mod 2^28 << 11 | fine << 6 | channel
+* with a previous coarse time of 0 for the first hit, so packed_len bytes hold n_words hits.
+* Events sorted by coarse time (TDC_FRAME_FLAG_ORDERED) take 2 bytes for a hit less than 8
+* clock cycles after the previous one and 3 bytes up to 1024 cycles, instead of 8. See
+* tdc_pack.h for the encoder and decoder.
+*/
+#ifndef TDC_FRAME_H
+#define TDC_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TDC_FRAME_MAGIC     0x46434454u     // "TDCF" when read as bytes
+#define TDC_FRAME_VERSION   3
+
+// Upper bound on the payload of a single frame. One full BRAM is 1024 words, events read out
+// through the DMA are only limited by the DDR buffers and may be much larger.
+#define TDC_FRAME_MAX_WORDS (1u << 20)
+
+// bram_id of frames read out through the DMA rather than from a BRAM
+#define TDC_FRAME_BRAM_DMA  0
+
+// Frame flags
+#define TDC_FRAME_FLAG_OVERFLOW 0x0001  // BRAM wrapped around during the event, the oldest hits were overwritten
+#define TDC_FRAME_FLAG_DROPPED  0x0002  // DMA stream was back-pressured, the PL dropped some of the hits of the event
+#define TDC_FRAME_FLAG_ORDERED  0x0004  // Words sorted by coarse time by the PS (see tdc_order.h)
+#define TDC_FRAME_FLAG_PACKED   0x0008  // Payload is packed_len bytes of packed hits rather than 64-bit words
+
+// Largest packed payload of n hits (a 39-bit varint, 6 bytes, per hit)
+#define TDC_FRAME_PACKED_MAX_LEN(n)    ((size_t)(n) * 6)
+
+struct tdc_frame_header {
+    uint32_t magic;         // TDC_FRAME_MAGIC
+    uint16_t version;       // TDC_FRAME_VERSION
+    uint16_t header_len;    // Size of this header in bytes
+    uint32_t trigger;       // Trigger sequence number (UIO interrupt count, DMA trailer trigger number)
+    uint16_t bram_id;       // BRAM (1 or 2) or bank + 1 (N bank firmware) the event was read out of, TDC_FRAME_BRAM_DMA for the DMA firmware
+    uint16_t flags;         // TDC_FRAME_FLAG_*
+    uint32_t n_words;       // Number of 64-bit words following the header
+    uint32_t missed_trigs;  // Triggers missed by the PL since reset
+    uint64_t timestamp_ns;  // CLOCK_REALTIME when the interrupt was serviced
+    // Version 2
+    uint32_t n_dropped;     // Triggers lost between the previous frame and this one
+    // Version 3
+    uint32_t packed_len;    // Payload bytes if TDC_FRAME_FLAG_PACKED, else 0
+} __attribute__((packed));
+
+// Size of a version 1 header, the smallest header_len a reader accepts
+#define TDC_FRAME_HEADER_V1_LEN 32
+
+_Static_assert(sizeof(struct tdc_frame_header) == 40, "tdc_frame_header must be 40 bytes");
+
+// Returns 0 if the header looks like a valid frame header, -1 otherwise
+static inline int tdc_frame_check(const struct tdc_frame_header *h)
+{
+    if (h->magic != TDC_FRAME_MAGIC)
+        return -1;
+    if (h->header_len < TDC_FRAME_HEADER_V1_LEN)
+        return -1;
+    if (h->n_words > TDC_FRAME_MAX_WORDS)
+        return -1;
+    if ((h->flags & TDC_FRAME_FLAG_PACKED) &&
+        (h->header_len < sizeof(struct tdc_frame_header) || h->packed_len > TDC_FRAME_PACKED_MAX_LEN(h->n_words)))
+        return -1;
+    return 0;
+}
+
+// Bytes of payload following the header
+static inline size_t tdc_frame_payload_len(const struct tdc_frame_header *h)
+{
+    if (h->flags & TDC_FRAME_FLAG_PACKED)
+        return h->packed_len;
+    return (size_t)h->n_words * sizeof(uint64_t);
+}
+
+// n_dropped of a frame, 0 for version 1 frames which do not have it
+static inline uint32_t tdc_frame_dropped(const struct tdc_frame_header *h)
+{
+    return (h->header_len >= sizeof(struct tdc_frame_header)) ? h->n_dropped : 0;
+}
+
+// Hit word field extraction
+static inline unsigned tdc_hit_channel(uint64_t w) { return (unsigned)(w & 0x3f); }
+static inline unsigned tdc_hit_fine(uint64_t w)    { return (unsigned)((w >> 6) & 0x1f); }
+static inline uint32_t tdc_hit_coarse(uint64_t w)  { return (uint32_t)((w >> 11) & 0xfffffff); }
+
+// DMA event trailer word
+#define TDC_DMA_TRAILER_MARKER  0x5a
+static inline int tdc_is_trailer(uint64_t w)            { return (w >> 56) == TDC_DMA_TRAILER_MARKER; }
+static inline uint32_t tdc_trailer_dropped(uint64_t w)  { return (uint32_t)((w >> 32) & 0xffffff); }
+static inline uint32_t tdc_trailer_trigger(uint64_t w)  { return (uint32_t)w; }
+
+#endif
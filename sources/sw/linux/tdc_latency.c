@@ -0,0 +1,101 @@
+/*
+* Latency histograms of the trigger handshake between the PL and the PS (see tdc_latency.h)
+*/
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tdc_latency.h"
+
+static const char *const lat_names[TDC_LAT_N] = { "irq -> busy", "busy", "end to end" };
+
+// Exact below 2 * TDC_LAT_SUB, then TDC_LAT_SUB bins per power of two
+static unsigned lat_bin(uint32_t v)
+{
+    if (v < 2 * TDC_LAT_SUB)
+        return v;
+    unsigned e = 31 - (unsigned)__builtin_clz(v) - TDC_LAT_SUB_BITS;
+    return (e + 1) * TDC_LAT_SUB + ((v >> e) - TDC_LAT_SUB);
+}
+
+// Largest value that falls into bin b
+static uint32_t lat_bin_max(unsigned b)
+{
+    if (b < 2 * TDC_LAT_SUB)
+        return b;
+    unsigned e = b / TDC_LAT_SUB - 1;
+    uint64_t m = b % TDC_LAT_SUB + TDC_LAT_SUB;
+    return (uint32_t)(((m + 1) << e) - 1);
+}
+
+static void hist_add(struct tdc_lat_hist *h, uint32_t v)
+{
+    if (h->n == 0 || v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+    h->n++;
+    h->sum += v;
+    h->bins[lat_bin(v)]++;
+}
+
+void tdc_latency_clear(struct tdc_latency *l)
+{
+    memset(l, 0, sizeof(*l));
+}
+
+void tdc_latency_add(struct tdc_latency *l, const struct tdc_pl_handshake *hs)
+{
+    if (hs->seq == 0) {
+        l->untimed++;
+        return;
+    }
+    l->timed++;
+    // Unsigned differences of the low 32 bits are right across a wrap of the counter
+    hist_add(&l->h[TDC_LAT_IRQ_BUSY], hs->busy_set - hs->irq);
+    hist_add(&l->h[TDC_LAT_BUSY], hs->busy_clr - hs->busy_set);
+    hist_add(&l->h[TDC_LAT_END_TO_END], hs->busy_clr - (uint32_t)hs->trig);
+}
+
+uint32_t tdc_lat_percentile(const struct tdc_lat_hist *h, double q)
+{
+    if (h->n == 0)
+        return 0;
+    // Rank of the entry, counting from 1: ceil(q * n)
+    uint64_t rank = (uint64_t)(q * h->n), seen = 0;
+    if (rank < q * h->n || rank < 1)
+        rank++;
+    for (unsigned b = 0; b < TDC_LAT_BINS; b++) {
+        seen += h->bins[b];
+        if (seen >= rank) {
+            uint32_t v = lat_bin_max(b);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+void tdc_latency_format(const struct tdc_latency *l, char *buf, size_t len)
+{
+    const double us = 1e6 / TDC_STATS_CLK0_HZ;
+    size_t off = 0;
+    int n;
+
+    buf[0] = '\0';
+    n = snprintf(buf, len, "PL handshake latency over %" PRIu64 " triggers (%" PRIu64 " not timed), us:\n"
+                 "  %-11s %8s %8s %8s %8s %8s %8s %8s\n",
+                 l->timed, l->untimed, "", "mean", "min", "p50", "p90", "p99", "p99.9", "max");
+    if (n < 0 || (size_t)n >= len)
+        return;
+    off = (size_t)n;
+    for (unsigned i = 0; i < TDC_LAT_N && l->timed > 0; i++) {
+        const struct tdc_lat_hist *h = &l->h[i];
+        n = snprintf(buf + off, len - off, "  %-11s %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n", lat_names[i],
+                     (double)h->sum / h->n * us, h->min * us,
+                     tdc_lat_percentile(h, 0.5) * us, tdc_lat_percentile(h, 0.9) * us,
+                     tdc_lat_percentile(h, 0.99) * us, tdc_lat_percentile(h, 0.999) * us, h->max * us);
+        if (n < 0 || (size_t)n >= len - off)
+            return;
+        off += (size_t)n;
+    }
+}
@@ -0,0 +1,63 @@
+/*
+* Latency histograms of the trigger handshake between the PL and the PS
+*
+* With the statistics block (tdc_stats.h, version 2), every event read out carries the PL
+* timestamps of its handshake: trigger accepted, interrupt raised, rd_busy raised and rd_busy
+* lowered, on a free-running clk0 counter. From them three histograms are filled:
+*   irq -> busy   interrupt raised until rd_busy raised: interrupt delivery and wake-up of the
+*                 IRQ thread, what the kernel configuration and IRQ affinity act on
+*   busy          rd_busy high: copying the BRAM, what the readout code acts on
+*   end to end    trigger accepted until rd_busy lowered: the dead time of one trigger (with
+*                 trigger matching, including the wait for the end of its window)
+* measured by the PL clock, so they include everything the software timestamps cannot see.
+*
+* The bins are log-linear in clk0 cycles: exact below 64 cycles, then 32 bins per power of two
+* (at most 3% wide) up to 2^32 cycles (20 s), so percentiles are accurate to a bin without
+* keeping every event. Not thread safe: fill and read from the same thread.
+*/
+#ifndef TDC_LATENCY_H
+#define TDC_LATENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tdc_stats.h"
+
+#define TDC_LAT_SUB_BITS    5
+#define TDC_LAT_SUB         (1u << TDC_LAT_SUB_BITS)                // Bins per power of two
+#define TDC_LAT_BINS        ((32 - TDC_LAT_SUB_BITS + 1) * TDC_LAT_SUB)
+
+enum {
+    TDC_LAT_IRQ_BUSY,       // Interrupt raised -> rd_busy raised
+    TDC_LAT_BUSY,           // rd_busy raised -> rd_busy lowered
+    TDC_LAT_END_TO_END,     // Trigger accepted -> rd_busy lowered
+    TDC_LAT_N
+};
+
+struct tdc_lat_hist {
+    uint64_t n;
+    uint64_t sum;                   // clk0 cycles
+    uint32_t min, max;
+    uint32_t bins[TDC_LAT_BINS];
+};
+
+struct tdc_latency {
+    uint64_t timed;                 // Events with PL timestamps
+    uint64_t untimed;               // Events without (the record was not latched in time)
+    struct tdc_lat_hist h[TDC_LAT_N];
+};
+
+// Empty all histograms
+void tdc_latency_clear(struct tdc_latency *l);
+
+// Add the handshake of one event; one with seq 0 is counted as untimed
+void tdc_latency_add(struct tdc_latency *l, const struct tdc_pl_handshake *hs);
+
+// Smallest latency (clk0 cycles, upper edge of its bin) that a fraction q of the entries do not exceed
+uint32_t tdc_lat_percentile(const struct tdc_lat_hist *h, double q);
+
+// Human readable report: count, mean, minimum, 50/90/99/99.9th percentiles and maximum of every
+// histogram, in microseconds
+void tdc_latency_format(const struct tdc_latency *l, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,203 @@
+/*
+* Online monitoring histograms in shared memory (see tdc_mon.h)
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tdc_frame.h"
+#include "tdc_mon.h"
+
+static inline uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int map(struct tdc_mon *m, const char *name, int owner)
+{
+    int fd = shm_open(name, owner ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open shared memory %s: %m\n", name);
+        return -1;
+    }
+    if (owner && ftruncate(fd, sizeof(struct tdc_mon_shm)) < 0) {
+        fprintf(stderr, "Failed to size shared memory %s: %m\n", name);
+        close(fd);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct tdc_mon_shm)) {
+        fprintf(stderr, "Shared memory %s is not a monitoring segment\n", name);
+        close(fd);
+        return -1;
+    }
+    void *p = mmap(NULL, sizeof(struct tdc_mon_shm), owner ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Failed to map shared memory %s: %m\n", name);
+        return -1;
+    }
+    memset(m, 0, sizeof(*m));
+    m->shm = p;
+    m->owner = owner;
+    snprintf(m->name, sizeof(m->name), "%s", name);
+    return 0;
+}
+
+int tdc_mon_create(struct tdc_mon *m, const char *name, unsigned n_writers)
+{
+    if (n_writers == 0 || n_writers > TDC_MON_MAX_WRITERS) {
+        fprintf(stderr, "Monitoring: 1 to %d writer threads\n", TDC_MON_MAX_WRITERS);
+        return -1;
+    }
+    if (map(m, name, 1) < 0)
+        return -1;
+    // A segment left behind by a previous run is restarted; viewers see the magic go away first
+    struct tdc_mon_shm *s = m->shm;
+    s->magic = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    memset((char *)s + sizeof(s->magic), 0, sizeof(*s) - sizeof(s->magic));
+    s->version   = TDC_MON_VERSION;
+    s->n_writers = (uint16_t)n_writers;
+    s->start_ns  = s->tick_ns = realtime_ns();
+    __atomic_store_n(&s->magic, TDC_MON_MAGIC, __ATOMIC_RELEASE);
+    m->last_ns = s->start_ns;
+    return 0;
+}
+
+int tdc_mon_attach(struct tdc_mon *m, const char *name)
+{
+    if (map(m, name, 0) < 0)
+        return -1;
+    if (m->shm->magic != TDC_MON_MAGIC || m->shm->version != TDC_MON_VERSION ||
+        m->shm->n_writers == 0 || m->shm->n_writers > TDC_MON_MAX_WRITERS) {
+        fprintf(stderr, "Shared memory %s is not a version %d monitoring segment (is the daemon running?)\n",
+                name, TDC_MON_VERSION);
+        tdc_mon_close(m);
+        return -1;
+    }
+    return 0;
+}
+
+void tdc_mon_close(struct tdc_mon *m)
+{
+    if (m->shm == NULL)
+        return;
+    munmap(m->shm, sizeof(struct tdc_mon_shm));
+    if (m->owner)
+        shm_unlink(m->name);
+    m->shm = NULL;
+}
+
+void tdc_mon_fill(struct tdc_mon_counters *c, const uint64_t *words, size_t n)
+{
+    uint32_t per_ch[TDC_DECODE_CHANNELS] = { 0 };
+
+    // Hits are counted per channel on the stack first, so the shared counters are touched once
+    // per channel and event rather than once per hit
+    for (size_t i = 0; i < n; i++) {
+        unsigned ch = tdc_hit_channel(words[i]);
+        per_ch[ch]++;
+        c->fine[ch][tdc_hit_fine(words[i])]++;
+    }
+    for (unsigned ch = 0; ch < TDC_DECODE_CHANNELS; ch++) {
+        uint32_t k = per_ch[ch];
+        c->ch_hits[ch] += k;
+        c->ch_mult[ch][k < TDC_MON_CH_MULT_BINS - 1 ? k : TDC_MON_CH_MULT_BINS - 1]++;
+    }
+    unsigned bin = (n == 0) ? 0 : 64 - __builtin_clzll((uint64_t)n);
+    c->mult[bin < TDC_MON_MULT_BINS ? bin : TDC_MON_MULT_BINS - 1]++;
+    c->hits += n;
+    c->events++;
+}
+
+void tdc_mon_sum(const struct tdc_mon *m, struct tdc_mon_counters *sum)
+{
+    const uint64_t *w = (const uint64_t *)&m->shm->w[0];
+    uint64_t *s = (uint64_t *)sum;
+    size_t n = sizeof(*sum) / sizeof(uint64_t);
+
+    // Nothing but uint64_t counters in a block, so they can be added as one array
+    memset(sum, 0, sizeof(*sum));
+    for (unsigned b = 0; b < m->shm->n_writers; b++, w += n)
+        for (size_t i = 0; i < n; i++)
+            s[i] += w[i];
+}
+
+void tdc_mon_tick(struct tdc_mon *m)
+{
+    static struct tdc_mon_counters sum;     // 26 KB, kept off the stack
+    uint64_t t = realtime_ns();
+    double dt = (t - m->last_ns) / 1e9;
+
+    if (dt <= 0)
+        return;
+    tdc_mon_sum(m, &sum);
+    for (unsigned ch = 0; ch < TDC_DECODE_CHANNELS; ch++) {
+        m->shm->ch_rate_hz[ch] = (uint32_t)((sum.ch_hits[ch] - m->last_ch_hits[ch]) / dt + 0.5);
+        m->last_ch_hits[ch] = sum.ch_hits[ch];
+    }
+    m->shm->event_rate_hz = (uint32_t)((sum.events - m->last_events) / dt + 0.5);
+    m->shm->tick_ns = t;
+    m->last_events = sum.events;
+    m->last_ns = t;
+}
+
+// snprintf at buf + *off, keeping *off within len
+static void append(char *buf, size_t len, size_t *off, const char *fmt, ...)
+{
+    va_list ap;
+    if (*off >= len)
+        return;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *off, len - *off, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        *off = (*off + n < len) ? *off + n : len;
+}
+
+void tdc_mon_format(const struct tdc_mon *m, char *buf, size_t len)
+{
+    static struct tdc_mon_counters c;       // 26 KB, kept off the stack
+    const struct tdc_mon_shm *s = m->shm;
+    size_t off = 0;
+
+    buf[0] = '\0';
+    tdc_mon_sum(m, &c);
+    append(buf, len, &off, "Monitoring over %.0f s: %" PRIu64 " events (%" PRIu32 "/s), %" PRIu64
+           " hits, %.2f hits per trigger\n", (s->tick_ns - s->start_ns) / 1e9, c.events, s->event_rate_hz,
+           c.hits, c.events ? (double)c.hits / c.events : 0.0);
+    append(buf, len, &off, "  Hits per trigger:");
+    for (unsigned b = 0; b < TDC_MON_MULT_BINS; b++)
+        if (c.mult[b] != 0)
+            append(buf, len, &off, " %s%u: %" PRIu64, b <= 1 ? "" : ">=", b == 0 ? 0 : 1u << (b - 1), c.mult[b]);
+    append(buf, len, &off, "\n");
+
+    for (unsigned ch = 0; ch < TDC_DECODE_CHANNELS; ch++) {
+        uint64_t lo = UINT64_MAX, hi = 0;
+        unsigned empty = 0;
+        for (unsigned f = 0; f < TDC_DECODE_FINE_BINS; f++) {
+            uint64_t k = c.fine[ch][f];
+            lo = (k < lo) ? k : lo;
+            hi = (k > hi) ? k : hi;
+            empty += (k == 0);
+        }
+        append(buf, len, &off, "  ch %2u %10" PRIu32 " Hz %6.2f%% %7.3f hits/trigger", ch, s->ch_rate_hz[ch],
+               c.hits ? 100.0 * c.ch_hits[ch] / c.hits : 0.0, c.events ? (double)c.ch_hits[ch] / c.events : 0.0);
+        if (c.ch_hits[ch] == 0)
+            append(buf, len, &off, "  no hits\n");
+        else if (empty > 0)
+            append(buf, len, &off, "  %u empty fine bins\n", empty);
+        else
+            append(buf, len, &off, "  fine bins max/min %.2f\n", (double)hi / lo);
+    }
+}
@@ -0,0 +1,101 @@
+/*
+* Online monitoring histograms in shared memory
+*
+* The daemon adds every event it reads out to a few histograms that show the health of the
+* detector without a copy of the raw stream leaving the board:
+*   - hits per channel (occupancy; the hit rate of every channel is derived from it every second)
+*   - fine time per channel (a dead or stuck sampler shows up as empty or overfull bins)
+*   - hits per trigger, per channel and for the whole event
+*
+* The histograms live in a POSIX shared memory segment (shm_open(), /dev/shm/tdc_mon by
+* default), so any number of viewers (monitor.c, a Python script with mmap, ...) can look at
+* them live without talking to the daemon. Every thread that fills histograms has its own
+* cache-line aligned block of counters (struct tdc_mon_counters), so writers never share a
+* cache line and no atomic operation is needed; viewers add the blocks up (tdc_mon_sum()).
+*
+* Counters only ever grow (until the daemon restarts, see start_ns), and are plain aligned
+* 64-bit words, which are read and written in one access on the supported CPUs (aarch64,
+* x86-64). A viewer can catch an event half counted, or the rates mid-update, but never sees a
+* torn counter. Rates are computed by differencing two reads.
+*
+* All functions print what failed to stderr and return -1 on error.
+*/
+#ifndef TDC_MON_H
+#define TDC_MON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tdc_decode.h"
+#include "tdc_spsc.h"
+
+#define TDC_MON_SHM_NAME        "/tdc_mon"
+#define TDC_MON_MAGIC           0x4e4d4454u     // "TDMN" when read as bytes
+#define TDC_MON_VERSION         1
+#define TDC_MON_MAX_WRITERS     4
+
+// Hits per trigger of one channel: 0 .. TDC_MON_CH_MULT_BINS - 2, last bin is everything above
+#define TDC_MON_CH_MULT_BINS    16
+// Hits per trigger of the event: bin 0 is no hit, bin k >= 1 is 2^(k-1) .. 2^k - 1 hits
+#define TDC_MON_MULT_BINS       22
+
+struct tdc_mon_counters {
+    _Alignas(TDC_CACHE_LINE) uint64_t events;
+    uint64_t hits;
+    uint64_t ch_hits[TDC_DECODE_CHANNELS];
+    uint64_t mult[TDC_MON_MULT_BINS];
+    uint64_t ch_mult[TDC_DECODE_CHANNELS][TDC_MON_CH_MULT_BINS];
+    uint64_t fine[TDC_DECODE_CHANNELS][TDC_DECODE_FINE_BINS];
+};
+
+// Layout of the shared memory segment
+struct tdc_mon_shm {
+    uint32_t magic;             // TDC_MON_MAGIC, written last by tdc_mon_create()
+    uint16_t version;           // TDC_MON_VERSION
+    uint16_t n_writers;         // Counter blocks in use
+    uint64_t start_ns;          // CLOCK_REALTIME when the counters started
+    // Updated by tdc_mon_tick()
+    uint64_t tick_ns;           // CLOCK_REALTIME of the last update
+    uint32_t event_rate_hz;     // Events per second over the last tick
+    uint32_t ch_rate_hz[TDC_DECODE_CHANNELS];   // Hits per second of every channel over the last tick
+    struct tdc_mon_counters w[TDC_MON_MAX_WRITERS];
+};
+
+struct tdc_mon {
+    struct tdc_mon_shm *shm;
+    int owner;                  // Created the segment: may write, removes it on close
+    char name[64];
+    // Owner only, for the rates
+    uint64_t last_ns, last_events;
+    uint64_t last_ch_hits[TDC_DECODE_CHANNELS];
+};
+
+// Create (or take over) the segment with zeroed counters for n_writers threads
+int tdc_mon_create(struct tdc_mon *m, const char *name, unsigned n_writers);
+
+// Map an existing segment read-only, for a viewer
+int tdc_mon_attach(struct tdc_mon *m, const char *name);
+
+// Unmap, and remove the segment if m created it
+void tdc_mon_close(struct tdc_mon *m);
+
+// Counter block of writer thread i (owner only)
+static inline struct tdc_mon_counters *tdc_mon_writer(struct tdc_mon *m, unsigned i)
+{
+    return &m->shm->w[i];
+}
+
+// Add one event of n raw BRAM words. Only the thread owning c may call it.
+void tdc_mon_fill(struct tdc_mon_counters *c, const uint64_t *words, size_t n);
+
+// Sum of the counter blocks of every writer
+void tdc_mon_sum(const struct tdc_mon *m, struct tdc_mon_counters *sum);
+
+// Update the rates from the counters (owner only, called about once per second)
+void tdc_mon_tick(struct tdc_mon *m);
+
+// Human readable report: event rate and hits per trigger, then rate, share of the hits, mean
+// hits per trigger and fine time spread (max / min bin) of every channel
+void tdc_mon_format(const struct tdc_mon *m, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,96 @@
+/*
+* Time ordering of the hit words of one event (see tdc_order.h)
+*/
+#include <string.h>
+
+#include "tdc_order.h"
+
+#define COARSE_SHIFT    11
+#define COARSE_MASK     ((1u << 28) - 1)
+#define COARSE_HALF     (1u << 27)
+
+// Coarse time of w relative to ref, with ref mapped to the middle of the range so that words
+// up to half the counter range before or after it compare correctly across the wrap
+static inline uint32_t order_key(uint64_t w, uint32_t ref)
+{
+    return ((uint32_t)(w >> COARSE_SHIFT) - ref + COARSE_HALF) & COARSE_MASK;
+}
+
+// Stable LSD radix sort on order_key(), one pass per byte of the key span
+static void radix_sort(uint64_t *words, size_t n, uint64_t *tmp, uint32_t ref)
+{
+    uint32_t kmin = COARSE_MASK, kmax = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t k = order_key(words[i], ref);
+        if (k < kmin)
+            kmin = k;
+        if (k > kmax)
+            kmax = k;
+    }
+
+    uint64_t *src = words, *dst = tmp;
+    for (unsigned shift = 0; shift < 32 && ((kmax - kmin) >> shift) != 0; shift += 8) {
+        size_t count[256] = { 0 };
+        for (size_t i = 0; i < n; i++)
+            count[((order_key(src[i], ref) - kmin) >> shift) & 0xff]++;
+        size_t pos = 0;
+        for (unsigned b = 0; b < 256; b++) {
+            size_t c = count[b];
+            count[b] = pos;
+            pos += c;
+        }
+        for (size_t i = 0; i < n; i++)
+            dst[count[((order_key(src[i], ref) - kmin) >> shift) & 0xff]++] = src[i];
+        uint64_t *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != words)
+        memcpy(words, src, n * sizeof(*words));
+}
+
+enum tdc_order_method tdc_order_hits(uint64_t *words, size_t n, uint64_t *tmp)
+{
+    if (n < 2)
+        return TDC_ORDER_SORTED;
+    uint32_t ref = (uint32_t)(words[0] >> COARSE_SHIFT) & COARSE_MASK;
+
+    // Skip the words already in order
+    size_t i = 1;
+    uint32_t prev = order_key(words[0], ref);
+    for (; i < n; i++) {
+        uint32_t k = order_key(words[i], ref);
+        if (k < prev)
+            break;
+        prev = k;
+    }
+    if (i == n)
+        return TDC_ORDER_SORTED;
+
+    // Insertion pass from the first word out of order, as long as no word is more than
+    // TDC_ORDER_WINDOW places out of place
+    for (; i < n; i++) {
+        uint64_t w = words[i];
+        uint32_t k = order_key(w, ref);
+        if (order_key(words[i - 1], ref) <= k)
+            continue;
+        size_t j = i, lim = i > TDC_ORDER_WINDOW ? i - TDC_ORDER_WINDOW : 0;
+        do {
+            words[j] = words[j - 1];
+            j--;
+        } while (j > lim && order_key(words[j - 1], ref) > k);
+        if (j == lim && lim > 0 && order_key(words[j - 1], ref) > k) {
+            // Too far out of place: put the words back as they were and radix sort
+            memmove(&words[j], &words[j + 1], (i - j) * sizeof(*words));
+            words[i] = w;
+            break;
+        }
+        words[j] = w;
+    }
+    if (i == n)
+        return TDC_ORDER_INSERTION;
+
+    // Equal keys still have their original order, so the radix sort keeps the result stable
+    radix_sort(words, n, tmp, ref);
+    return TDC_ORDER_RADIX;
+}
@@ -0,0 +1,40 @@
+/*
+* Time ordering of the hit words of one event
+*
+* The 64 channels reach the BRAM through three layers of round-robin arbiters and ring buffers
+* (TDC_64ch_2BRAM.vhd), so the words of an event are only roughly in coarse time order: a hit
+* is overtaken by the hits already queued in the other buffers of the tree, a handful in normal
+* running and at most a few hundred when every buffer is full. tdc_order_hits() puts them back
+* in order by exploiting that bound:
+*
+*   - a first pass checks whether the words are already in order (nothing to do)
+*   - otherwise an insertion pass fixes them in place, at a cost proportional to how far each
+*     word is out of place, as long as no word is more than TDC_ORDER_WINDOW places out of place
+*   - beyond that (bursts, or an overflowed BRAM whose oldest hits were overwritten) it finishes
+*     with an LSD radix sort on the coarse time, one pass per byte of the time span of the event
+*
+* The sort key is the 28-bit coarse time relative to the first word of the event, so events that
+* straddle the wrap of the coarse counter (every ~5 s) are ordered correctly as long as they
+* span less than half its range. Words with the same coarse time keep their BRAM order (the
+* sort is stable), and the fine time is not looked at: without a calibration its direction
+* within the clock period is not known.
+*/
+#ifndef TDC_ORDER_H
+#define TDC_ORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Places a word may be moved by the insertion pass before the radix sort takes over
+#define TDC_ORDER_WINDOW    32
+
+enum tdc_order_method {
+    TDC_ORDER_SORTED,       // Already in order, untouched
+    TDC_ORDER_INSERTION,    // Fixed by the insertion pass
+    TDC_ORDER_RADIX,        // Too far out of order, radix sorted
+};
+
+// Sort n hit words in place by coarse time. tmp must hold n words (only used by the radix sort).
+enum tdc_order_method tdc_order_hits(uint64_t *words, size_t n, uint64_t *tmp);
+
+#endif
@@ -0,0 +1,67 @@
+/*
+* Packed hit encoding of the event payload (see tdc_pack.h)
+*/
+#include "tdc_pack.h"
+
+#define HIT_BITS        39
+#define HIT_PAD         (~0ull << HIT_BITS)     // Upper bits, always set in a hit word
+#define LOW_BITS        11                      // Fine time and channel
+#define LOW_MASK        ((1u << LOW_BITS) - 1)
+#define COARSE_MASK     ((1u << 28) - 1)
+#define VARINT_MAX_LEN  6                       // ceil(HIT_BITS / 7)
+
+ssize_t tdc_pack_hits(const uint64_t *words, size_t n, uint8_t *out)
+{
+    uint8_t *p = out;
+    uint32_t prev = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t w = words[i];
+        if ((w & HIT_PAD) != HIT_PAD)
+            return -1;
+        uint32_t coarse = (uint32_t)(w >> LOW_BITS) & COARSE_MASK;
+        uint64_t v = (uint64_t)((coarse - prev) & COARSE_MASK) << LOW_BITS | (w & LOW_MASK);
+        prev = coarse;
+        while (v >= 0x80) {
+            *p++ = (uint8_t)v | 0x80;
+            v >>= 7;
+        }
+        *p++ = (uint8_t)v;
+    }
+    return p - out;
+}
+
+int tdc_unpack_hits(const uint8_t *in, size_t len, uint64_t *words, size_t n)
+{
+    const uint8_t *p = in, *end = in + len;
+    uint32_t prev = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t v;
+        // Fast paths for the 2 and 3 byte hits of an ordered event
+        if (end - p >= 3 && (p[1] & 0x80) == 0 && (p[0] & 0x80)) {
+            v = (p[0] & 0x7f) | (uint64_t)p[1] << 7;
+            p += 2;
+        } else if (end - p >= 3 && (p[2] & 0x80) == 0 && (p[0] & p[1] & 0x80)) {
+            v = (p[0] & 0x7f) | (uint64_t)(p[1] & 0x7f) << 7 | (uint64_t)p[2] << 14;
+            p += 3;
+        } else {
+            unsigned shift = 0;
+            v = 0;
+            while (1) {
+                if (p == end || shift >= 7 * VARINT_MAX_LEN)
+                    return -1;
+                uint8_t b = *p++;
+                v |= (uint64_t)(b & 0x7f) << shift;
+                shift += 7;
+                if (!(b & 0x80))
+                    break;
+            }
+            if (v >> HIT_BITS)
+                return -1;
+        }
+        prev = (prev + (uint32_t)(v >> LOW_BITS)) & COARSE_MASK;
+        words[i] = HIT_PAD | (uint64_t)prev << LOW_BITS | (v & LOW_MASK);
+    }
+    return p == end ? 0 : -1;
+}
@@ -0,0 +1,30 @@
+/*
+* Packed hit encoding of the event payload (see tdc_frame.h, TDC_FRAME_FLAG_PACKED)
+*
+* Every hit is stored as a varint of its coarse time difference to the previous hit, fine time
+* and channel, dropping the always-set upper 25 bits of the BRAM word. The encoding is
+* lossless for any word order, but only compact for events sorted by coarse time
+* (tdc_order.h): a trigger's worth of hits then takes 2 to 3 bytes per hit instead of 8.
+*
+* tdc_pack_hits() may pack in place (out == (uint8_t *)words): hit i is read before any of
+* its bytes are written, and never more than 6 * (i + 1) <= 8 * (i + 1) bytes have been
+* written by then.
+*/
+#ifndef TDC_PACK_H
+#define TDC_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tdc_frame.h"
+
+// Pack n hit words into out, which must hold TDC_FRAME_PACKED_MAX_LEN(n) bytes. Returns the
+// number of bytes written, or -1 if a word is not a hit word (upper 25 bits not all set).
+ssize_t tdc_pack_hits(const uint64_t *words, size_t n, uint8_t *out);
+
+// Unpack exactly n hits from the len bytes at in. Returns 0, or -1 if the payload does not
+// hold exactly n well-formed hits.
+int tdc_unpack_hits(const uint8_t *in, size_t len, uint64_t *words, size_t n);
+
+#endif
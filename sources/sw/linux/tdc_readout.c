@@ -0,0 +1,499 @@
+/*
+* Readout library for the 2 BRAM and N bank TDC firmware (see tdc_readout.h)
+*
+* Uses the following UIO devices with the 2 BRAM firmware:
+*   - uio0: tdc_int                (PL -> PS interrupt)
+*   - uio1: axi_bram_ctrl@a0000000 (BRAM 1)
+*   - uio2: axi_bram_ctrl@a0002000 (BRAM 2)
+*   - uio3: gpio@a0010000          (read_busy, missed trigger count on channel 2)
+*   - uio4: gpio@a0020000          (which_bram, BRAM status on channel 2)
+*
+* and with the N bank firmware:
+*   - uio0: tdc_int                (PL -> PS interrupt)
+*   - uio1: axi_bram_ctrl@a0000000 (all banks, banks * 8 KB)
+*   - uio2: gpio@a0010000          (read_busy, missed trigger count on channel 2)
+*   - uio3: gpio@a0020000          (bank_sel, bank status on channel 2)
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "tdc_readout.h"
+#include "tdc_spsc.h"
+#include "tdc_uio.h"
+#include "tdc_order.h"
+
+// UIO device numbers (/dev/uioN)
+#define UIO_INTR    0
+#define UIO_BRAM1   1
+#define UIO_BRAM2   2
+#define UIO_RDBUSY  3
+#define UIO_BRAMSEL 4
+
+#define UIO_NB_BANKS    1
+#define UIO_NB_RDBUSY   2
+#define UIO_NB_BANKSEL  3
+
+// Memory ranges (from the device tree)
+#define BRAM_LEN        8192                    // 8 KB BRAM
+#define GPIO_LEN        65536                   // AXI GPIO register space
+
+// AXI GPIO data registers (32-bit word offsets)
+#define GPIO_DATA       0                       // channel 1
+#define GPIO2_DATA      2                       // channel 2
+
+// which_bram channel 2: status of the BRAM handed off to the PS, latched by the PL at trigger time
+#define BRAM_STATUS_FILL_MASK   0xffffu         // number of words written
+#define BRAM_STATUS_OVERFLOW    0x80000000u     // BRAM wrapped around, all words are valid
+
+// bank_sel (N bank firmware, channel 1): bank to read out and number of banks queued in the PL,
+// latched by the PL when the interrupt is raised. Channel 2 has the same layout as BRAM_STATUS.
+#define BANK_SEL_BANK_MASK      0xfu
+#define BANK_SEL_QUEUED_SHIFT   4
+#define BANK_SEL_QUEUED_MASK    0xfu
+
+// Reads of the statistics block to wait for the PL to latch the handshake after rd_busy fell
+// (it takes a few clk0 cycles after the GPIO write)
+#define HANDSHAKE_POLLS         16
+
+struct tdc_readout {
+    struct tdc_readout_config cfg;
+
+    // UIO devices, held open for the lifetime of the readout. With the N bank firmware bram1
+    // maps all the banks, bram2 is not used and bramsel is the bank_sel / bank status GPIO.
+    struct uio_dev intr, bram1, bram2, rdbusy, bramsel;
+
+    // Buffer pool and the queues moving buffers between the two threads
+    struct tdc_event *pool;
+    void **full_slots, **free_slots;
+    struct tdc_spsc full;       // IRQ thread -> sender thread
+    struct tdc_spsc free;       // sender thread -> IRQ thread
+
+    int wake_efd;               // Signals the sender (thread or caller) that events were queued
+    int stop_efd;               // Wakes the IRQ thread up to stop
+    atomic_int irq_done;        // IRQ thread has exited, the sender drains the queue and exits
+    pthread_t irq_thread, send_thread;
+    int running;
+
+    // Counters, written by one thread each and read by tdc_readout_get_stats()
+    _Atomic uint64_t triggers, pool_exhausted;
+    _Atomic uint64_t events_sent, send_errors;
+    _Atomic uint32_t queue_high_water, pl_banks_high_water;
+    _Atomic uint64_t lat_n, lat_sum_ns, lat_min_ns, lat_max_ns;
+    atomic_int lat_reset;
+
+    // Trigger accounting, IRQ thread only
+    uint32_t last_count;        // UIO interrupt count of the previous trigger
+    int have_count;             // last_count is valid
+    uint32_t last_missed;       // PL missed trigger count at the previous trigger
+    uint32_t pending_dropped;   // Triggers lost since the last queued event
+    uint32_t last_hs_seq;       // Last handshake read from the statistics block
+    _Atomic uint64_t pl_missed, irq_missed;
+
+    // Scratch for tdc_order_hits(), consumer only
+    uint64_t order_tmp[TDC_READOUT_MAX_WORDS];
+};
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void pin_to_cpu(int cpu, const char *who)
+{
+    cpu_set_t set;
+    if (cpu < 0)
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        fprintf(stderr, "Failed to pin the %s thread to CPU %d\n", who, cpu);
+}
+
+// Service one trigger. Called with the interrupt already received.
+static void readout_trigger(struct tdc_readout *rd, uint32_t count)
+{
+    volatile uint32_t *rdbusy_reg  = (volatile uint32_t *)rd->rdbusy.ptr;
+    volatile uint32_t *bramsel_reg = (volatile uint32_t *)rd->bramsel.ptr;
+    uint64_t t_irq = now_ns();
+    uint64_t t_real = realtime_ns();
+
+    // 1. Raise PS -> PL "read busy" flag
+    rdbusy_reg[GPIO_DATA] = 0x01;
+
+    // 2. Read PL -> PS signal describing which BRAM to read out and its fill count / overflow flag.
+    //    2 BRAM firmware: the BRAM being written to (0b01 = BRAM 1, 0b10 = BRAM 2), read the other one.
+    //    N bank firmware: the oldest queued bank, which is read out of the single banked BRAM.
+    uint32_t sel         = bramsel_reg[GPIO_DATA];
+    uint32_t bram_status = bramsel_reg[GPIO2_DATA];
+    volatile uint64_t *bram;
+    uint16_t bram_id;
+    if (rd->cfg.banks > 0) {
+        uint32_t bank   = sel & BANK_SEL_BANK_MASK;
+        uint32_t queued = (sel >> BANK_SEL_QUEUED_SHIFT) & BANK_SEL_QUEUED_MASK;
+        if (bank >= rd->cfg.banks)
+            bank = 0;
+        bram    = (volatile uint64_t *)rd->bram1.ptr + (size_t)bank * TDC_READOUT_MAX_WORDS;
+        bram_id = bank + 1;
+        if (queued > atomic_load_explicit(&rd->pl_banks_high_water, memory_order_relaxed))
+            atomic_store_explicit(&rd->pl_banks_high_water, queued, memory_order_relaxed);
+    } else if ((sel & 0x3) == 0x1) {
+        bram    = (volatile uint64_t *)rd->bram2.ptr;
+        bram_id = 2;
+    } else {
+        bram    = (volatile uint64_t *)rd->bram1.ptr;
+        bram_id = 1;
+    }
+    uint32_t n_words = bram_status & BRAM_STATUS_FILL_MASK;
+    // Triggers missed by the PL up to this one, latched by the PL before the interrupt
+    uint32_t missed = rdbusy_reg[GPIO2_DATA];
+    if (n_words > TDC_READOUT_MAX_WORDS)
+        n_words = TDC_READOUT_MAX_WORDS;
+
+    // 3. Take a free event buffer. Without one the trigger is still acknowledged so the PL
+    //    clears the BRAM, but its hits are lost.
+    struct tdc_event *ev = tdc_spsc_pop(&rd->free);
+    if (ev != NULL) {
+        // 4. Copy the filled words of the BRAM or bank handed off to the PS. The BRAM is
+        //    mapped as device memory, so use plain 64-bit loads rather than memcpy()
+        for (uint32_t i = 0; i < n_words; i++)
+            ev->words[i] = bram[i];
+    }
+
+    // 5. Lower the read_busy flag
+    rdbusy_reg[GPIO_DATA] = 0x0;
+    uint64_t lat = now_ns() - t_irq;
+
+    atomic_fetch_add_explicit(&rd->triggers, 1, memory_order_relaxed);
+    if (atomic_exchange_explicit(&rd->lat_reset, 0, memory_order_relaxed)) {
+        atomic_store_explicit(&rd->lat_n, 0, memory_order_relaxed);
+        atomic_store_explicit(&rd->lat_sum_ns, 0, memory_order_relaxed);
+        atomic_store_explicit(&rd->lat_min_ns, UINT64_MAX, memory_order_relaxed);
+        atomic_store_explicit(&rd->lat_max_ns, 0, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&rd->lat_n, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&rd->lat_sum_ns, lat, memory_order_relaxed);
+    if (lat < atomic_load_explicit(&rd->lat_min_ns, memory_order_relaxed))
+        atomic_store_explicit(&rd->lat_min_ns, lat, memory_order_relaxed);
+    if (lat > atomic_load_explicit(&rd->lat_max_ns, memory_order_relaxed))
+        atomic_store_explicit(&rd->lat_max_ns, lat, memory_order_relaxed);
+
+    // 6. Read the PL timestamps of this handshake. The PL latches them once it sees rd_busy low,
+    //    and they only change again when rd_busy falls after the next trigger, which this
+    //    thread raises and lowers itself.
+    struct tdc_pl_handshake hs = { 0 };
+    if (rd->cfg.pl_stats != NULL) {
+        for (unsigned i = 0; i < HANDSHAKE_POLLS; i++) {
+            if (tdc_stats_handshake(rd->cfg.pl_stats, rd->last_hs_seq, &hs) == 1) {
+                rd->last_hs_seq = hs.seq;
+                break;
+            }
+        }
+    }
+
+    // Triggers lost since the previous one: missed by the PL while it was busy, and interrupts
+    // that were not serviced one by one (the UIO count moved by more than one)
+    uint32_t pl_gap = missed - rd->last_missed;
+    uint32_t irq_gap = rd->have_count ? count - rd->last_count - 1 : 0;
+    rd->last_missed = missed;
+    rd->last_count = count;
+    rd->have_count = 1;
+    rd->pending_dropped += pl_gap + irq_gap;
+    atomic_fetch_add_explicit(&rd->pl_missed, pl_gap, memory_order_relaxed);
+    atomic_fetch_add_explicit(&rd->irq_missed, irq_gap, memory_order_relaxed);
+
+    if (ev == NULL) {
+        atomic_fetch_add_explicit(&rd->pool_exhausted, 1, memory_order_relaxed);
+        rd->pending_dropped++;
+        return;
+    }
+
+    // Everything below runs after the PL has been released
+    ev->hdr.magic        = TDC_FRAME_MAGIC;
+    ev->hdr.version      = TDC_FRAME_VERSION;
+    ev->hdr.header_len   = sizeof(ev->hdr);
+    ev->hdr.trigger      = count;
+    ev->hdr.bram_id      = bram_id;
+    ev->hdr.flags        = (bram_status & BRAM_STATUS_OVERFLOW) ? TDC_FRAME_FLAG_OVERFLOW : 0;
+    ev->hdr.n_words      = n_words;
+    ev->hdr.missed_trigs = missed;
+    ev->hdr.timestamp_ns = t_real;
+    ev->hdr.n_dropped    = rd->pending_dropped;
+    ev->hdr.packed_len   = 0;
+    ev->pl_hs            = hs;
+    rd->pending_dropped  = 0;
+
+    // Cannot fail: the queue holds as many entries as there are buffers
+    tdc_spsc_push(&rd->full, ev);
+    uint32_t depth = tdc_spsc_count(&rd->full);
+    if (depth > atomic_load_explicit(&rd->queue_high_water, memory_order_relaxed))
+        atomic_store_explicit(&rd->queue_high_water, depth, memory_order_relaxed);
+
+    uint64_t one = 1;
+    if (write(rd->wake_efd, &one, sizeof(one)) != (ssize_t)sizeof(one))
+        perror("Failed to wake up the sender thread");
+}
+
+static void *irq_thread(void *arg)
+{
+    struct tdc_readout *rd = arg;
+    struct pollfd fds[2] = {
+        { .fd = rd->intr.fd,  .events = POLLIN },
+        { .fd = rd->stop_efd, .events = POLLIN },
+    };
+    uint32_t count;
+
+    pin_to_cpu(rd->cfg.irq_cpu, "IRQ");
+    if (rd->cfg.irq_priority > 0) {
+        struct sched_param sp = { .sched_priority = rd->cfg.irq_priority };
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) != 0)
+            fprintf(stderr, "Failed to give the IRQ thread real-time priority %d\n", rd->cfg.irq_priority);
+    }
+    while (1) {
+        if (uio_irq_unmask(&rd->intr) < 0)
+            break;
+        if (poll(fds, 2, -1) < 0) {
+            perror("poll");
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+            break;
+        if (!(fds[0].revents & POLLIN))
+            continue;
+        if (uio_irq_wait(&rd->intr, &count) < 0)
+            break;
+        readout_trigger(rd, count);
+    }
+
+    atomic_store(&rd->irq_done, 1);
+    uint64_t one = 1;
+    if (write(rd->wake_efd, &one, sizeof(one)) != (ssize_t)sizeof(one))
+        perror("Failed to wake up the sender thread");
+    return NULL;
+}
+
+static void *send_thread(void *arg)
+{
+    struct tdc_readout *rd = arg;
+    uint64_t n;
+
+    pin_to_cpu(rd->cfg.send_cpu, "sender");
+    while (1) {
+        struct tdc_event *ev;
+        while ((ev = tdc_readout_next(rd)) != NULL)
+            tdc_readout_release(rd, ev, rd->cfg.send(rd->cfg.send_ctx, ev));
+        // The IRQ thread sets irq_done before its final wake-up, so nothing can be left behind
+        if (atomic_load(&rd->irq_done) && tdc_spsc_count(&rd->full) == 0)
+            break;
+        // Sleep until more events are queued; the eventfd counts, so no wake-up is lost
+        if (read(rd->wake_efd, &n, sizeof(n)) != (ssize_t)sizeof(n)) {
+            perror("Failed to wait for events");
+            break;
+        }
+    }
+    return NULL;
+}
+
+struct tdc_event *tdc_readout_next(struct tdc_readout *rd)
+{
+    struct tdc_event *ev = tdc_spsc_pop(&rd->full);
+    if (ev != NULL && rd->cfg.order) {
+        tdc_order_hits(ev->words, ev->hdr.n_words, rd->order_tmp);
+        ev->hdr.flags |= TDC_FRAME_FLAG_ORDERED;
+    }
+    return ev;
+}
+
+void tdc_readout_release(struct tdc_readout *rd, struct tdc_event *ev, int status)
+{
+    if (status < 0)
+        atomic_fetch_add_explicit(&rd->send_errors, 1, memory_order_relaxed);
+    else
+        atomic_fetch_add_explicit(&rd->events_sent, 1, memory_order_relaxed);
+    // Cannot fail: the queue holds as many entries as there are buffers
+    tdc_spsc_push(&rd->free, ev);
+}
+
+int tdc_readout_fd(struct tdc_readout *rd)
+{
+    return rd->wake_efd;
+}
+
+// Open UIO device n, or the descriptor the caller gave in its place
+static int readout_open(const struct tdc_readout_config *cfg, struct uio_dev *dev, unsigned n, size_t len)
+{
+    char path[16];
+    snprintf(path, sizeof(path), "/dev/uio%u", n);
+    return uio_open_fd(dev, path, (cfg->dev_fds != NULL) ? cfg->dev_fds[n] : -1, len);
+}
+
+struct tdc_readout *tdc_readout_create(const struct tdc_readout_config *cfg)
+{
+    struct tdc_readout *rd;
+    unsigned n = cfg->pool_size;
+
+    if (n == 0 || (n & (n - 1)) != 0) {
+        fprintf(stderr, "tdc_readout: pool size must be a power of two\n");
+        return NULL;
+    }
+    if (cfg->banks == 1 || cfg->banks > TDC_READOUT_MAX_BANKS) {
+        fprintf(stderr, "tdc_readout: the N bank firmware has 2 to %d banks\n", TDC_READOUT_MAX_BANKS);
+        return NULL;
+    }
+    if (posix_memalign((void **)&rd, TDC_CACHE_LINE, sizeof(*rd)) != 0)
+        return NULL;
+    memset(rd, 0, sizeof(*rd));
+    rd->cfg = *cfg;
+    rd->intr.fd = rd->bram1.fd = rd->bram2.fd = rd->rdbusy.fd = rd->bramsel.fd = -1;
+    rd->wake_efd = rd->stop_efd = -1;
+    atomic_store(&rd->lat_min_ns, UINT64_MAX);
+
+    // The whole pool is allocated and touched here, and locked if allowed, so that the IRQ
+    // thread never takes a page fault
+    if (posix_memalign((void **)&rd->pool, TDC_CACHE_LINE, (size_t)n * sizeof(struct tdc_event)) != 0)
+        goto fail;
+    memset(rd->pool, 0, (size_t)n * sizeof(struct tdc_event));
+    if (mlock(rd->pool, (size_t)n * sizeof(struct tdc_event)) != 0)
+        perror("tdc_readout: mlock of the event pool failed, continuing");
+    rd->full_slots = calloc(n, sizeof(void *));
+    rd->free_slots = calloc(n, sizeof(void *));
+    if (rd->full_slots == NULL || rd->free_slots == NULL)
+        goto fail;
+    tdc_spsc_init(&rd->full, rd->full_slots, n);
+    tdc_spsc_init(&rd->free, rd->free_slots, n);
+    for (unsigned i = 0; i < n; i++)
+        tdc_spsc_push(&rd->free, &rd->pool[i]);
+
+    // Without a send callback the caller polls the eventfd from its own event loop
+    rd->wake_efd = eventfd(0, (cfg->send == NULL) ? EFD_NONBLOCK : 0);
+    rd->stop_efd = eventfd(0, 0);
+    if (rd->wake_efd < 0 || rd->stop_efd < 0) {
+        perror("eventfd");
+        goto fail;
+    }
+
+    if (cfg->banks > 0) {
+        if (readout_open(cfg, &rd->intr,    UIO_INTR,       0)                               < 0 ||
+            readout_open(cfg, &rd->bram1,   UIO_NB_BANKS,   (size_t)cfg->banks * BRAM_LEN)   < 0 ||
+            readout_open(cfg, &rd->rdbusy,  UIO_NB_RDBUSY,  GPIO_LEN)                        < 0 ||
+            readout_open(cfg, &rd->bramsel, UIO_NB_BANKSEL, GPIO_LEN)                        < 0)
+            goto fail;
+    } else {
+        if (readout_open(cfg, &rd->intr,    UIO_INTR,    0)        < 0 ||
+            readout_open(cfg, &rd->bram1,   UIO_BRAM1,   BRAM_LEN) < 0 ||
+            readout_open(cfg, &rd->bram2,   UIO_BRAM2,   BRAM_LEN) < 0 ||
+            readout_open(cfg, &rd->rdbusy,  UIO_RDBUSY,  GPIO_LEN) < 0 ||
+            readout_open(cfg, &rd->bramsel, UIO_BRAMSEL, GPIO_LEN) < 0)
+            goto fail;
+    }
+
+    // Make sure the PL is not left waiting on a stale busy flag
+    ((volatile uint32_t *)rd->rdbusy.ptr)[GPIO_DATA] = 0x0;
+    // Only triggers missed from now on count against this run
+    rd->last_missed = ((volatile uint32_t *)rd->rdbusy.ptr)[GPIO2_DATA];
+    // Nor does a handshake completed before it
+    if (cfg->pl_stats != NULL) {
+        struct tdc_pl_handshake hs;
+        tdc_stats_handshake(cfg->pl_stats, 0, &hs);
+        rd->last_hs_seq = hs.seq;
+    }
+    return rd;
+
+fail:
+    tdc_readout_destroy(rd);
+    return NULL;
+}
+
+int tdc_readout_start(struct tdc_readout *rd)
+{
+    atomic_store(&rd->irq_done, 0);
+    if (rd->cfg.send != NULL && pthread_create(&rd->send_thread, NULL, send_thread, rd) != 0) {
+        perror("Failed to start the sender thread");
+        return -1;
+    }
+    if (pthread_create(&rd->irq_thread, NULL, irq_thread, rd) != 0) {
+        perror("Failed to start the IRQ thread");
+        if (rd->cfg.send != NULL) {
+            atomic_store(&rd->irq_done, 1);
+            uint64_t one = 1;
+            if (write(rd->wake_efd, &one, sizeof(one)) < 0)
+                perror("eventfd");
+            pthread_join(rd->send_thread, NULL);
+        }
+        return -1;
+    }
+    rd->running = 1;
+    return 0;
+}
+
+void tdc_readout_stop(struct tdc_readout *rd)
+{
+    uint64_t one = 1;
+    if (!rd->running)
+        return;
+    if (write(rd->stop_efd, &one, sizeof(one)) != (ssize_t)sizeof(one))
+        perror("Failed to stop the IRQ thread");
+    pthread_join(rd->irq_thread, NULL);
+    if (rd->cfg.send != NULL)
+        pthread_join(rd->send_thread, NULL);
+    rd->running = 0;
+}
+
+void tdc_readout_destroy(struct tdc_readout *rd)
+{
+    if (rd == NULL)
+        return;
+    tdc_readout_stop(rd);
+    uio_close(&rd->bramsel);
+    uio_close(&rd->rdbusy);
+    uio_close(&rd->bram2);
+    uio_close(&rd->bram1);
+    uio_close(&rd->intr);
+    if (rd->wake_efd >= 0)
+        close(rd->wake_efd);
+    if (rd->stop_efd >= 0)
+        close(rd->stop_efd);
+    free(rd->full_slots);
+    free(rd->free_slots);
+    free(rd->pool);
+    free(rd);
+}
+
+void tdc_readout_get_stats(struct tdc_readout *rd, struct tdc_readout_stats *s, int reset_latency)
+{
+    s->triggers         = atomic_load_explicit(&rd->triggers, memory_order_relaxed);
+    s->events_sent      = atomic_load_explicit(&rd->events_sent, memory_order_relaxed);
+    s->send_errors      = atomic_load_explicit(&rd->send_errors, memory_order_relaxed);
+    s->pool_exhausted   = atomic_load_explicit(&rd->pool_exhausted, memory_order_relaxed);
+    s->pl_missed        = atomic_load_explicit(&rd->pl_missed, memory_order_relaxed);
+    s->irq_missed       = atomic_load_explicit(&rd->irq_missed, memory_order_relaxed);
+    s->queue_depth      = tdc_spsc_count(&rd->full);
+    s->queue_high_water = atomic_load_explicit(&rd->queue_high_water, memory_order_relaxed);
+    s->pl_banks_high_water = atomic_load_explicit(&rd->pl_banks_high_water, memory_order_relaxed);
+    s->lat_n            = atomic_load_explicit(&rd->lat_n, memory_order_relaxed);
+    s->lat_sum_ns       = atomic_load_explicit(&rd->lat_sum_ns, memory_order_relaxed);
+    s->lat_min_ns       = atomic_load_explicit(&rd->lat_min_ns, memory_order_relaxed);
+    s->lat_max_ns       = atomic_load_explicit(&rd->lat_max_ns, memory_order_relaxed);
+    // Applied by the IRQ thread on the next trigger, so it never races with an update
+    if (reset_latency)
+        atomic_store_explicit(&rd->lat_reset, 1, memory_order_relaxed);
+}
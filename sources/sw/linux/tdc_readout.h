@@ -0,0 +1,120 @@
+/*
+* Readout library for the 2 BRAM and N bank TDC firmware
+*
+* Firmware: on every trigger it accepts, the PL hands a filled BRAM (2 BRAM firmware,
+* TDC_64ch_2BRAM) or bank (N bank firmware, TDC_64ch_NBANK, struct tdc_readout_config::banks
+* > 0) over to the PS and raises the interrupt; the PS raises rd_busy, reads the filled words
+* and lowers rd_busy to hand it back. The N bank firmware queues up to banks-1 filled banks and
+* interrupts once per bank, oldest first, so the handshake is the same for both; only where the
+* words are and the status registers differ. The devices are /dev/uio0-4 (see tdc_readout.c),
+* or the descriptors in struct tdc_readout_config::dev_fds, e.g. of the emulator (tdc_emu.h).
+*
+* Threads: the IRQ thread does nothing but the handshake, so a slow consumer (e.g. a TCP peer)
+* can never stretch the time rd_busy is held high. It waits for the interrupt, raises rd_busy,
+* copies the filled words into a free event buffer, lowers rd_busy and queues the event. It can
+* be pinned to its own core and run with a real-time priority (struct tdc_readout_config). The
+* events are consumed either by a sender thread calling the send callback, or from the caller's
+* own event loop: leave send NULL, wait for tdc_readout_fd() to become readable (read it to
+* clear it), take events with tdc_readout_next() and hand each one back with
+* tdc_readout_release() once it has been sent. Only one thread may consume events.
+*
+* Buffers: all event buffers are allocated up front and travel between the IRQ thread and the
+* consumer through a pair of lock-free SPSC queues (tdc_spsc.h), so the IRQ path makes no
+* allocation and takes no lock. When no free buffer is left, the trigger is still acknowledged
+* but its hits are discarded and counted in pool_exhausted; with the queue high-water mark this
+* tells how large the pool must be for a given trigger rate and consumer speed. Every trigger
+* that did not produce an event (missed by the PL, interrupt not seen, no free buffer) is added
+* to n_dropped of the next event (tdc_frame.h). With the N bank firmware, the largest number of
+* banks seen queued in the PL tells how close a trigger burst came to dead time.
+*
+* Options: with order set, every event is sorted by coarse time (tdc_order.h) on the consumer
+* side, in tdc_readout_next(), so the dead time is not affected, and carries
+* TDC_FRAME_FLAG_ORDERED. With the statistics block of the 2 BRAM firmware (pl_stats), the IRQ
+* thread also reads the PL timestamps of every handshake (tdc_stats.h) after lowering rd_busy
+* and hands them over with the event.
+*/
+#ifndef TDC_READOUT_H
+#define TDC_READOUT_H
+
+#include <stdint.h>
+
+#include "tdc_frame.h"
+#include "tdc_stats.h"
+
+// Words in one BRAM (or one bank of the N bank firmware)
+#define TDC_READOUT_MAX_WORDS   1024
+
+// Largest number of banks the N bank firmware can be built with
+#define TDC_READOUT_MAX_BANKS   16
+
+// UIO devices used by the readout, /dev/uio0 to /dev/uio4 (see tdc_readout.c)
+#define TDC_READOUT_DEVS        5
+
+// One event: the frame header followed by the hit words, ready to be sent as is
+struct tdc_event {
+    struct tdc_frame_header hdr;
+    uint64_t words[TDC_READOUT_MAX_WORDS];
+    struct tdc_pl_handshake pl_hs;      // PL timestamps of its handshake (not sent), seq 0 => not timed
+};
+
+// Called by the sender thread for every event. Return < 0 to report a failed send.
+typedef int (*tdc_send_fn)(void *ctx, const struct tdc_event *ev);
+
+struct tdc_readout_config {
+    unsigned pool_size;     // Number of event buffers, must be a power of two
+    unsigned banks;         // Banks of the N bank firmware (g_banks), 0 => 2 BRAM firmware
+    int irq_cpu;            // Core for the IRQ thread, -1 => not pinned
+    int irq_priority;       // SCHED_FIFO priority of the IRQ thread, 0 => normal scheduling
+    int send_cpu;           // Core for the sender thread, -1 => not pinned
+    tdc_send_fn send;       // NULL => no sender thread, the caller consumes the events
+    void *send_ctx;
+    int order;              // Sort the words of every event by coarse time
+    struct uio_dev *pl_stats;   // Statistics block to read the handshake timestamps from, NULL => none
+    const int *dev_fds;     // NULL => open /dev/uioN, else open descriptors to use in their place,
+                            // indexed by N (TDC_READOUT_DEVS entries, see tdc_emu_fds())
+};
+
+struct tdc_readout_stats {
+    uint64_t triggers;          // Interrupts serviced
+    uint64_t events_sent;       // Events passed to the send callback
+    uint64_t send_errors;       // Send callback returned < 0
+    uint64_t pool_exhausted;    // Triggers whose hits were discarded, no free buffer
+    uint64_t pl_missed;         // Triggers missed by the PL (previous readout not finished)
+    uint64_t irq_missed;        // Interrupts not serviced one by one (gaps in the UIO count)
+    uint32_t queue_depth;       // Events waiting for the sender right now
+    uint32_t queue_high_water;  // Largest queue depth seen since start
+    uint32_t pl_banks_high_water; // Most banks seen queued in the PL at an interrupt (N bank firmware)
+    // Interrupt -> busy low latency since the last reset (see tdc_readout_get_stats)
+    uint64_t lat_n;
+    uint64_t lat_sum_ns;
+    uint64_t lat_min_ns;
+    uint64_t lat_max_ns;
+};
+
+struct tdc_readout;
+
+// Allocate the buffer pool and open/map the UIO devices. Returns NULL on error.
+struct tdc_readout *tdc_readout_create(const struct tdc_readout_config *cfg);
+
+// Start the IRQ and sender threads. Returns 0, or -1 on error.
+int tdc_readout_start(struct tdc_readout *rd);
+
+// Stop both threads; events still queued are sent first (by the sender thread, if there is one)
+void tdc_readout_stop(struct tdc_readout *rd);
+
+// Release the UIO devices and the buffer pool (stops the threads if needed)
+void tdc_readout_destroy(struct tdc_readout *rd);
+
+// Without a send callback: non-blocking eventfd that becomes readable when events are queued
+int tdc_readout_fd(struct tdc_readout *rd);
+
+// Oldest queued event, or NULL if there is none
+struct tdc_event *tdc_readout_next(struct tdc_readout *rd);
+
+// Return an event taken with tdc_readout_next() to the pool. status < 0 counts a send error.
+void tdc_readout_release(struct tdc_readout *rd, struct tdc_event *ev, int status);
+
+// Snapshot of the counters. If reset_latency is set, the latency statistics start over.
+void tdc_readout_get_stats(struct tdc_readout *rd, struct tdc_readout_stats *s, int reset_latency);
+
+#endif
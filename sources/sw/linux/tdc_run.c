@@ -0,0 +1,594 @@
+/*
+* Run files: event frames stored in blocks with a trailing index (see tdc_run.h)
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tdc_run.h"
+#include "tdc_spsc.h"
+
+#define DEFAULT_BLOCKS  8
+
+#define ALIGN_UP(x, a)  (((x) + (a) - 1) & ~((uint64_t)(a) - 1))
+
+// One block buffer
+struct block {
+    uint8_t *buf;               // block_size bytes, TDC_RUN_ALIGN aligned
+    uint32_t len;               // Bytes to write
+    uint64_t offset;            // File offset
+};
+
+struct tdc_run_writer {
+    struct tdc_run_writer_config cfg;
+    int fd;
+    atomic_int direct;
+    int efd;                    // Blocks queued for the writer thread
+    atomic_int stop;
+    pthread_t thread;
+    int running;
+
+    struct block *pool;
+    void **full_slots, **free_slots;
+    struct tdc_spsc full;       // caller -> writer thread
+    struct tdc_spsc free;       // writer thread -> caller
+
+    // Caller only
+    struct block *cur;          // Block being filled, NULL if none
+    uint32_t used;
+    uint64_t next_off;
+    uint64_t seq;
+    uint64_t trigger;           // Extended trigger of the last frame
+    int have_trigger;
+    struct tdc_run_index *index;
+    size_t n_index, index_cap;
+    size_t block_index;         // First index entry of the current block
+    int index_lost;             // An entry could not be stored, no index is written
+
+    _Atomic uint64_t frames, bytes, dropped, blocks, write_errors;
+    _Atomic uint32_t queue_high_water;
+};
+
+static inline uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Write len bytes at off. O_DIRECT is dropped if the file system turns out not to support it
+// for this write. Returns 0, or -1 on error.
+static int write_at(struct tdc_run_writer *w, const uint8_t *buf, size_t len, uint64_t off)
+{
+    while (len > 0) {
+        ssize_t n = pwrite(w->fd, buf, len, (off_t)off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EINVAL && atomic_load(&w->direct)) {
+            fprintf(stderr, "tdc_run: O_DIRECT writes not supported for %s, using buffered writes\n", w->cfg.path);
+            fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT);
+            atomic_store(&w->direct, 0);
+            continue;
+        }
+        if (n <= 0) {
+            fprintf(stderr, "tdc_run: write to %s failed: %s\n", w->cfg.path, n < 0 ? strerror(errno) : "no space");
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+static void *writer_thread(void *arg)
+{
+    struct tdc_run_writer *w = arg;
+    struct block *b;
+    uint64_t n;
+
+    if (w->cfg.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cfg.cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            fprintf(stderr, "Failed to pin the run file writer thread to CPU %d\n", w->cfg.cpu);
+    }
+    while (1) {
+        // Blocks are queued before stop is set, so the last pass picks all of them up
+        int stop = atomic_load(&w->stop);
+        while ((b = tdc_spsc_pop(&w->full)) != NULL) {
+            if (write_at(w, b->buf, b->len, b->offset) < 0)
+                atomic_fetch_add_explicit(&w->write_errors, 1, memory_order_relaxed);
+            else
+                atomic_fetch_add_explicit(&w->blocks, 1, memory_order_relaxed);
+            tdc_spsc_push(&w->free, b);
+        }
+        if (stop)
+            break;
+        if (read(w->efd, &n, sizeof(n)) < 0 && errno != EINTR) {
+            perror("tdc_run: eventfd");
+            break;
+        }
+    }
+    return NULL;
+}
+
+struct tdc_run_writer *tdc_run_writer_create(const struct tdc_run_writer_config *cfg)
+{
+    struct tdc_run_writer *w = calloc(1, sizeof(*w));
+    uint8_t *page = NULL;
+
+    if (w == NULL)
+        return NULL;
+    w->cfg = *cfg;
+    if (w->cfg.block_size == 0)
+        w->cfg.block_size = TDC_RUN_BLOCK_SIZE;
+    if (w->cfg.n_blocks == 0)
+        w->cfg.n_blocks = DEFAULT_BLOCKS;
+    w->fd = w->efd = -1;
+    if (w->cfg.block_size % TDC_RUN_ALIGN != 0 || w->cfg.block_size < 2 * TDC_RUN_ALIGN) {
+        fprintf(stderr, "tdc_run: the block size must be a multiple of %d bytes, at least %d\n",
+                TDC_RUN_ALIGN, 2 * TDC_RUN_ALIGN);
+        goto fail;
+    }
+
+    // The queues need a power of two, the pool holds exactly n_blocks buffers
+    unsigned qcap = 1;
+    while (qcap < w->cfg.n_blocks)
+        qcap <<= 1;
+    w->pool = calloc(w->cfg.n_blocks, sizeof(struct block));
+    w->full_slots = calloc(qcap, sizeof(void *));
+    w->free_slots = calloc(qcap, sizeof(void *));
+    if (w->pool == NULL || w->full_slots == NULL || w->free_slots == NULL)
+        goto fail_alloc;
+    tdc_spsc_init(&w->full, w->full_slots, qcap);
+    tdc_spsc_init(&w->free, w->free_slots, qcap);
+    for (unsigned i = 0; i < w->cfg.n_blocks; i++) {
+        if (posix_memalign((void **)&w->pool[i].buf, TDC_RUN_ALIGN, w->cfg.block_size) != 0) {
+            w->pool[i].buf = NULL;
+            goto fail_alloc;
+        }
+        tdc_spsc_push(&w->free, &w->pool[i]);
+    }
+    if (posix_memalign((void **)&page, TDC_RUN_ALIGN, TDC_RUN_ALIGN) != 0) {
+        page = NULL;
+        goto fail_alloc;
+    }
+
+    w->fd = open(w->cfg.path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (w->fd >= 0)
+        w->direct = 1;
+    else if (errno == EINVAL)
+        w->fd = open(w->cfg.path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) {
+        fprintf(stderr, "tdc_run: failed to create %s: %s\n", w->cfg.path, strerror(errno));
+        goto fail;
+    }
+
+    memset(page, 0, TDC_RUN_ALIGN);
+    struct tdc_run_header *hdr = (struct tdc_run_header *)page;
+    hdr->magic      = TDC_RUN_MAGIC;
+    hdr->version    = TDC_RUN_VERSION;
+    hdr->header_len = TDC_RUN_ALIGN;
+    hdr->block_size = w->cfg.block_size;
+    hdr->start_ns   = realtime_ns();
+    if (write_at(w, page, TDC_RUN_ALIGN, 0) < 0)
+        goto fail;
+    w->next_off = TDC_RUN_ALIGN;
+    free(page);
+    page = NULL;
+
+    w->efd = eventfd(0, 0);
+    if (w->efd < 0) {
+        perror("eventfd");
+        goto fail;
+    }
+    if (pthread_create(&w->thread, NULL, writer_thread, w) != 0) {
+        perror("Failed to start the run file writer thread");
+        goto fail;
+    }
+    w->running = 1;
+    return w;
+
+fail_alloc:
+    fprintf(stderr, "tdc_run: failed to allocate %u blocks of %u bytes\n", w->cfg.n_blocks, w->cfg.block_size);
+fail:
+    free(page);
+    tdc_run_writer_close(w);
+    return NULL;
+}
+
+// New index entry for the chunk starting with a frame at off in the current block, NULL if
+// there is no memory for it
+static struct tdc_run_index *chunk_start(struct tdc_run_writer *w, uint32_t off)
+{
+    if (w->n_index == w->index_cap) {
+        size_t cap = w->index_cap ? 2 * w->index_cap : 16384;
+        struct tdc_run_index *index = realloc(w->index, cap * sizeof(*index));
+        if (index != NULL) {
+            w->index = index;
+            w->index_cap = cap;
+        }
+    }
+    // Without the entry the file is still readable, its index is then rebuilt on open
+    w->index_lost |= w->n_index == w->index_cap;
+    if (w->index_lost)
+        return NULL;
+    struct tdc_run_index *ix = &w->index[w->n_index++];
+    memset(ix, 0, sizeof(*ix));
+    ix->frame_off = off;
+    return ix;
+}
+
+// Hand the current block to the writer thread
+static void submit(struct tdc_run_writer *w)
+{
+    struct block *b = w->cur;
+    struct tdc_run_block *bh = (struct tdc_run_block *)b->buf;
+    uint64_t one = 1;
+
+    w->cur = NULL;
+    b->len = (uint32_t)ALIGN_UP(w->used, TDC_RUN_ALIGN);
+    memset(b->buf + w->used, 0, b->len - w->used);
+    bh->len    = b->len;
+    bh->used   = w->used;
+    b->offset  = w->next_off;
+    w->next_off += b->len;
+
+    // The chunks of the block only learn where it goes now
+    for (size_t i = w->block_index; i < w->n_index; i++) {
+        w->index[i].offset = b->offset;
+        w->index[i].len    = b->len;
+    }
+
+    // Cannot fail: the queue holds as many entries as there are buffers
+    tdc_spsc_push(&w->full, b);
+    uint32_t depth = tdc_spsc_count(&w->full);
+    if (depth > atomic_load_explicit(&w->queue_high_water, memory_order_relaxed))
+        atomic_store_explicit(&w->queue_high_water, depth, memory_order_relaxed);
+    if (write(w->efd, &one, sizeof(one)) != (ssize_t)sizeof(one))
+        perror("tdc_run: eventfd");
+}
+
+int tdc_run_write(struct tdc_run_writer *w, const struct tdc_frame_header *hdr, const void *payload)
+{
+    size_t plen = tdc_frame_payload_len(hdr);
+    size_t len = hdr->header_len + plen;
+    size_t stride = ALIGN_UP(len, 8);
+
+    // The trigger is extended even for dropped frames, so that it stays right after a gap
+    uint64_t trigger = w->have_trigger ? w->trigger + (uint32_t)(hdr->trigger - (uint32_t)w->trigger) : hdr->trigger;
+    w->trigger = trigger;
+    w->have_trigger = 1;
+
+    if (sizeof(struct tdc_run_block) + stride > w->cfg.block_size) {
+        atomic_fetch_add_explicit(&w->dropped, 1, memory_order_relaxed);
+        return -1;
+    }
+    if (w->cur != NULL && w->used + stride > w->cfg.block_size)
+        submit(w);
+    if (w->cur == NULL) {
+        w->cur = tdc_spsc_pop(&w->free);
+        if (w->cur == NULL) {
+            atomic_fetch_add_explicit(&w->dropped, 1, memory_order_relaxed);
+            return -1;
+        }
+        struct tdc_run_block *bh = (struct tdc_run_block *)w->cur->buf;
+        memset(bh, 0, sizeof(*bh));
+        bh->magic = TDC_RUN_BLOCK_MAGIC;
+        bh->seq   = w->seq++;
+        w->used   = sizeof(*bh);
+        w->block_index = w->n_index;
+    }
+
+    struct tdc_run_block *bh = (struct tdc_run_block *)w->cur->buf;
+    struct tdc_run_index *ix = NULL;
+    if (bh->n_frames % TDC_RUN_CHUNK_FRAMES == 0)
+        ix = chunk_start(w, w->used);
+    else if (!w->index_lost)
+        ix = &w->index[w->n_index - 1];
+    uint8_t *p = w->cur->buf + w->used;
+    memcpy(p, hdr, hdr->header_len);
+    memcpy(p + hdr->header_len, payload, plen);
+    memset(p + len, 0, stride - len);
+    w->used += (uint32_t)stride;
+
+    if (bh->n_frames++ == 0) {
+        bh->first_trigger = trigger;
+        bh->first_ns      = hdr->timestamp_ns;
+    }
+    bh->last_trigger = trigger;
+    bh->last_ns      = hdr->timestamp_ns;
+    if (ix != NULL) {
+        if (ix->n_frames++ == 0) {
+            ix->first_trigger = trigger;
+            ix->first_ns      = hdr->timestamp_ns;
+        }
+        ix->last_trigger = trigger;
+        ix->last_ns      = hdr->timestamp_ns;
+    }
+    atomic_fetch_add_explicit(&w->frames, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&w->bytes, len, memory_order_relaxed);
+    return 0;
+}
+
+void tdc_run_flush(struct tdc_run_writer *w)
+{
+    if (w->cur != NULL && w->used > sizeof(struct tdc_run_block))
+        submit(w);
+}
+
+void tdc_run_writer_get_stats(struct tdc_run_writer *w, struct tdc_run_writer_stats *s)
+{
+    s->frames           = atomic_load_explicit(&w->frames, memory_order_relaxed);
+    s->bytes            = atomic_load_explicit(&w->bytes, memory_order_relaxed);
+    s->dropped          = atomic_load_explicit(&w->dropped, memory_order_relaxed);
+    s->blocks           = atomic_load_explicit(&w->blocks, memory_order_relaxed);
+    s->write_errors     = atomic_load_explicit(&w->write_errors, memory_order_relaxed);
+    s->queue_high_water = atomic_load_explicit(&w->queue_high_water, memory_order_relaxed);
+    s->direct           = atomic_load(&w->direct);
+}
+
+// Index and trailer, after the last block
+static int write_index(struct tdc_run_writer *w)
+{
+    size_t ilen = w->n_index * sizeof(struct tdc_run_index);
+    size_t len = ALIGN_UP(ilen + sizeof(struct tdc_run_trailer), TDC_RUN_ALIGN);
+    uint8_t *buf;
+
+    if (posix_memalign((void **)&buf, TDC_RUN_ALIGN, len) != 0) {
+        fprintf(stderr, "tdc_run: no memory for the index of %s, it will be rebuilt on open\n", w->cfg.path);
+        return -1;
+    }
+    memset(buf, 0, len);
+    if (ilen > 0)
+        memcpy(buf, w->index, ilen);
+    struct tdc_run_trailer *t = (struct tdc_run_trailer *)(buf + len - sizeof(*t));
+    t->magic        = TDC_RUN_INDEX_MAGIC;
+    t->index_offset = w->next_off;
+    t->n_index      = w->n_index;
+    t->n_frames     = atomic_load(&w->frames);
+    t->dropped      = atomic_load(&w->dropped);
+    t->end_ns       = realtime_ns();
+    int ret = write_at(w, buf, len, w->next_off);
+    free(buf);
+    return ret;
+}
+
+int tdc_run_writer_close(struct tdc_run_writer *w)
+{
+    int ret = 0;
+    uint64_t one = 1;
+
+    if (w == NULL)
+        return 0;
+    if (w->running) {
+        tdc_run_flush(w);
+        atomic_store(&w->stop, 1);
+        if (write(w->efd, &one, sizeof(one)) != (ssize_t)sizeof(one))
+            perror("tdc_run: eventfd");
+        pthread_join(w->thread, NULL);
+        // A block that could not be written leaves a hole; the index would point into it
+        if (atomic_load(&w->write_errors) == 0 && !w->index_lost && write_index(w) < 0)
+            ret = -1;
+        if (atomic_load(&w->write_errors) != 0 || fdatasync(w->fd) < 0)
+            ret = -1;
+    }
+    if (w->fd >= 0)
+        close(w->fd);
+    if (w->efd >= 0)
+        close(w->efd);
+    for (unsigned i = 0; w->pool != NULL && i < w->cfg.n_blocks; i++)
+        free(w->pool[i].buf);
+    free(w->pool);
+    free(w->full_slots);
+    free(w->free_slots);
+    free(w->index);
+    free(w);
+    return ret;
+}
+
+/*
+* Reader
+*/
+
+// Index entries from the block headers, one per block, for a file without a valid trailer
+static int rebuild_index(struct tdc_run *r)
+{
+    size_t cap = 0;
+    uint64_t off = r->hdr->header_len;
+
+    r->n_index = r->n_frames = 0;
+    while (off + sizeof(struct tdc_run_block) <= r->len) {
+        const struct tdc_run_block *bh = (const struct tdc_run_block *)(r->map + off);
+        if (bh->magic != TDC_RUN_BLOCK_MAGIC || bh->len < sizeof(*bh) || bh->len % TDC_RUN_ALIGN != 0 ||
+            bh->used > bh->len || off + bh->len > r->len)
+            break;      // Index, or the block being written when the writer stopped
+        if (r->n_index == cap) {
+            cap = cap ? 2 * cap : 1024;
+            struct tdc_run_index *index = realloc(r->rebuilt, cap * sizeof(*index));
+            if (index == NULL) {
+                fprintf(stderr, "tdc_run: no memory to rebuild the index\n");
+                return -1;
+            }
+            r->rebuilt = index;
+        }
+        struct tdc_run_index *ix = &r->rebuilt[r->n_index++];
+        ix->offset        = off;
+        ix->len           = bh->len;
+        ix->n_frames      = bh->n_frames;
+        ix->frame_off     = sizeof(*bh);
+        ix->reserved      = 0;
+        ix->first_trigger = bh->first_trigger;
+        ix->last_trigger  = bh->last_trigger;
+        ix->first_ns      = bh->first_ns;
+        ix->last_ns       = bh->last_ns;
+        r->n_frames += bh->n_frames;
+        off += bh->len;
+    }
+    r->index = r->rebuilt;
+    r->recovered = 1;
+    return 0;
+}
+
+int tdc_run_open(struct tdc_run *r, const char *path)
+{
+    struct stat st;
+
+    memset(r, 0, sizeof(*r));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(struct tdc_run_header)) {
+        fprintf(stderr, "%s is not a run file\n", path);
+        close(fd);
+        return -1;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    r->map = p;
+    r->len = st.st_size;
+    r->hdr = p;
+    if (r->hdr->magic != TDC_RUN_MAGIC || r->hdr->version != TDC_RUN_VERSION ||
+        r->hdr->header_len < sizeof(struct tdc_run_header) || r->hdr->header_len > r->len) {
+        fprintf(stderr, "%s is not a version %d run file\n", path, TDC_RUN_VERSION);
+        tdc_run_close(r);
+        return -1;
+    }
+
+    const struct tdc_run_trailer *t = (const struct tdc_run_trailer *)(r->map + r->len - sizeof(*t));
+    if (r->len >= r->hdr->header_len + sizeof(*t) && t->magic == TDC_RUN_INDEX_MAGIC &&
+        t->index_offset >= r->hdr->header_len && t->n_index <= r->len / sizeof(struct tdc_run_index) &&
+        t->index_offset + t->n_index * sizeof(struct tdc_run_index) <= r->len - sizeof(*t)) {
+        r->index    = (const struct tdc_run_index *)(r->map + t->index_offset);
+        r->n_index  = t->n_index;
+        r->n_frames = t->n_frames;
+    } else if (rebuild_index(r) < 0) {
+        tdc_run_close(r);
+        return -1;
+    }
+    return 0;
+}
+
+void tdc_run_close(struct tdc_run *r)
+{
+    if (r->map != NULL)
+        munmap((void *)r->map, r->len);
+    free(r->rebuilt);
+    memset(r, 0, sizeof(*r));
+}
+
+// Cursor at the first frame of index entry e
+static void cursor_at(const struct tdc_run *r, uint64_t e, struct tdc_run_cursor *c)
+{
+    memset(c, 0, sizeof(*c));
+    c->entry = e;
+    c->off = (e < r->n_index) ? r->index[e].frame_off : 0;
+}
+
+void tdc_run_rewind(const struct tdc_run *r, struct tdc_run_cursor *c)
+{
+    cursor_at(r, 0, c);
+}
+
+int tdc_run_next(const struct tdc_run *r, struct tdc_run_cursor *c, struct tdc_run_frame *f)
+{
+    while (c->entry < r->n_index && c->frame >= r->index[c->entry].n_frames)
+        cursor_at(r, c->entry + 1, c);
+    if (c->entry >= r->n_index)
+        return -1;
+
+    const struct tdc_run_index *ix = &r->index[c->entry];
+    if (ix->offset + ix->len > r->len)
+        return -1;
+    const struct tdc_run_block *bh = (const struct tdc_run_block *)(r->map + ix->offset);
+    const struct tdc_frame_header *hdr = (const struct tdc_frame_header *)((const uint8_t *)bh + c->off);
+    if (bh->used > ix->len || c->off + TDC_FRAME_HEADER_V1_LEN > bh->used || tdc_frame_check(hdr) < 0)
+        return -1;
+    size_t len = hdr->header_len + tdc_frame_payload_len(hdr);
+    if (c->off + len > bh->used)
+        return -1;
+
+    f->hdr     = hdr;
+    f->payload = (const uint8_t *)hdr + hdr->header_len;
+    f->trigger = (c->frame == 0) ? ix->first_trigger : c->trigger + (uint32_t)(hdr->trigger - (uint32_t)c->trigger);
+    c->trigger = f->trigger;
+    c->off    += (uint32_t)ALIGN_UP(len, 8);
+    c->frame++;
+    return 0;
+}
+
+// Cursor at the first frame of index entry e (or later) for which after() is true
+static int seek(const struct tdc_run *r, uint64_t e, struct tdc_run_cursor *c,
+                int (*after)(const struct tdc_run_frame *, uint64_t), uint64_t key)
+{
+    struct tdc_run_frame f;
+    struct tdc_run_cursor prev;
+
+    cursor_at(r, e, c);
+    do {
+        prev = *c;
+        if (tdc_run_next(r, c, &f) < 0)
+            return -1;
+    } while (!after(&f, key));
+    // prev also holds the extended trigger of the frame before, so the walk continues exactly
+    *c = prev;
+    return 0;
+}
+
+static int trigger_after(const struct tdc_run_frame *f, uint64_t trigger)
+{
+    return f->trigger >= trigger;
+}
+
+static int time_after(const struct tdc_run_frame *f, uint64_t t_ns)
+{
+    return f->hdr->timestamp_ns >= t_ns;
+}
+
+int tdc_run_find_trigger(const struct tdc_run *r, uint64_t trigger, struct tdc_run_cursor *c)
+{
+    // First chunk whose last trigger is at or after trigger
+    uint64_t lo = 0, hi = r->n_index;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (r->index[mid].last_trigger < trigger)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return seek(r, lo, c, trigger_after, trigger);
+}
+
+int tdc_run_find_time(const struct tdc_run *r, uint64_t t_ns, struct tdc_run_cursor *c)
+{
+    uint64_t lo = 0, hi = r->n_index;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (r->index[mid].last_ns < t_ns)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return seek(r, lo, c, time_after, t_ns);
+}
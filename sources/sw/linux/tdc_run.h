@@ -0,0 +1,181 @@
+/*
+* Run files: event frames stored in blocks with a trailing index, for local recording
+*
+* A run file keeps every frame exactly as sent on the network (tdc_frame.h), so the board can
+* record a run to its own storage while the DAQ host is unreachable, and offline analysis can
+* seek straight to a trigger or a time instead of rescanning the whole run.
+*
+* File layout (little endian, every part a multiple of TDC_RUN_ALIGN bytes):
+*   struct tdc_run_header, padded to TDC_RUN_ALIGN
+*   blocks, each:
+*     struct tdc_run_block
+*     n_frames x { frame header, payload, padded to 8 bytes }
+*     padding to TDC_RUN_ALIGN
+*   index: n_index x struct tdc_run_index, padding, struct tdc_run_trailer at the very end
+*
+* The index has one entry per chunk of up to TDC_RUN_CHUNK_FRAMES consecutive frames of a block
+* (first/last trigger and time, block and frame offsets), a few bytes per frame, so a lookup is
+* a binary search over the chunks and a walk through at most TDC_RUN_CHUNK_FRAMES frames,
+* however large the blocks. Triggers are the frame trigger counts extended to 64 bits across
+* wraparound. Times are the frame timestamps (CLOCK_REALTIME), assumed not to go backwards.
+*
+* Writer: the caller (e.g. the daemon event loop) copies frames into the current block, which
+* is handed to a writer thread when full and written with one large aligned pwrite(), with
+* O_DIRECT where the file system supports it so that a long run does not churn the page cache.
+* Block buffers are allocated up front and travel between the two threads through a pair of
+* SPSC queues (tdc_spsc.h), like the event buffers of the readout library. If the storage
+* falls behind until every buffer is queued, frames are dropped and counted, never waited for.
+* tdc_run_flush() writes a partly filled block (call it every second or so), so a crash loses
+* at most that much.
+*
+* Reader: the file is mapped read-only. A file without a valid trailer (writer killed, power
+* lost) is still readable: its index is rebuilt by walking the block headers, one entry per
+* block.
+*
+* All functions print what failed to stderr and return -1 on error.
+*/
+#ifndef TDC_RUN_H
+#define TDC_RUN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tdc_frame.h"
+
+#define TDC_RUN_MAGIC           0x52434454u     // "TDCR" when read as bytes
+#define TDC_RUN_BLOCK_MAGIC     0x42434454u     // "TDCB"
+#define TDC_RUN_INDEX_MAGIC     0x49434454u     // "TDCI"
+#define TDC_RUN_VERSION         2               // 1: one index entry per block
+#define TDC_RUN_ALIGN           4096            // O_DIRECT alignment of every write
+#define TDC_RUN_BLOCK_SIZE      (4u << 20)      // Default block size
+#define TDC_RUN_CHUNK_FRAMES    64              // Most frames per index entry
+
+struct tdc_run_header {
+    uint32_t magic;             // TDC_RUN_MAGIC
+    uint16_t version;           // TDC_RUN_VERSION
+    uint16_t header_len;        // Bytes before the first block (TDC_RUN_ALIGN)
+    uint32_t block_size;        // Nominal block size; the last, flushed blocks can be shorter
+    uint32_t reserved;
+    uint64_t start_ns;          // CLOCK_REALTIME when the file was created
+} __attribute__((packed));
+
+struct tdc_run_block {
+    uint32_t magic;             // TDC_RUN_BLOCK_MAGIC
+    uint32_t len;               // Bytes of the block, this header and padding included
+    uint32_t n_frames;
+    uint32_t used;              // Bytes of this header and the frames
+    uint64_t seq;               // Block number
+    uint64_t first_trigger;     // Extended trigger of the first frame
+    uint64_t last_trigger;
+    uint64_t first_ns;          // Timestamp of the first frame
+    uint64_t last_ns;
+    uint64_t reserved;
+} __attribute__((packed));
+
+struct tdc_run_index {
+    uint64_t offset;            // File offset of the block
+    uint32_t len;               // Bytes of the block
+    uint32_t n_frames;          // Frames of the chunk
+    uint32_t frame_off;         // Offset of the first frame of the chunk in the block
+    uint32_t reserved;
+    uint64_t first_trigger;
+    uint64_t last_trigger;
+    uint64_t first_ns;
+    uint64_t last_ns;
+} __attribute__((packed));
+
+struct tdc_run_trailer {
+    uint32_t magic;             // TDC_RUN_INDEX_MAGIC
+    uint32_t reserved;
+    uint64_t index_offset;      // File offset of the first struct tdc_run_index
+    uint64_t n_index;           // Index entries
+    uint64_t n_frames;          // Frames in the whole file
+    uint64_t dropped;           // Frames the writer had to drop
+    uint64_t end_ns;            // CLOCK_REALTIME when the file was closed
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct tdc_run_header) <= TDC_RUN_ALIGN, "tdc_run_header must fit its page");
+_Static_assert(sizeof(struct tdc_run_block) == 64, "tdc_run_block must be 64 bytes");
+_Static_assert(sizeof(struct tdc_run_index) == 56, "tdc_run_index must be 56 bytes");
+
+/*
+* Writer
+*/
+struct tdc_run_writer_config {
+    const char *path;           // Created, or truncated if it exists
+    uint32_t block_size;        // Multiple of TDC_RUN_ALIGN, 0 => TDC_RUN_BLOCK_SIZE; must hold the largest frame
+    unsigned n_blocks;          // Block buffers, 0 => 8
+    int cpu;                    // CPU to pin the writer thread to, -1 => any
+};
+
+struct tdc_run_writer_stats {
+    uint64_t frames;            // Frames taken
+    uint64_t bytes;             // Frame bytes taken
+    uint64_t dropped;           // Frames dropped: every block buffer queued, or frame larger than a block
+    uint64_t blocks;            // Blocks written
+    uint64_t write_errors;      // Blocks that could not be written
+    unsigned queue_high_water;  // Most blocks waiting for the writer thread
+    int direct;                 // Blocks are written with O_DIRECT
+};
+
+struct tdc_run_writer;
+
+// Create the file, write its header and start the writer thread
+struct tdc_run_writer *tdc_run_writer_create(const struct tdc_run_writer_config *cfg);
+
+// Copy one frame into the current block. Returns -1 if it had to be dropped. Only one thread
+// may call tdc_run_write() and tdc_run_flush().
+int tdc_run_write(struct tdc_run_writer *w, const struct tdc_frame_header *hdr, const void *payload);
+
+// Hand the current block to the writer thread even if it is not full
+void tdc_run_flush(struct tdc_run_writer *w);
+
+void tdc_run_writer_get_stats(struct tdc_run_writer *w, struct tdc_run_writer_stats *s);
+
+// Write the remaining frames, the index and the trailer, and close the file. Returns -1 if
+// anything could not be written.
+int tdc_run_writer_close(struct tdc_run_writer *w);
+
+/*
+* Reader
+*/
+struct tdc_run {
+    const uint8_t *map;
+    size_t len;
+    const struct tdc_run_header *hdr;
+    const struct tdc_run_index *index;
+    uint64_t n_index;
+    uint64_t n_frames;
+    int recovered;              // No valid trailer, the index was rebuilt from the blocks (one entry per block)
+    struct tdc_run_index *rebuilt;
+};
+
+// Position in a run file, returned by the find functions and advanced by tdc_run_next()
+struct tdc_run_cursor {
+    uint64_t entry;             // Index entry
+    uint32_t frame;             // Frame within its chunk
+    uint32_t off;               // Its offset in the block
+    uint64_t trigger;           // Extended trigger of the previous frame of the chunk
+};
+
+struct tdc_run_frame {
+    const struct tdc_frame_header *hdr;
+    const void *payload;        // tdc_frame_payload_len(hdr) bytes, 8-byte aligned
+    uint64_t trigger;           // Extended trigger
+};
+
+int tdc_run_open(struct tdc_run *r, const char *path);
+void tdc_run_close(struct tdc_run *r);
+
+// Cursor at the first frame of the run
+void tdc_run_rewind(const struct tdc_run *r, struct tdc_run_cursor *c);
+
+// Cursor at the first frame with a trigger (time) at or after trigger (t_ns). Returns -1 if
+// there is none.
+int tdc_run_find_trigger(const struct tdc_run *r, uint64_t trigger, struct tdc_run_cursor *c);
+int tdc_run_find_time(const struct tdc_run *r, uint64_t t_ns, struct tdc_run_cursor *c);
+
+// Frame at the cursor, and advance it. Returns -1 at the end of the run or on a corrupt block.
+int tdc_run_next(const struct tdc_run *r, struct tdc_run_cursor *c, struct tdc_run_frame *f);
+
+#endif
@@ -0,0 +1,67 @@
+/*
+* Lock-free single-producer/single-consumer queue of pointers
+*
+* Exactly one thread may push and exactly one (other) thread may pop. The producer owns head,
+* the consumer owns tail, and each index lives on its own cache line so that the two cores do
+* not fight over the same line. The capacity must be a power of two; the indices run freely
+* and are masked on access, so all capacity slots can be used.
+*/
+#ifndef TDC_SPSC_H
+#define TDC_SPSC_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define TDC_CACHE_LINE 64
+
+struct tdc_spsc {
+    _Alignas(TDC_CACHE_LINE) _Atomic uint32_t head;     // Next slot to push (producer)
+    _Alignas(TDC_CACHE_LINE) _Atomic uint32_t tail;     // Next slot to pop (consumer)
+    _Alignas(TDC_CACHE_LINE) uint32_t mask;             // capacity - 1
+    void **slots;
+};
+
+// slots must hold capacity pointers, capacity must be a power of two. Returns -1 otherwise.
+static inline int tdc_spsc_init(struct tdc_spsc *q, void **slots, uint32_t capacity)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+        return -1;
+    atomic_store_explicit(&q->head, 0, memory_order_relaxed);
+    atomic_store_explicit(&q->tail, 0, memory_order_relaxed);
+    q->mask  = capacity - 1;
+    q->slots = slots;
+    return 0;
+}
+
+// Producer only. Returns 0, or -1 if the queue is full.
+static inline int tdc_spsc_push(struct tdc_spsc *q, void *p)
+{
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if (head - tail > q->mask)
+        return -1;
+    q->slots[head & q->mask] = p;
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return 0;
+}
+
+// Consumer only. Returns NULL if the queue is empty.
+static inline void *tdc_spsc_pop(struct tdc_spsc *q)
+{
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (head == tail)
+        return NULL;
+    void *p = q->slots[tail & q->mask];
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return p;
+}
+
+// Number of queued entries. Exact from either end, approximate from any other thread.
+static inline uint32_t tdc_spsc_count(struct tdc_spsc *q)
+{
+    return atomic_load_explicit(&q->head, memory_order_acquire) -
+           atomic_load_explicit(&q->tail, memory_order_acquire);
+}
+
+#endif
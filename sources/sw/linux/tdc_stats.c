@@ -0,0 +1,189 @@
+/*
+* Per-stage hit, drop and buffer occupancy counters of the TDC firmware (see tdc_stats.h)
+*/
+#include <stdio.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+#include "tdc_stats.h"
+
+// Register map of tdc_stats.vhd (32-bit word offsets)
+#define REG_ID              (0x000 / 4)
+#define REG_CTRL            (0x004 / 4)
+#define REG_SEQ             (0x008 / 4)
+#define REG_CONFIG          (0x00C / 4)
+#define REG_CYCLES_LO       (0x010 / 4)
+#define REG_CYCLES_HI       (0x014 / 4)
+#define REG_OUT_WORDS       (0x018 / 4)
+#define REG_OUT_OVERWR      (0x01C / 4)
+#define REG_OUT_HWM         (0x020 / 4)
+#define REG_TIME_LO         (0x024 / 4)     // Version 2
+#define REG_TIME_HI         (0x028 / 4)
+#define REG_LAT_SEQ         (0x040 / 4)     // Last completed handshake, not a snapshot
+#define REG_LAT_TRIG_LO     (0x044 / 4)
+#define REG_LAT_TRIG_HI     (0x048 / 4)
+#define REG_LAT_IRQ         (0x04C / 4)
+#define REG_LAT_BUSY_SET    (0x050 / 4)
+#define REG_LAT_BUSY_CLR    (0x054 / 4)
+#define REG_BUF(b)          ((0x100 + 16 * (b)) / 4)    // + 0 writes, + 1 drops, + 2 high-water mark
+#define REG_CH_HITS(ch)     ((0x400 + 4 * (ch)) / 4)
+#define REG_CH_DROPS(ch)    ((0x500 + 4 * (ch)) / 4)
+#define REG_CH_WRITTEN(ch)  ((0x600 + 4 * (ch)) / 4)
+
+#define STATS_ID            0x54534454u     // "TDST"
+#define CTRL_SNAPSHOT       (1u << 0)       // W: take a snapshot, R: snapshot pending
+#define CTRL_CLEAR          (1u << 1)       // W: restart the counters with the snapshot
+
+#define CONFIG_VERSION(c)   ((c) >> 24)
+
+#define STATS_REG_SIZE      0x1000
+#define SNAPSHOT_POLLS      100000          // A snapshot takes a few clk0 + AXI clock cycles
+
+int tdc_stats_open(struct uio_dev *dev)
+{
+    if (uio_open_by_name(dev, TDC_STATS_UIO_NAME) < 0)
+        return -1;
+    volatile uint32_t *r = dev->ptr;
+    if (dev->len < STATS_REG_SIZE || r[REG_ID] != STATS_ID) {
+        fprintf(stderr, "%s is not a TDC statistics block (ID 0x%08x)\n", dev->path,
+                dev->len >= 4 ? r[REG_ID] : 0);
+        uio_close(dev);
+        return -1;
+    }
+    return 0;
+}
+
+int tdc_stats_snapshot(struct uio_dev *dev, int clear, struct tdc_pl_stats *s)
+{
+    volatile uint32_t *r = dev->ptr;
+    unsigned i;
+
+    // The PL ignores a request while the previous one is pending
+    for (i = 0; i < SNAPSHOT_POLLS && (r[REG_CTRL] & CTRL_SNAPSHOT); i++)
+        ;
+    r[REG_CTRL] = CTRL_SNAPSHOT | (clear ? CTRL_CLEAR : 0);
+    for (i = 0; i < SNAPSHOT_POLLS && (r[REG_CTRL] & CTRL_SNAPSHOT); i++)
+        ;
+    if (i == SNAPSHOT_POLLS) {
+        fprintf(stderr, "TDC statistics snapshot timed out (is clk0 running?)\n");
+        return -1;
+    }
+
+    uint32_t config = r[REG_CONFIG];
+    s->seq        = r[REG_SEQ];
+    s->n_buffers  = config & 0xff;
+    s->n_channels = (config >> 8) & 0xff;
+    if (s->n_buffers > TDC_STATS_MAX_BUFFERS)
+        s->n_buffers = TDC_STATS_MAX_BUFFERS;
+    if (s->n_channels > TDC_STATS_MAX_CHANNELS)
+        s->n_channels = TDC_STATS_MAX_CHANNELS;
+    s->cycles         = ((uint64_t)r[REG_CYCLES_HI] << 32) | r[REG_CYCLES_LO];
+    s->time           = CONFIG_VERSION(config) >= 2 ? ((uint64_t)r[REG_TIME_HI] << 32) | r[REG_TIME_LO] : 0;
+    s->out_words      = r[REG_OUT_WORDS];
+    s->out_overwrites = r[REG_OUT_OVERWR];
+    s->out_hwm        = r[REG_OUT_HWM];
+    for (unsigned b = 0; b < s->n_buffers; b++) {
+        s->buf[b].writes = r[REG_BUF(b)];
+        s->buf[b].drops  = r[REG_BUF(b) + 1];
+        s->buf[b].hwm    = r[REG_BUF(b) + 2];
+    }
+    for (unsigned ch = 0; ch < s->n_channels; ch++) {
+        s->ch_hits[ch]    = r[REG_CH_HITS(ch)];
+        s->ch_drops[ch]   = r[REG_CH_DROPS(ch)];
+        s->ch_written[ch] = r[REG_CH_WRITTEN(ch)];
+    }
+    return 0;
+}
+
+int tdc_stats_has_handshake(struct uio_dev *dev)
+{
+    volatile uint32_t *r = dev->ptr;
+    return CONFIG_VERSION(r[REG_CONFIG]) >= 2;
+}
+
+int tdc_stats_handshake(struct uio_dev *dev, uint32_t last_seq, struct tdc_pl_handshake *h)
+{
+    volatile uint32_t *r = dev->ptr;
+    uint32_t seq = r[REG_LAT_SEQ];
+
+    // The record is latched in one clk0 cycle together with LAT_SEQ. If LAT_SEQ was read just as
+    // it changed, reading it again after the record tells (it cannot change twice in between).
+    if (seq == last_seq)
+        return 0;
+    h->trig     = ((uint64_t)r[REG_LAT_TRIG_HI] << 32) | r[REG_LAT_TRIG_LO];
+    h->irq      = r[REG_LAT_IRQ];
+    h->busy_set = r[REG_LAT_BUSY_SET];
+    h->busy_clr = r[REG_LAT_BUSY_CLR];
+    h->seq      = r[REG_LAT_SEQ];
+    if (h->seq != seq)
+        return 0;
+    return 1;
+}
+
+// snprintf at buf + *off, keeping *off within len
+static void append(char *buf, size_t len, size_t *off, const char *fmt, ...)
+{
+    va_list ap;
+    if (*off >= len)
+        return;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *off, len - *off, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        *off = (*off + n < len) ? *off + n : len;
+}
+
+// Totals of buffers [first, last)
+static void stage_sum(const struct tdc_pl_stats *s, unsigned first, unsigned last,
+                      uint64_t *writes, uint64_t *drops, uint32_t *hwm)
+{
+    *writes = *drops = *hwm = 0;
+    for (unsigned b = first; b < last && b < s->n_buffers; b++) {
+        *writes += s->buf[b].writes;
+        *drops  += s->buf[b].drops;
+        if (s->buf[b].hwm > *hwm)
+            *hwm = s->buf[b].hwm;
+    }
+}
+
+void tdc_stats_format(const struct tdc_pl_stats *s, char *buf, size_t len)
+{
+    double secs = s->cycles / TDC_STATS_CLK0_HZ;
+    double per_us = secs > 0 ? 1.0 / (secs * 1e6) : 0.0;    // counts -> MHz
+    uint64_t hits = 0, ch_drops = 0, l1_writes, l1_drops, l2_writes, l2_drops;
+    uint32_t l1_hwm, l2_hwm;
+    size_t off = 0;
+
+    buf[0] = '\0';
+    for (unsigned ch = 0; ch < s->n_channels; ch++) {
+        hits     += s->ch_hits[ch];
+        ch_drops += s->ch_drops[ch];
+    }
+    stage_sum(s, 0, TDC_STATS_L1_BUFFERS, &l1_writes, &l1_drops, &l1_hwm);
+    stage_sum(s, TDC_STATS_L1_BUFFERS, s->n_buffers, &l2_writes, &l2_drops, &l2_hwm);
+
+    append(buf, len, &off, "PL stats #%" PRIu32 " over %.3f s:\n", s->seq, secs);
+    append(buf, len, &off, "  Encoders   %10" PRIu64 " hits (%.3f MHz), channel FIFO drops %" PRIu64 "\n",
+           hits, hits * per_us, ch_drops);
+    append(buf, len, &off, "  L1 buffers %10" PRIu64 " words (%.3f MHz), drops %" PRIu64 ", high water %" PRIu32 "\n",
+           l1_writes, l1_writes * per_us, l1_drops, l1_hwm);
+    append(buf, len, &off, "  L2 buffers %10" PRIu64 " words (%.3f MHz), drops %" PRIu64 ", high water %" PRIu32 "\n",
+           l2_writes, l2_writes * per_us, l2_drops, l2_hwm);
+    append(buf, len, &off, "  BRAM       %10" PRIu32 " words (%.3f MHz), overwritten %" PRIu32 ", high water %" PRIu32 "\n",
+           s->out_words, s->out_words * per_us, s->out_overwrites, s->out_hwm);
+
+    for (unsigned b = 0; b < s->n_buffers; b++) {
+        if (s->buf[b].drops == 0)
+            continue;
+        append(buf, len, &off, "  %s buffer %u: %" PRIu32 " words, %" PRIu32 " drops, high water %" PRIu32 "\n",
+               b < TDC_STATS_L1_BUFFERS ? "L1" : "L2",
+               b < TDC_STATS_L1_BUFFERS ? b : b - TDC_STATS_L1_BUFFERS,
+               s->buf[b].writes, s->buf[b].drops, s->buf[b].hwm);
+    }
+    for (unsigned ch = 0; ch < s->n_channels; ch++) {
+        if (s->ch_drops[ch] == 0)
+            continue;
+        append(buf, len, &off, "  Channel %u: %" PRIu32 " hits, %" PRIu32 " FIFO drops, %" PRIu32 " written\n",
+               ch, s->ch_hits[ch], s->ch_drops[ch], s->ch_written[ch]);
+    }
+}
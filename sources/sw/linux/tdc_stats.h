@@ -0,0 +1,82 @@
+/*
+* Per-stage hit, drop and buffer occupancy counters of the TDC firmware (tdc_stats.vhd)
+*
+* The statistics block counts, per channel, the hits out of the encoder, the hits dropped by
+* the channel's full FIFO and the hits written to BRAM; per buffer of the arbiter tree (16
+* layer 1 buffers, then the layer 2 buffers) the words written, the words dropped because it
+* was full and its high-water mark; and at the BRAM writer the words written, the words that
+* overwrote an older hit and the high-water mark of the BRAM fill. A snapshot copies all of
+* them at once in the PL, optionally restarting them, so a periodic snapshot with clear gives
+* consistent per-period counts of where hits are lost.
+*
+* From version 2 of the block, the PL also timestamps every trigger handshake with the PS on a
+* free-running clk0 counter: the trigger accepted, the interrupt raised, rd_busy raised and
+* rd_busy lowered. The timestamps of the last completed handshake are latched when rd_busy
+* falls and stay put until it falls again, see tdc_stats_handshake() and tdc_latency.h.
+*
+* The block is a generic-uio device named "tdc_stats" (a 4 KB register page); see
+* tdc_stats.vhd for the register map. All functions print what failed to stderr and return
+* -1 on error.
+*/
+#ifndef TDC_STATS_H
+#define TDC_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tdc_uio.h"
+
+#define TDC_STATS_UIO_NAME      "tdc_stats"
+#define TDC_STATS_MAX_BUFFERS   48
+#define TDC_STATS_MAX_CHANNELS  64
+#define TDC_STATS_L1_BUFFERS    16      // Buffers 0-15 are the layer 1 (TDC_4ch) buffers
+#define TDC_STATS_CLK0_HZ       212.4e6
+
+struct tdc_pl_stats {
+    uint32_t seq;               // Snapshots taken since the PL was reset
+    unsigned n_buffers;
+    unsigned n_channels;
+    uint64_t cycles;            // clk0 cycles covered by the counts
+    uint64_t time;              // Free-running clk0 counter at the snapshot (version 2, else 0)
+    uint32_t out_words;         // Words written to BRAM
+    uint32_t out_overwrites;    // Words written over an older hit (BRAM wrapped before the trigger)
+    uint32_t out_hwm;           // High-water mark of the BRAM fill (words)
+    struct {
+        uint32_t writes;
+        uint32_t drops;         // Writes while full
+        uint32_t hwm;           // High-water mark of the fill count
+    } buf[TDC_STATS_MAX_BUFFERS];
+    uint32_t ch_hits[TDC_STATS_MAX_CHANNELS];
+    uint32_t ch_drops[TDC_STATS_MAX_CHANNELS];
+    uint32_t ch_written[TDC_STATS_MAX_CHANNELS];
+};
+
+// Timestamps of one trigger handshake, in cycles of the free-running clk0 counter. Only the
+// trigger has the full 64 bits; the others are its low 32 bits, so differences are valid
+// modulo 2^32 cycles (20 s).
+struct tdc_pl_handshake {
+    uint32_t seq;               // Handshakes completed since the PL was reset, 0 => not timed
+    uint64_t trig;              // Trigger accepted by the BRAM writer
+    uint32_t irq;               // Interrupt raised
+    uint32_t busy_set;          // rd_busy raised by the PS
+    uint32_t busy_clr;          // rd_busy lowered by the PS
+};
+
+// Find the statistics block, map it and check its ID
+int tdc_stats_open(struct uio_dev *dev);
+
+// Whether the firmware timestamps the trigger handshake (statistics block version 2 or later)
+int tdc_stats_has_handshake(struct uio_dev *dev);
+
+// Read the last completed handshake into h if it is not handshake last_seq any more. Returns 1
+// if it was read, 0 if the PL has not completed another one (yet). Consistent while rd_busy is
+// held high, or after it was lowered until it is raised again.
+int tdc_stats_handshake(struct uio_dev *dev, uint32_t last_seq, struct tdc_pl_handshake *h);
+
+// Take a snapshot (restarting the counters if clear) and read it into s
+int tdc_stats_snapshot(struct uio_dev *dev, int clear, struct tdc_pl_stats *s);
+
+// Human readable report: totals and rates per stage, then every buffer and channel that dropped hits
+void tdc_stats_format(const struct tdc_pl_stats *s, char *buf, size_t len);
+
+#endif
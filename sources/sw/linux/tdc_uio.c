@@ -0,0 +1,149 @@
+/*
+* Helpers to open, map and wait on the UIO devices exported by the TDC firmware (see tdc_uio.h)
+*/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+
+#include "tdc_uio.h"
+
+// Open dev->path, or map a duplicate of fd if fd >= 0
+static int uio_map(struct uio_dev *dev, int fd)
+{
+    dev->fd = (fd >= 0) ? dup(fd) : open(dev->path, O_RDWR);
+    if (dev->fd < 0) {
+        fprintf(stderr, "Failed to open %s: ", dev->path);
+        perror("open");
+        return -1;
+    }
+    dev->ptr = NULL;
+    if (dev->len > 0) {
+        void *p = mmap(NULL, dev->len, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, 0);
+        if (p == MAP_FAILED) {
+            fprintf(stderr, "Failed to mmap %s: ", dev->path);
+            perror("mmap");
+            close(dev->fd);
+            dev->fd = -1;
+            return -1;
+        }
+        dev->ptr = p;
+    }
+    // A device opened from a descriptor stands in for the kernel device (e.g. the emulator of tdc_emu.h)
+    if (fd >= 0)
+        printf("Opened %s (emulated by descriptor %d, %zu bytes mapped)\n", dev->path, fd, dev->len);
+    else
+        printf("Opened %s (%zu bytes mapped)\n", dev->path, dev->len);
+    return 0;
+}
+
+int uio_open(struct uio_dev *dev, const char *path, size_t len)
+{
+    return uio_open_fd(dev, path, -1, len);
+}
+
+int uio_open_fd(struct uio_dev *dev, const char *path, int fd, size_t len)
+{
+    snprintf(dev->path, sizeof(dev->path), "%s", path);
+    dev->len  = len;
+    dev->phys = 0;
+    return uio_map(dev, fd);
+}
+
+// Read a single (0x prefixed) hex value from a sysfs attribute
+static int sysfs_read_u64(const char *path, uint64_t *v)
+{
+    FILE *f = fopen(path, "r");
+    unsigned long long x;
+    int ok = (f != NULL && fscanf(f, "%llx", &x) == 1);
+    if (f != NULL)
+        fclose(f);
+    if (!ok) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        return -1;
+    }
+    *v = x;
+    return 0;
+}
+
+int uio_open_by_name(struct uio_dev *dev, const char *name)
+{
+    DIR *dir = opendir("/sys/class/uio");
+    struct dirent *e;
+    char attr[300], node[64];
+    uint64_t size = 0;
+    int found = 0;
+
+    if (dir == NULL) {
+        perror("Failed to open /sys/class/uio");
+        return -1;
+    }
+    while (!found && (e = readdir(dir)) != NULL) {
+        if (strncmp(e->d_name, "uio", 3) != 0)
+            continue;
+        snprintf(attr, sizeof(attr), "/sys/class/uio/%s/name", e->d_name);
+        FILE *f = fopen(attr, "r");
+        if (f == NULL)
+            continue;
+        if (fgets(node, sizeof(node), f) != NULL) {
+            node[strcspn(node, "\n")] = '\0';
+            if (strcmp(node, name) == 0) {
+                snprintf(dev->path, sizeof(dev->path), "/dev/%.32s", e->d_name);
+                snprintf(attr, sizeof(attr), "/sys/class/uio/%s/maps/map0/addr", e->d_name);
+                found = sysfs_read_u64(attr, &dev->phys) == 0;
+                snprintf(attr, sizeof(attr), "/sys/class/uio/%s/maps/map0/size", e->d_name);
+                found = found && sysfs_read_u64(attr, &size) == 0;
+                if (!found) {
+                    fclose(f);
+                    closedir(dir);
+                    return -1;
+                }
+            }
+        }
+        fclose(f);
+    }
+    closedir(dir);
+    if (!found) {
+        fprintf(stderr, "No UIO device named %s\n", name);
+        return -1;
+    }
+    dev->len = size;
+    if (uio_map(dev, -1) < 0)
+        return -1;
+    printf("  %s: %s @ 0x%" PRIx64 "\n", dev->path, name, dev->phys);
+    return 0;
+}
+
+void uio_close(struct uio_dev *dev)
+{
+    if (dev->ptr != NULL)
+        munmap((void *)dev->ptr, dev->len);
+    if (dev->fd >= 0)
+        close(dev->fd);
+    dev->ptr = NULL;
+    dev->fd = -1;
+}
+
+int uio_irq_unmask(struct uio_dev *dev)
+{
+    uint32_t info = 1;
+    if (write(dev->fd, &info, sizeof(info)) != (ssize_t)sizeof(info)) {
+        fprintf(stderr, "Failed to write to (unmask) %s: ", dev->path);
+        perror("write");
+        return -1;
+    }
+    return 0;
+}
+
+int uio_irq_wait(struct uio_dev *dev, uint32_t *count)
+{
+    if (read(dev->fd, count, sizeof(*count)) != (ssize_t)sizeof(*count)) {
+        fprintf(stderr, "Failed to read from %s: ", dev->path);
+        perror("read");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+/*
+* Helpers to open, map and wait on the UIO devices exported by the TDC firmware
+*
+* Every device is opened and mapped once and kept for the lifetime of the program, so that
+* the per-trigger path only touches registers and memory. Devices can either be opened by
+* path (/dev/uioN, fixed by the probe order of the device tree) or looked up by the name of
+* their device tree node in /sys/class/uio.
+*
+* A device can also be opened from a descriptor that is already open (uio_open_fd()), in which
+* case a duplicate of that descriptor is used instead of the kernel device. This is how the
+* software emulator of the firmware (tdc_emu.h) stands in for the UIO devices: its descriptors
+* are handed to the readout library through struct tdc_readout_config::dev_fds.
+*
+* All functions print what failed to stderr and return -1 on error.
+*/
+#ifndef TDC_UIO_H
+#define TDC_UIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct uio_dev {
+    char path[64];          // /dev/uioN
+    int fd;
+    size_t len;             // Bytes mapped from map 0, 0 => not mapped (interrupt only)
+    uint64_t phys;          // Physical address of map 0 (only known when opened by name)
+    volatile void *ptr;
+};
+
+// Open path and map the first len bytes of map 0 (len = 0 for interrupt-only devices)
+int uio_open(struct uio_dev *dev, const char *path, size_t len);
+
+// Same, but map a duplicate of fd instead of opening path if fd >= 0 (path only names the device)
+int uio_open_fd(struct uio_dev *dev, const char *path, int fd, size_t len);
+
+// Find the device whose device tree node is called name, open it and map all of map 0
+int uio_open_by_name(struct uio_dev *dev, const char *name);
+
+void uio_close(struct uio_dev *dev);
+
+// Re-enable (unmask) the interrupt of the device
+int uio_irq_unmask(struct uio_dev *dev);
+
+// Block until the next interrupt; *count receives the total number of interrupts so far
+int uio_irq_wait(struct uio_dev *dev, uint32_t *count);
+
+#endif
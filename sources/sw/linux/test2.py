@@ -1,23 +1,37 @@
 '''
-Read/Write shared memory (AXI BRAM controller) using the device.py classes 
+Read/Write shared memory (AXI BRAM controller) using the device.py classes
 '''
 from device import *
-import time 
+import time
 
-uio = Uio('1')
+bramsel = Uio('4')      # which_bram AXI GPIO: channel 1 the BRAM being written, channel 2 the fill count of the other one
 
-region = uio.region(0) 
+# The PL writes the BRAM on channel 1 (1 or 2), the other one holds the hits of the last trigger
+sel = bramsel.read(ctypes.c_uint32, offset=0x0)
+if sel not in ( 1, 2 ):
+    raise SystemExit(f'BRAM ID #{sel} invalid - expect ID = 1 or 2')
+bram_id = 3 - sel
+uio = Uio(str(bram_id))    # uio1: BRAM 1, uio2: BRAM 2
+print(f'Reading BRAM {bram_id}')
+
+region = uio.region(0)
+
+# Fill count [15:0] and overflow flag [31] of the BRAM last handed off to the PS (GPIO2_DATA at offset 0x8)
+status = bramsel.read(ctypes.c_uint32, offset=0x8)
+n_words, overflow = bram_fill(status)
+n_words = min(n_words, int(region.size/8))
+print(f'BRAM status: 0x{status:08x} ({n_words} words{", overflow" if overflow else ""})')
 
 start = time.time()
 
-for i in range(int(region.size/8)):     # 8192 / 8 = 1024
-        offset = i*8
-        data = int.from_bytes(region.read(8, offset=offset), 'little').to_bytes(8, 'big')
-        print(f'Addr {i}: 0x{data.hex()}')
-        # overwrite the old data
-        uio.write(bytes(8), offset=offset)
+# One copy of the filled words out of the BRAM, then overwrite the old data in one go
+words = region.words(n_words).copy()
+region.clear(n_words)
 
 end = time.time()
 
-print(f'It took {end-start}s to read {int(region.size/8)} BRAM addresses')
+channel, fine, coarse = hit_fields(words)
+for i in range(n_words):
+        print(f'Addr {i}: 0x{int(words[i]):016x} (channel {channel[i]}, fine {fine[i]}, coarse {coarse[i]})')
 
+print(f'It took {end-start}s to read {n_words} BRAM addresses')
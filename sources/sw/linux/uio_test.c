@@ -11,7 +11,12 @@
 #include <inttypes.h>
 #include <limits.h>     // CHAR_BIT
 
-#define UIO_DEVICE "/dev/uio1" // Adjust if your BRAM is mapped to a different UIO device
+#define UIO_BRAM_1  "/dev/uio1" // Adjust if your BRAMs are mapped to different UIO devices
+#define UIO_BRAM_2  "/dev/uio2"
+#define UIO_BRAMSEL "/dev/uio4" // which_bram AXI GPIO: channel 1 the BRAM being written, channel 2 the fill count of the other one
+
+#define GPIO_DATA   0           // AXI GPIO channel 1 data register (32-bit word offset)
+#define GPIO2_DATA  2           // AXI GPIO channel 2 data register (32-bit word offset)
 
 // isolate channel from the data word
 unsigned getbits(uint64_t value, unsigned offset, unsigned n);
@@ -29,57 +34,85 @@ unsigned getbits(uint64_t value, unsigned offset, unsigned n) {
 
 
 int main() {
-    int fd;
-    volatile unsigned int *bram_ptr;
+    int fd, sel_fd;
+    volatile uint64_t *bram_ptr;
+    volatile uint32_t *sel_ptr;
     off_t offset = 0; // Offset within the mapped memory region (usually 0 for BRAM)
     size_t length = 8192; // Size of the BRAM in bytes (e.g., 8KB)
+    size_t sel_length = 65536; // Size of the AXI GPIO register space
 
-    // Open the UIO device
-    fd = open(UIO_DEVICE, O_RDWR);
+    // Open and map the which_bram GPIO to find out which BRAM the PL handed off and how many words it wrote
+    sel_fd = open(UIO_BRAMSEL, O_RDWR);
+    if (sel_fd < 0) {
+        perror("Failed to open which_bram UIO device");
+        return 1;
+    }
+    sel_ptr = (volatile uint32_t *)mmap(NULL, sel_length, PROT_READ | PROT_WRITE, MAP_SHARED, sel_fd, offset);
+    if (sel_ptr == MAP_FAILED) {
+        perror("Failed to mmap which_bram");
+        close(sel_fd);
+        return 1;
+    }
+
+    // The PL writes the BRAM on channel 1 (1 or 2), the other one holds the hits of the last trigger
+    uint32_t sel = sel_ptr[GPIO_DATA];
+    unsigned bram_id;
+    if (sel == 1) {
+        bram_id = 2;
+    }
+    else if (sel == 2) {
+        bram_id = 1;
+    }
+    else {
+        fprintf(stderr, "BRAM ID #%u invalid - expect ID = 1 or 2\n", sel);
+        munmap((void *)sel_ptr, sel_length);
+        close(sel_fd);
+        return 1;
+    }
+
+    // Open the UIO device of that BRAM
+    fd = open((bram_id == 1) ? UIO_BRAM_1 : UIO_BRAM_2, O_RDWR);
     if (fd < 0) {
         perror("Failed to open UIO device");
         return 1;
     }
     else {
-        printf("Opened BRAM 2\n");                                                       
-    }                                                                                    
-                                                                                         
-    // Map the BRAM memory into user space                                               
+        printf("Opened BRAM %u\n", bram_id);
+    }
+
+    // Map the BRAM memory into user space
     bram_ptr = (volatile uint64_t *)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
-    if (bram_ptr == MAP_FAILED) {                                                                      
-        perror("Failed to mmap BRAM");                                                                 
-        close(fd);                                                                                     
-        return 1;                                                                                      
-    }                                                                                                  
-                                                                                                       
-    // printf("%d,0x%"PRIx64",%u,%u,%u\n\r",i,bram1_data,coarseTime,fineTime,channelID);               
-    for (int i=0; i<250; i+=1) {                                                                       
-                                                                                                       
-        uint64_t bram1_data = bram_ptr[i];                                                             
-                                                                                                       
-        unsigned channelID  = getbits(bram1_data, 0, 6);                                               
-        unsigned fineTime   = getbits(bram1_data, 6, 5);                                               
-        unsigned coarseTime = getbits(bram1_data, 11, 28);                                             
-                                                                                                       
-        uint64_t data = bram_ptr[i];                                                                   
-        //uint64_t data1 = bram_ptr[i];                                                                
-        //uint64_t data2 = bram_ptr[i+1];                                                              
-        //printf("%#018"PRIx64"\n", data);                                                             
-        printf("Read data: 0x%llx%llx\n", data1, data2);                                               
-                                                                                                       
-        //printf("Address %d: 0x%"PRIx64",\t\tCoarse time: %u,\t\tFine time: %u,\t\tChannel ID: %u\n\r",i,bram1_data,coarseTime,fineTime,channelID);
-                                                                                                                                                    
-        //bram_ptr[i] = 0;                                                                                                                          
-    }                                                                                                                                               
-                                                                                                                                                    
-                                                                                                                                                    
-    // Read a value from BRAM (example: read the first 32-bit word)                                                                                 
-    //unsigned int data = bram_ptr[0];                                                                                                              
-    //printf("Data read from BRAM: 0x%08X\n", data);                                                                                                
-                                                                                                                                                    
-    // Unmap the memory and close the device                                                                                                        
-    munmap((void *)bram_ptr, length);                                                                                                               
-    close(fd);  
-    return 0;                                                                                                                                       
-}
+    if (bram_ptr == MAP_FAILED) {
+        perror("Failed to mmap BRAM");
+        close(fd);
+        return 1;
+    }
+
+    // Fill count [15:0] and overflow flag [31] of the BRAM last handed off to the PS
+    uint32_t status = sel_ptr[GPIO2_DATA];
+    unsigned n_words = status & 0xffff;
+    if (n_words > length / 8)
+        n_words = length / 8;
+    printf("BRAM status: 0x%08x (%u words%s)\n", status, n_words, (status & 0x80000000u) ? ", overflow" : "");
+
+    // printf("%d,0x%"PRIx64",%u,%u,%u\n\r",i,bram1_data,coarseTime,fineTime,channelID);
+    for (unsigned i=0; i<n_words; i+=1) {
 
+        uint64_t bram1_data = bram_ptr[i];
+
+        unsigned channelID  = getbits(bram1_data, 0, 6);
+        unsigned fineTime   = getbits(bram1_data, 6, 5);
+        unsigned coarseTime = getbits(bram1_data, 11, 28);
+
+        printf("Address %u: 0x%"PRIx64",\t\tCoarse time: %u,\t\tFine time: %u,\t\tChannel ID: %u\n\r",i,bram1_data,coarseTime,fineTime,channelID);
+
+        //bram_ptr[i] = 0;
+    }
+
+    // Unmap the memory and close the devices
+    munmap((void *)sel_ptr, sel_length);
+    close(sel_fd);
+    munmap((void *)bram_ptr, length);
+    close(fd);
+    return 0;
+}